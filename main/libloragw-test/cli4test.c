@@ -26,6 +26,14 @@ void app_main(void)
     register_test_loragw_toa();
     register_test_loragw_hal_tx();
     register_test_loragw_hal_rx();
+    register_test_rxpk_encoder();
+    register_test_base64();
+    register_test_txpk_decoder();
+    register_test_jitqueue();
+    register_test_loragw_clock();
+    register_test_duty_cycle();
+    register_test_loragw_reg_shadow();
+    register_test_loragw_sx1302_rx();
 
     // initialize console REPL environment
     esp_console_repl_t *repl = NULL;
@@ -0,0 +1,472 @@
+/*
+ / _____)             _              | |
+( (____  _____ ____ _| |_ _____  ____| |__
+ \____ \| ___ |    (_   _) ___ |/ ___)  _ \
+ _____) ) ____| | | || |_| ____( (___| | | |
+(______/|_____)_|_|_| \__)_____)\____)_| |_|
+  (C)2019 Semtech
+
+Description:
+    Check the table driven base64 encoder/decoder against the former one
+    symbol at a time implementation, and compare their speed
+
+License: Revised BSD License, see LICENSE.TXT file include in the project
+*/
+
+
+/* -------------------------------------------------------------------------- */
+/* --- DEPENDANCIES --------------------------------------------------------- */
+
+#include <stdint.h>     /* C99 types */
+#include <stdbool.h>    /* bool type */
+#include <stdio.h>      /* printf sscanf */
+#include <stdlib.h>     /* rand */
+#include <string.h>
+#include <getopt.h>     /* getopt */
+
+#include "esp_system.h"
+#include "esp_console.h"
+#include "esp_timer.h"
+
+#include "base64.h"
+
+/* -------------------------------------------------------------------------- */
+/* --- PRIVATE CONSTANTS ---------------------------------------------------- */
+
+#define DEFAULT_NB_LOOP 1000
+#define PAYLOAD_MAX     255     /* LoRa PHYPayload */
+#define B64_MAX         344     /* base64 of PAYLOAD_MAX bytes, with padding and terminator */
+
+/* -------------------------------------------------------------------------- */
+/* --- PRIVATE VARIABLES ---------------------------------------------------- */
+
+static uint8_t bin_in[PAYLOAD_MAX];
+static uint8_t bin_ref[PAYLOAD_MAX];
+static uint8_t bin_out[PAYLOAD_MAX];
+static char b64_ref[B64_MAX];
+static char b64_out[B64_MAX];
+
+/* -------------------------------------------------------------------------- */
+/* --- PRIVATE FUNCTIONS DEFINITION ----------------------------------------- */
+
+/* reference: implementation used before the lookup tables (invalid characters call exit) */
+
+static char legacy_code_to_char(uint8_t x) {
+    if (x <= 25) {
+        return 'A' + x;
+    } else if ((x >= 26) && (x <= 51)) {
+        return 'a' + (x-26);
+    } else if ((x >= 52) && (x <= 61)) {
+        return '0' + (x-52);
+    } else if (x == 62) {
+        return '+';
+    } else if (x == 63) {
+        return '/';
+    } else {
+        exit(EXIT_FAILURE);
+    }
+}
+
+static uint8_t legacy_char_to_code(char x) {
+    if ((x >= 'A') && (x <= 'Z')) {
+        return (uint8_t)x - (uint8_t)'A';
+    } else if ((x >= 'a') && (x <= 'z')) {
+        return (uint8_t)x - (uint8_t)'a' + 26;
+    } else if ((x >= '0') && (x <= '9')) {
+        return (uint8_t)x - (uint8_t)'0' + 52;
+    } else if (x == '+') {
+        return 62;
+    } else if (x == '/') {
+        return 63;
+    } else {
+        exit(EXIT_FAILURE);
+    }
+}
+
+static int legacy_bin_to_b64_nopad(const uint8_t * in, int size, char * out, int max_len) {
+    int i;
+    int result_len; /* size of the result */
+    int full_blocks; /* number of 3 unsigned chars / 4 characters blocks */
+    int last_bytes; /* number of unsigned chars <3 in the last block */
+    int last_chars; /* number of characters <4 in the last block */
+    uint32_t b;
+
+    /* check input values */
+    if ((out == NULL) || (in == NULL)) {
+        return -1;
+    }
+    if (size == 0) {
+        *out = 0; /* null string */
+        return 0;
+    }
+
+    /* calculate the number of base64 'blocks' */
+    full_blocks = size / 3;
+    last_bytes = size % 3;
+    switch (last_bytes) {
+        case 0: /* no byte left to encode */
+            last_chars = 0;
+            break;
+        case 1: /* 1 byte left to encode -> +2 chars */
+            last_chars = 2;
+            break;
+        case 2: /* 2 bytes left to encode -> +3 chars */
+            last_chars = 3;
+            break;
+        default:
+            exit(EXIT_FAILURE);
+    }
+
+    /* check if output buffer is big enough */
+    result_len = (4*full_blocks) + last_chars;
+    if (max_len < (result_len + 1)) { /* 1 char added for string terminator */
+        return -1;
+    }
+
+    /* process all the full blocks */
+    for (i=0; i < full_blocks; ++i) {
+        b  = (0xFF & in[3*i]    ) << 16;
+        b |= (0xFF & in[3*i + 1]) << 8;
+        b |=  0xFF & in[3*i + 2];
+        out[4*i + 0] = legacy_code_to_char((b >> 18) & 0x3F);
+        out[4*i + 1] = legacy_code_to_char((b >> 12) & 0x3F);
+        out[4*i + 2] = legacy_code_to_char((b >> 6 ) & 0x3F);
+        out[4*i + 3] = legacy_code_to_char( b        & 0x3F);
+    }
+
+    /* process the last 'partial' block and terminate string */
+    i = full_blocks;
+    if (last_chars == 0) {
+        out[4*i] =  0; /* null character to terminate string */
+    } else if (last_chars == 2) {
+        b  = (0xFF & in[3*i]    ) << 16;
+        out[4*i + 0] = legacy_code_to_char((b >> 18) & 0x3F);
+        out[4*i + 1] = legacy_code_to_char((b >> 12) & 0x3F);
+        out[4*i + 2] =  0; /* null character to terminate string */
+    } else if (last_chars == 3) {
+        b  = (0xFF & in[3*i]    ) << 16;
+        b |= (0xFF & in[3*i + 1]) << 8;
+        out[4*i + 0] = legacy_code_to_char((b >> 18) & 0x3F);
+        out[4*i + 1] = legacy_code_to_char((b >> 12) & 0x3F);
+        out[4*i + 2] = legacy_code_to_char((b >> 6 ) & 0x3F);
+        out[4*i + 3] = 0; /* null character to terminate string */
+    }
+
+    return result_len;
+}
+
+static int legacy_b64_to_bin_nopad(const char * in, int size, uint8_t * out, int max_len) {
+    int i;
+    int result_len; /* size of the result */
+    int full_blocks; /* number of 3 unsigned chars / 4 characters blocks */
+    int last_chars; /* number of characters <4 in the last block */
+    int last_bytes; /* number of unsigned chars <3 in the last block */
+    uint32_t b;
+
+    /* check input values */
+    if ((out == NULL) || (in == NULL)) {
+        return -1;
+    }
+    if (size == 0) {
+        return 0;
+    }
+
+    /* calculate the number of base64 'blocks' */
+    full_blocks = size / 4;
+    last_chars = size % 4;
+    switch (last_chars) {
+        case 0: /* no char left to decode */
+            last_bytes = 0;
+            break;
+        case 1: /* only 1 char left is an error */
+            return -1;
+        case 2: /* 2 chars left to decode -> +1 byte */
+            last_bytes = 1;
+            break;
+        case 3: /* 3 chars left to decode -> +2 bytes */
+            last_bytes = 2;
+            break;
+        default:
+            exit(EXIT_FAILURE);
+    }
+
+    /* check if output buffer is big enough */
+    result_len = (3*full_blocks) + last_bytes;
+    if (max_len < result_len) {
+        return -1;
+    }
+
+    /* process all the full blocks */
+    for (i=0; i < full_blocks; ++i) {
+        b  = (0x3F & legacy_char_to_code(in[4*i]    )) << 18;
+        b |= (0x3F & legacy_char_to_code(in[4*i + 1])) << 12;
+        b |= (0x3F & legacy_char_to_code(in[4*i + 2])) << 6;
+        b |=  0x3F & legacy_char_to_code(in[4*i + 3]);
+        out[3*i + 0] = (b >> 16) & 0xFF;
+        out[3*i + 1] = (b >> 8 ) & 0xFF;
+        out[3*i + 2] =  b        & 0xFF;
+    }
+
+    /* process the last 'partial' block */
+    i = full_blocks;
+    if (last_bytes == 1) {
+        b  = (0x3F & legacy_char_to_code(in[4*i]    )) << 18;
+        b |= (0x3F & legacy_char_to_code(in[4*i + 1])) << 12;
+        out[3*i + 0] = (b >> 16) & 0xFF;
+        if (((b >> 12) & 0x0F) != 0) {
+        }
+    } else if (last_bytes == 2) {
+        b  = (0x3F & legacy_char_to_code(in[4*i]    )) << 18;
+        b |= (0x3F & legacy_char_to_code(in[4*i + 1])) << 12;
+        b |= (0x3F & legacy_char_to_code(in[4*i + 2])) << 6;
+        out[3*i + 0] = (b >> 16) & 0xFF;
+        out[3*i + 1] = (b >> 8 ) & 0xFF;
+        if (((b >> 6) & 0x03) != 0) {
+        }
+    }
+
+    return result_len;
+}
+
+static int legacy_bin_to_b64(const uint8_t * in, int size, char * out, int max_len) {
+    int ret;
+
+    ret = legacy_bin_to_b64_nopad(in, size, out, max_len);
+
+    if (ret == -1) {
+        return -1;
+    }
+    switch (ret%4) {
+        case 0: /* nothing to do */
+            return ret;
+        case 1:
+            return -1;
+        case 2: /* 2 chars in last block, must add 2 padding char */
+            if (max_len >= (ret + 2 + 1)) {
+                out[ret] = '=';
+                out[ret+1] = '=';
+                out[ret+2] = 0;
+                return ret+2;
+            } else {
+                return -1;
+            }
+        case 3: /* 3 chars in last block, must add 1 padding char */
+            if (max_len >= (ret + 1 + 1)) {
+                out[ret] = '=';
+                out[ret+1] = 0;
+                return ret+1;
+            } else {
+                return -1;
+            }
+        default:
+            exit(EXIT_FAILURE);
+    }
+}
+
+static int legacy_b64_to_bin(const char * in, int size, uint8_t * out, int max_len) {
+    if (in == NULL) {
+        return -1;
+    }
+    if ((size%4 == 0) && (size >= 4)) { /* potentially padded Base64 */
+        if (in[size-2] == '=') { /* 2 padding char to ignore */
+            return legacy_b64_to_bin_nopad(in, size-2, out, max_len);
+        } else if (in[size-1] == '=') { /* 1 padding char to ignore */
+            return legacy_b64_to_bin_nopad(in, size-1, out, max_len);
+        } else { /* no padding to ignore */
+            return legacy_b64_to_bin_nopad(in, size, out, max_len);
+        }
+    } else { /* treat as unpadded Base64 */
+        return legacy_b64_to_bin_nopad(in, size, out, max_len);
+    }
+}
+
+/* encode with both implementations, with and without padding, and decode back, return number of errors */
+static int check_buffer(int size) {
+    int pad;
+    int len_ref, len_out;
+    int nb_err = 0;
+
+    for (pad = 0; pad <= 1; pad++) {
+        if (pad) {
+            len_ref = legacy_bin_to_b64(bin_in, size, b64_ref, sizeof b64_ref);
+            len_out = bin_to_b64(bin_in, size, b64_out, sizeof b64_out);
+        } else {
+            len_ref = legacy_bin_to_b64_nopad(bin_in, size, b64_ref, sizeof b64_ref);
+            len_out = bin_to_b64_nopad(bin_in, size, b64_out, sizeof b64_out);
+        }
+        if ((len_ref != len_out) || (strcmp(b64_ref, b64_out) != 0)) {
+            printf("ERROR: %d bytes, encoded%s as \"%s\" instead of \"%s\"\n", size, pad ? "" : " w/o padding", b64_out, b64_ref);
+            nb_err += 1;
+            continue;
+        }
+        len_ref = legacy_b64_to_bin(b64_ref, len_ref, bin_ref, sizeof bin_ref);
+        len_out = b64_to_bin(b64_out, len_out, bin_out, sizeof bin_out);
+        if ((len_ref != size) || (len_out != size) || (memcmp(bin_out, bin_in, size) != 0)) {
+            printf("ERROR: %d bytes, \"%s\" not decoded back\n", size, b64_out);
+            nb_err += 1;
+        }
+    }
+
+    return nb_err;
+}
+
+/* characters out of the alphabet and too small buffers must be reported, return number of errors */
+static int check_errors(void) {
+    int c, i;
+    char str[5] = "QUJD"; /* "ABC" */
+    int nb_err = 0;
+
+    for (c = 0; c < 256; c++) {
+        if (((c >= 'A') && (c <= 'Z')) || ((c >= 'a') && (c <= 'z')) || ((c >= '0') && (c <= '9')) || (c == '+') || (c == '/')) {
+            continue;
+        }
+        for (i = 0; i < 4; i++) {
+            memcpy(str, "QUJD", 4);
+            str[i] = (char)c;
+            if ((c != '=') || (i < 2)) { /* trailing '=' are padding */
+                if (b64_to_bin(str, 4, bin_out, sizeof bin_out) != -1) {
+                    printf("ERROR: invalid character 0x%02X at position %d not detected\n", c, i);
+                    nb_err += 1;
+                }
+            }
+        }
+    }
+
+    memset(bin_in, 0xA5, sizeof bin_in);
+    for (i = 1; i < 64; i++) {
+        if ((bin_to_b64(bin_in, i, b64_out, ((i + 2) / 3) * 4) != -1) || (bin_to_b64_nopad(bin_in, i, b64_out, (i * 4 + 2) / 3) != -1)) {
+            printf("ERROR: output buffer overflow not detected when encoding %d bytes\n", i);
+            nb_err += 1;
+        }
+        bin_to_b64(bin_in, i, b64_out, sizeof b64_out);
+        if (b64_to_bin(b64_out, strlen(b64_out), bin_out, i - 1) != -1) {
+            printf("ERROR: output buffer overflow not detected when decoding %d bytes\n", i);
+            nb_err += 1;
+        }
+    }
+
+    return nb_err;
+}
+
+/* describe command line options */
+static void usage(void) {
+    printf("Available options:\n");
+    printf(" -h print this help\n");
+    printf(" -n <uint>  number of %d bytes payloads encoded and decoded for the benchmark [1..100000], default %d\n", PAYLOAD_MAX, DEFAULT_NB_LOOP);
+    printf(" -x         exhaustive check of all 3-byte inputs (16M, long)\n");
+}
+
+/* -------------------------------------------------------------------------- */
+/* --- MAIN FUNCTION -------------------------------------------------------- */
+
+int main_test_base64(int argc, char **argv) {
+    int i, x;
+    unsigned int arg_u;
+    unsigned int nb_loop = DEFAULT_NB_LOOP;
+    bool exhaustive = false;
+    uint32_t v, v_max;
+    int size;
+    int len;
+    int64_t t_start;
+    int64_t t_enc_ref = 0, t_enc = 0, t_dec_ref = 0, t_dec = 0;
+    int nb_err = 0;
+
+    optind = 0;
+
+    /* parse command line options */
+    while ((i = getopt(argc, argv, "hxn:")) != -1) {
+        switch (i) {
+            case 'h':
+                usage();
+                return -1;
+            case 'x':
+                exhaustive = true;
+                break;
+            case 'n':
+                x = sscanf(optarg, "%u", &arg_u);
+                if ((x != 1) || (arg_u < 1) || (arg_u > 100000)) {
+                    printf("ERROR: argument parsing of -n argument. Use -h to print help\n");
+                    return EXIT_FAILURE;
+                } else {
+                    nb_loop = arg_u;
+                }
+                break;
+            default:
+                printf("ERROR: argument parsing\n");
+                usage();
+                return EXIT_FAILURE;
+        }
+    }
+
+    /* all 1 and 2-byte inputs (all partial blocks), and all 3-byte inputs if requested */
+    for (size = 1; size <= (exhaustive ? 3 : 2); size++) {
+        v_max = 1UL << (8 * size);
+        printf("### base64: all %d-byte inputs ###\n", size);
+        for (v = 0; v < v_max; v++) {
+            bin_in[0] = v & 0xFF;
+            bin_in[1] = (v >> 8) & 0xFF;
+            bin_in[2] = (v >> 16) & 0xFF;
+            nb_err += check_buffer(size);
+            if (nb_err > 10) {
+                return EXIT_FAILURE;
+            }
+        }
+    }
+
+    /* all payload sizes, random content */
+    printf("### base64: random inputs of 0 to %d bytes ###\n", PAYLOAD_MAX);
+    for (i = 0; i < 16; i++) {
+        for (size = 0; size <= PAYLOAD_MAX; size++) {
+            for (x = 0; x < size; x++) {
+                bin_in[x] = rand() & 0xFF;
+            }
+            nb_err += check_buffer(size);
+            if (nb_err > 10) {
+                return EXIT_FAILURE;
+            }
+        }
+    }
+
+    printf("### base64: error detection ###\n");
+    nb_err += check_errors();
+
+    /* benchmark on the largest LoRa payload */
+    for (x = 0; x < PAYLOAD_MAX; x++) {
+        bin_in[x] = rand() & 0xFF;
+    }
+    for (i = 0; i < (int)nb_loop; i++) {
+        t_start = esp_timer_get_time();
+        len = legacy_bin_to_b64(bin_in, PAYLOAD_MAX, b64_ref, sizeof b64_ref);
+        t_enc_ref += esp_timer_get_time() - t_start;
+
+        t_start = esp_timer_get_time();
+        len = bin_to_b64(bin_in, PAYLOAD_MAX, b64_out, sizeof b64_out);
+        t_enc += esp_timer_get_time() - t_start;
+
+        t_start = esp_timer_get_time();
+        legacy_b64_to_bin(b64_ref, len, bin_ref, sizeof bin_ref);
+        t_dec_ref += esp_timer_get_time() - t_start;
+
+        t_start = esp_timer_get_time();
+        b64_to_bin(b64_out, len, bin_out, sizeof bin_out);
+        t_dec += esp_timer_get_time() - t_start;
+    }
+    printf("### base64: %u x %d bytes ###\n", nb_loop, PAYLOAD_MAX);
+    printf("encode: former %.2f us, tables %.2f us\n", (double)t_enc_ref / nb_loop, (double)t_enc / nb_loop);
+    printf("decode: former %.2f us, tables %.2f us\n", (double)t_dec_ref / nb_loop, (double)t_dec / nb_loop);
+    printf("%d errors\n", nb_err);
+
+    return (nb_err == 0) ? 0 : EXIT_FAILURE;
+}
+
+void register_test_base64(void)
+{
+    const esp_console_cmd_t test_base64_cmd = {
+        .command = "test_base64",
+        .help = "Test base64 encoder/decoder",
+        .hint = NULL,
+        .func = &main_test_base64,
+        .argtable = NULL,
+    };
+    ESP_ERROR_CHECK(esp_console_cmd_register(&test_base64_cmd));
+}
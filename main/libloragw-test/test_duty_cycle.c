@@ -0,0 +1,291 @@
+/*
+ / _____)             _              | |
+( (____  _____ ____ _| |_ _____  ____| |__
+ \____ \| ___ |    (_   _) ___ |/ ___)  _ \
+ _____) ) ____| | | || |_| ____( (___| | | |
+(______/|_____)_|_|_| \__)_____)\____)_| |_|
+  (C)2019 Semtech
+
+Description:
+    Check the downlink duty-cycle ledger: sub-band budgets, expiry of the
+    airtime out of the sliding window, dwell time, and compare it with an
+    exact sliding window on random traffic
+
+License: Revised BSD License, see LICENSE.TXT file include in the project
+*/
+
+
+/* -------------------------------------------------------------------------- */
+/* --- DEPENDANCIES --------------------------------------------------------- */
+
+/* fix an issue between POSIX and C99 */
+#if __STDC_VERSION__ >= 199901L
+    #define _XOPEN_SOURCE 600
+#else
+    #define _XOPEN_SOURCE 500
+#endif
+
+#include <stdint.h>     /* C99 types */
+#include <stdbool.h>    /* bool type */
+#include <stdio.h>      /* printf */
+#include <stdlib.h>     /* rand */
+#include <string.h>     /* memmove */
+#include <getopt.h>     /* getopt */
+
+#include "esp_system.h"
+#include "esp_console.h"
+#include "esp_timer.h"
+
+#include "duty_cycle.h"
+
+/* -------------------------------------------------------------------------- */
+/* --- PRIVATE MACROS ------------------------------------------------------- */
+
+#define RAND_RANGE(min, max) (rand() % (max + 1 - min) + min)
+
+/* -------------------------------------------------------------------------- */
+/* --- PRIVATE CONSTANTS ---------------------------------------------------- */
+
+#define DEFAULT_NB_PKT      20000
+#define WINDOW_S            3600
+#define FREQ_G3             869525000   /* EU868 10% sub-band, RX2 */
+#define FREQ_G              868100000   /* EU868 1% sub-band */
+#define HISTORY_MAX         4096        /* packets kept by the exact reference */
+
+/* -------------------------------------------------------------------------- */
+/* --- PRIVATE VARIABLES ---------------------------------------------------- */
+
+static struct duty_cycle_s duty;
+
+/* exact sliding window on the 10% sub-band, for reference */
+static struct {
+    int64_t time_ms;
+    uint32_t toa_ms;
+} history[HISTORY_MAX];
+
+/* -------------------------------------------------------------------------- */
+/* --- PRIVATE FUNCTIONS DEFINITION ----------------------------------------- */
+
+static uint32_t ref_used(int nb, int64_t now_ms, int64_t window_ms) {
+    uint32_t used = 0;
+    int i;
+
+    for (i = 0; i < nb; i++) {
+        if ((now_ms - history[i].time_ms) < window_ms) {
+            used += history[i].toa_ms;
+        }
+    }
+    return used;
+}
+
+/* describe command line options */
+static void usage(void) {
+    printf("Available options:\n");
+    printf(" -h print this help\n");
+    printf(" -n <uint>  number of random packets [100..1000000], default %d\n", DEFAULT_NB_PKT);
+}
+
+/* -------------------------------------------------------------------------- */
+/* --- MAIN FUNCTION -------------------------------------------------------- */
+
+int main_test_duty_cycle(int argc, char **argv) {
+    int i, x;
+    unsigned int arg_u;
+    unsigned int nb_pkt = DEFAULT_NB_PKT;
+    unsigned int nb_error = 0;
+    unsigned int nb_accepted, nb_hist;
+    enum duty_cycle_error_e err;
+    struct duty_cycle_stat_s stat;
+    struct duty_cycle_band_s band;
+    int64_t now_ms, window_ms, bucket_ms;
+    int64_t start_us, cpu_us;
+    uint32_t toa_ms, ref_low, ref_high;
+
+    optind = 0;
+
+    /* parse command line options */
+    while ((i = getopt(argc, argv, "hn:")) != -1) {
+        switch (i) {
+            case 'h':
+                usage();
+                return -1;
+            case 'n':
+                x = sscanf(optarg, "%u", &arg_u);
+                if ((x != 1) || (arg_u < 100) || (arg_u > 1000000)) {
+                    printf("ERROR: argument parsing of -n argument. Use -h to print help\n");
+                    return EXIT_FAILURE;
+                } else {
+                    nb_pkt = arg_u;
+                }
+                break;
+            default:
+                printf("ERROR: argument parsing\n");
+                usage();
+                return EXIT_FAILURE;
+        }
+    }
+
+    /* 1 - the 10% sub-band takes 360 s on air per hour, then rejects */
+    duty_cycle_init(&duty, WINDOW_S);
+    if (duty_cycle_add_region(&duty, "EU868") != 0) {
+        printf("ERROR: EU868 region not loaded\n");
+        return EXIT_FAILURE;
+    }
+    window_ms = WINDOW_S * 1000LL;
+    bucket_ms = window_ms / DUTY_CYCLE_BUCKET_NB;
+    now_ms = 1000;
+    nb_accepted = 0;
+    while (duty_cycle_charge(&duty, FREQ_G3, 1000, now_ms, false) == DUTY_CYCLE_OK) {
+        nb_accepted += 1;
+        now_ms += 1000;
+    }
+    printf("10%% sub-band: %u s on air accepted in %lld s\n", nb_accepted, (long long)(now_ms / 1000));
+    if (nb_accepted != (WINDOW_S / 10)) {
+        printf("ERROR: %u s accepted instead of %d s\n", nb_accepted, WINDOW_S / 10);
+        nb_error += 1;
+    }
+
+    /* 2 - other sub-bands have their own budget */
+    if (duty_cycle_charge(&duty, FREQ_G, 1000, now_ms, false) != DUTY_CYCLE_OK) {
+        printf("ERROR: 1%% sub-band rejected while the 10%% one is exhausted\n");
+        nb_error += 1;
+    }
+    if (duty_cycle_charge(&duty, 433175000, 100000, now_ms, false) != DUTY_CYCLE_OK) {
+        printf("ERROR: packet outside of any sub-band rejected\n");
+        nb_error += 1;
+    }
+
+    /* 3 - beacons are charged even when over budget */
+    if (duty_cycle_charge(&duty, FREQ_G3, 500, now_ms, true) != DUTY_CYCLE_OK) {
+        printf("ERROR: beacon rejected\n");
+        nb_error += 1;
+    }
+
+    /* 4 - the airtime leaves the window, at most one bucket late */
+    if (duty_cycle_charge(&duty, FREQ_G3, 1000, 1000 + window_ms - bucket_ms, false) != DUTY_CYCLE_EXCEEDED) {
+        printf("ERROR: airtime expired too early\n");
+        nb_error += 1;
+    }
+    if (duty_cycle_charge(&duty, FREQ_G3, 1000, 1000 + window_ms + bucket_ms, false) != DUTY_CYCLE_OK) {
+        printf("ERROR: airtime did not expire\n");
+        nb_error += 1;
+    }
+    if (duty_cycle_charge(&duty, FREQ_G3, 1000, 1000 + (3 * window_ms), false) != DUTY_CYCLE_OK) {
+        printf("ERROR: airtime did not expire after a long idle time\n");
+        nb_error += 1;
+    }
+    duty_cycle_get_stat(&duty, 1000 + (3 * window_ms), &stat, true);
+    printf("stats: %lu charged, %lu exceeded, %lu dwell time, %lu out of band\n", stat.nb_charged, stat.nb_exceeded, stat.nb_dwell_time, stat.nb_out_of_band);
+    if ((stat.nb_exceeded != 2) || (stat.nb_out_of_band != 1) || (stat.used_ms[4] != 1000)) {
+        printf("ERROR: wrong statistics\n");
+        nb_error += 1;
+    }
+    vSemaphoreDelete(duty.mx_duty);
+
+    /* 5 - dwell time */
+    duty_cycle_init(&duty, WINDOW_S);
+    duty_cycle_add_region(&duty, "US915");
+    if ((duty_cycle_charge(&duty, 923300000, 400, 0, false) != DUTY_CYCLE_OK) || (duty_cycle_charge(&duty, 923300000, 401, 0, false) != DUTY_CYCLE_DWELL_TIME)) {
+        printf("ERROR: dwell time not enforced\n");
+        nb_error += 1;
+    }
+    vSemaphoreDelete(duty.mx_duty);
+
+    /* 6 - the airtime of a packet never sent is given back, unless it already left the window */
+    duty_cycle_init(&duty, WINDOW_S);
+    duty_cycle_add_region(&duty, "EU868");
+    for (now_ms = 1000; duty_cycle_charge(&duty, FREQ_G3, 1000, now_ms, false) == DUTY_CYCLE_OK; now_ms += 1000);
+    duty_cycle_refund(&duty, FREQ_G3, 1000, 1000 + (2 * bucket_ms), now_ms);
+    if ((duty_cycle_charge(&duty, FREQ_G3, 1000, now_ms, false) != DUTY_CYCLE_OK) || (duty_cycle_charge(&duty, FREQ_G3, 1000, now_ms, false) != DUTY_CYCLE_EXCEEDED)) {
+        printf("ERROR: airtime not given back\n");
+        nb_error += 1;
+    }
+    duty_cycle_refund(&duty, FREQ_G3, 1000, now_ms - window_ms - (2 * bucket_ms), now_ms);
+    duty_cycle_refund(&duty, 433175000, 1000, now_ms, now_ms);
+    duty_cycle_get_stat(&duty, now_ms, &stat, true);
+    if ((stat.nb_refunded != 1) || (stat.used_ms[4] != duty.budget_ms[4])) {
+        printf("ERROR: airtime out of the window or out of sub-bands given back\n");
+        nb_error += 1;
+    }
+    vSemaphoreDelete(duty.mx_duty);
+
+    /* 7 - a packet is charged to the first sub-band containing its frequency */
+    duty_cycle_init(&duty, WINDOW_S);
+    band.freq_min = 869400000;
+    band.freq_max = 869650000;
+    band.duty_cycle = 1.0;
+    band.dwell_max_ms = 0;
+    duty_cycle_add_band(&duty, &band);
+    duty_cycle_add_region(&duty, "EU868");
+    for (now_ms = 1000, nb_accepted = 0; duty_cycle_charge(&duty, FREQ_G3, 1000, now_ms, false) == DUTY_CYCLE_OK; now_ms += 1000) {
+        nb_accepted += 1;
+    }
+    if (nb_accepted != (WINDOW_S / 100)) {
+        printf("ERROR: %u s accepted instead of %d s with an overriding sub-band\n", nb_accepted, WINDOW_S / 100);
+        nb_error += 1;
+    }
+    vSemaphoreDelete(duty.mx_duty);
+
+    /* 8 - random traffic, some packets given back, the ledger is between the exact window and the window extended by one bucket */
+    duty_cycle_init(&duty, WINDOW_S);
+    duty_cycle_add_region(&duty, "EU868");
+    now_ms = 0;
+    nb_hist = 0;
+    nb_accepted = 0;
+    cpu_us = 0;
+    for (i = 0; i < (int)nb_pkt; i++) {
+        now_ms += RAND_RANGE(1, 20000);
+        toa_ms = RAND_RANGE(30, 2800);
+        start_us = esp_timer_get_time();
+        err = duty_cycle_charge(&duty, FREQ_G3, toa_ms, now_ms, false);
+        cpu_us += esp_timer_get_time() - start_us;
+        ref_low = ref_used(nb_hist, now_ms, window_ms);
+        ref_high = ref_used(nb_hist, now_ms, window_ms + bucket_ms);
+        if (((err == DUTY_CYCLE_OK) && ((ref_low + toa_ms) > duty.budget_ms[4])) ||
+                ((err != DUTY_CYCLE_OK) && ((ref_high + toa_ms) <= duty.budget_ms[4]))) {
+            if (nb_error < 5) {
+                printf("ERROR: packet %d %s with %lu-%lu ms used in the window\n", i, (err == DUTY_CYCLE_OK) ? "accepted" : "rejected", ref_low, ref_high);
+            }
+            nb_error += 1;
+        }
+        if (err == DUTY_CYCLE_OK) {
+            nb_accepted += 1;
+            /* keep only the packets still in the reference window */
+            if (nb_hist == HISTORY_MAX) {
+                for (x = 0; (x < (int)nb_hist) && ((now_ms - history[x].time_ms) >= (window_ms + bucket_ms)); x++);
+                memmove(&history[0], &history[x], (nb_hist - x) * sizeof history[0]);
+                nb_hist -= x;
+            }
+            if (nb_hist < HISTORY_MAX) {
+                history[nb_hist].time_ms = now_ms;
+                history[nb_hist].toa_ms = toa_ms;
+                nb_hist += 1;
+            }
+        }
+        /* a queued packet dropped as too late */
+        if ((nb_hist > 0) && (RAND_RANGE(0, 7) == 0)) {
+            x = RAND_RANGE(0, (int)nb_hist - 1);
+            duty_cycle_refund(&duty, FREQ_G3, history[x].toa_ms, history[x].time_ms, now_ms);
+            memmove(&history[x], &history[x + 1], (nb_hist - x - 1) * sizeof history[0]);
+            nb_hist -= 1;
+        }
+    }
+    printf("random traffic: %u/%u packets accepted, %.3f us per charge\n", nb_accepted, nb_pkt, (double)cpu_us / nb_pkt);
+    vSemaphoreDelete(duty.mx_duty);
+
+    printf("%u errors\n", nb_error);
+
+    return (nb_error == 0) ? 0 : EXIT_FAILURE;
+}
+
+void register_test_duty_cycle(void)
+{
+    const esp_console_cmd_t test_duty_cycle_cmd = {
+        .command = "test_duty_cycle",
+        .help = "Test downlink duty-cycle ledger",
+        .hint = NULL,
+        .func = &main_test_duty_cycle,
+        .argtable = NULL,
+    };
+    ESP_ERROR_CHECK(esp_console_cmd_register(&test_duty_cycle_cmd));
+}
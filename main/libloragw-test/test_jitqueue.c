@@ -0,0 +1,645 @@
+/*
+ / _____)             _              | |
+( (____  _____ ____ _| |_ _____  ____| |__
+ \____ \| ___ |    (_   _) ___ |/ ___)  _ \
+ _____) ) ____| | | || |_| ____( (___| | | |
+(______/|_____)_|_|_| \__)_____)\____)_| |_|
+  (C)2019 Semtech
+
+Description:
+    Check the JiT queue ordering across the counter roll-over, and compare
+    enqueue/peek/dequeue cost with the former sort on every operation, at
+    32, 128 and 512 packets (the larger sizes need JIT_QUEUE_MAX raised at
+    build time). Timings are those of the target the command runs on.
+    Simulate downlink traffic over several counter roll-overs, checking the
+    dispatch order and the collision decisions against 64-bit time.
+    Benchmark the ASAP slot search of immediate (Class C) downlinks on dense
+    multicast loads, on one and on two RF chains.
+
+License: Revised BSD License, see LICENSE.TXT file include in the project
+*/
+
+
+/* -------------------------------------------------------------------------- */
+/* --- DEPENDANCIES --------------------------------------------------------- */
+
+/* fix an issue between POSIX and C99 */
+#if __STDC_VERSION__ >= 199901L
+    #define _XOPEN_SOURCE 600
+#else
+    #define _XOPEN_SOURCE 500
+#endif
+
+#include <stdint.h>     /* C99 types */
+#include <stdbool.h>    /* bool type */
+#include <stdio.h>      /* printf */
+#include <stdlib.h>     /* rand qsort */
+#include <string.h>
+#include <getopt.h>     /* getopt */
+
+#include "esp_system.h"
+#include "esp_console.h"
+#include "esp_timer.h"
+
+#include "loragw_hal.h"
+#include "jitqueue.h"
+
+/* -------------------------------------------------------------------------- */
+/* --- PRIVATE CONSTANTS ---------------------------------------------------- */
+
+#define PKT_SPACING_US  100000      /* more than pre delay + time on air + margin of a small SF7 packet */
+#define START_TIME_US   0xFFF00000  /* close to the counter roll-over */
+#define PEEK_ADVANCE_US 10000       /* less than TX_JIT_DELAY */
+#define DEFAULT_NB_WRAP 3
+
+static const int bench_size[] = { 32, 128, 512 };
+
+/* same values as jitqueue.c, for the reference collision decision */
+#define SIM_TX_START_DELAY  1500
+#define SIM_TX_MARGIN_DELAY 1000
+
+#define SIM_STEP_MAX_US     30000       /* thread_jit polling period, less than TX_JIT_DELAY */
+#define SIM_ENQUEUE_RATE    8           /* one downlink every SIM_ENQUEUE_RATE steps on average */
+#define SIM_ADVANCE_MIN_US  1000000     /* downlink timestamp, from 1s... */
+#define SIM_ADVANCE_MAX_US  5000000     /* ... to 5s after the current time */
+#define SIM_COUNTER_WRAP    0x100000000ULL
+
+#define DEFAULT_NB_CLASS_C  20          /* dense class C loads simulated */
+#define CLASS_C_NB_CLASS_A  8           /* class A downlinks already in each queue */
+#define CLASS_C_BEACON_US   4000000     /* a beacon is queued 4s ahead, with its guard */
+#define CLASS_C_NB_PKT      (JIT_QUEUE_MAX - CLASS_C_NB_CLASS_A - 1) /* multicast downlinks per load, they fit in one queue */
+
+/* -------------------------------------------------------------------------- */
+/* --- PRIVATE VARIABLES ---------------------------------------------------- */
+
+static struct jit_queue_s queue;
+static struct jit_queue_s queue_alt; /* second RF chain, for the class C benchmark */
+static struct jit_queue_s chain_queue[LGW_RF_CHAIN_NB]; /* one queue per RF chain, for the collision balancing */
+static struct jit_node_s legacy_nodes[JIT_QUEUE_MAX];
+static uint32_t slot_order[JIT_QUEUE_MAX];
+
+/* packets accepted in the queue, in 64-bit time that does not wrap */
+static struct {
+    uint64_t time_us;
+    uint32_t pre_delay;
+    uint32_t post_delay;
+} sim_ref[JIT_QUEUE_MAX];
+static int sim_num;
+
+/* -------------------------------------------------------------------------- */
+/* --- PRIVATE FUNCTIONS DEFINITION ----------------------------------------- */
+
+/* reference: queue sorted with qsort after every change, as before the heap */
+static int legacy_compare(const void *a, const void *b) {
+    int p_count = ((const struct jit_node_s *)a)->pkt.count_us;
+    int q_count = ((const struct jit_node_s *)b)->pkt.count_us;
+
+    return p_count - q_count;
+}
+
+static void legacy_enqueue(int *num, const struct lgw_pkt_tx_s *pkt) {
+    int i;
+
+    for (i = 0; i < *num; i++) { /* collision scan */
+        if ((pkt->count_us - legacy_nodes[i].pkt.count_us) < PKT_SPACING_US / 2) {
+            break;
+        }
+    }
+    memcpy(&(legacy_nodes[*num].pkt), pkt, sizeof *pkt);
+    *num += 1;
+    qsort(legacy_nodes, *num, sizeof legacy_nodes[0], legacy_compare);
+}
+
+static int legacy_peek(int num, uint32_t time_us) {
+    int i;
+    int idx = -1;
+
+    for (i = 0; i < num; i++) {
+        if ((idx == -1) || ((legacy_nodes[i].pkt.count_us - time_us) < (legacy_nodes[idx].pkt.count_us - time_us))) {
+            idx = i;
+        }
+    }
+    return idx;
+}
+
+static void legacy_dequeue(int *num, int idx, struct lgw_pkt_tx_s *pkt) {
+    memcpy(pkt, &(legacy_nodes[idx].pkt), sizeof *pkt);
+    *num -= 1;
+    memcpy(&(legacy_nodes[idx]), &(legacy_nodes[*num]), sizeof legacy_nodes[0]);
+    qsort(legacy_nodes, *num, sizeof legacy_nodes[0], legacy_compare);
+}
+
+static void shuffle_slots(int n) {
+    int i, j;
+    uint32_t tmp;
+
+    for (i = 0; i < n; i++) {
+        slot_order[i] = i;
+    }
+    for (i = n - 1; i > 0; i--) {
+        j = rand() % (i + 1);
+        tmp = slot_order[i];
+        slot_order[i] = slot_order[j];
+        slot_order[j] = tmp;
+    }
+}
+
+static uint32_t rand_range(uint32_t min, uint32_t max) {
+    return min + (uint32_t)((((uint64_t)rand() << 16) ^ (uint64_t)rand()) % (max - min + 1));
+}
+
+/* reference collision decision, with time that does not wrap */
+static bool sim_collides(uint64_t time_us, uint32_t pre_delay, uint32_t post_delay) {
+    int i;
+    int64_t d;
+
+    for (i = 0; i < sim_num; i++) {
+        d = (int64_t)(time_us - sim_ref[i].time_us);
+        if (((d >= 0) && (d <= (int64_t)pre_delay + sim_ref[i].post_delay + SIM_TX_MARGIN_DELAY)) ||
+            ((d <= 0) && (-d <= (int64_t)sim_ref[i].pre_delay + post_delay + SIM_TX_MARGIN_DELAY))) {
+            return true;
+        }
+    }
+    return false;
+}
+
+/* run class A downlinks through the queue for nb_wrap counter roll-overs, return the number of errors */
+static unsigned int simulate_wraps(unsigned int nb_wrap) {
+    struct lgw_pkt_tx_s pkt;
+    enum jit_pkt_type_e pkt_type;
+    enum jit_error_e err, err_ref;
+    uint64_t now = START_TIME_US;
+    uint64_t end = START_TIME_US + (nb_wrap * SIM_COUNTER_WRAP);
+    uint64_t t;
+    uint32_t pre_delay, post_delay;
+    uint32_t prev_count_us = 0;
+    bool first = true;
+    int pkt_idx;
+    int i, k;
+    unsigned int nb_step = 0, nb_sent = 0, nb_collision = 0, nb_full = 0;
+    unsigned int nb_error = 0;
+
+    jit_queue_init(&queue);
+    sim_num = 0;
+
+    memset(&pkt, 0, sizeof pkt);
+    pkt.modulation = MOD_LORA;
+    pkt.bandwidth = BW_125KHZ;
+    pkt.coderate = CR_LORA_4_5;
+    pkt.preamble = 8;
+    pkt.tx_mode = TIMESTAMPED;
+
+    while (now < end) {
+        nb_step += 1;
+
+        /* thread_jit: send what is due */
+        while (1) {
+            err = jit_peek(&queue, (lgw_tmst_t)now, &pkt_idx);
+            if ((err != JIT_ERROR_OK) || (pkt_idx < 0)) {
+                break;
+            }
+            jit_dequeue(&queue, pkt_idx, &pkt, &pkt_type);
+            for (k = -1, i = 0; i < sim_num; i++) {
+                if ((k < 0) || (sim_ref[i].time_us < sim_ref[k].time_us)) {
+                    k = i;
+                }
+            }
+            if ((k < 0) || (pkt.count_us != (lgw_tmst_t)sim_ref[k].time_us)) {
+                printf("ERROR: packet %u dequeued at %u is not the earliest one\n", pkt.count_us, (lgw_tmst_t)now);
+                nb_error += 1;
+            } else {
+                sim_ref[k] = sim_ref[--sim_num];
+            }
+            if ((first == false) && !TMST_BEFORE(prev_count_us, pkt.count_us)) {
+                printf("ERROR: packet %u dequeued after packet %u\n", pkt.count_us, prev_count_us);
+                nb_error += 1;
+            }
+            first = false;
+            prev_count_us = pkt.count_us;
+            nb_sent += 1;
+        }
+        for (i = 0; i < sim_num; i++) {
+            if (sim_ref[i].time_us < now) {
+                printf("ERROR: packet %u missed at %u\n", (lgw_tmst_t)sim_ref[i].time_us, (lgw_tmst_t)now);
+                sim_ref[i--] = sim_ref[--sim_num];
+                nb_error += 1;
+            }
+        }
+
+        /* thread_down: a new downlink, possibly on the other side of the roll-over */
+        if (rand_range(1, SIM_ENQUEUE_RATE) == 1) {
+            t = now + rand_range(SIM_ADVANCE_MIN_US, SIM_ADVANCE_MAX_US);
+            pkt.count_us = (lgw_tmst_t)t;
+            pkt.datarate = rand_range(DR_LORA_SF7, DR_LORA_SF9);
+            pkt.size = rand_range(1, 64);
+            pre_delay = SIM_TX_START_DELAY + TX_JIT_DELAY;
+            post_delay = lgw_time_on_air(&pkt) * 1000UL;
+            if (sim_num == JIT_QUEUE_MAX) {
+                err_ref = JIT_ERROR_FULL;
+                nb_full += 1;
+            } else if (sim_collides(t, pre_delay, post_delay) == true) {
+                err_ref = JIT_ERROR_COLLISION_PACKET;
+                nb_collision += 1;
+            } else {
+                err_ref = JIT_ERROR_OK;
+            }
+            err = jit_enqueue(&queue, (lgw_tmst_t)now, &pkt, JIT_PKT_TYPE_DOWNLINK_CLASS_A);
+            if (err != err_ref) {
+                printf("ERROR: enqueue of packet %u at %u returned %d, expected %d\n", pkt.count_us, (lgw_tmst_t)now, err, err_ref);
+                nb_error += 1;
+            }
+            if (err == JIT_ERROR_OK) {
+                sim_ref[sim_num].time_us = t;
+                sim_ref[sim_num].pre_delay = pre_delay;
+                sim_ref[sim_num].post_delay = post_delay;
+                sim_num += 1;
+            }
+        }
+
+        now += rand_range(1, SIM_STEP_MAX_US);
+    }
+
+    printf("%u roll-overs: %u steps, %u downlinks sent, %u collisions, %u queue full\n", nb_wrap, nb_step, nb_sent, nb_collision, nb_full);
+
+    return nb_error;
+}
+
+/* reference ASAP slot: every candidate tested against every packet, O(n^2) */
+static lgw_tmst_t ref_asap(const struct jit_queue_s *q, lgw_tmst_t time_us, uint32_t pre_delay, uint32_t post_delay) {
+    lgw_tmst_t asap_us = time_us + 2 * TX_JIT_DELAY;
+    lgw_tmst_t best_us = 0, cand_us;
+    bool found = false;
+    int i, j;
+
+    for (i = -1; i < q->num_pkt; i++) {
+        if (i < 0) {
+            cand_us = asap_us;
+        } else {
+            cand_us = q->nodes[i].pkt.count_us + q->nodes[i].post_delay + pre_delay + TX_JIT_DELAY + SIM_TX_MARGIN_DELAY;
+        }
+        if (TMST_BEFORE(cand_us, asap_us) || ((found == true) && !TMST_BEFORE(cand_us, best_us))) {
+            continue;
+        }
+        for (j = 0; j < q->num_pkt; j++) {
+            if (jit_collision_test(cand_us, pre_delay, post_delay, q->nodes[j].pkt.count_us, q->nodes[j].pre_delay, q->nodes[j].post_delay) == true) {
+                break;
+            }
+        }
+        if (j == q->num_pkt) {
+            best_us = cand_us;
+            found = true;
+        }
+    }
+    return best_us;
+}
+
+/* fill a queue with a beacon and class A downlinks, as background for class C */
+static void class_c_background(struct jit_queue_s *q, lgw_tmst_t time_us) {
+    struct lgw_pkt_tx_s pkt;
+    int i;
+
+    jit_queue_init(q);
+
+    memset(&pkt, 0, sizeof pkt);
+    pkt.modulation = MOD_LORA;
+    pkt.bandwidth = BW_125KHZ;
+    pkt.coderate = CR_LORA_4_5;
+    pkt.preamble = 8;
+    pkt.tx_mode = TIMESTAMPED;
+
+    pkt.count_us = time_us + CLASS_C_BEACON_US;
+    pkt.datarate = DR_LORA_SF9;
+    pkt.size = 17;
+    jit_enqueue(q, time_us, &pkt, JIT_PKT_TYPE_BEACON);
+
+    for (i = 0; i < CLASS_C_NB_CLASS_A; i++) {
+        pkt.count_us = time_us + rand_range(SIM_ADVANCE_MIN_US, SIM_ADVANCE_MAX_US);
+        pkt.datarate = rand_range(DR_LORA_SF7, DR_LORA_SF9);
+        pkt.size = rand_range(1, 64);
+        jit_enqueue(q, time_us, &pkt, JIT_PKT_TYPE_DOWNLINK_CLASS_A); /* collisions are expected */
+    }
+}
+
+/* queue bursts of class C multicast downlinks, return the number of errors */
+static unsigned int benchmark_class_c(unsigned int nb_round) {
+    struct lgw_pkt_tx_s pkt;
+    struct jit_queue_s *q;
+    lgw_tmst_t time_us, asap_us, asap_alt_us, ref_us;
+    uint32_t pre_delay, post_delay;
+    unsigned int r, seed;
+    int nb_chain;
+    int i;
+    unsigned int nb_pkt = 0;
+    uint64_t delay_us[2] = { 0, 0 };
+    unsigned int nb_delay[2] = { 0, 0 };
+    int64_t t_start, t_gap = 0, t_ref = 0;
+    unsigned int nb_error = 0;
+
+    memset(&pkt, 0, sizeof pkt);
+    pkt.modulation = MOD_LORA;
+    pkt.bandwidth = BW_125KHZ;
+    pkt.coderate = CR_LORA_4_5;
+    pkt.preamble = 8;
+
+    for (r = 0; r < nb_round; r++) {
+        time_us = START_TIME_US + rand_range(0, 0x1FFFFF); /* around the counter roll-over */
+        seed = rand();
+
+        /* same load on one RF chain, then on two */
+        for (nb_chain = 1; nb_chain <= 2; nb_chain++) {
+            srand(seed);
+            class_c_background(&queue, time_us);
+            class_c_background(&queue_alt, time_us);
+
+            for (i = 0; i < CLASS_C_NB_PKT; i++) {
+                pkt.datarate = rand_range(DR_LORA_SF7, DR_LORA_SF10);
+                pkt.size = rand_range(10, 50);
+                pre_delay = SIM_TX_START_DELAY + TX_JIT_DELAY;
+                post_delay = lgw_time_on_air(&pkt) * 1000UL;
+
+                t_start = esp_timer_get_time();
+                asap_us = jit_queue_asap(&queue, time_us, &pkt);
+                t_gap += esp_timer_get_time() - t_start;
+                q = &queue;
+                if (nb_chain == 2) {
+                    asap_alt_us = jit_queue_asap(&queue_alt, time_us, &pkt);
+                    if (TMST_BEFORE(asap_alt_us, asap_us)) {
+                        asap_us = asap_alt_us;
+                        q = &queue_alt;
+                    }
+                }
+                t_start = esp_timer_get_time();
+                ref_us = ref_asap(q, time_us, pre_delay, post_delay);
+                t_ref += esp_timer_get_time() - t_start;
+                if (asap_us != ref_us) {
+                    printf("ERROR: class C slot %u, expected %u (%u packets queued)\n", asap_us, ref_us, q->num_pkt);
+                    nb_error += 1;
+                }
+
+                if (jit_enqueue(q, time_us, &pkt, JIT_PKT_TYPE_DOWNLINK_CLASS_C) != JIT_ERROR_OK) {
+                    printf("ERROR: class C enqueue failed (%u packets queued)\n", q->num_pkt);
+                    nb_error += 1;
+                    break;
+                }
+                if (pkt.count_us != asap_us) {
+                    printf("ERROR: class C enqueued at %u, ASAP slot was %u\n", pkt.count_us, asap_us);
+                    nb_error += 1;
+                }
+                nb_pkt += 1;
+                delay_us[nb_chain - 1] += TMST_UNTIL(pkt.count_us, time_us);
+                nb_delay[nb_chain - 1] += 1;
+            }
+        }
+    }
+
+    printf("%u class C loads: ASAP slot %.2f us (reference %.2f us), average delay %llu ms on one RF chain, %llu ms on two\n",
+            nb_round, (double)t_gap / nb_pkt, (double)t_ref / nb_pkt,
+            (nb_delay[0] > 0) ? (delay_us[0] / nb_delay[0] / 1000) : 0, (nb_delay[1] > 0) ? (delay_us[1] / nb_delay[1] / 1000) : 0);
+
+    return nb_error;
+}
+
+static bool chain_any(uint8_t rf_chain, const struct lgw_pkt_tx_s *pkt) {
+    (void)rf_chain;
+    (void)pkt;
+    return true;
+}
+
+static bool chain_none(uint8_t rf_chain, const struct lgw_pkt_tx_s *pkt) {
+    (void)rf_chain;
+    (void)pkt;
+    return false;
+}
+
+/* a downlink colliding on its RF chain is queued on the other one, and sent from there */
+static unsigned int check_other_chain(void) {
+    struct lgw_pkt_tx_s pkt;
+    enum jit_pkt_type_e pkt_type;
+    enum jit_error_e err;
+    lgw_tmst_t time_us = START_TIME_US;
+    int i, pkt_idx;
+    unsigned int nb_error = 0;
+
+    for (i = 0; i < LGW_RF_CHAIN_NB; i++) {
+        jit_queue_init(&chain_queue[i]);
+    }
+
+    memset(&pkt, 0, sizeof pkt);
+    pkt.modulation = MOD_LORA;
+    pkt.datarate = DR_LORA_SF7;
+    pkt.bandwidth = BW_125KHZ;
+    pkt.coderate = CR_LORA_4_5;
+    pkt.preamble = 8;
+    pkt.size = 10;
+    pkt.tx_mode = TIMESTAMPED;
+    pkt.rf_chain = 0;
+    pkt.count_us = time_us + 1000000;
+    jit_enqueue(&chain_queue[0], time_us, &pkt, JIT_PKT_TYPE_DOWNLINK_CLASS_A);
+
+    /* no other chain can send it: the packet is left as requested */
+    pkt.count_us += 1000;
+    err = jit_enqueue(&chain_queue[0], time_us, &pkt, JIT_PKT_TYPE_DOWNLINK_CLASS_A);
+    if (err != JIT_ERROR_COLLISION_PACKET) {
+        printf("ERROR: colliding downlink not rejected (%d)\n", err);
+        nb_error += 1;
+    }
+    err = jit_enqueue_other_chain(chain_queue, LGW_RF_CHAIN_NB, time_us, &pkt, JIT_PKT_TYPE_DOWNLINK_CLASS_A, chain_none);
+    if ((err == JIT_ERROR_OK) || (pkt.rf_chain != 0)) {
+        printf("ERROR: downlink moved to rf_chain %u without a chain able to send it\n", pkt.rf_chain);
+        nb_error += 1;
+    }
+
+    /* moved to the other chain: it is sent with that chain */
+    err = jit_enqueue_other_chain(chain_queue, LGW_RF_CHAIN_NB, time_us, &pkt, JIT_PKT_TYPE_DOWNLINK_CLASS_A, chain_any);
+    if ((err != JIT_ERROR_OK) || (pkt.rf_chain != 1)) {
+        printf("ERROR: downlink not moved to rf_chain 1 (%d, rf_chain %u)\n", err, pkt.rf_chain);
+        nb_error += 1;
+    }
+    memset(&pkt, 0, sizeof pkt);
+    time_us = START_TIME_US + 1000000 + 1000 - PEEK_ADVANCE_US;
+    if ((jit_peek(&chain_queue[1], time_us, &pkt_idx) != JIT_ERROR_OK) || (pkt_idx < 0)) {
+        printf("ERROR: moved downlink not found on rf_chain 1\n");
+        return nb_error + 1;
+    }
+    jit_dequeue(&chain_queue[1], pkt_idx, &pkt, &pkt_type);
+    if (pkt.rf_chain != 1) {
+        printf("ERROR: downlink moved to rf_chain 1 would be sent on rf_chain %u\n", pkt.rf_chain);
+        nb_error += 1;
+    }
+    printf("collision on rf_chain 0: downlink sent on rf_chain %u\n", pkt.rf_chain);
+
+    return nb_error;
+}
+
+/* describe command line options */
+static void usage(void) {
+    printf("Available options:\n");
+    printf(" -h print this help\n");
+    printf(" -l         also measure the former qsort based queue\n");
+    printf(" -w <uint>  simulate traffic over this number of counter roll-overs [0..100], default %d\n", DEFAULT_NB_WRAP);
+    printf(" -c <uint>  simulate this number of dense class C loads [0..1000], default %d\n", DEFAULT_NB_CLASS_C);
+}
+
+/* -------------------------------------------------------------------------- */
+/* --- MAIN FUNCTION -------------------------------------------------------- */
+
+int main_test_jitqueue(int argc, char **argv) {
+    int i, k, n, x;
+    unsigned int arg_u;
+    unsigned int nb_wrap = DEFAULT_NB_WRAP;
+    unsigned int nb_class_c = DEFAULT_NB_CLASS_C;
+    bool legacy = false;
+    struct lgw_pkt_tx_s pkt;
+    enum jit_pkt_type_e pkt_type;
+    enum jit_error_e err;
+    int pkt_idx;
+    int legacy_num;
+    uint32_t time_us, prev_count_us;
+    int64_t t_start;
+    int64_t t_enq, t_peek, t_deq;
+    unsigned int nb_error = 0;
+
+    optind = 0;
+
+    /* parse command line options */
+    while ((i = getopt(argc, argv, "hlw:c:")) != -1) {
+        switch (i) {
+            case 'h':
+                usage();
+                return -1;
+            case 'l':
+                legacy = true;
+                break;
+            case 'w':
+                x = sscanf(optarg, "%u", &arg_u);
+                if ((x != 1) || (arg_u > 100)) {
+                    printf("ERROR: argument parsing of -w argument. Use -h to print help\n");
+                    return EXIT_FAILURE;
+                } else {
+                    nb_wrap = arg_u;
+                }
+                break;
+            case 'c':
+                x = sscanf(optarg, "%u", &arg_u);
+                if ((x != 1) || (arg_u > 1000)) {
+                    printf("ERROR: argument parsing of -c argument. Use -h to print help\n");
+                    return EXIT_FAILURE;
+                } else {
+                    nb_class_c = arg_u;
+                }
+                break;
+            default:
+                printf("ERROR: argument parsing\n");
+                usage();
+                return EXIT_FAILURE;
+        }
+    }
+
+    printf("### JiT queue: %d nodes max ###\n", JIT_QUEUE_MAX);
+
+    jit_queue_init(&queue);
+
+    memset(&pkt, 0, sizeof pkt);
+    pkt.modulation = MOD_LORA;
+    pkt.datarate = DR_LORA_SF7;
+    pkt.bandwidth = BW_125KHZ;
+    pkt.coderate = CR_LORA_4_5;
+    pkt.preamble = 8;
+    pkt.size = 10;
+    pkt.tx_mode = TIMESTAMPED;
+
+    for (k = 0; k < (int)(sizeof bench_size / sizeof bench_size[0]); k++) {
+        n = bench_size[k];
+        if (n > JIT_QUEUE_MAX) {
+            printf("%4d packets: skipped, rebuild with -DJIT_QUEUE_MAX=%d -DJIT_GAP_LEAVES=%d to measure\n", n, n, 2 * n);
+            continue;
+        }
+        shuffle_slots(n);
+
+        /* enqueue in random order, the last packets are after the counter roll-over */
+        time_us = START_TIME_US;
+        t_start = esp_timer_get_time();
+        for (i = 0; i < n; i++) {
+            pkt.count_us = time_us + 1000000 + (slot_order[i] * PKT_SPACING_US);
+            err = jit_enqueue(&queue, time_us, &pkt, JIT_PKT_TYPE_DOWNLINK_CLASS_A);
+            if (err != JIT_ERROR_OK) {
+                printf("ERROR: enqueue of packet %d failed (%d)\n", i, err);
+                nb_error += 1;
+            }
+        }
+        t_enq = esp_timer_get_time() - t_start;
+
+        /* peek and dequeue in timestamp order, just before each TX time */
+        t_peek = t_deq = 0;
+        prev_count_us = time_us;
+        for (i = 0; i < n; i++) {
+            time_us = START_TIME_US + 1000000 + (i * PKT_SPACING_US) - PEEK_ADVANCE_US;
+            t_start = esp_timer_get_time();
+            err = jit_peek(&queue, time_us, &pkt_idx);
+            t_peek += esp_timer_get_time() - t_start;
+            if ((err != JIT_ERROR_OK) || (pkt_idx < 0)) {
+                printf("ERROR: no packet to peek at %u\n", time_us);
+                nb_error += 1;
+                break;
+            }
+            t_start = esp_timer_get_time();
+            jit_dequeue(&queue, pkt_idx, &pkt, &pkt_type);
+            t_deq += esp_timer_get_time() - t_start;
+            if ((pkt.count_us != (time_us + PEEK_ADVANCE_US)) || ((int32_t)(pkt.count_us - prev_count_us) <= 0)) {
+                printf("ERROR: packet %d dequeued out of order (%u after %u)\n", i, pkt.count_us, prev_count_us);
+                nb_error += 1;
+            }
+            prev_count_us = pkt.count_us;
+        }
+        printf("%4d packets: enqueue %.2f us, peek %.2f us, dequeue %.2f us\n", n, (double)t_enq / n, (double)t_peek / n, (double)t_deq / n);
+
+        if (legacy == false) {
+            continue;
+        }
+        legacy_num = 0;
+        time_us = START_TIME_US;
+        t_start = esp_timer_get_time();
+        for (i = 0; i < n; i++) {
+            pkt.count_us = time_us + 1000000 + (slot_order[i] * PKT_SPACING_US);
+            legacy_enqueue(&legacy_num, &pkt);
+        }
+        t_enq = esp_timer_get_time() - t_start;
+        t_peek = t_deq = 0;
+        for (i = 0; i < n; i++) {
+            time_us = START_TIME_US + 1000000 + (i * PKT_SPACING_US) - PEEK_ADVANCE_US;
+            t_start = esp_timer_get_time();
+            pkt_idx = legacy_peek(legacy_num, time_us);
+            t_peek += esp_timer_get_time() - t_start;
+            t_start = esp_timer_get_time();
+            legacy_dequeue(&legacy_num, pkt_idx, &pkt);
+            t_deq += esp_timer_get_time() - t_start;
+        }
+        printf("%4d packets: enqueue %.2f us, peek %.2f us, dequeue %.2f us (qsort)\n", n, (double)t_enq / n, (double)t_peek / n, (double)t_deq / n);
+    }
+
+    nb_error += check_other_chain();
+
+    if (nb_wrap > 0) {
+        nb_error += simulate_wraps(nb_wrap);
+    }
+
+    if (nb_class_c > 0) {
+        nb_error += benchmark_class_c(nb_class_c);
+    }
+
+    printf("%u errors\n", nb_error);
+
+    return (nb_error == 0) ? 0 : EXIT_FAILURE;
+}
+
+void register_test_jitqueue(void)
+{
+    const esp_console_cmd_t test_jit_cmd = {
+        .command = "test_jit",
+        .help = "Test JiT queue ordering, cost, roll-over handling and class C slot search",
+        .hint = NULL,
+        .func = &main_test_jitqueue,
+        .argtable = NULL,
+    };
+    ESP_ERROR_CHECK(esp_console_cmd_register(&test_jit_cmd));
+}
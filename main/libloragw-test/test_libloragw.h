@@ -5,6 +5,14 @@
 void register_test_loragw_toa(void);
 void register_test_loragw_hal_tx(void);
 void register_test_loragw_hal_rx(void);
+void register_test_rxpk_encoder(void);
+void register_test_base64(void);
+void register_test_txpk_decoder(void);
+void register_test_jitqueue(void);
+void register_test_loragw_clock(void);
+void register_test_duty_cycle(void);
+void register_test_loragw_reg_shadow(void);
+void register_test_loragw_sx1302_rx(void);
 
 
 #endif
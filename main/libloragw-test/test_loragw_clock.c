@@ -0,0 +1,178 @@
+/*
+ / _____)             _              | |
+( (____  _____ ____ _| |_ _____  ____| |__
+ \____ \| ___ |    (_   _) ___ |/ ___)  _ \
+ _____) ) ____| | | || |_| ____( (___| | | |
+(______/|_____)_|_|_| \__)_____)\____)_| |_|
+  (C)2019 Semtech
+
+Description:
+    Check the concentrator clock model against a simulated SX1302 counter
+    drifting from the host clock, across the counter roll-over and restart
+
+License: Revised BSD License, see LICENSE.TXT file include in the project
+*/
+
+
+/* -------------------------------------------------------------------------- */
+/* --- DEPENDANCIES --------------------------------------------------------- */
+
+/* fix an issue between POSIX and C99 */
+#if __STDC_VERSION__ >= 199901L
+    #define _XOPEN_SOURCE 600
+#else
+    #define _XOPEN_SOURCE 500
+#endif
+
+#include <stdint.h>     /* C99 types */
+#include <stdbool.h>    /* bool type */
+#include <stdio.h>      /* printf */
+#include <stdlib.h>     /* rand */
+#include <math.h>       /* fabs */
+#include <getopt.h>     /* getopt */
+
+#include "esp_system.h"
+#include "esp_console.h"
+
+#include "loragw_hal.h"
+#include "loragw_clock.h"
+
+/* -------------------------------------------------------------------------- */
+/* --- PRIVATE MACROS ------------------------------------------------------- */
+
+#define RAND_RANGE(min, max) (rand() % (max + 1 - min) + min)
+
+/* -------------------------------------------------------------------------- */
+/* --- PRIVATE CONSTANTS ---------------------------------------------------- */
+
+#define DEFAULT_DURATION_S  1200
+#define READ_JITTER_US      20          /* host time of a read is known within the SPI transfer time */
+#define STEP_MAX_US         50000       /* max host time between two estimates */
+#define RESTART_AT_S        600         /* the concentrator counter restarts, as with lgw_stop/lgw_start */
+
+static const double drift_ppm[] = { -40.0, 0.0, 25.0 };
+
+/* -------------------------------------------------------------------------- */
+/* --- PRIVATE FUNCTIONS DEFINITION ----------------------------------------- */
+
+/* simulated concentrator counter at a host time */
+static uint32_t sim_counter(uint32_t start_us, double drift, int64_t host_us) {
+    return start_us + (uint32_t)llround((double)host_us * (1.0 + (drift / 1E6)));
+}
+
+/* describe command line options */
+static void usage(void) {
+    printf("Available options:\n");
+    printf(" -h print this help\n");
+    printf(" -d <uint>  simulated duration in seconds [60..86400], default %d\n", DEFAULT_DURATION_S);
+}
+
+/* -------------------------------------------------------------------------- */
+/* --- MAIN FUNCTION -------------------------------------------------------- */
+
+int main_test_loragw_clock(int argc, char **argv) {
+    int i, k, x;
+    unsigned int arg_u;
+    unsigned int duration_s = DEFAULT_DURATION_S;
+    struct lgw_clock_stat_s stat;
+    int64_t host_us, next_read_us, end_us;
+    uint32_t start_us, count_us, true_us;
+    int32_t err_us;
+    uint32_t err_max_us;
+    bool restarted;
+    unsigned int nb_estimate, nb_read;
+    unsigned int nb_error = 0;
+
+    optind = 0;
+
+    /* parse command line options */
+    while ((i = getopt(argc, argv, "hd:")) != -1) {
+        switch (i) {
+            case 'h':
+                usage();
+                return -1;
+            case 'd':
+                x = sscanf(optarg, "%u", &arg_u);
+                if ((x != 1) || (arg_u < 60) || (arg_u > 86400)) {
+                    printf("ERROR: argument parsing of -d argument. Use -h to print help\n");
+                    return EXIT_FAILURE;
+                } else {
+                    duration_s = arg_u;
+                }
+                break;
+            default:
+                printf("ERROR: argument parsing\n");
+                usage();
+                return EXIT_FAILURE;
+        }
+    }
+
+    printf("### Clock model: %u s, resync after %d ms, error budget %d us ###\n", duration_s, LGW_CLOCK_RESYNC_MS, LGW_CLOCK_ERROR_MAX_US);
+
+    for (k = 0; k < (int)(sizeof drift_ppm / sizeof drift_ppm[0]); k++) {
+        lgw_clock_reset();
+
+        start_us = 0xFFFFFFFF - 5000000; /* roll-over in 5s */
+        restarted = false;
+        err_max_us = 0;
+        nb_estimate = nb_read = 0;
+        host_us = 1000000;
+        next_read_us = host_us;
+        end_us = host_us + (duration_s * 1000000LL);
+
+        while (host_us < end_us) {
+            /* the counter restarts, the HAL resets the model */
+            if ((restarted == false) && (host_us >= (RESTART_AT_S * 1000000LL))) {
+                start_us = 0 - sim_counter(0, drift_ppm[k], host_us);
+                lgw_clock_reset();
+                restarted = true;
+            }
+
+            /* counter read when the model gets stale or at a random time, as lgw_get_instcnt() does */
+            true_us = sim_counter(start_us, drift_ppm[k], host_us);
+            if ((lgw_clock_estimate(host_us, &count_us) == false) || (host_us >= next_read_us)) {
+                lgw_clock_sample(true_us, host_us + RAND_RANGE(-READ_JITTER_US, READ_JITTER_US));
+                nb_read += 1;
+                next_read_us = host_us + RAND_RANGE(100000, 5000000);
+            } else {
+                nb_estimate += 1;
+                err_us = TMST_DIFF(count_us, true_us);
+                if ((uint32_t)abs(err_us) > err_max_us) {
+                    err_max_us = abs(err_us);
+                }
+                if (abs(err_us) > LGW_CLOCK_ERROR_MAX_US) {
+                    if (nb_error < 5) {
+                        printf("ERROR: estimate %u is %d us away from the counter at %lld us\n", count_us, err_us, (long long)host_us);
+                    }
+                    nb_error += 1;
+                }
+            }
+
+            host_us += RAND_RANGE(1, STEP_MAX_US);
+        }
+
+        lgw_clock_get_stat(&stat, true);
+        printf("drift %+6.1f ppm: measured %+6.2f ppm, %u estimates (max error %lu us), %u counter reads (max error %lu us, %lu above budget)\n",
+                drift_ppm[k], stat.drift_ppm, nb_estimate, (unsigned long)err_max_us, nb_read, (unsigned long)stat.err_max_us, (unsigned long)stat.nb_over_budget);
+        if (fabs(stat.drift_ppm - drift_ppm[k]) > 1.0) {
+            printf("ERROR: drift not tracked\n");
+            nb_error += 1;
+        }
+    }
+
+    printf("%u errors\n", nb_error);
+
+    return (nb_error == 0) ? 0 : EXIT_FAILURE;
+}
+
+void register_test_loragw_clock(void)
+{
+    const esp_console_cmd_t test_clock_cmd = {
+        .command = "test_clock",
+        .help = "Test concentrator clock model",
+        .hint = NULL,
+        .func = &main_test_loragw_clock,
+        .argtable = NULL,
+    };
+    ESP_ERROR_CHECK(esp_console_cmd_register(&test_clock_cmd));
+}
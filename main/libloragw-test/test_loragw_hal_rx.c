@@ -32,6 +32,7 @@ License: Revised BSD License, see LICENSE.TXT file include in the project
 #include <getopt.h>
 
 #include "esp_console.h"
+#include "esp_timer.h"
 
 #include "loragw_hal.h"
 #include "loragw_reg.h"
@@ -78,6 +79,7 @@ static void usage(void) {
     printf(" -z <uint>     Size of the RX packet array to be passed to lgw_receive()\n");
     printf(" -m <uint>     Channel frequency plan mode [0:LoRaWAN-like, 1:Same frequency for all channels (-400000Hz on RF0)]\n");
     printf(" -j            Set radio in single input mode (SX1250 only)\n");
+    printf(" -y            Fetch packets with lgw_receive_desc() (zero-copy from the RX buffer)\n");
     printf( "~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~\n" );
     printf(" --fdd         Enable Full-Duplex mode (CN490 reference design)\n");
 }
@@ -103,6 +105,7 @@ int main_test_loragw_hal_rx(int argc, char **argv)
     bool single_input_mode = false;
     float rssi_offset = 0.0;
     bool full_duplex = false;
+    bool zero_copy = false;
 
     struct lgw_conf_board_s boardconf;
     struct lgw_conf_rxrf_s rfconf;
@@ -111,6 +114,12 @@ int main_test_loragw_hal_rx(int argc, char **argv)
     unsigned long nb_pkt_crc_ok = 0, nb_loop = 0, cnt_loop;
     int nb_pkt;
 
+    /* fetch cost measurement */
+    struct lgw_pkt_rx_s rxslot; /* stands for the packet forwarder uplink ring slot */
+    unsigned long nb_pkt_fetched;
+    uint32_t nb_bytes_copied;
+    int64_t t_start, t_fetch_us;
+
     uint8_t channel_mode = 0; /* LoRaWAN-like */
 
     const int32_t channel_if_mode0[9] = {
@@ -151,7 +160,7 @@ int main_test_loragw_hal_rx(int argc, char **argv)
     optind = 0;
 
     /* parse command line options */
-    while ((i = getopt_long(argc, argv, "hja:b:k:r:n:z:m:o:d:u", long_options, &option_index)) != -1) {
+    while ((i = getopt_long(argc, argv, "hjya:b:k:r:n:z:m:o:d:u", long_options, &option_index)) != -1) {
         switch (i) {
             case 'h':
                 usage();
@@ -196,6 +205,9 @@ int main_test_loragw_hal_rx(int argc, char **argv)
             case 'j': /* Set radio in single input mode */
                 single_input_mode = true;
                 break;
+            case 'y': /* Fetch packets as descriptors */
+                zero_copy = true;
+                break;
             case 'a': /* <float> Radio A RX frequency in MHz */
                 i = sscanf(optarg, "%lf", &arg_d);
                 if (i != 1) {
@@ -339,7 +351,9 @@ int main_test_loragw_hal_rx(int argc, char **argv)
 
     /* set the buffer size to hold received packets */
     struct lgw_pkt_rx_s rxpkt[max_rx_pkt];
+    struct lgw_pkt_rx_desc_s rxdesc[max_rx_pkt];
     printf("INFO: rxpkt buffer size is set to %u\n", max_rx_pkt);
+    printf("INFO: Fetch packets with %s\n", (zero_copy == true) ? "lgw_receive_desc()" : "lgw_receive()");
     printf("INFO: Select channel mode %u\n", channel_mode);
 
     /* Loop until user quits */
@@ -365,9 +379,29 @@ int main_test_loragw_hal_rx(int argc, char **argv)
         /* Loop until we have enough packets with CRC OK */
         printf("Waiting for packets...\n");
         nb_pkt_crc_ok = 0;
+        nb_pkt_fetched = 0;
+        nb_bytes_copied = 0;
+        t_fetch_us = 0;
         while (((nb_pkt_crc_ok < nb_loop) || nb_loop == 0) && (quit_sig != 1) && (exit_sig != 1)) {
-            /* fetch N packets */
-            nb_pkt = lgw_receive(ARRAY_SIZE(rxpkt), rxpkt);
+            /* fetch N packets, and copy them as the packet forwarder does in its uplink ring */
+            t_start = esp_timer_get_time();
+            if (zero_copy == true) {
+                nb_pkt = lgw_receive_desc(ARRAY_SIZE(rxdesc), rxdesc);
+                for (i = 0; i < nb_pkt; i++) {
+                    lgw_pkt_rx_from_desc(&rxpkt[i], &rxdesc[i]);
+                    nb_bytes_copied += rxdesc[i].size;
+                }
+            } else {
+                nb_pkt = lgw_receive(ARRAY_SIZE(rxpkt), rxpkt);
+                for (i = 0; i < nb_pkt; i++) {
+                    memcpy(&rxslot, &rxpkt[i], sizeof rxslot);
+                    nb_bytes_copied += rxpkt[i].size + sizeof rxslot;
+                }
+            }
+            if (nb_pkt > 0) {
+                t_fetch_us += esp_timer_get_time() - t_start;
+                nb_pkt_fetched += nb_pkt;
+            }
 
             if (nb_pkt == 0) {
                 wait_ms(10);
@@ -399,6 +433,9 @@ int main_test_loragw_hal_rx(int argc, char **argv)
         }
 
         printf( "\nNb valid packets received: %lu CRC OK (%lu)\n", nb_pkt_crc_ok, cnt_loop );
+        if (nb_pkt_fetched > 0) {
+            printf("Fetch cost: %.1f us/pkt, %.1f bytes copied/pkt\n", (double)t_fetch_us / nb_pkt_fetched, (double)nb_bytes_copied / nb_pkt_fetched);
+        }
 
         /* Stop the gateway */
         x = lgw_stop();
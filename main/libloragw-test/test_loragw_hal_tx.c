@@ -32,6 +32,7 @@ License: Revised BSD License, see LICENSE.TXT file include in the project
 #include <getopt.h>     /* getopt_long */
 
 #include "esp_console.h"
+#include "esp_timer.h"
 
 #include "loragw_hal.h"
 #include "loragw_reg.h"
@@ -141,6 +142,10 @@ int main_test_loragw_hal_tx(int argc, char **argv)
     uint32_t count_us;
     uint32_t trig_delay_us = 1000000;
     bool trig_delay = false;
+    int64_t time_us;
+    int64_t send_us_sum = 0;
+    int64_t send_us_max = 0;
+    struct lgw_com_bulk_stat_s bulk_stat;
 
     /* SPI interfaces */
     const char com_path_default[] = COM_PATH_DEFAULT;
@@ -467,11 +472,16 @@ int main_test_loragw_hal_tx(int argc, char **argv)
         }
 
         /* connect, configure and start the LoRa concentrator */
+        time_us = esp_timer_get_time();
         x = lgw_start();
         if (x != 0) {
             printf("ERROR: failed to start the gateway\n");
             return EXIT_FAILURE;
         }
+        printf("lgw_start: %lld ms\n", (esp_timer_get_time() - time_us) / 1000);
+        if (lgw_com_get_bulk_stat(&bulk_stat, true) == LGW_COM_SUCCESS) {
+            printf("lgw_start: %lu register writes in %lu SPI transactions\n", (unsigned long)bulk_stat.nb_write, (unsigned long)bulk_stat.nb_trans);
+        }
 
         /* Send packets */
         memset(&pkt, 0, sizeof pkt);
@@ -553,11 +563,17 @@ int main_test_loragw_hal_tx(int argc, char **argv)
 
             pkt.payload[6] = (uint8_t)(i >> 0); /* FCnt */
             pkt.payload[7] = (uint8_t)(i >> 8); /* FCnt */
+            time_us = esp_timer_get_time();
             x = lgw_send(&pkt);
+            time_us = esp_timer_get_time() - time_us;
             if (x != 0) {
                 printf("ERROR: failed to send packet\n");
                 break;
             }
+            send_us_sum += time_us;
+            if (time_us > send_us_max) {
+                send_us_max = time_us;
+            }
             /* wait for packet to finish sending */
             do {
                 wait_ms(30);
@@ -571,6 +587,11 @@ int main_test_loragw_hal_tx(int argc, char **argv)
         }
 
         printf( "\nNb packets sent: %u (%u)\n", i, cnt_loop + 1 );
+        if (i > 0) {
+            printf("lgw_send: avg %lld us, max %lld us\n", send_us_sum / i, send_us_max);
+        }
+        send_us_sum = 0;
+        send_us_max = 0;
 
         /* Stop the gateway */
         x = lgw_stop();
@@ -0,0 +1,706 @@
+/*
+ / _____)             _              | |
+( (____  _____ ____ _| |_ _____  ____| |__
+ \____ \| ___ |    (_   _) ___ |/ ___)  _ \
+ _____) ) ____| | | || |_| ____( (___| | | |
+(______/|_____)_|_|_| \__)_____)\____)_| |_|
+  (C)2019 Semtech
+
+Description:
+    Check the register shadow against the concentrator: random register writes
+    are mirrored in a simulated register file, register reads and the shadow
+    must match it, read-modify-writes of known bytes must not read the chip.
+    With -s the concentrator is simulated: lgw_com_* are wrapped at link time
+    (-Wl,--wrap) and served from a register map built from the register table,
+    status bits change on each read, pulse bits clear after a write, bits not
+    covered by a field come up random, COM errors can be injected.
+
+License: Revised BSD License, see LICENSE.TXT file include in the project
+*/
+
+
+/* -------------------------------------------------------------------------- */
+/* --- DEPENDANCIES --------------------------------------------------------- */
+
+/* fix an issue between POSIX and C99 */
+#if __STDC_VERSION__ >= 199901L
+    #define _XOPEN_SOURCE 600
+#else
+    #define _XOPEN_SOURCE 500
+#endif
+
+#include <stdint.h>     /* C99 types */
+#include <stdbool.h>    /* bool type */
+#include <stdio.h>      /* printf */
+#include <stdlib.h>     /* rand */
+#include <string.h>     /* memset */
+#include <getopt.h>     /* getopt */
+
+#include "esp_system.h"
+#include "esp_console.h"
+
+#include "loragw_reg.h"
+#include "loragw_com.h"
+#include "loragw_gpio.h"
+
+/* -------------------------------------------------------------------------- */
+/* --- PRIVATE MACROS ------------------------------------------------------- */
+
+#define RAND_RANGE(min, max) (rand() % (max + 1 - min) + min)
+
+/* -------------------------------------------------------------------------- */
+/* --- PRIVATE CONSTANTS ---------------------------------------------------- */
+
+#define COM_PATH_DEFAULT    "/dev/spidev0.0"
+#define DEFAULT_NB_WRITE    20000
+#define READ_EVERY          8       /* one register read every few writes, on average */
+#define DEFAULT_NB_BURST    500
+#define BURST_SIZE_MAX      8
+#define NB_COM_ERROR        200     /* COM errors injected, simulation only */
+
+/* register map, simulated from TX_TOP_A to OTP */
+#define SIM_ADDR_START      0x5200
+#define SIM_ADDR_END        0x6200
+#define SIM_SIZE            (SIM_ADDR_END - SIM_ADDR_START)
+
+/* bytes the shadow should hold: TX_TOP_A to CAPTURE_RAM, but the MBIST, RADIO_FE and AGC_MCU blocks */
+#define SHADOWED_START      0x5200
+#define SHADOWED_END        0x6000
+#define UNSHADOWED_START    0x56C0
+#define UNSHADOWED_END      0x57C0
+
+extern const struct lgw_reg_s loregs[LGW_TOTALREGS+1];
+
+/* -------------------------------------------------------------------------- */
+/* --- PRIVATE VARIABLES ---------------------------------------------------- */
+
+static int32_t sim_regs[LGW_TOTALREGS]; /* simulated register file, unsigned field values */
+
+/* simulated concentrator */
+static bool sim = false;
+static bool sim_open = false;
+static uint8_t sim_mem[SIM_SIZE];       /* register bytes */
+static uint8_t sim_cover[SIM_SIZE];     /* bits covered by a field */
+static uint8_t sim_rdon[SIM_SIZE];      /* status bits, change on each read */
+static uint8_t sim_pulse[SIM_SIZE];     /* pulse bits, cleared once written */
+static int16_t sim_first[SIM_SIZE];     /* first register of the byte, -1 if none */
+static int sim_cur_reg = -1;            /* register being written by the test, -1 for bursts */
+static int sim_fail = 0;                /* next COM writes failing, after being applied */
+static unsigned int sim_nb_error = 0;   /* unexpected COM accesses */
+
+/* -------------------------------------------------------------------------- */
+/* --- PRIVATE FUNCTIONS DEFINITION ----------------------------------------- */
+
+/* build the simulated register map from the register table, as after a reset */
+static void sim_reset(void) {
+    int i, a;
+    uint8_t mask;
+
+    memset(sim_cover, 0, sizeof sim_cover);
+    memset(sim_rdon, 0, sizeof sim_rdon);
+    memset(sim_pulse, 0, sizeof sim_pulse);
+    for (a = 0; a < SIM_SIZE; a++) {
+        sim_first[a] = -1;
+        sim_mem[a] = rand() & 0xFF;
+    }
+    for (i = 0; i < LGW_TOTALREGS; i++) {
+        a = loregs[i].addr - SIM_ADDR_START;
+        mask = ((1 << loregs[i].leng) - 1) << loregs[i].offs;
+        if (sim_first[a] < 0) {
+            sim_first[a] = i;
+        }
+        sim_cover[a] |= mask;
+        if (loregs[i].rdon == 1) {
+            sim_rdon[a] |= mask;
+        } else if (loregs[i].chck == 0) {
+            sim_pulse[a] |= mask;
+        }
+        sim_mem[a] = (sim_mem[a] & ~mask) | (((uint8_t)loregs[i].dflt << loregs[i].offs) & mask);
+    }
+    for (a = 0; a < SIM_SIZE; a++) {
+        sim_mem[a] &= ~sim_pulse[a];
+    }
+
+    /* what lgw_reset() tells the HAL */
+    lgw_reg_shadow_reset(true);
+}
+
+static bool sim_addr_ok(uint8_t spi_mux_target, uint16_t address, uint16_t size) {
+    if ((sim_open == false) || (spi_mux_target != LGW_SPI_MUX_TARGET_SX1302) || (address < SIM_ADDR_START) || ((address + size) > SIM_ADDR_END)) {
+        printf("ERROR: unexpected COM access at 0x%04X (%u bytes)\n", address, size);
+        sim_nb_error += 1;
+        return false;
+    }
+    return true;
+}
+
+static uint8_t sim_read(uint16_t address) {
+    int a = address - SIM_ADDR_START;
+
+    sim_mem[a] = (sim_mem[a] & ~sim_rdon[a]) | (rand() & sim_rdon[a]);
+    return sim_mem[a];
+}
+
+static void sim_write(uint16_t address, uint8_t data) {
+    int a = address - SIM_ADDR_START;
+
+    /* a read-modify-write must not write back another byte or a pulse it read earlier */
+    if ((sim_cur_reg >= 0) && (address != loregs[sim_cur_reg].addr)) {
+        printf("ERROR: write to register %d went to 0x%04X\n", sim_cur_reg, address);
+        sim_nb_error += 1;
+    }
+    if ((data & sim_pulse[a]) != 0) {
+        printf("ERROR: spurious pulse 0x%02X written at 0x%04X\n", data & sim_pulse[a], address);
+        sim_nb_error += 1;
+    }
+    sim_mem[a] = ((sim_mem[a] & sim_rdon[a]) | (data & ~sim_rdon[a])) & ~sim_pulse[a];
+}
+
+/* the write was applied, but the transfer reports an error */
+static int sim_status(void) {
+    if (sim_fail > 0) {
+        sim_fail -= 1;
+        return LGW_COM_ERROR;
+    }
+    return LGW_COM_SUCCESS;
+}
+
+int __real_lgw_com_open(lgw_com_type_t com_type, const char *com_path);
+int __real_lgw_com_close(void);
+int __real_lgw_com_w(uint8_t spi_mux_target, uint16_t address, uint8_t data);
+int __real_lgw_com_r(uint8_t spi_mux_target, uint16_t address, uint8_t *data);
+int __real_lgw_com_rmw(uint8_t spi_mux_target, uint16_t address, uint8_t offs, uint8_t leng, uint8_t data);
+int __real_lgw_com_wb(uint8_t spi_mux_target, uint16_t address, const uint8_t *data, uint16_t size);
+int __real_lgw_com_rb(uint8_t spi_mux_target, uint16_t address, uint8_t *data, uint16_t size);
+uint16_t __real_lgw_com_chunk_size(void);
+
+int __wrap_lgw_com_open(lgw_com_type_t com_type, const char *com_path) {
+    if (sim == false) {
+        return __real_lgw_com_open(com_type, com_path);
+    }
+    sim_open = true;
+    return LGW_COM_SUCCESS;
+}
+
+int __wrap_lgw_com_close(void) {
+    if (sim == false) {
+        return __real_lgw_com_close();
+    }
+    sim_open = false;
+    return LGW_COM_SUCCESS;
+}
+
+int __wrap_lgw_com_w(uint8_t spi_mux_target, uint16_t address, uint8_t data) {
+    if (sim == false) {
+        return __real_lgw_com_w(spi_mux_target, address, data);
+    }
+    if (sim_addr_ok(spi_mux_target, address, 1) == false) {
+        return LGW_COM_ERROR;
+    }
+    sim_write(address, data);
+    return sim_status();
+}
+
+int __wrap_lgw_com_r(uint8_t spi_mux_target, uint16_t address, uint8_t *data) {
+    if (sim == false) {
+        return __real_lgw_com_r(spi_mux_target, address, data);
+    }
+    if (sim_addr_ok(spi_mux_target, address, 1) == false) {
+        return LGW_COM_ERROR;
+    }
+    *data = sim_read(address);
+    return LGW_COM_SUCCESS;
+}
+
+int __wrap_lgw_com_rmw(uint8_t spi_mux_target, uint16_t address, uint8_t offs, uint8_t leng, uint8_t data) {
+    uint8_t mask = ((1 << leng) - 1) << offs;
+
+    if (sim == false) {
+        return __real_lgw_com_rmw(spi_mux_target, address, offs, leng, data);
+    }
+    if (sim_addr_ok(spi_mux_target, address, 1) == false) {
+        return LGW_COM_ERROR;
+    }
+    sim_write(address, (sim_read(address) & ~mask) | ((data << offs) & mask));
+    return sim_status();
+}
+
+int __wrap_lgw_com_wb(uint8_t spi_mux_target, uint16_t address, const uint8_t *data, uint16_t size) {
+    uint16_t k;
+
+    if (sim == false) {
+        return __real_lgw_com_wb(spi_mux_target, address, data, size);
+    }
+    if (sim_addr_ok(spi_mux_target, address, size) == false) {
+        return LGW_COM_ERROR;
+    }
+    for (k = 0; k < size; k++) {
+        sim_write(address + k, data[k]);
+    }
+    return sim_status();
+}
+
+int __wrap_lgw_com_rb(uint8_t spi_mux_target, uint16_t address, uint8_t *data, uint16_t size) {
+    uint16_t k;
+
+    if (sim == false) {
+        return __real_lgw_com_rb(spi_mux_target, address, data, size);
+    }
+    if (sim_addr_ok(spi_mux_target, address, size) == false) {
+        return LGW_COM_ERROR;
+    }
+    for (k = 0; k < size; k++) {
+        data[k] = sim_read(address + k);
+    }
+    return LGW_COM_SUCCESS;
+}
+
+/* small chunks, for lgw_mem_wb() bursts to be split */
+uint16_t __wrap_lgw_com_chunk_size(void) {
+    if (sim == false) {
+        return __real_lgw_com_chunk_size();
+    }
+    return 3;
+}
+
+/* registers which read back what was written, all test fails if CLK32_RIF_CTRL is set */
+static bool reg_testable(int i) {
+    return (loregs[i].rdon == 0) && (loregs[i].chck == 1) && (i != SX1302_REG_COMMON_CTRL0_CLK32_RIF_CTRL);
+}
+
+static int32_t reg_mask(int i) {
+    return (1 << loregs[i].leng) - 1;
+}
+
+/* fields of the byte holding register i: loregs[first..last-1] */
+static void byte_fields(int i, int *first, int *last) {
+    int k;
+
+    for (k = i; (k > 0) && (loregs[k - 1].addr == loregs[i].addr); k--);
+    *first = k;
+    for (k = i; (k < LGW_TOTALREGS) && (loregs[k].addr == loregs[i].addr); k++);
+    *last = k;
+}
+
+/* bits of the byte holding register i covered by a field */
+static uint8_t byte_cover(int i) {
+    int k, first, last;
+    uint8_t mask = 0;
+
+    byte_fields(i, &first, &last);
+    for (k = first; k < last; k++) {
+        mask |= reg_mask(k) << loregs[k].offs;
+    }
+    return mask;
+}
+
+/* the shadow holds the byte of register i: host written fields only, no side effect */
+static bool byte_shadowed(int i) {
+    int k, first, last;
+    uint16_t addr = loregs[i].addr;
+
+    if ((addr < SHADOWED_START) || (addr >= SHADOWED_END) || ((addr >= UNSHADOWED_START) && (addr < UNSHADOWED_END))) {
+        return false;
+    }
+    if (lgw_reg_side_effect(addr) == true) {
+        return false;
+    }
+    byte_fields(i, &first, &last);
+    for (k = first; k < last; k++) {
+        if ((loregs[k].rdon == 1) || (loregs[k].chck == 0)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+/* compare a register with the simulated register file */
+static unsigned int check_reg(int i) {
+    int32_t val;
+
+    if (lgw_reg_r(i, &val) != LGW_REG_SUCCESS) {
+        printf("ERROR: failed to read register %d\n", i);
+        return 1;
+    }
+    if ((val & reg_mask(i)) != sim_regs[i]) {
+        printf("ERROR: register %d is %d, should be %d\n", i, val & reg_mask(i), sim_regs[i]);
+        return 1;
+    }
+    return 0;
+}
+
+/* random writes mirrored in the simulated register file */
+static unsigned int random_writes(unsigned int nb_write) {
+    unsigned int n;
+    unsigned int nb_error = 0;
+    int i;
+    int32_t val;
+
+    for (n = 0; n < nb_write; n++) {
+        do {
+            i = RAND_RANGE(0, LGW_TOTALREGS - 1);
+        } while (reg_testable(i) == false);
+        val = rand() & reg_mask(i);
+        sim_cur_reg = i;
+        if (lgw_reg_w(i, val) != LGW_REG_SUCCESS) {
+            printf("ERROR: failed to write register %d\n", i);
+            sim_cur_reg = -1;
+            return nb_error + 1;
+        }
+        sim_cur_reg = -1;
+        sim_regs[i] = val;
+
+        if (RAND_RANGE(1, READ_EVERY) == 1) {
+            do {
+                i = RAND_RANGE(0, LGW_TOTALREGS - 1);
+            } while (reg_testable(i) == false);
+            nb_error += check_reg(i);
+        }
+    }
+
+    return nb_error;
+}
+
+/* burst write of random values in the testable fields of a few shadowed bytes, starting at register i */
+static int burst_write(int i, bool by_address) {
+    uint8_t data[BURST_SIZE_MAX];
+    uint16_t size, k;
+    int j, first, last;
+    uint8_t mask;
+    int x;
+
+    /* consecutive shadowed bytes holding fields */
+    byte_fields(i, &first, &last);
+    for (size = 1; size < BURST_SIZE_MAX; size++) {
+        if ((last >= LGW_TOTALREGS) || (loregs[last].addr != loregs[i].addr + size) || (byte_shadowed(last) == false)) {
+            break;
+        }
+        byte_fields(last, &first, &last);
+    }
+    size = RAND_RANGE(1, size);
+
+    /* keep the bits of the fields that are not tested, and of no field */
+    if (lgw_reg_rb(i, data, size) != LGW_REG_SUCCESS) {
+        printf("ERROR: failed to burst read at 0x%04X\n", loregs[i].addr);
+        return LGW_REG_ERROR;
+    }
+    for (k = 0, j = i; k < size; k++) {
+        byte_fields(j, &first, &last);
+        for (j = first; j < last; j++) {
+            if (reg_testable(j) == true) {
+                mask = reg_mask(j) << loregs[j].offs;
+                data[k] = (data[k] & ~mask) | (((rand() & reg_mask(j)) << loregs[j].offs) & mask);
+            }
+        }
+    }
+
+    if (by_address == true) {
+        x = lgw_mem_wb(loregs[i].addr, data, size);
+    } else {
+        x = lgw_reg_wb(i, data, size);
+    }
+
+    /* the simulated concentrator applies failed writes too, lgw_mem_wb() stops at the failed chunk */
+    if ((x != LGW_REG_SUCCESS) && (by_address == true) && (size > lgw_com_chunk_size())) {
+        size = lgw_com_chunk_size();
+    }
+    for (k = 0, j = i; k < size; k++) {
+        byte_fields(j, &first, &last);
+        for (j = first; j < last; j++) {
+            if (reg_testable(j) == true) {
+                sim_regs[j] = (data[k] >> loregs[j].offs) & reg_mask(j);
+            }
+        }
+    }
+
+    return x;
+}
+
+/* random burst writes, by register and by address, the shadow must follow them */
+static unsigned int random_bursts(unsigned int nb_burst) {
+    unsigned int n;
+    unsigned int nb_error = 0;
+    int i;
+    int32_t val;
+    uint16_t nb_hit, nb_miss, miss;
+
+    for (n = 0; n < nb_burst; n++) {
+        do {
+            i = RAND_RANGE(0, LGW_TOTALREGS - 1);
+        } while ((reg_testable(i) == false) || (byte_shadowed(i) == false));
+        if (burst_write(i, (n & 1) == 1) != LGW_REG_SUCCESS) {
+            printf("ERROR: failed to burst write at 0x%04X\n", loregs[i].addr);
+            return nb_error + 1;
+        }
+
+        /* the byte is known, its read-modify-writes do not read the chip */
+        lgw_reg_shadow_get_reg_stat(i, &nb_hit, &nb_miss);
+        val = rand() & reg_mask(i);
+        sim_cur_reg = i;
+        if (lgw_reg_w(i, val) != LGW_REG_SUCCESS) {
+            printf("ERROR: failed to write register %d\n", i);
+            sim_cur_reg = -1;
+            return nb_error + 1;
+        }
+        sim_cur_reg = -1;
+        sim_regs[i] = val;
+        miss = nb_miss;
+        lgw_reg_shadow_get_reg_stat(i, &nb_hit, &nb_miss);
+#if LGW_REG_SHADOW == 1
+        if (nb_miss != miss) {
+            printf("ERROR: register byte 0x%04X read after a burst write\n", loregs[i].addr);
+            nb_error += 1;
+        }
+#endif
+    }
+
+    return nb_error;
+}
+
+/* failed writes leave the byte unknown, it is read again by the next read-modify-write */
+static unsigned int com_errors(unsigned int nb_com_error) {
+    unsigned int n;
+    unsigned int nb_error = 0;
+    int i, j, first, last;
+    int32_t val;
+
+    for (n = 0; n < nb_com_error; n++) {
+        /* a field sharing a shadowed byte with another testable one */
+        do {
+            i = RAND_RANGE(0, LGW_TOTALREGS - 1);
+            byte_fields(i, &first, &last);
+            j = RAND_RANGE(first, last - 1);
+        } while ((reg_testable(i) == false) || (reg_testable(j) == false) || (i == j) || (byte_shadowed(i) == false));
+        nb_error += check_reg(i);
+
+        sim_fail = 1;
+        if ((n % 3) == 0) {
+            val = rand() & reg_mask(i);
+            sim_cur_reg = i;
+            if (lgw_reg_w(i, val) == LGW_REG_SUCCESS) {
+                printf("ERROR: write of register %d did not fail\n", i);
+                nb_error += 1;
+            }
+            sim_cur_reg = -1;
+            sim_regs[i] = val;
+        } else if (burst_write(i, (n % 3) == 2) == LGW_REG_SUCCESS) {
+            printf("ERROR: burst write at 0x%04X did not fail\n", loregs[i].addr);
+            nb_error += 1;
+        }
+        sim_fail = 0;
+
+        /* a stale shadow would write the old value of the failed field back */
+        val = rand() & reg_mask(j);
+        sim_cur_reg = j;
+        if (lgw_reg_w(j, val) != LGW_REG_SUCCESS) {
+            printf("ERROR: failed to write register %d\n", j);
+            nb_error += 1;
+        }
+        sim_cur_reg = -1;
+        sim_regs[j] = val;
+        nb_error += check_reg(i);
+        nb_error += check_reg(j);
+    }
+
+    return nb_error;
+}
+
+/* the shadow against the concentrator */
+static unsigned int check_shadow(void) {
+    uint16_t nb_mismatch;
+
+    if (lgw_reg_shadow_check(&nb_mismatch) != LGW_REG_SUCCESS) {
+        printf("ERROR: failed to check the register shadow\n");
+        return 1;
+    }
+    if (nb_mismatch != 0) {
+        printf("ERROR: %u register shadow bytes differ from the concentrator\n", nb_mismatch);
+        return 1;
+    }
+    return 0;
+}
+
+/* all registers and the shadow against the simulated register file and the concentrator */
+static unsigned int check_all(void) {
+    int i;
+    unsigned int nb_error = 0;
+
+    nb_error += check_shadow();
+    for (i = 0; i < LGW_TOTALREGS; i++) {
+        if (reg_testable(i) == true) {
+            nb_error += check_reg(i);
+        }
+    }
+
+    return nb_error;
+}
+
+/* a known byte is never read again: at most one miss per register byte, none if its default value is known,
+   and the bytes the shadow cannot hold are never served from it */
+static unsigned int check_stat(const char *step, bool from_defaults) {
+    struct lgw_reg_shadow_stat_s stat;
+    uint16_t nb_hit, nb_miss;
+    uint16_t top_hit = 0;
+    unsigned int byte_miss = 0;
+    unsigned int miss_max = 1;
+    bool shadowed = false;
+    unsigned int nb_error = 0;
+    int i, top = 0;
+
+    for (i = 0; i < LGW_TOTALREGS; i++) {
+        if ((i == 0) || (loregs[i].addr != loregs[i - 1].addr)) {
+            byte_miss = 0;
+            shadowed = byte_shadowed(i);
+            miss_max = ((from_defaults == true) && (byte_cover(i) == 0xFF)) ? 0 : 1;
+        }
+        lgw_reg_shadow_get_reg_stat(i, &nb_hit, &nb_miss);
+        if ((shadowed == false) && ((nb_hit != 0) || (nb_miss != 0))) {
+            printf("ERROR: register %d at 0x%04X served from the shadow\n", i, loregs[i].addr);
+            nb_error += 1;
+        }
+        byte_miss += nb_miss;
+        if ((byte_miss > miss_max) && ((byte_miss - nb_miss) <= miss_max)) {
+            printf("ERROR: register byte 0x%04X read %u times by read-modify-writes%s\n", loregs[i].addr, byte_miss,
+                    (miss_max == 0) ? ", its default value is known" : "");
+            nb_error += 1;
+        }
+        if (nb_hit > top_hit) {
+            top_hit = nb_hit;
+            top = i;
+        }
+    }
+    lgw_reg_shadow_get_stat(&stat, true);
+    printf("%s: %lu read-modify-writes from the shadow, %lu read the concentrator, %lu not shadowed (most hits: register %d, %u)\n", step,
+            (unsigned long)stat.nb_hit, (unsigned long)stat.nb_miss, (unsigned long)stat.nb_bypass, top, top_hit);
+
+    return nb_error;
+}
+
+/* describe command line options */
+static void usage(void) {
+    printf("Available options:\n");
+    printf(" -h print this help\n");
+    printf(" -n <uint>  number of random register writes per step [100..1000000], default %d\n", DEFAULT_NB_WRITE);
+    printf(" -s         simulate the concentrator, COM errors are injected\n");
+}
+
+/* the concentrator registers hold their default values after a reset */
+static void reset(void) {
+    if (sim == true) {
+        sim_reset();
+    } else {
+        lgw_reset();
+    }
+}
+
+/* -------------------------------------------------------------------------- */
+/* --- MAIN FUNCTION -------------------------------------------------------- */
+
+int main_test_loragw_reg_shadow(int argc, char **argv) {
+    int i, x;
+    unsigned int arg_u;
+    unsigned int nb_write = DEFAULT_NB_WRITE;
+    unsigned int nb_error = 0;
+    struct lgw_reg_shadow_stat_s stat;
+
+    optind = 0;
+    sim = false;
+
+    /* parse command line options */
+    while ((i = getopt(argc, argv, "hn:s")) != -1) {
+        switch (i) {
+            case 'h':
+                usage();
+                return -1;
+            case 'n':
+                x = sscanf(optarg, "%u", &arg_u);
+                if ((x != 1) || (arg_u < 100) || (arg_u > 1000000)) {
+                    printf("ERROR: argument parsing of -n argument. Use -h to print help\n");
+                    return EXIT_FAILURE;
+                } else {
+                    nb_write = arg_u;
+                }
+                break;
+            case 's':
+                sim = true;
+                break;
+            default:
+                printf("ERROR: argument parsing\n");
+                usage();
+                return EXIT_FAILURE;
+        }
+    }
+
+#if LGW_REG_SHADOW == 0
+    printf("WARNING: register shadow disabled at build time, only checking the register file\n");
+#endif
+
+    /* the concentrator registers hold their default values after a reset */
+    reset();
+    if (lgw_connect(LGW_COM_SPI, COM_PATH_DEFAULT) != LGW_REG_SUCCESS) {
+        printf("ERROR: failed to connect\n");
+        return EXIT_FAILURE;
+    }
+    for (i = 0; i < LGW_TOTALREGS; i++) {
+        sim_regs[i] = loregs[i].dflt & reg_mask(i);
+    }
+    lgw_reg_shadow_get_stat(&stat, true);
+    sim_nb_error = 0;
+
+    printf("### Register shadow: %u random writes per step%s ###\n", nb_write, (sim == true) ? ", simulated concentrator" : "");
+
+    /* shadow loaded with the defaults at connection, but the bytes having bits out of any field */
+    nb_error += check_shadow();
+    nb_error += random_writes(nb_write);
+    nb_error += check_all();
+    nb_error += check_stat("after reset", true);
+
+    /* shadow forgotten, known bytes are read once from the concentrator */
+    lgw_reg_shadow_reset(false);
+    nb_error += random_writes(nb_write);
+    nb_error += check_all();
+    nb_error += check_stat("after forget", false);
+
+    /* bytes written by bursts are known */
+    lgw_reg_shadow_reset(false);
+    nb_error += random_bursts(DEFAULT_NB_BURST);
+    nb_error += check_shadow();
+    nb_error += random_writes(nb_write);
+    nb_error += check_all();
+    nb_error += check_stat("after bursts", false);
+
+    /* each failed write costs one read of its byte */
+    if (sim == true) {
+        nb_error += com_errors(NB_COM_ERROR);
+        nb_error += check_all();
+        lgw_reg_shadow_get_stat(&stat, true);
+        printf("after COM errors: %lu read-modify-writes read the concentrator\n", (unsigned long)stat.nb_miss);
+#if LGW_REG_SHADOW == 1
+        if (stat.nb_miss != NB_COM_ERROR) {
+            printf("ERROR: %d COM errors, the shadow should have been missed as many times\n", NB_COM_ERROR);
+            nb_error += 1;
+        }
+#endif
+        nb_error += sim_nb_error;
+    }
+
+    lgw_disconnect();
+    reset();
+    sim = false;
+
+    printf("%u errors\n", nb_error);
+
+    return (nb_error == 0) ? 0 : EXIT_FAILURE;
+}
+
+void register_test_loragw_reg_shadow(void)
+{
+    const esp_console_cmd_t test_reg_shadow_cmd = {
+        .command = "test_reg_shadow",
+        .help = "Test register shadow against the concentrator",
+        .hint = NULL,
+        .func = &main_test_loragw_reg_shadow,
+        .argtable = NULL,
+    };
+    ESP_ERROR_CHECK(esp_console_cmd_register(&test_reg_shadow_cmd));
+}
@@ -0,0 +1,447 @@
+/*
+ / _____)             _              | |
+( (____  _____ ____ _| |_ _____  ____| |__
+ \____ \| ___ |    (_   _) ___ |/ ___)  _ \
+ _____) ) ____| | | || |_| ____( (___| | | |
+(______/|_____)_|_|_| \__)_____)\____)_| |_|
+  (C)2019 Semtech
+
+Description:
+    Check the one-pass RX buffer parser against the previous two-pass one:
+    hand-built RX buffers (resync, truncation, bad checksum, lost syncword,
+    out of range metadata), then random corruptions of generated buffers,
+    must give the same packets and the same errors, but for a syncword cut
+    at the end of resynced data (see check()).
+    No concentrator is needed.
+
+License: Revised BSD License, see LICENSE.TXT file include in the project
+*/
+
+
+/* -------------------------------------------------------------------------- */
+/* --- DEPENDANCIES --------------------------------------------------------- */
+
+/* fix an issue between POSIX and C99 */
+#if __STDC_VERSION__ >= 199901L
+    #define _XOPEN_SOURCE 600
+#else
+    #define _XOPEN_SOURCE 500
+#endif
+
+#include <stdint.h>     /* C99 types */
+#include <stdbool.h>    /* bool type */
+#include <stdio.h>      /* printf */
+#include <stdlib.h>     /* rand */
+#include <string.h>     /* memset memcpy */
+#include <getopt.h>     /* getopt */
+
+#include "esp_system.h"
+#include "esp_console.h"
+#include "esp_timer.h"
+
+#include "loragw_reg.h"
+#include "loragw_sx1302_rx.h"
+
+/* -------------------------------------------------------------------------- */
+/* --- PRIVATE MACROS ------------------------------------------------------- */
+
+#define RAND_RANGE(min, max) (rand() % (max + 1 - min) + min)
+
+/* -------------------------------------------------------------------------- */
+/* --- PRIVATE CONSTANTS ---------------------------------------------------- */
+
+#define DEFAULT_NB_BUFFER   5000
+#define MAX_POP             255
+
+#define PKT_HEAD            9
+#define PKT_TAIL            14
+
+/* hand-built in the RX buffer format, not captured: a 23 bytes LoRaWAN join request on SF7, then an uplink on SF10 with fine timestamp metrics */
+static const uint8_t handmade_1[] = {
+    0xA5, 0xC0, 0x17, 0x03, 0x73, 0x03, 0xF4, 0x1F, 0x00,
+    0x00, 0x01, 0x02, 0x03, 0x04, 0x05, 0x06, 0x07, 0x08, 0x70, 0xB3, 0xD5, 0x7E, 0xD0, 0x02, 0x5A, 0x3C,
+    0x3A, 0x11, 0x7E, 0x4C, 0x8F, 0xC2,
+    0x10, 0x24, 0x53, 0x54, 0x00, 0x00, 0x40, 0xE2, 0x01, 0x00, 0x9A, 0x4B, 0x00, 0x53
+};
+static const uint8_t handmade_2[] = {
+    0xA5, 0xC0, 0x0E, 0x06, 0xA9, 0x06, 0x30, 0xFE, 0x0F,
+    0x40, 0x11, 0x22, 0x33, 0x44, 0x80, 0x01, 0x00, 0x02, 0x01, 0xA2, 0xB3, 0xC4, 0xD5,
+    0x10, 0xF8, 0x5C, 0x60, 0x22, 0x33, 0x10, 0x27, 0x00, 0x80, 0x34, 0x12, 0x03, 0x01, 0xFF, 0x02, 0xFE, 0x00, 0x01, 0xDB
+};
+
+/* -------------------------------------------------------------------------- */
+/* --- PRIVATE VARIABLES ---------------------------------------------------- */
+
+static rx_buffer_t rxb;
+
+/* previous parser: zeros after the bytes fetched, which it may read, but for the bytes a resync moved the data from */
+static struct {
+    uint8_t buffer[4096 + 512];
+    int size;
+    int index;
+    int pkt_nb;
+} ref;
+
+/* parse result, as seen by sx1302_parse() */
+struct parse_s {
+    int nb_pkt;                     /* packets counted after the fetch */
+    int nb_pop;
+    int ret[MAX_POP];
+    int pkt_idx[MAX_POP];           /* start of the packets popped, in the buffer fetched */
+    bool stale_sync;                /* previous parser: syncword ending past the data, in the bytes left by a resync */
+};
+
+/* -------------------------------------------------------------------------- */
+/* --- PRIVATE FUNCTIONS DEFINITION ----------------------------------------- */
+
+/* add a packet in the SX1302 RX buffer format, with its checksum */
+static int pkt_add(uint8_t *buf, int size, uint8_t modem_id, uint8_t chan, uint8_t sf, uint8_t payload_len, uint8_t num_ts) {
+    int i, n;
+    uint8_t sum = 0;
+
+    n = PKT_HEAD + payload_len + PKT_TAIL + (2 * num_ts);
+    if ((size + n) > 4096) {
+        return size;
+    }
+    for (i = 0; i < n; i++) {
+        buf[size + i] = (uint8_t)rand();
+    }
+    buf[size + 0] = 0xA5;
+    buf[size + 1] = 0xC0;
+    buf[size + 2] = payload_len;
+    buf[size + 3] = chan;
+    buf[size + 4] = (uint8_t)((sf << 4) | (buf[size + 4] & 0x0F));
+    buf[size + 5] = modem_id;
+    buf[size + payload_len + 21] = num_ts;
+    for (i = 0; i < (n - 1); i++) {
+        sum += buf[size + i];
+    }
+    buf[size + n - 1] = sum;
+
+    return size + n;
+}
+
+static int pkt_add_random(uint8_t *buf, int size) {
+    return pkt_add(buf, size, RAND_RANGE(0, 17), RAND_RANGE(0, 9), RAND_RANGE(5, 12), RAND_RANGE(0, 255), (RAND_RANGE(0, 3) == 0) ? RAND_RANGE(1, 40) : 0);
+}
+
+static int ref_pop(void) {
+    int i, n, num_ts;
+    uint8_t sum = 0;
+    uint8_t len, modem_id, chan, sf;
+
+    if (ref.index >= ref.size) {
+        return LGW_REG_ERROR;
+    }
+    if ((ref.buffer[ref.index] != 0xA5) || (ref.buffer[ref.index + 1] != 0xC0)) {
+        return LGW_REG_ERROR;
+    }
+    len = ref.buffer[ref.index + 2];
+    num_ts = ref.buffer[ref.index + len + 21];
+    n = PKT_HEAD + len + PKT_TAIL + (2 * num_ts);
+    if ((ref.index + n) > ref.size) {
+        return LGW_REG_WARNING;
+    }
+    for (i = 0; i < (n - 1); i++) {
+        sum += ref.buffer[ref.index + i];
+    }
+    if (sum != ref.buffer[ref.index + n - 1]) {
+        return LGW_REG_WARNING;
+    }
+    modem_id = ref.buffer[ref.index + 5];
+    chan = ref.buffer[ref.index + 3];
+    sf = ref.buffer[ref.index + 4] >> 4;
+    if (modem_id > 17) {
+        return LGW_REG_ERROR;
+    }
+    if ((modem_id <= 16) && ((chan > 9) || (sf < 5) || (sf > 12))) {
+        return LGW_REG_ERROR;
+    }
+    ref.index += n;
+    ref.pkt_nb -= 1;
+
+    return LGW_REG_SUCCESS;
+}
+
+/* previous parser: resync by moving the data, count the packets, then check each packet when popped */
+static void ref_parse(const uint8_t *buf, int size, struct parse_s *res) {
+    int idx, offset = 0;
+    int ret;
+
+    memset(&ref, 0, sizeof ref);
+    memset(res, 0, sizeof *res);
+    memcpy(ref.buffer, buf, size);
+    ref.size = size;
+
+    if (size > 0) {
+        if (size < (PKT_HEAD + PKT_TAIL)) {
+            return;
+        }
+        idx = 0;
+        while ((idx <= (ref.size - 2)) && ((ref.buffer[idx] != 0xA5) || (ref.buffer[idx + 1] != 0xC0))) {
+            idx += 1;
+        }
+        if (idx > (ref.size - 2)) {
+            return;
+        }
+        if (idx != 0) {
+            /* the last idx bytes stay where they were, past the data moved */
+            memmove(ref.buffer, ref.buffer + idx, ref.size - idx);
+            ref.size -= idx;
+            offset = idx;
+        }
+        idx = 0;
+        while (idx < ref.size) {
+            if ((ref.buffer[idx] != 0xA5) || (ref.buffer[idx + 1] != 0xC0)) {
+                ref.pkt_nb = 0;
+                return;
+            }
+            if ((idx + 1) >= ref.size) {
+                res->stale_sync = true;
+            }
+            ref.pkt_nb += 1;
+            idx += PKT_HEAD + ref.buffer[idx + 2] + PKT_TAIL + (2 * ref.buffer[idx + ref.buffer[idx + 2] + 21]);
+        }
+    }
+
+    /* as receive_packets(): stop at the first warning or error */
+    res->nb_pkt = ref.pkt_nb;
+    while ((res->nb_pop < res->nb_pkt) && (res->nb_pop < MAX_POP)) {
+        res->pkt_idx[res->nb_pop] = offset + ref.index;
+        ret = ref_pop();
+        res->ret[res->nb_pop++] = ret;
+        if (ret != LGW_REG_SUCCESS) {
+            break;
+        }
+    }
+}
+
+/* parser under test, on a buffer holding stale bytes after the data fetched */
+static void new_parse(const uint8_t *buf, int size, struct parse_s *res, uint32_t *scan_us) {
+    int ret;
+    static rx_packet_t pkt;
+
+    memset(res, 0, sizeof *res);
+    rx_buffer_new(&rxb);
+    memset(rxb.buffer, 0xA5, sizeof rxb.buffer);
+    memcpy(rxb.buffer, buf, size);
+    rxb.buffer_size = size;
+    rx_buffer_scan(&rxb);
+    *scan_us = rxb.scan_us;
+
+    res->nb_pkt = rxb.buffer_pkt_nb;
+    while ((res->nb_pop < res->nb_pkt) && (res->nb_pop < MAX_POP)) {
+        res->pkt_idx[res->nb_pop] = rxb.buffer_index;
+        ret = rx_buffer_pop(&rxb, &pkt);
+        res->ret[res->nb_pop++] = ret;
+        if (ret != LGW_REG_SUCCESS) {
+            rx_buffer_del(&rxb);
+            break;
+        }
+        /* the payload is left in the buffer, right after the head metadata */
+        if ((pkt.payload != &rxb.buffer[res->pkt_idx[res->nb_pop - 1] + PKT_HEAD]) || (pkt.rxbytenb_modem != buf[res->pkt_idx[res->nb_pop - 1] + 2])) {
+            res->ret[res->nb_pop - 1] = -100;
+            break;
+        }
+    }
+}
+
+/* the buffers where the previous parser read a syncword in the bytes left by a resync */
+static unsigned int nb_stale_sync;
+
+static unsigned int check(const char *name, const uint8_t *buf, int size, bool verbose, uint32_t *scan_us_max) {
+    struct parse_s r, n;
+    uint32_t scan_us;
+
+    ref_parse(buf, size, &r);
+    if (r.stale_sync == true) {
+        /* the previous parser completed a syncword cut at the end of the data with a byte left by the resync, then
+           popped the packets before it; a syncword cut discards the buffer, as it did when there was no resync */
+        memset(&r, 0, sizeof r);
+        nb_stale_sync += 1;
+    }
+    new_parse(buf, size, &n, &scan_us);
+    if (scan_us > *scan_us_max) {
+        *scan_us_max = scan_us;
+    }
+
+    if (verbose == true) {
+        printf("%-24s %4d bytes: %3d packets, %3d popped, last %d\n", name, size, n.nb_pkt, n.nb_pop, (n.nb_pop > 0) ? n.ret[n.nb_pop - 1] : 0);
+    }
+    if ((r.nb_pkt != n.nb_pkt) || (r.nb_pop != n.nb_pop) || (memcmp(r.ret, n.ret, r.nb_pop * sizeof r.ret[0]) != 0) || (memcmp(r.pkt_idx, n.pkt_idx, r.nb_pop * sizeof r.pkt_idx[0]) != 0)) {
+        printf("ERROR: %s: %d packets, %d popped (last %d), previous parser %d packets, %d popped (last %d)\n", name,
+                n.nb_pkt, n.nb_pop, (n.nb_pop > 0) ? n.ret[n.nb_pop - 1] : 0, r.nb_pkt, r.nb_pop, (r.nb_pop > 0) ? r.ret[r.nb_pop - 1] : 0);
+        return 1;
+    }
+
+    return 0;
+}
+
+/* describe command line options */
+static void usage(void) {
+    printf("Available options:\n");
+    printf(" -h print this help\n");
+    printf(" -n <uint>  number of random RX buffers [100..1000000], default %d\n", DEFAULT_NB_BUFFER);
+}
+
+/* -------------------------------------------------------------------------- */
+/* --- MAIN FUNCTION -------------------------------------------------------- */
+
+int main_test_loragw_sx1302_rx(int argc, char **argv) {
+    static uint8_t buf[4096];
+    int i, x, size, k, nb_pkt;
+    unsigned int arg_u;
+    unsigned int nb_buffer = DEFAULT_NB_BUFFER;
+    unsigned int nb_error = 0;
+    uint32_t scan_us_max = 0;
+    int64_t start_us;
+
+    optind = 0;
+    nb_stale_sync = 0;
+
+    /* parse command line options */
+    while ((i = getopt(argc, argv, "hn:")) != -1) {
+        switch (i) {
+            case 'h':
+                usage();
+                return -1;
+            case 'n':
+                x = sscanf(optarg, "%u", &arg_u);
+                if ((x != 1) || (arg_u < 100) || (arg_u > 1000000)) {
+                    printf("ERROR: argument parsing of -n argument. Use -h to print help\n");
+                    return EXIT_FAILURE;
+                } else {
+                    nb_buffer = arg_u;
+                }
+                break;
+            default:
+                printf("ERROR: argument parsing\n");
+                usage();
+                return EXIT_FAILURE;
+        }
+    }
+
+    printf("### RX buffer parser: hand-built buffers, then %u random buffers ###\n", nb_buffer);
+
+    /* hand-built buffers */
+    memcpy(buf, handmade_1, sizeof handmade_1);
+    memcpy(buf + sizeof handmade_1, handmade_2, sizeof handmade_2);
+    nb_error += check("hand-built", buf, sizeof handmade_1 + sizeof handmade_2, true, &scan_us_max);
+    nb_error += check("hand-built, cut", buf, sizeof handmade_1 + sizeof handmade_2 - 5, true, &scan_us_max);
+    buf[30] ^= 0x40;
+    nb_error += check("hand-built, bad checksum", buf, sizeof handmade_1 + sizeof handmade_2, true, &scan_us_max);
+
+    /* buffers built packet by packet */
+    size = pkt_add(buf, 0, 3, 2, 7, 20, 0);
+    nb_error += check("one packet", buf, size, true, &scan_us_max);
+    size = pkt_add(buf, size, 16, 8, 12, 51, 0);
+    size = pkt_add(buf, size, 17, 0, 0, 12, 0);
+    size = pkt_add(buf, size, 5, 4, 9, 0, 20);
+    nb_error += check("mixed modems", buf, size, true, &scan_us_max);
+    nb_error += check("one byte more", buf, size + 1, true, &scan_us_max);
+    nb_error += check("truncated", buf, size - 3, true, &scan_us_max);
+    nb_error += check("too short", buf, 22, true, &scan_us_max);
+    memmove(buf + 7, buf, size);
+    memcpy(buf, "\x12\xA5\x00\xA5\xA5\xC1\x00", 7);
+    nb_error += check("resync", buf, size + 7, true, &scan_us_max);
+    size = pkt_add(buf, 4, 3, 2, 7, 20, 0);
+    size = pkt_add(buf, size, 3, 2, 7, 30, 0);
+    buf[size - 1] += 0xC0 - buf[size - 3]; /* the byte the previous parser reads past the data after the resync */
+    buf[size - 3] = 0xC0;
+    buf[size++] = 0xA5;
+    memcpy(buf, "\x12\x34\x56\x78", 4);
+    nb_error += check("resync, syncword cut", buf, size, true, &scan_us_max);
+    memset(buf, 0x5A, 64);
+    nb_error += check("no syncword", buf, 64, true, &scan_us_max);
+    size = pkt_add(buf, 0, 3, 2, 7, 20, 0);
+    size = pkt_add(buf, size, 3, 2, 7, 30, 0);
+    buf[size - 10] ^= 0x01;
+    size = pkt_add(buf, size, 3, 2, 7, 40, 0);
+    nb_error += check("bad checksum", buf, size, true, &scan_us_max);
+    size = pkt_add(buf, 0, 3, 2, 7, 20, 0);
+    buf[size++] = 0x00;
+    size = pkt_add(buf, size, 3, 2, 7, 30, 0);
+    nb_error += check("syncword lost", buf, size, true, &scan_us_max);
+    size = pkt_add(buf, 0, 3, 2, 7, 20, 0);
+    size = pkt_add(buf, size, 18, 2, 7, 20, 0);
+    nb_error += check("bad modem", buf, size, true, &scan_us_max);
+    size = pkt_add(buf, 0, 3, 2, 7, 20, 0);
+    size = pkt_add(buf, size, 3, 2, 4, 20, 0);
+    nb_error += check("bad datarate", buf, size, true, &scan_us_max);
+    for (size = 0, nb_pkt = 0; nb_pkt < 200; nb_pkt++) {
+        size = pkt_add(buf, size, 0, 0, 7, 0, 0);
+    }
+    nb_error += check("full, small packets", buf, size, true, &scan_us_max);
+    for (size = 0, nb_pkt = 0; nb_pkt < 20; nb_pkt++) {
+        size = pkt_add(buf, size, 1, 1, 8, 250, 0);
+    }
+    buf[4095] = 0xA5;
+    nb_error += check("full, syncword cut", buf, 4096, true, &scan_us_max);
+
+    /* generated buffers, corrupted the ways a fetch can be */
+    start_us = esp_timer_get_time();
+    for (k = 0; k < (int)nb_buffer; k++) {
+        nb_pkt = RAND_RANGE(1, 20);
+        for (size = 0, i = 0; i < nb_pkt; i++) {
+            size = pkt_add_random(buf, size);
+        }
+        switch (RAND_RANGE(0, 6)) {
+            case 0: /* as fetched */
+                break;
+            case 1: /* cut anywhere */
+                size = RAND_RANGE(0, size);
+                break;
+            case 2: /* corrupted byte */
+                buf[RAND_RANGE(0, size - 1)] ^= (uint8_t)RAND_RANGE(1, 255);
+                break;
+            case 3: /* fetch started in the middle of a packet */
+                x = RAND_RANGE(1, 40);
+                if (x < size) {
+                    memmove(buf, buf + x, size - x);
+                    size -= x;
+                }
+                break;
+            case 4: /* bytes lost */
+                x = RAND_RANGE(0, size - 1);
+                i = RAND_RANGE(1, 8);
+                if ((x + i) < size) {
+                    memmove(buf + x, buf + x + i, size - x - i);
+                    size -= i;
+                }
+                break;
+            case 5: /* fetch started in the middle of a packet and cut after a syncword byte */
+                x = RAND_RANGE(1, 40);
+                if ((x < size) && (size < 4096)) {
+                    memmove(buf, buf + x, size - x);
+                    buf[size - x] = 0xA5;
+                    size -= x - 1;
+                }
+                break;
+            default: /* extra bytes */
+                x = RAND_RANGE(1, 8);
+                for (i = 0; (i < x) && (size < 4096); i++) {
+                    buf[size++] = (i == 0) ? 0xA5 : (uint8_t)rand();
+                }
+                break;
+        }
+        nb_error += check("random", buf, size, false, &scan_us_max);
+    }
+    printf("%u random buffers in %lld ms, longest indexing %lu us\n", nb_buffer, (long long)((esp_timer_get_time() - start_us) / 1000), (unsigned long)scan_us_max);
+
+    printf("%u buffers with a syncword cut at the end of resynced data, discarded\n", nb_stale_sync);
+    printf("%u errors\n", nb_error);
+
+    return (nb_error == 0) ? 0 : EXIT_FAILURE;
+}
+
+void register_test_loragw_sx1302_rx(void)
+{
+    const esp_console_cmd_t test_sx1302_rx_cmd = {
+        .command = "test_sx1302_rx",
+        .help = "Test RX buffer parser against the previous one",
+        .hint = NULL,
+        .func = &main_test_loragw_sx1302_rx,
+        .argtable = NULL,
+    };
+    ESP_ERROR_CHECK(esp_console_cmd_register(&test_sx1302_rx_cmd));
+}
@@ -35,7 +35,76 @@ License: Revised BSD License, see LICENSE.TXT file include in the project
 #include "esp_console.h"
 #include "argtable3/argtable3.h"
 
+#include "esp_timer.h"
+
 #include "loragw_hal.h"
+#include "loragw_aux.h"
+
+/* -------------------------------------------------------------------------- */
+/* --- PRIVATE CONSTANTS ---------------------------------------------------- */
+
+static const uint8_t check_bw[] = { BW_125KHZ, BW_250KHZ, BW_500KHZ };
+static const uint16_t check_preamble[] = { 0, 6, 8, 12, 16, 255, 4096, 65535 };
+
+/* -------------------------------------------------------------------------- */
+/* --- PRIVATE FUNCTIONS DEFINITION ----------------------------------------- */
+
+/* compare the integer time on air with the floating point reference for all parameters and sizes */
+static int check_all(void) {
+    int sf, b, cr, h, c, p, size;
+    uint32_t toa_ref, toa_int;
+    unsigned int nb_check = 0;
+    unsigned int nb_error = 0;
+    int64_t start_us, ref_us, int_us;
+    volatile uint32_t sink = 0;
+
+    for (sf = DR_LORA_SF5; sf <= DR_LORA_SF12; sf++) {
+        for (b = 0; b < (int)(sizeof check_bw / sizeof check_bw[0]); b++) {
+            for (cr = CR_LORA_4_5; cr <= CR_LORA_4_8; cr++) {
+                for (h = 0; h < 2; h++) {
+                    for (c = 0; c < 2; c++) {
+                        for (p = 0; p < (int)(sizeof check_preamble / sizeof check_preamble[0]); p++) {
+                            for (size = 0; size < 256; size++) {
+                                toa_ref = lora_packet_time_on_air(check_bw[b], sf, cr, check_preamble[p], h, c, size, NULL, NULL, NULL);
+                                toa_int = lora_packet_toa_us(check_bw[b], sf, cr, check_preamble[p], h, c, size);
+                                nb_check += 1;
+                                if (toa_int != toa_ref) {
+                                    if (nb_error < 5) {
+                                        printf("ERROR: SF%d bw:0x%02X cr:%d preamble:%u no_header:%d no_crc:%d size:%d => %u us, reference %u us\n",
+                                                sf, check_bw[b], cr, check_preamble[p], h, c, size, toa_int, toa_ref);
+                                    }
+                                    nb_error += 1;
+                                }
+                            }
+                        }
+                    }
+                }
+            }
+        }
+    }
+
+    /* benchmark on the downlink parameters: 8 symbols preamble, explicit header, no CRC */
+    start_us = esp_timer_get_time();
+    for (sf = DR_LORA_SF5; sf <= DR_LORA_SF12; sf++) {
+        for (size = 0; size < 256; size++) {
+            sink += lora_packet_time_on_air(BW_125KHZ, sf, CR_LORA_4_5, 8, false, true, size, NULL, NULL, NULL);
+        }
+    }
+    ref_us = esp_timer_get_time() - start_us;
+    start_us = esp_timer_get_time();
+    for (sf = DR_LORA_SF5; sf <= DR_LORA_SF12; sf++) {
+        for (size = 0; size < 256; size++) {
+            sink += lora_packet_toa_us(BW_125KHZ, sf, CR_LORA_4_5, 8, false, true, size);
+        }
+    }
+    int_us = esp_timer_get_time() - start_us;
+    (void)sink;
+
+    printf("%u combinations checked, %u errors\n", nb_check, nb_error);
+    printf("time on air: %.3f us per call (reference %.3f us)\n", (double)int_us / (8 * 256), (double)ref_us / (8 * 256));
+
+    return (nb_error == 0) ? 0 : EXIT_FAILURE;
+}
 
 
 
@@ -51,6 +120,7 @@ static void usage(void) {
     printf(" -z <uint>  Payload length [0..255]\n");
     printf(" -i         Implicit header (no header)\n");
     printf(" -r         CRC enabled\n");
+    printf(" -x         Check all parameters and sizes against the reference, and benchmark\n");
 }
 
 /* -------------------------------------------------------------------------- */
@@ -83,7 +153,7 @@ int main_test_loragw_toa(int argc, char **argv) {
     optind = 0;
 
     /* parse command line options */
-    while ((i = getopt_long (argc, argv, "hirs:b:z:l:c:", long_options, &option_index)) != -1) {
+    while ((i = getopt_long (argc, argv, "hirxs:b:z:l:c:", long_options, &option_index)) != -1) {
         switch (i) {
             case 'h':
                 usage();
@@ -95,6 +165,8 @@ int main_test_loragw_toa(int argc, char **argv) {
             case 'r':
                 pkt.no_crc = false;
                 break;
+            case 'x':
+                return check_all();
             case 'l':
                 preamb = true; /* param set */
                 i = sscanf(optarg, "%u", &arg_u);
@@ -0,0 +1,259 @@
+/*
+ / _____)             _              | |
+( (____  _____ ____ _| |_ _____  ____| |__
+ \____ \| ___ |    (_   _) ___ |/ ___)  _ \
+ _____) ) ____| | | || |_| ____( (___| | | |
+(______/|_____)_|_|_| \__)_____)\____)_| |_|
+  (C)2019 Semtech
+
+Description:
+    Check that the rxpk encoder output is identical to the former snprintf
+    based serializer, and compare the time spent per packet
+
+License: Revised BSD License, see LICENSE.TXT file include in the project
+*/
+
+
+/* -------------------------------------------------------------------------- */
+/* --- DEPENDANCIES --------------------------------------------------------- */
+
+/* fix an issue between POSIX and C99 */
+#if __STDC_VERSION__ >= 199901L
+    #define _XOPEN_SOURCE 600
+#else
+    #define _XOPEN_SOURCE 500
+#endif
+
+#include <stdint.h>     /* C99 types */
+#include <stdbool.h>    /* bool type */
+#include <stdio.h>      /* printf snprintf */
+#include <stdlib.h>     /* rand */
+#include <string.h>
+#include <inttypes.h>   /* PRIu64 */
+#include <math.h>       /* roundf */
+#include <time.h>       /* gmtime */
+#include <getopt.h>     /* getopt_long */
+
+#include "esp_system.h"
+#include "esp_console.h"
+#include "esp_timer.h"
+
+#include "loragw_hal.h"
+#include "loragw_gps.h"
+#include "base64.h"
+#include "rxpk_encoder.h"
+
+/* -------------------------------------------------------------------------- */
+/* --- PRIVATE MACROS ------------------------------------------------------- */
+
+#define RAND_RANGE(min, max) (rand() % (max + 1 - min) + min)
+
+/* -------------------------------------------------------------------------- */
+/* --- PRIVATE CONSTANTS ---------------------------------------------------- */
+
+#define DEFAULT_NB_PKT  1000
+
+/* -------------------------------------------------------------------------- */
+/* --- PRIVATE VARIABLES ---------------------------------------------------- */
+
+static char buff_ref[RXPK_JSON_SIZE_MAX];
+static char buff_enc[RXPK_JSON_SIZE_MAX];
+
+/* -------------------------------------------------------------------------- */
+/* --- PRIVATE FUNCTIONS DEFINITION ----------------------------------------- */
+
+/* reference: serializer used by thread_up before the rxpk encoder (errors return -1) */
+static int legacy_serialize(const struct lgw_pkt_rx_s *p, const struct tref *ref, char *buff, int size) {
+    int idx = 0;
+    int j;
+    struct timespec pkt_utc_time;
+    struct tm *x;
+    struct timespec pkt_gps_time;
+    uint64_t pkt_gps_time_ms;
+    static const char *datr[8] = { "SF5", "SF6", "SF7", "SF8", "SF9", "SF10", "SF11", "SF12" };
+
+    idx += snprintf(buff + idx, size - idx, "{\"jver\":%d", 1);
+    idx += snprintf(buff + idx, size - idx, ",\"tmst\":%lu", (unsigned long)p->count_us);
+    if (ref != NULL) {
+        if (lgw_cnt2utc(*ref, p->count_us, &pkt_utc_time) == LGW_GPS_SUCCESS) {
+            x = gmtime(&(pkt_utc_time.tv_sec));
+            idx += snprintf(buff + idx, size - idx, ",\"time\":\"%04i-%02i-%02iT%02i:%02i:%02i.%06liZ\"", (x->tm_year) + 1900, (x->tm_mon) + 1, x->tm_mday, x->tm_hour, x->tm_min, x->tm_sec, (pkt_utc_time.tv_nsec) / 1000);
+        }
+        if (lgw_cnt2gps(*ref, p->count_us, &pkt_gps_time) == LGW_GPS_SUCCESS) {
+            pkt_gps_time_ms = pkt_gps_time.tv_sec * 1E3 + pkt_gps_time.tv_nsec / 1E6;
+            idx += snprintf(buff + idx, size - idx, ",\"tmms\":%" PRIu64 "", pkt_gps_time_ms);
+        }
+    }
+    if (p->ftime_received == true) {
+        idx += snprintf(buff + idx, size - idx, ",\"ftime\":%lu", (unsigned long)p->ftime);
+    }
+    idx += snprintf(buff + idx, size - idx, ",\"chan\":%1u,\"rfch\":%1u,\"freq\":%.6lf,\"mid\":%2u", p->if_chain, p->rf_chain, ((double)p->freq_hz / 1e6), p->modem_id);
+    switch (p->status) {
+        case STAT_CRC_OK:  idx += snprintf(buff + idx, size - idx, ",\"stat\":1"); break;
+        case STAT_CRC_BAD: idx += snprintf(buff + idx, size - idx, ",\"stat\":-1"); break;
+        case STAT_NO_CRC:  idx += snprintf(buff + idx, size - idx, ",\"stat\":0"); break;
+        default: return -1;
+    }
+    if (p->modulation == MOD_LORA) {
+        idx += snprintf(buff + idx, size - idx, ",\"modu\":\"LORA\",\"datr\":\"%s", datr[p->datarate - 5]);
+        switch (p->bandwidth) {
+            case BW_125KHZ: idx += snprintf(buff + idx, size - idx, "BW125\""); break;
+            case BW_250KHZ: idx += snprintf(buff + idx, size - idx, "BW250\""); break;
+            case BW_500KHZ: idx += snprintf(buff + idx, size - idx, "BW500\""); break;
+            default: return -1;
+        }
+        switch (p->coderate) {
+            case CR_LORA_4_5: idx += snprintf(buff + idx, size - idx, ",\"codr\":\"4/5\""); break;
+            case CR_LORA_4_6: idx += snprintf(buff + idx, size - idx, ",\"codr\":\"4/6\""); break;
+            case CR_LORA_4_7: idx += snprintf(buff + idx, size - idx, ",\"codr\":\"4/7\""); break;
+            case CR_LORA_4_8: idx += snprintf(buff + idx, size - idx, ",\"codr\":\"4/8\""); break;
+            case 0:           idx += snprintf(buff + idx, size - idx, ",\"codr\":\"OFF\""); break;
+            default: return -1;
+        }
+        idx += snprintf(buff + idx, size - idx, ",\"rssis\":%.0f", roundf(p->rssis));
+        idx += snprintf(buff + idx, size - idx, ",\"lsnr\":%.1f", p->snr);
+        idx += snprintf(buff + idx, size - idx, ",\"foff\":%ld", (long)p->freq_offset);
+    } else {
+        idx += snprintf(buff + idx, size - idx, ",\"modu\":\"FSK\",\"datr\":%lu", (unsigned long)p->datarate);
+    }
+    idx += snprintf(buff + idx, size - idx, ",\"rssi\":%.0f,\"size\":%u", roundf(p->rssic), p->size);
+    idx += snprintf(buff + idx, size - idx, ",\"data\":\"");
+    j = bin_to_b64(p->payload, p->size, buff + idx, 341);
+    if (j < 0) {
+        return -1;
+    }
+    idx += j;
+    idx += snprintf(buff + idx, size - idx, "\"}");
+
+    return idx;
+}
+
+static void random_packet(struct lgw_pkt_rx_s *p) {
+    int i;
+    static const uint8_t bw[3] = { BW_125KHZ, BW_250KHZ, BW_500KHZ };
+    static const uint8_t stat[3] = { STAT_CRC_OK, STAT_CRC_BAD, STAT_NO_CRC };
+
+    memset(p, 0, sizeof *p);
+    p->freq_hz = RAND_RANGE(400000000, 1000000000);
+    p->if_chain = RAND_RANGE(0, 9);
+    p->rf_chain = RAND_RANGE(0, 1);
+    p->modem_id = RAND_RANGE(0, 16);
+    p->status = stat[RAND_RANGE(0, 2)];
+    p->count_us = ((uint32_t)rand() << 16) ^ (uint32_t)rand();
+    p->ftime_received = (rand() & 1) ? true : false;
+    p->ftime = RAND_RANGE(0, 999999999);
+    p->modulation = (RAND_RANGE(0, 9) == 0) ? MOD_FSK : MOD_LORA;
+    if (p->modulation == MOD_LORA) {
+        p->datarate = RAND_RANGE(DR_LORA_SF5, DR_LORA_SF12);
+        p->bandwidth = bw[RAND_RANGE(0, 2)];
+        p->coderate = RAND_RANGE(0, CR_LORA_4_8);
+        p->snr = (float)RAND_RANGE(-128, 127) / 4; /* quarter of dB, as reported by the SX1302 */
+        p->freq_offset = RAND_RANGE(-65536, 65536);
+    } else {
+        p->datarate = RAND_RANGE(1200, 300000);
+    }
+    p->rssic = (float)RAND_RANGE(-14000, 0) / 100;
+    p->rssis = p->rssic - (float)RAND_RANGE(0, 2000) / 100;
+    p->size = RAND_RANGE(0, 255);
+    for (i = 0; i < p->size; i++) {
+        p->payload[i] = (uint8_t)rand();
+    }
+}
+
+/* describe command line options */
+static void usage(void) {
+    printf("Available options:\n");
+    printf(" -h print this help\n");
+    printf(" -n <uint>  number of random packets to serialize [1..100000], default %d\n", DEFAULT_NB_PKT);
+    printf(" -g         add GPS time fields (time, tmms)\n");
+}
+
+/* -------------------------------------------------------------------------- */
+/* --- MAIN FUNCTION -------------------------------------------------------- */
+
+int main_test_rxpk_encoder(int argc, char **argv) {
+    int i, x;
+    unsigned int arg_u;
+    unsigned int nb_pkt = DEFAULT_NB_PKT;
+    bool gps = false;
+    struct lgw_pkt_rx_s pkt;
+    struct tref ref;
+    int len_ref, len_enc;
+    int64_t t_start;
+    int64_t t_ref = 0, t_enc = 0;
+    unsigned int nb_diff = 0;
+
+    optind = 0;
+
+    /* parse command line options */
+    while ((i = getopt(argc, argv, "hgn:")) != -1) {
+        switch (i) {
+            case 'h':
+                usage();
+                return -1;
+            case 'g':
+                gps = true;
+                break;
+            case 'n':
+                x = sscanf(optarg, "%u", &arg_u);
+                if ((x != 1) || (arg_u < 1) || (arg_u > 100000)) {
+                    printf("ERROR: argument parsing of -n argument. Use -h to print help\n");
+                    return EXIT_FAILURE;
+                } else {
+                    nb_pkt = arg_u;
+                }
+                break;
+            default:
+                printf("ERROR: argument parsing\n");
+                usage();
+                return EXIT_FAILURE;
+        }
+    }
+
+    /* synthetic GPS time reference */
+    memset(&ref, 0, sizeof ref);
+    ref.systime = time(NULL);
+    ref.count_us = 0;
+    ref.utc.tv_sec = 1700000000;
+    ref.gps.tv_sec = 1384035218;
+    ref.xtal_err = 1.0;
+
+    printf("### rxpk encoder: %u packets%s ###\n", nb_pkt, (gps == true) ? " with GPS time" : "");
+
+    for (i = 0; i < (int)nb_pkt; i++) {
+        random_packet(&pkt);
+
+        t_start = esp_timer_get_time();
+        len_ref = legacy_serialize(&pkt, (gps == true) ? &ref : NULL, buff_ref, sizeof buff_ref);
+        t_ref += esp_timer_get_time() - t_start;
+
+        t_start = esp_timer_get_time();
+        len_enc = rxpk_encode(&pkt, (gps == true) ? &ref : NULL, buff_enc, sizeof buff_enc);
+        t_enc += esp_timer_get_time() - t_start;
+
+        if ((len_ref != len_enc) || (memcmp(buff_ref, buff_enc, len_ref) != 0)) {
+            if (nb_diff < 5) {
+                printf("ERROR: output mismatch on packet %d\n  snprintf: %s\n  encoder:  %s\n", i, buff_ref, buff_enc);
+            }
+            nb_diff += 1;
+        }
+    }
+
+    printf("snprintf serializer: %.2f us/packet\n", (double)t_ref / nb_pkt);
+    printf("rxpk encoder:        %.2f us/packet\n", (double)t_enc / nb_pkt);
+    printf("%u/%u packets with different output\n", nb_diff, nb_pkt);
+
+    return (nb_diff == 0) ? 0 : EXIT_FAILURE;
+}
+
+void register_test_rxpk_encoder(void)
+{
+    const esp_console_cmd_t test_rxpk_cmd = {
+        .command = "test_rxpk",
+        .help = "Test rxpk JSON encoder",
+        .hint = NULL,
+        .func = &main_test_rxpk_encoder,
+        .argtable = NULL,
+    };
+    ESP_ERROR_CHECK(esp_console_cmd_register(&test_rxpk_cmd));
+}
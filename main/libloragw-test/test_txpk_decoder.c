@@ -0,0 +1,333 @@
+/*
+ / _____)             _              | |
+( (____  _____ ____ _| |_ _____  ____| |__
+ \____ \| ___ |    (_   _) ___ |/ ___)  _ \
+ _____) ) ____| | | || |_| ____( (___| | | |
+(______/|_____)_|_|_| \__)_____)\____)_| |_|
+  (C)2019 Semtech
+
+Description:
+    Check that the single pass txpk decoder gives the same packets as the
+    parson based one, on hand written corner cases and random downlinks,
+    and compare time and heap used per downlink on the target
+
+License: Revised BSD License, see LICENSE.TXT file include in the project
+*/
+
+
+/* -------------------------------------------------------------------------- */
+/* --- DEPENDANCIES --------------------------------------------------------- */
+
+/* fix an issue between POSIX and C99 */
+#if __STDC_VERSION__ >= 199901L
+    #define _XOPEN_SOURCE 600
+#else
+    #define _XOPEN_SOURCE 500
+#endif
+
+#include <stdint.h>     /* C99 types */
+#include <stdbool.h>    /* bool type */
+#include <stdio.h>      /* printf snprintf */
+#include <stdlib.h>     /* rand malloc free */
+#include <string.h>
+#include <getopt.h>     /* getopt */
+
+#include "esp_system.h"
+#include "esp_console.h"
+#include "esp_timer.h"
+
+#include "loragw_hal.h"
+#include "parson.h"
+#include "base64.h"
+#include "txpk_decoder.h"
+
+/* -------------------------------------------------------------------------- */
+/* --- PRIVATE MACROS ------------------------------------------------------- */
+
+#define RAND_RANGE(min, max) (rand() % (max + 1 - min) + min)
+
+/* -------------------------------------------------------------------------- */
+/* --- PRIVATE CONSTANTS ---------------------------------------------------- */
+
+#define DEFAULT_NB_PKT  1000
+
+#define TXPK_LORA   "\"freq\":868.1,\"rfch\":0,\"powe\":14,\"modu\":\"LORA\",\"datr\":\"SF7BW125\",\"codr\":\"4/5\",\"ipol\":true,\"size\":2,\"data\":\"AQI=\""
+
+/* PULL_RESP the single pass must decode like parson, and whether it has to fall back to parson for it */
+static const struct {
+    const char *json;
+    bool dom;
+} txpk_cases[] = {
+    /* duplicated members, parson rejects them */
+    { "{\"txpk\":{\"imme\":true,\"x\":1,\"x\":2," TXPK_LORA "}}", true },
+    { "{\"txpk\":{\"imme\":true,\"freq\":869.5," TXPK_LORA "}}", true },
+    { "{\"x\":1,\"x\":2,\"txpk\":{\"imme\":true," TXPK_LORA "}}", true },
+    { "{\"brd\":{\"x\":1,\"x\":2},\"txpk\":{\"imme\":true," TXPK_LORA "}}", true },
+    { "{\"txpk\":{\"imme\":true," TXPK_LORA "},\"txpk\":{\"imme\":true," TXPK_LORA "}}", true },
+    { "{\"txpk\":{\"imme\":true,\"x\":1,\"y\":1," TXPK_LORA "},\"x\":1,\"y\":1}", false },
+    /* more members than checked for duplicates */
+    { "{\"txpk\":{\"imme\":true,\"a\":0,\"b\":0,\"c\":0,\"d\":0,\"e\":0,\"f\":0,\"g\":0,\"h\":0,\"i\":0,\"j\":0,\"k\":0,\"l\":0,\"m\":0,\"n\":0,\"o\":0," TXPK_LORA "}}", true },
+    /* escaped characters */
+    { "{\"txpk\":{\"imme\":true,\"desc\":\"\\\"quoted\\\"\"," TXPK_LORA "}}", true },
+    { "{\"txpk\":{\"imme\":true,\"\\u0078\":1," TXPK_LORA "}}", true },
+    { "{\"txpk\":{\"imme\":true,\"freq\":868.1,\"rfch\":0,\"modu\":\"LORA\",\"datr\":\"SF7BW125\",\"codr\":\"4\\/5\",\"size\":2,\"data\":\"AQI=\"}}", true },
+    /* numbers beyond the exact single division */
+    { "{\"txpk\":{\"tmst\":4294967295," TXPK_LORA "}}", false },
+    { "{\"txpk\":{\"tmms\":1234567890123456789," TXPK_LORA "}}", false },
+    { "{\"txpk\":{\"imme\":true,\"freq\":868.1000000000000001,\"rfch\":0,\"modu\":\"LORA\",\"datr\":\"SF7BW125\",\"codr\":\"4/5\",\"size\":2,\"data\":\"AQI=\"}}", false },
+    { "{\"txpk\":{\"imme\":true,\"freq\":8.681E2,\"rfch\":0,\"modu\":\"FSK\",\"datr\":50e3,\"fdev\":2.5e4,\"size\":2,\"data\":\"AQI=\"}}", false },
+    { "{\"txpk\":{\"imme\":true,\"freq\":868.3,\"rfch\":0,\"modu\":\"FSK\",\"datr\":-0.0,\"fdev\":25000.000000000001,\"size\":2,\"data\":\"AQI=\"}}", false },
+    { "{\"txpk\":{\"imme\":true,\"freq\":0868.1,\"rfch\":0," TXPK_LORA "}}", true },
+    /* missing fields */
+    { "{\"txpk\":{\"imme\":false,\"freq\":868.1,\"rfch\":0,\"modu\":\"LORA\",\"datr\":\"SF7BW125\",\"codr\":\"4/5\",\"size\":2,\"data\":\"AQI=\"}}", false },
+    { "{\"txpk\":{\"imme\":true,\"rfch\":0,\"modu\":\"LORA\",\"datr\":\"SF7BW125\",\"codr\":\"4/5\",\"size\":2,\"data\":\"AQI=\"}}", false },
+    { "{\"txpk\":{\"imme\":true,\"freq\":868.1,\"rfch\":0,\"modu\":\"LORA\",\"datr\":\"SF7BW125\",\"size\":2,\"data\":\"AQI=\"}}", false },
+    { "{\"txpk\":{\"imme\":true,\"freq\":868.1,\"rfch\":0,\"modu\":\"FSK\",\"datr\":50000,\"size\":2,\"data\":\"AQI=\"}}", false },
+    { "{\"txpk\":{\"imme\":true,\"freq\":868.1,\"rfch\":0,\"modu\":\"LORA\",\"datr\":\"SF7BW125\",\"codr\":\"4/5\",\"size\":2}}", false },
+    { "{\"rxpk\":{\"imme\":true," TXPK_LORA "}}", true },
+    /* fields of the wrong type */
+    { "{\"txpk\":{\"imme\":\"true\",\"tmst\":1000," TXPK_LORA "}}", false },
+    { "{\"txpk\":{\"imme\":true,\"freq\":\"868.1\",\"rfch\":0,\"modu\":\"LORA\",\"datr\":\"SF7BW125\",\"codr\":\"4/5\",\"size\":2,\"data\":\"AQI=\"}}", false },
+    { "{\"txpk\":{\"imme\":true,\"freq\":868.1,\"rfch\":null,\"modu\":\"LORA\",\"datr\":\"SF7BW125\",\"codr\":\"4/5\",\"size\":2,\"data\":\"AQI=\"}}", false },
+    { "{\"txpk\":{\"imme\":true,\"freq\":868.1,\"rfch\":0,\"modu\":1,\"datr\":\"SF7BW125\",\"codr\":\"4/5\",\"size\":2,\"data\":\"AQI=\"}}", false },
+    { "{\"txpk\":{\"imme\":true,\"freq\":868.1,\"rfch\":0,\"modu\":\"LORA\",\"datr\":7,\"codr\":\"4/5\",\"size\":2,\"data\":\"AQI=\"}}", false },
+    { "{\"txpk\":{\"imme\":true,\"freq\":868.1,\"rfch\":0,\"modu\":\"FSK\",\"datr\":\"50000\",\"fdev\":25000,\"size\":\"2\",\"data\":\"AQI=\"}}", false },
+    { "{\"txpk\":{\"imme\":true,\"freq\":868.1,\"rfch\":0,\"modu\":\"LORA\",\"datr\":\"SF7BW125\",\"codr\":\"4/5\",\"size\":2,\"data\":[1,2]}}", true },
+    { "{\"txpk\":[1,2]}", true },
+    { "{\"txpk\":{\"imme\":true,\"ncrc\":1," TXPK_LORA "}}", false },
+    /* malformed JSON */
+    { "{\"txpk\":{\"imme\":true," TXPK_LORA "}", true },
+    { "{\"txpk\":{\"imme\":true," TXPK_LORA "}} x", true },
+    { "{\"txpk\":{\"imme\":true,\"freq\":868.,\"rfch\":0,\"modu\":\"LORA\",\"datr\":\"SF7BW125\",\"codr\":\"4/5\",\"size\":2,\"data\":\"AQI=\"}}", true },
+    { "{\"txpk\":{\"imme\":tru," TXPK_LORA "}}", true }
+};
+
+/* PULL_RESP with a corrupt payload, both decoders must reject them so that nothing is sent */
+static const char *txpk_corrupt[] = {
+    "{\"txpk\":{\"imme\":true,\"freq\":868.1,\"rfch\":0,\"modu\":\"LORA\",\"datr\":\"SF7BW125\",\"codr\":\"4/5\",\"size\":2,\"data\":\"A!I=\"}}",
+    "{\"txpk\":{\"imme\":true,\"freq\":868.1,\"rfch\":0,\"modu\":\"LORA\",\"datr\":\"SF7BW125\",\"codr\":\"4/5\",\"size\":6,\"data\":\"AQIDBA U=\"}}",
+    "{\"txpk\":{\"imme\":true,\"freq\":868.1,\"rfch\":0,\"modu\":\"LORA\",\"datr\":\"SF7BW125\",\"codr\":\"4/5\",\"size\":6,\"data\":\"AQIDBAU*\",\"x\":1,\"x\":2}}",
+    "{\"txpk\":{\"imme\":true,\"freq\":868.1,\"rfch\":0,\"modu\":\"LORA\",\"datr\":\"SF7BW125\",\"codr\":\"4/5\",\"size\":3,\"data\":\"AQID\\n\"}}"
+};
+
+/* -------------------------------------------------------------------------- */
+/* --- PRIVATE VARIABLES ---------------------------------------------------- */
+
+static char json[1000]; /* same size as the PULL_RESP buffer */
+
+/* heap used by parson */
+static uint32_t nb_alloc;
+static uint32_t nb_alloc_bytes;
+
+/* -------------------------------------------------------------------------- */
+/* --- PRIVATE FUNCTIONS DEFINITION ----------------------------------------- */
+
+static void *count_malloc(size_t size) {
+    nb_alloc += 1;
+    nb_alloc_bytes += size;
+    return malloc(size);
+}
+
+/* decode with both paths, they must give the same packet and status */
+static bool same_decoding(const char *str, bool *dom) {
+    struct lgw_pkt_tx_s pkt_dom, pkt_dec;
+    struct txpk_info_s info_dom, info_dec;
+    int x_dom, x_dec;
+
+    x_dom = txpk_decode_dom(str, &pkt_dom, &info_dom);
+    x_dec = txpk_decode(str, &pkt_dec, &info_dec);
+    *dom = info_dec.dom;
+
+    info_dom.dom = info_dec.dom;
+    return ((x_dom == x_dec) && (memcmp(&pkt_dom, &pkt_dec, sizeof pkt_dom) == 0) && (memcmp(&info_dom, &info_dec, sizeof info_dom) == 0));
+}
+
+/* hand written PULL_RESP: duplicated members, escaped strings, long numbers, missing and mistyped fields, corrupt payloads */
+static unsigned int check_cases(void) {
+    struct lgw_pkt_tx_s pkt;
+    struct txpk_info_s info;
+    unsigned int nb_error = 0;
+    bool dom;
+    int i;
+
+    for (i = 0; i < (int)(sizeof txpk_cases / sizeof txpk_cases[0]); i++) {
+        if (same_decoding(txpk_cases[i].json, &dom) == false) {
+            printf("ERROR: decoding mismatch on case %d: %s\n", i, txpk_cases[i].json);
+            nb_error += 1;
+        }
+        if (dom != txpk_cases[i].dom) {
+            printf("ERROR: case %d %s decoded with parson: %s\n", i, (dom == true) ? "unexpectedly" : "not", txpk_cases[i].json);
+            nb_error += 1;
+        }
+    }
+    for (i = 0; i < (int)(sizeof txpk_corrupt / sizeof txpk_corrupt[0]); i++) {
+        if (txpk_decode(txpk_corrupt[i], &pkt, &info) == 0) {
+            printf("ERROR: corrupt payload accepted: %s\n", txpk_corrupt[i]);
+            nb_error += 1;
+        }
+        if (txpk_decode_dom(txpk_corrupt[i], &pkt, &info) == 0) {
+            printf("ERROR: corrupt payload accepted by parson: %s\n", txpk_corrupt[i]);
+            nb_error += 1;
+        }
+    }
+    printf("%d hand written downlinks, %u errors\n", (int)(sizeof txpk_cases / sizeof txpk_cases[0]) + i, nb_error);
+
+    return nb_error;
+}
+
+/* PULL_RESP as sent by a network server, with extra fields parson is needed for */
+static int random_pull_resp(char *buff, int size, bool *complex) {
+    static const char *codr[4] = { "4/5", "4/6", "4/7", "4/8" };
+    static const int bw[3] = { 125, 250, 500 };
+    uint8_t payload[255];
+    char data[341];
+    int pkt_size = RAND_RANGE(0, 255);
+    int idx = 0;
+    int i;
+
+    for (i = 0; i < pkt_size; i++) {
+        payload[i] = (uint8_t)rand();
+    }
+    bin_to_b64(payload, pkt_size, data, sizeof data);
+
+    idx += snprintf(buff + idx, size - idx, "{\"txpk\":{");
+    switch (RAND_RANGE(0, 2)) {
+        case 0:  idx += snprintf(buff + idx, size - idx, "\"imme\":true"); break;
+        case 1:  idx += snprintf(buff + idx, size - idx, "\"imme\":false,\"tmst\":%lu", ((unsigned long)rand() << 16) ^ (unsigned long)rand()); break;
+        default: idx += snprintf(buff + idx, size - idx, "\"tmms\":%d%09d", RAND_RANGE(1, 1999), RAND_RANGE(0, 999999999)); break;
+    }
+    idx += snprintf(buff + idx, size - idx, ",\"freq\":%d.%d,\"rfch\":%d", RAND_RANGE(400, 999), RAND_RANGE(0, 99999), RAND_RANGE(0, 1));
+    if (rand() & 1) {
+        idx += snprintf(buff + idx, size - idx, ",\"powe\":%d", RAND_RANGE(-5, 27));
+    }
+    if (RAND_RANGE(0, 9) > 0) {
+        idx += snprintf(buff + idx, size - idx, ",\"modu\":\"LORA\",\"datr\":\"SF%dBW%d\",\"codr\":\"%s\",\"ipol\":%s",
+                        RAND_RANGE(5, 12), bw[RAND_RANGE(0, 2)], codr[RAND_RANGE(0, 3)], (rand() & 1) ? "true" : "false");
+    } else {
+        idx += snprintf(buff + idx, size - idx, ",\"modu\":\"FSK\",\"datr\":%d,\"fdev\":%d", RAND_RANGE(1200, 300000), RAND_RANGE(1000, 100000));
+    }
+    if (rand() & 1) {
+        idx += snprintf(buff + idx, size - idx, ",\"prea\":%d", RAND_RANGE(0, 16));
+    }
+    if (rand() & 1) {
+        idx += snprintf(buff + idx, size - idx, ",\"ncrc\":%s", (rand() & 1) ? "true" : "false");
+    }
+    *complex = (RAND_RANGE(0, 7) == 0);
+    if (*complex == true) {
+        idx += snprintf(buff + idx, size - idx, ",\"brd\":{\"ant\":[0,1]},\"desc\":\"\\\"quoted\\\"\"");
+    }
+    idx += snprintf(buff + idx, size - idx, ",\"size\":%d,\"data\":\"%s\"}}", pkt_size, data);
+
+    return idx;
+}
+
+/* describe command line options */
+static void usage(void) {
+    printf("Available options:\n");
+    printf(" -h print this help\n");
+    printf(" -n <uint>  number of random PULL_RESP to decode [1..100000], default %d\n", DEFAULT_NB_PKT);
+}
+
+/* -------------------------------------------------------------------------- */
+/* --- MAIN FUNCTION -------------------------------------------------------- */
+
+int main_test_txpk_decoder(int argc, char **argv) {
+    int i, x;
+    unsigned int arg_u;
+    unsigned int nb_pkt = DEFAULT_NB_PKT;
+    struct lgw_pkt_tx_s pkt_dom, pkt_dec;
+    struct txpk_info_s info_dom, info_dec;
+    int x_dom, x_dec;
+    bool complex;
+    int64_t t_start;
+    int64_t t_dom = 0, t_dec = 0;
+    uint32_t alloc_dom = 0, alloc_bytes_dom = 0, alloc_dec = 0, alloc_bytes_dec = 0;
+    unsigned int nb_complex = 0, nb_fallback = 0;
+    unsigned int nb_diff = 0;
+    unsigned int nb_case_error;
+
+    optind = 0;
+
+    /* parse command line options */
+    while ((i = getopt(argc, argv, "hn:")) != -1) {
+        switch (i) {
+            case 'h':
+                usage();
+                return -1;
+            case 'n':
+                x = sscanf(optarg, "%u", &arg_u);
+                if ((x != 1) || (arg_u < 1) || (arg_u > 100000)) {
+                    printf("ERROR: argument parsing of -n argument. Use -h to print help\n");
+                    return EXIT_FAILURE;
+                } else {
+                    nb_pkt = arg_u;
+                }
+                break;
+            default:
+                printf("ERROR: argument parsing\n");
+                usage();
+                return EXIT_FAILURE;
+        }
+    }
+
+    printf("### txpk decoder: %u downlinks ###\n", nb_pkt);
+
+    nb_case_error = check_cases();
+
+    json_set_allocation_functions(count_malloc, free);
+
+    for (i = 0; i < (int)nb_pkt; i++) {
+        random_pull_resp(json, sizeof json, &complex);
+        if (complex == true) {
+            nb_complex += 1;
+        }
+
+        nb_alloc = nb_alloc_bytes = 0;
+        t_start = esp_timer_get_time();
+        x_dom = txpk_decode_dom(json, &pkt_dom, &info_dom);
+        t_dom += esp_timer_get_time() - t_start;
+        alloc_dom += nb_alloc;
+        alloc_bytes_dom += nb_alloc_bytes;
+
+        nb_alloc = nb_alloc_bytes = 0;
+        t_start = esp_timer_get_time();
+        x_dec = txpk_decode(json, &pkt_dec, &info_dec);
+        t_dec += esp_timer_get_time() - t_start;
+        alloc_dec += nb_alloc;
+        alloc_bytes_dec += nb_alloc_bytes;
+        if (info_dec.dom == true) {
+            nb_fallback += 1;
+        }
+
+        info_dom.dom = info_dec.dom;
+        if ((x_dom != x_dec) || (memcmp(&pkt_dom, &pkt_dec, sizeof pkt_dom) != 0) || (memcmp(&info_dom, &info_dec, sizeof info_dom) != 0)) {
+            if (nb_diff < 5) {
+                printf("ERROR: decoding mismatch on downlink %d: %s\n", i, json);
+            }
+            nb_diff += 1;
+        }
+    }
+
+    json_set_allocation_functions(malloc, free);
+
+    printf("parson decoder:      %.2f us/downlink, %.1f allocations, %.0f bytes/downlink\n",
+            (double)t_dom / nb_pkt, (double)alloc_dom / nb_pkt, (double)alloc_bytes_dom / nb_pkt);
+    printf("single pass decoder: %.2f us/downlink, %.1f allocations, %.0f bytes/downlink\n",
+            (double)t_dec / nb_pkt, (double)alloc_dec / nb_pkt, (double)alloc_bytes_dec / nb_pkt);
+    printf("%u/%u downlinks decoded with parson, %u expected\n", nb_fallback, nb_pkt, nb_complex);
+    printf("%u/%u downlinks with different output\n", nb_diff, nb_pkt);
+
+    return ((nb_case_error == 0) && (nb_diff == 0) && (nb_fallback == nb_complex)) ? 0 : EXIT_FAILURE;
+}
+
+void register_test_txpk_decoder(void)
+{
+    const esp_console_cmd_t test_txpk_cmd = {
+        .command = "test_txpk",
+        .help = "Test txpk JSON decoder",
+        .hint = NULL,
+        .func = &main_test_txpk_decoder,
+        .argtable = NULL,
+    };
+    ESP_ERROR_CHECK(esp_console_cmd_register(&test_txpk_cmd));
+}
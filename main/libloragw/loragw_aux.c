@@ -37,6 +37,28 @@ License: Revised BSD License, see LICENSE.TXT file include in the project
 #endif
 
 
+/* Per spreading factor constants of the LoRa time on air, for BW 125kHz:
+    - t_symbol_us: duration of a symbol (2^SF / BW)
+    - div: payload bits per symbol, times 4 (4 * (SF - 2*DE), low datarate optimization for SF11 and SF12)
+    - offset: payload bits not depending on size, header and CRC (-4*SF, +8 from SF7)
+    - quarters: preamble to header symbols, in quarters (4.25 from SF7, 6.25 below, + 8) */
+static const struct {
+    uint16_t t_symbol_us;
+    uint8_t div;
+    int8_t offset;
+    uint8_t quarters;
+} toa_sf_table[8] = {
+    {   256, 20, -20, 57 }, /* SF5 */
+    {   512, 24, -24, 57 }, /* SF6 */
+    {  1024, 28, -20, 49 }, /* SF7 */
+    {  2048, 32, -24, 49 }, /* SF8 */
+    {  4096, 36, -28, 49 }, /* SF9 */
+    {  8192, 40, -32, 49 }, /* SF10 */
+    { 16384, 36, -36, 49 }, /* SF11 */
+    { 32768, 40, -40, 49 }  /* SF12 */
+};
+
+
 // TODO: need to have a better implementation for this function
 void wait_us(unsigned long delay_us) {
     vTaskDelay(delay_us / portTICK_PERIOD_MS / 1000 );
@@ -123,6 +145,29 @@ uint32_t lora_packet_time_on_air(const uint8_t bw, const uint8_t sf, const uint8
 }
 
 
+uint32_t lora_packet_toa_us(const uint8_t bw, const uint8_t sf, const uint8_t cr, const uint16_t n_symbol_preamble,
+                            const bool no_header, const bool no_crc, const uint8_t size) {
+    int32_t n_bit;
+    uint32_t n_symbol_payload;
+    uint32_t t_symbol_us;
+
+    if ((IS_LORA_DR(sf) == false) || (IS_LORA_BW(bw) == false) || (IS_LORA_CR(cr) == false)) {
+        printf("ERROR: wrong LoRa parameters (sf:%u bw:0x%02X cr:%u) - %s\n", sf, bw, cr, __FUNCTION__);
+        return 0;
+    }
+
+    /* BW_125KHZ, BW_250KHZ and BW_500KHZ are consecutive, each halves the symbol duration */
+    t_symbol_us = toa_sf_table[sf - DR_LORA_SF5].t_symbol_us >> (bw - BW_125KHZ);
+
+    /* ceil(max(bits, 0) / bits per symbol) blocks of (CR + 4) symbols */
+    n_bit = 8 * size + toa_sf_table[sf - DR_LORA_SF5].offset + ((no_crc == false) ? 16 : 0) + ((no_header == false) ? 20 : 0);
+    n_symbol_payload = (n_bit > 0) ? ((n_bit + toa_sf_table[sf - DR_LORA_SF5].div - 1) / toa_sf_table[sf - DR_LORA_SF5].div) * (cr + 4) : 0;
+
+    /* the number of symbols is a multiple of 1/4 and t_symbol_us of 4, the product is exact */
+    return (4 * ((uint32_t)n_symbol_preamble + n_symbol_payload) + toa_sf_table[sf - DR_LORA_SF5].quarters) * (t_symbol_us / 4);
+}
+
+
 #pragma GCC diagnostic push
 #pragma GCC diagnostic ignored "-Wunused-parameter"
 void _meas_time_start(struct timeval *tm)
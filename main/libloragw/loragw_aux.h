@@ -106,6 +106,28 @@ uint32_t lora_packet_time_on_air( const uint8_t bw,
                                   uint32_t * nb_symbols_payload,
                                   uint16_t * t_symbol_us);
 
+/**
+@brief Calculate the time on air of a LoRa packet in microseconds, with integer operations only
+@param bw packet bandwidth
+@param sf packet spreading factor
+@param cr packet coding rate
+@param n_symbol_preamble packet preamble length (number of symbols)
+@param no_header true if packet has no header
+@param no_crc true if packet has no CRC
+@param size packet size in bytes
+@return the packet time on air in microseconds, the same as lora_packet_time_on_air()
+
+The constants of each spreading factor come from a table, lora_packet_time_on_air() is kept as the
+reference and for the symbol counts.
+*/
+uint32_t lora_packet_toa_us(const uint8_t bw,
+                            const uint8_t sf,
+                            const uint8_t cr,
+                            const uint16_t n_symbol_preamble,
+                            const bool no_header,
+                            const bool no_crc,
+                            const uint8_t size);
+
 /**
 @brief Record the current time, for measure start
 @param tm Pointer to the current time value
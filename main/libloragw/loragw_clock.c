@@ -0,0 +1,206 @@
+/*
+ / _____)             _              | |
+( (____  _____ ____ _| |_ _____  ____| |__
+ \____ \| ___ |    (_   _) ___ |/ ___)  _ \
+ _____) ) ____| | | || |_| ____( (___| | | |
+(______/|_____)_|_|_| \__)_____)\____)_| |_|
+  (C)2019 Semtech
+
+Description:
+    Host side model of the SX1302 free running counter.
+    Every counter read is a sample, the concentrator time between reads is
+    extrapolated from the last sample with the host monotonic clock, corrected
+    by the drift measured between samples at least LGW_CLOCK_DRIFT_WINDOW_MS
+    apart. The estimate error is measured at each read.
+
+License: Revised BSD License, see LICENSE.TXT file include in the project
+*/
+
+
+/* -------------------------------------------------------------------------- */
+/* --- DEPENDANCIES --------------------------------------------------------- */
+
+#include <stdint.h>     /* C99 types */
+#include <stdbool.h>    /* bool type */
+#include <stdio.h>      /* printf */
+#include <string.h>     /* memset */
+#include <math.h>       /* llround */
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+
+#include "loragw_clock.h"
+#include "loragw_hal.h"
+
+/* -------------------------------------------------------------------------- */
+/* --- PRIVATE MACROS ------------------------------------------------------- */
+
+#if DEBUG_CLOCK == 1
+    #define DEBUG_MSG(str)                fprintf(stdout, str)
+    #define DEBUG_PRINTF(fmt, args...)    fprintf(stdout,"%s:%d: "fmt, __FUNCTION__, __LINE__, args)
+#else
+    #define DEBUG_MSG(str)
+    #define DEBUG_PRINTF(fmt, args...)
+#endif
+
+/* -------------------------------------------------------------------------- */
+/* --- PRIVATE CONSTANTS ---------------------------------------------------- */
+
+#define CLOCK_JUMP_US   (10 * LGW_CLOCK_ERROR_MAX_US) /* beyond this error, the counter restarted: measure the drift again */
+
+/* -------------------------------------------------------------------------- */
+/* --- PRIVATE VARIABLES ---------------------------------------------------- */
+
+static SemaphoreHandle_t mx_clock = NULL; /* the model is updated under the HAL caller lock, but read from any task */
+
+static struct {
+    bool        valid;          /* a counter read is available */
+    uint32_t    count_us;       /* last counter read */
+    int64_t     host_us;        /* host time of the last counter read */
+    bool        rate_valid;     /* a drift has been measured */
+    double      rate;           /* concentrator microseconds per host microsecond */
+    uint32_t    anchor_count_us; /* counter read the next drift is measured from */
+    int64_t     anchor_host_us;
+    struct lgw_clock_stat_s stat;
+} clock_model;
+
+/* -------------------------------------------------------------------------- */
+/* --- PRIVATE FUNCTIONS DEFINITION ----------------------------------------- */
+
+static bool clock_fresh(int64_t host_us) {
+    return (clock_model.valid == true) && ((host_us - clock_model.host_us) <= (LGW_CLOCK_RESYNC_MS * 1000LL));
+}
+
+static uint32_t clock_extrapolate(int64_t host_us) {
+    return clock_model.count_us + (uint32_t)llround((double)(host_us - clock_model.host_us) * clock_model.rate);
+}
+
+/* -------------------------------------------------------------------------- */
+/* --- PUBLIC FUNCTIONS DEFINITION ------------------------------------------ */
+
+void lgw_clock_reset(void) {
+    if (mx_clock == NULL) {
+        mx_clock = xSemaphoreCreateMutex();
+        if (mx_clock == NULL) {
+            printf("ERROR: failed to create clock model mutex\n");
+            return;
+        }
+    }
+
+    xSemaphoreTake(mx_clock, portMAX_DELAY);
+    memset(&clock_model, 0, sizeof clock_model);
+    clock_model.rate = 1.0;
+    xSemaphoreGive(mx_clock);
+}
+
+void lgw_clock_sample(uint32_t count_us, int64_t host_us) {
+    int32_t err_us;
+    uint32_t abs_err_us;
+    double rate;
+
+    if (mx_clock == NULL) {
+        return;
+    }
+
+    xSemaphoreTake(mx_clock, portMAX_DELAY);
+
+    clock_model.stat.nb_sample += 1;
+
+    /* measure the error of the estimate that could have been given just before this read */
+    if (clock_fresh(host_us) == true) {
+        err_us = TMST_DIFF(count_us, clock_extrapolate(host_us));
+        abs_err_us = (err_us < 0) ? -(uint32_t)err_us : (uint32_t)err_us;
+        if (abs_err_us > clock_model.stat.err_max_us) {
+            clock_model.stat.err_max_us = abs_err_us;
+        }
+        if (abs_err_us > LGW_CLOCK_ERROR_MAX_US) {
+            clock_model.stat.nb_over_budget += 1;
+            DEBUG_PRINTF("WARNING: clock estimate was %d us off\n", err_us);
+        }
+        if (abs_err_us > CLOCK_JUMP_US) {
+            clock_model.anchor_host_us = host_us;
+            clock_model.anchor_count_us = count_us;
+        }
+    } else if (clock_model.valid == false) {
+        clock_model.anchor_host_us = host_us;
+        clock_model.anchor_count_us = count_us;
+    }
+
+    /* measure the drift over a window long enough for the read latency to be negligible */
+    if ((host_us - clock_model.anchor_host_us) >= (LGW_CLOCK_DRIFT_WINDOW_MS * 1000LL)) {
+        rate = (double)(count_us - clock_model.anchor_count_us) / (double)(host_us - clock_model.anchor_host_us);
+        if (clock_model.rate_valid == true) {
+            clock_model.rate += (rate - clock_model.rate) / LGW_CLOCK_DRIFT_FILT_COEF;
+        } else {
+            clock_model.rate = rate;
+            clock_model.rate_valid = true;
+        }
+        clock_model.stat.drift_ppm = (clock_model.rate - 1.0) * 1E6;
+        clock_model.anchor_host_us = host_us;
+        clock_model.anchor_count_us = count_us;
+    }
+
+    clock_model.count_us = count_us;
+    clock_model.host_us = host_us;
+    clock_model.valid = true;
+
+    xSemaphoreGive(mx_clock);
+}
+
+bool lgw_clock_estimate(int64_t host_us, uint32_t *count_us) {
+    bool fresh;
+
+    if (mx_clock == NULL) {
+        return false;
+    }
+
+    xSemaphoreTake(mx_clock, portMAX_DELAY);
+
+    fresh = clock_fresh(host_us);
+    if (fresh == true) {
+        *count_us = clock_extrapolate(host_us);
+        clock_model.stat.nb_estimate += 1;
+    } else {
+        clock_model.stat.nb_stale += 1;
+    }
+
+    xSemaphoreGive(mx_clock);
+
+    return fresh;
+}
+
+bool lgw_clock_is_fresh(int64_t host_us) {
+    bool fresh;
+
+    if (mx_clock == NULL) {
+        return false;
+    }
+
+    xSemaphoreTake(mx_clock, portMAX_DELAY);
+    fresh = clock_fresh(host_us);
+    xSemaphoreGive(mx_clock);
+
+    return fresh;
+}
+
+void lgw_clock_get_stat(struct lgw_clock_stat_s *stat, bool reset) {
+    if (mx_clock == NULL) {
+        memset(stat, 0, sizeof *stat);
+        return;
+    }
+
+    xSemaphoreTake(mx_clock, portMAX_DELAY);
+
+    *stat = clock_model.stat;
+    if (reset == true) {
+        clock_model.stat.nb_estimate = 0;
+        clock_model.stat.nb_stale = 0;
+        clock_model.stat.nb_sample = 0;
+        clock_model.stat.nb_over_budget = 0;
+        clock_model.stat.err_max_us = 0;
+    }
+
+    xSemaphoreGive(mx_clock);
+}
+
+/* --- EOF ------------------------------------------------------------------ */
@@ -0,0 +1,91 @@
+/*
+ / _____)             _              | |
+( (____  _____ ____ _| |_ _____  ____| |__
+ \____ \| ___ |    (_   _) ___ |/ ___)  _ \
+ _____) ) ____| | | || |_| ____( (___| | | |
+(______/|_____)_|_|_| \__)_____)\____)_| |_|
+  (C)2019 Semtech
+
+Description:
+    Host side model of the SX1302 free running counter, to get the current
+    concentrator time without SPI access when microsecond accuracy is not needed
+
+License: Revised BSD License, see LICENSE.TXT file include in the project
+*/
+
+
+#ifndef _LORAGW_CLOCK_H
+#define _LORAGW_CLOCK_H
+
+/* -------------------------------------------------------------------------- */
+/* --- DEPENDANCIES --------------------------------------------------------- */
+
+#include <stdint.h>     /* C99 types */
+#include <stdbool.h>    /* bool type */
+
+#include "config.h"     /* library configuration options (dynamically generated) */
+
+/* -------------------------------------------------------------------------- */
+/* --- PUBLIC CONSTANTS ----------------------------------------------------- */
+
+#define LGW_CLOCK_RESYNC_MS         1000    /* max age of the last counter read for an estimate to be given */
+#define LGW_CLOCK_ERROR_MAX_US      100     /* error budget of an estimate, checked at each counter read */
+#define LGW_CLOCK_DRIFT_WINDOW_MS   10000   /* min time between the two counter reads a drift is measured on */
+#define LGW_CLOCK_DRIFT_FILT_COEF   4       /* coefficient for low-pass drift tracking */
+
+/* -------------------------------------------------------------------------- */
+/* --- PUBLIC TYPES --------------------------------------------------------- */
+
+/**
+@struct lgw_clock_stat_s
+@brief Clock model statistics, the error is measured at every counter read
+*/
+struct lgw_clock_stat_s {
+    uint32_t nb_estimate;       /*!> concentrator times given without SPI access */
+    uint32_t nb_stale;          /*!> estimates refused, the last counter read being too old */
+    uint32_t nb_sample;         /*!> counter reads fed to the model */
+    uint32_t nb_over_budget;    /*!> counter reads which were more than LGW_CLOCK_ERROR_MAX_US away from the estimate */
+    uint32_t err_max_us;        /*!> largest estimate error measured at a counter read */
+    double   drift_ppm;         /*!> concentrator clock rate relative to the host clock */
+};
+
+/* -------------------------------------------------------------------------- */
+/* --- PUBLIC FUNCTIONS PROTOTYPES ------------------------------------------ */
+
+/**
+@brief Forget all counter reads, to be called when the concentrator counter restarts
+*/
+void lgw_clock_reset(void);
+
+/**
+@brief Feed the model with a counter read
+@param count_us     32-bits concentrator counter value
+@param host_us      host monotonic time of the read (esp_timer_get_time)
+*/
+void lgw_clock_sample(uint32_t count_us, int64_t host_us);
+
+/**
+@brief Estimate the concentrator counter at a given host time
+@param host_us      host monotonic time (esp_timer_get_time)
+@param count_us     pointer to return the estimated 32-bits concentrator counter
+@return false if there was no counter read in the last LGW_CLOCK_RESYNC_MS, the counter has to be read
+*/
+bool lgw_clock_estimate(int64_t host_us, uint32_t *count_us);
+
+/**
+@brief Check if an estimate could be given at a given host time, without counting it in the statistics
+@param host_us      host monotonic time (esp_timer_get_time)
+@return false if there was no counter read in the last LGW_CLOCK_RESYNC_MS, the counter has to be read
+*/
+bool lgw_clock_is_fresh(int64_t host_us);
+
+/**
+@brief Get the clock model statistics
+@param stat     pointer to return the statistics
+@param reset    reset the counters and the max error once copied
+*/
+void lgw_clock_get_stat(struct lgw_clock_stat_s *stat, bool reset);
+
+#endif
+
+/* --- EOF ------------------------------------------------------------------ */
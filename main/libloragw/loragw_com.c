@@ -20,6 +20,9 @@ License: Revised BSD License, see LICENSE.TXT file include in the project
 
 #include <stdint.h>     /* C99 types */
 #include <stdio.h>      /* printf fprintf */
+#include <string.h>     /* memset */
+
+#include "esp_timer.h"
 
 #include "loragw_com.h"
 #include "loragw_usb.h"
@@ -56,6 +59,11 @@ static lgw_com_type_t _lgw_com_type = LGW_COM_UNKNOWN;
 */
 static void *_lgw_com_target = NULL;
 
+/**
+@brief Host time the last burst read started with lgw_com_rb_start() completed, USB only
+*/
+static int64_t _lgw_com_rb_done_us = 0;
+
 /* -------------------------------------------------------------------------- */
 /* --- PUBLIC FUNCTIONS DEFINITION ------------------------------------------ */
 
@@ -294,12 +302,65 @@ int lgw_com_rb(uint8_t spi_mux_target, uint16_t address, uint8_t *data, uint16_t
 
 /* ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~ */
 
+int lgw_com_rb_start(uint8_t spi_mux_target, uint16_t address, uint8_t *data, uint16_t size) {
+    int com_stat;
+
+    /* Check input parameters */
+    CHECK_NULL(_lgw_com_target);
+    CHECK_NULL(data);
+
+    switch (_lgw_com_type) {
+        case LGW_COM_SPI:
+            com_stat = lgw_spi_rb_start((spi_device_handle_t *)_lgw_com_target, spi_mux_target, address, data, size);
+            break;
+        case LGW_COM_USB:
+            /* no background transfer on USB, the read is done now */
+            com_stat = lgw_usb_rb(_lgw_com_target, spi_mux_target, address, data, size);
+            _lgw_com_rb_done_us = esp_timer_get_time();
+            break;
+        default:
+            printf("ERROR(%s:%d): wrong communication type (SHOULD NOT HAPPEN)\n", __FUNCTION__, __LINE__);
+            com_stat = LGW_COM_ERROR;
+            break;
+    }
+
+    return com_stat;
+}
+
+/* ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~ */
+
+int lgw_com_rb_wait(int64_t *done_us) {
+    int com_stat = LGW_COM_SUCCESS;
+
+    /* Check input parameters */
+    CHECK_NULL(_lgw_com_target);
+
+    switch (_lgw_com_type) {
+        case LGW_COM_SPI:
+            com_stat = lgw_spi_rb_wait((spi_device_handle_t *)_lgw_com_target, done_us);
+            break;
+        case LGW_COM_USB:
+            if (done_us != NULL) {
+                *done_us = _lgw_com_rb_done_us;
+            }
+            break;
+        default:
+            printf("ERROR(%s:%d): wrong communication type (SHOULD NOT HAPPEN)\n", __FUNCTION__, __LINE__);
+            com_stat = LGW_COM_ERROR;
+            break;
+    }
+
+    return com_stat;
+}
+
+/* ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~ */
+
 int lgw_com_set_write_mode(lgw_com_write_mode_t write_mode) {
     int com_stat = LGW_COM_SUCCESS;
 
     switch (_lgw_com_type) {
         case LGW_COM_SPI:
-            /* Do nothing: only single mode is supported on SPI */
+            com_stat = lgw_spi_set_write_mode((spi_device_handle_t *)_lgw_com_target, write_mode);
             break;
         case LGW_COM_USB:
             com_stat = lgw_usb_set_write_mode(write_mode);
@@ -320,7 +381,7 @@ int lgw_com_flush(void) {
 
     switch (_lgw_com_type) {
         case LGW_COM_SPI:
-            /* Do nothing: only single mode is supported on SPI */
+            com_stat = lgw_spi_flush((spi_device_handle_t *)_lgw_com_target);
             break;
         case LGW_COM_USB:
             com_stat = lgw_usb_flush(_lgw_com_target);
@@ -336,6 +397,27 @@ int lgw_com_flush(void) {
 
 /* ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~ */
 
+int lgw_com_get_bulk_stat(struct lgw_com_bulk_stat_s *stat, bool reset) {
+    int com_stat = LGW_COM_SUCCESS;
+
+    switch (_lgw_com_type) {
+        case LGW_COM_SPI:
+            lgw_spi_get_bulk_stat(stat, reset);
+            break;
+        case LGW_COM_USB:
+            memset(stat, 0, sizeof *stat);
+            break;
+        default:
+            printf("ERROR(%s:%d): wrong communication type (SHOULD NOT HAPPEN)\n", __FUNCTION__, __LINE__);
+            com_stat = LGW_COM_ERROR;
+            break;
+    }
+
+    return com_stat;
+}
+
+/* ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~ */
+
 uint16_t lgw_com_chunk_size(void) {
     switch (_lgw_com_type) {
         case LGW_COM_SPI:
@@ -22,6 +22,7 @@ License: Revised BSD License, see LICENSE.TXT file include in the project
 /* --- DEPENDANCIES --------------------------------------------------------- */
 
 #include <stdint.h>   /* C99 types*/
+#include <stdbool.h>  /* bool type */
 
 #include "config.h"   /* library configuration options (dynamically generated) */
 
@@ -50,6 +51,11 @@ typedef enum com_write_mode_e {
     LGW_COM_WRITE_MODE_UNKNOWN
 } lgw_com_write_mode_t;
 
+struct lgw_com_bulk_stat_s {
+    uint32_t nb_write;  /*!> single writes queued in bulk write mode */
+    uint32_t nb_trans;  /*!> transactions sent for them, adjacent writes being merged in bursts */
+};
+
 /* -------------------------------------------------------------------------- */
 /* --- PUBLIC FUNCTIONS PROTOTYPES ------------------------------------------ */
 
@@ -88,6 +94,24 @@ int lgw_com_wb(uint8_t spi_mux_target, uint16_t address, const uint8_t *data, ui
 */
 int lgw_com_rb(uint8_t spi_mux_target, uint16_t address, uint8_t *data, uint16_t size);
 
+/**
+@brief Start a burst read, the caller keeps running until lgw_com_rb_wait()
+@param spi_mux_target SPI target
+@param address address of the burst read
+@param data pointer to byte array to be filled, untouched until the read is done
+@param size size of the transfer, in byte(s)
+@return LGW_COM_SUCCESS or LGW_COM_ERROR
+Only done in the background on SPI, other accesses wait for the read in progress.
+*/
+int lgw_com_rb_start(uint8_t spi_mux_target, uint16_t address, uint8_t *data, uint16_t size);
+
+/**
+@brief Wait for the burst reads started with lgw_com_rb_start()
+@param done_us host time the last read completed, can be NULL
+@return LGW_COM_SUCCESS or LGW_COM_ERROR
+*/
+int lgw_com_rb_wait(int64_t *done_us);
+
 /**
  *
 */
@@ -98,6 +122,14 @@ int lgw_com_set_write_mode(lgw_com_write_mode_t write_mode);
 */
 int lgw_com_flush(void);
 
+/**
+@brief Get the bulk write mode statistics, to measure how many transactions write combining saves
+@param stat pointer to the statistics to be filled
+@param reset reset the statistics once read
+@return LGW_COM_SUCCESS or LGW_COM_ERROR
+*/
+int lgw_com_get_bulk_stat(struct lgw_com_bulk_stat_s *stat, bool reset);
+
 /**
  *
 */
@@ -14,6 +14,7 @@ License: Revised BSD License, see LICENSE.TXT file include in the project
 
 #include "loragw_gpio.h"
 #include "loragw_aux.h"
+#include "loragw_reg.h"
 
 
 void lgw_reset(void)
@@ -32,4 +33,7 @@ void lgw_reset(void)
     wait_ms(100);
     gpio_set_level(SX1302_RESET_PIN, 0);
     wait_ms(100);
+
+    /* registers are back to their default values */
+    lgw_reg_shadow_reset(true);
 }
@@ -42,10 +42,13 @@ License: Revised BSD License, see LICENSE.TXT file include in the project
 #include "loragw_sx1261.h"
 #include "loragw_sx1302.h"
 #include "loragw_sx1302_timestamp.h"
+#include "loragw_clock.h"
 #include "loragw_stts751.h"
 #include "loragw_ad5338r.h"
 #include "loragw_debug.h"
 
+#include "esp_timer.h"
+
 /* -------------------------------------------------------------------------- */
 /* --- DEBUG CONSTANTS ------------------------------------------------------ */
 
@@ -212,6 +215,8 @@ int32_t lgw_bw_getval(int x);
 static bool is_same_pkt(struct lgw_pkt_rx_s *p1, struct lgw_pkt_rx_s *p2);
 static int remove_pkt(struct lgw_pkt_rx_s * p, uint8_t * nb_pkt, uint8_t pkt_index);
 static int merge_packets(struct lgw_pkt_rx_s * p, uint8_t * nb_pkt);
+static int receive_packets(uint8_t max_pkt, struct lgw_pkt_rx_desc_s * desc, struct lgw_pkt_rx_s * pkt_data);
+static int modems_configure(void);
 
 /* -------------------------------------------------------------------------- */
 /* --- PRIVATE FUNCTIONS DEFINITION ----------------------------------------- */
@@ -251,7 +256,7 @@ static bool is_same_pkt(struct lgw_pkt_rx_s *p1, struct lgw_pkt_rx_s *p2) {
             -- datarate should be same
             -- payload should be same
         */
-        if ((abs((int)(p1->count_us - p2->count_us)) <= 24) &&
+        if ((abs(TMST_DIFF(p1->count_us, p2->count_us)) <= 24) &&
             (p1->if_chain == p2->if_chain) &&
             (p1->datarate == p2->datarate) &&
             (p1->size == p2->size) &&
@@ -296,16 +301,16 @@ int compare_pkt_tmst(const void *a, const void *b, void *arg)
     struct lgw_pkt_rx_s *p = (struct lgw_pkt_rx_s *)a;
     struct lgw_pkt_rx_s *q = (struct lgw_pkt_rx_s *)b;
     int *counter = (int *)arg;
-    int p_count, q_count;
-
-    p_count = p->count_us;
-    q_count = q->count_us;
 
-    if (p_count > q_count) {
+    /* packets of a fetch are a few seconds apart at most: serial number order holds across the counter roll-over */
+    if (TMST_BEFORE(q->count_us, p->count_us)) {
         *counter = *counter + 1;
+        return 1;
+    } else if (TMST_BEFORE(p->count_us, q->count_us)) {
+        return -1;
+    } else {
+        return 0;
     }
-
-    return (p_count - q_count);
 }
 
 /* ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~ */
@@ -439,6 +444,165 @@ static int merge_packets(struct lgw_pkt_rx_s * p, uint8_t * nb_pkt) {
     return 0;
 }
 
+/* ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~ */
+
+/* fetch and parse packets, either as descriptors (desc) or copied with their payload (pkt_data) */
+static int receive_packets(uint8_t max_pkt, struct lgw_pkt_rx_desc_s * desc, struct lgw_pkt_rx_s * pkt_data) {
+    int res;
+    uint8_t nb_pkt_fetched = 0;
+    uint8_t nb_pkt_found = 0;
+    uint8_t nb_pkt_left = 0;
+    struct lgw_pkt_rx_desc_s pkt_desc;
+    struct lgw_pkt_rx_desc_s *d;
+    // float current_temperature = 0.0, rssi_temperature_offset = 0.0;
+
+    /* Get packets from SX1302, if any */
+    res = sx1302_fetch(&nb_pkt_fetched);
+    if (res != LGW_REG_SUCCESS) {
+        printf("ERROR: failed to fetch packets from SX1302\n");
+        return LGW_HAL_ERROR;
+    }
+
+    /* Update internal counter */
+    /* WARNING: this needs to be called regularly by the upper layer */
+    /* The counter is only read when it matters: packets timestamps are expanded from a fresh
+       counter value, fine timestamps need the PPS history. Otherwise, reading it once per
+       LGW_CLOCK_RESYNC_MS is enough to follow its wrapping and keep the clock model in sync. */
+    if ((nb_pkt_fetched > 0) || (CONTEXT_FINE_TIMESTAMP.enable == true) || (lgw_clock_is_fresh(esp_timer_get_time()) == false)) {
+        res = sx1302_update();
+        if (res != LGW_REG_SUCCESS) {
+            return LGW_HAL_ERROR;
+        }
+    }
+
+    /* Exit now if no packet fetched */
+    if (nb_pkt_fetched == 0) {
+        return 0;
+    }
+    if (nb_pkt_fetched > max_pkt) {
+        nb_pkt_left = nb_pkt_fetched - max_pkt;
+        printf("WARNING: not enough space allocated, fetched %d packet(s), %d will be left in RX buffer\n", nb_pkt_fetched, nb_pkt_left);
+    }
+
+    /* Iterate on the RX buffer to get parsed packets */
+    for (nb_pkt_found = 0; nb_pkt_found < ((nb_pkt_fetched <= max_pkt) ? nb_pkt_fetched : max_pkt); nb_pkt_found++) {
+        d = (desc != NULL) ? &desc[nb_pkt_found] : &pkt_desc;
+
+        /* Get packet and move to next one */
+        res = sx1302_parse(&lgw_context, d);
+        if (res == LGW_REG_WARNING) {
+            printf("WARNING: parsing error on packet %d, discarding fetched packets\n", nb_pkt_found);
+            return LGW_HAL_SUCCESS;
+        } else if (res == LGW_REG_ERROR) {
+            printf("ERROR: fatal parsing error on packet %d, aborting...\n", nb_pkt_found);
+            return LGW_HAL_ERROR;
+        }
+
+        /* Appli RSSI offset calibrated for the board */
+        d->rssic += CONTEXT_RF_CHAIN[d->rf_chain].rssi_offset;
+        d->rssis += CONTEXT_RF_CHAIN[d->rf_chain].rssi_offset;
+
+        // rssi_temperature_offset = sx1302_rssi_get_temperature_offset(&CONTEXT_RF_CHAIN[d->rf_chain].rssi_tcomp, current_temperature);
+        // d->rssic += rssi_temperature_offset;
+        // d->rssis += rssi_temperature_offset;
+        // DEBUG_PRINTF("INFO: RSSI temperature offset applied: %.3f dB (current temperature %.1f C)\n", rssi_temperature_offset, current_temperature);
+
+        if (pkt_data != NULL) {
+            lgw_pkt_rx_from_desc(&pkt_data[nb_pkt_found], d);
+        }
+    }
+
+    DEBUG_PRINTF("INFO: nb pkt found:%u left:%u\n", nb_pkt_found, nb_pkt_left);
+
+    /* Packets keep coming: the next ones are fetched while the caller handles these */
+    res = sx1302_prefetch();
+    if (res != LGW_REG_SUCCESS) {
+        printf("ERROR: failed to start fetching packets from SX1302\n");
+        return LGW_HAL_ERROR;
+    }
+
+    return nb_pkt_found;
+}
+
+/* ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~ */
+
+/* modem configuration of lgw_start(), its writes are queued in bulk mode by the caller */
+static int modems_configure(void) {
+    int err;
+
+    /* Configure PA/LNA LUTs */
+    err = sx1302_pa_lna_lut_configure(&CONTEXT_BOARD);
+    if (err != LGW_REG_SUCCESS) {
+        printf("ERROR: failed to configure SX1302 PA/LNA LUT\n");
+        return LGW_HAL_ERROR;
+    }
+
+    /* Configure Radio FE */
+    err = sx1302_radio_fe_configure();
+    if (err != LGW_REG_SUCCESS) {
+        printf("ERROR: failed to configure SX1302 radio frontend\n");
+        return LGW_HAL_ERROR;
+    }
+
+    /* Configure the Channelizer */
+    err = sx1302_channelizer_configure(CONTEXT_IF_CHAIN, false);
+    if (err != LGW_REG_SUCCESS) {
+        printf("ERROR: failed to configure SX1302 channelizer\n");
+        return LGW_HAL_ERROR;
+    }
+
+    /* configure LoRa 'multi-sf' modems */
+    err = sx1302_lora_correlator_configure(CONTEXT_IF_CHAIN, &(CONTEXT_DEMOD));
+    if (err != LGW_REG_SUCCESS) {
+        printf("ERROR: failed to configure SX1302 LoRa modem correlators\n");
+        return LGW_HAL_ERROR;
+    }
+    err = sx1302_lora_modem_configure(CONTEXT_RF_CHAIN[0].freq_hz);
+    if (err != LGW_REG_SUCCESS) {
+        printf("ERROR: failed to configure SX1302 LoRa modems\n");
+        return LGW_HAL_ERROR;
+    }
+
+    /* configure LoRa 'single-sf' modem */
+    if (CONTEXT_IF_CHAIN[8].enable == true) {
+        err = sx1302_lora_service_correlator_configure(&(CONTEXT_LORA_SERVICE));
+        if (err != LGW_REG_SUCCESS) {
+            printf("ERROR: failed to configure SX1302 LoRa Service modem correlators\n");
+            return LGW_HAL_ERROR;
+        }
+        err = sx1302_lora_service_modem_configure(&(CONTEXT_LORA_SERVICE), CONTEXT_RF_CHAIN[0].freq_hz);
+        if (err != LGW_REG_SUCCESS) {
+            printf("ERROR: failed to configure SX1302 LoRa Service modem\n");
+            return LGW_HAL_ERROR;
+        }
+    }
+
+    /* configure FSK modem */
+    if (CONTEXT_IF_CHAIN[9].enable == true) {
+        err = sx1302_fsk_configure(&(CONTEXT_FSK));
+        if (err != LGW_REG_SUCCESS) {
+            printf("ERROR: failed to configure SX1302 FSK modem\n");
+            return LGW_HAL_ERROR;
+        }
+    }
+
+    /* configure syncword */
+    err = sx1302_lora_syncword(CONTEXT_LWAN_PUBLIC, CONTEXT_LORA_SERVICE.datarate);
+    if (err != LGW_REG_SUCCESS) {
+        printf("ERROR: failed to configure SX1302 LoRa syncword\n");
+        return LGW_HAL_ERROR;
+    }
+
+    /* enable demodulators - to be done before starting AGC/ARB */
+    err = sx1302_modem_enable();
+    if (err != LGW_REG_SUCCESS) {
+        printf("ERROR: failed to enable SX1302 modems\n");
+        return LGW_HAL_ERROR;
+    }
+
+    return LGW_HAL_SUCCESS;
+}
+
 /* -------------------------------------------------------------------------- */
 /* --- PUBLIC FUNCTIONS DEFINITION ------------------------------------------ */
 
@@ -838,7 +1002,7 @@ int lgw_debug_setconf(struct lgw_conf_debug_s * conf) {
 /* ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~ */
 
 int lgw_start(void) {
-    int i, err;
+    int i, err, x;
     uint8_t fw_version_agc;
 
     DEBUG_PRINTF(" --- %s\n", "IN");
@@ -925,73 +1089,22 @@ int lgw_start(void) {
         return LGW_HAL_ERROR;
     }
 
-    /* Configure PA/LNA LUTs */
-    err = sx1302_pa_lna_lut_configure(&CONTEXT_BOARD);
-    if (err != LGW_REG_SUCCESS) {
-        printf("ERROR: failed to configure SX1302 PA/LNA LUT\n");
-        return LGW_HAL_ERROR;
-    }
-
-    /* Configure Radio FE */
-    err = sx1302_radio_fe_configure();
-    if (err != LGW_REG_SUCCESS) {
-        printf("ERROR: failed to configure SX1302 radio frontend\n");
+    /* Queue the modem configuration writes, no delay is needed between them (speeds up configuration on SPI and USB) */
+    err = lgw_com_set_write_mode(LGW_COM_WRITE_MODE_BULK);
+    if (err != LGW_COM_SUCCESS) {
+        printf("ERROR: failed to set bulk write mode\n");
         return LGW_HAL_ERROR;
     }
 
-    /* Configure the Channelizer */
-    err = sx1302_channelizer_configure(CONTEXT_IF_CHAIN, false);
-    if (err != LGW_REG_SUCCESS) {
-        printf("ERROR: failed to configure SX1302 channelizer\n");
-        return LGW_HAL_ERROR;
-    }
-
-    /* configure LoRa 'multi-sf' modems */
-    err = sx1302_lora_correlator_configure(CONTEXT_IF_CHAIN, &(CONTEXT_DEMOD));
-    if (err != LGW_REG_SUCCESS) {
-        printf("ERROR: failed to configure SX1302 LoRa modem correlators\n");
-        return LGW_HAL_ERROR;
-    }
-    err = sx1302_lora_modem_configure(CONTEXT_RF_CHAIN[0].freq_hz);
-    if (err != LGW_REG_SUCCESS) {
-        printf("ERROR: failed to configure SX1302 LoRa modems\n");
-        return LGW_HAL_ERROR;
-    }
-
-    /* configure LoRa 'single-sf' modem */
-    if (CONTEXT_IF_CHAIN[8].enable == true) {
-        err = sx1302_lora_service_correlator_configure(&(CONTEXT_LORA_SERVICE));
-        if (err != LGW_REG_SUCCESS) {
-            printf("ERROR: failed to configure SX1302 LoRa Service modem correlators\n");
-            return LGW_HAL_ERROR;
-        }
-        err = sx1302_lora_service_modem_configure(&(CONTEXT_LORA_SERVICE), CONTEXT_RF_CHAIN[0].freq_hz);
-        if (err != LGW_REG_SUCCESS) {
-            printf("ERROR: failed to configure SX1302 LoRa Service modem\n");
-            return LGW_HAL_ERROR;
-        }
-    }
-
-    /* configure FSK modem */
-    if (CONTEXT_IF_CHAIN[9].enable == true) {
-        err = sx1302_fsk_configure(&(CONTEXT_FSK));
-        if (err != LGW_REG_SUCCESS) {
-            printf("ERROR: failed to configure SX1302 FSK modem\n");
-            return LGW_HAL_ERROR;
-        }
-    }
+    err = modems_configure();
 
-    /* configure syncword */
-    err = sx1302_lora_syncword(CONTEXT_LWAN_PUBLIC, CONTEXT_LORA_SERVICE.datarate);
-    if (err != LGW_REG_SUCCESS) {
-        printf("ERROR: failed to configure SX1302 LoRa syncword\n");
+    /* Flush the configuration writes, back to single write mode, also after a failed step: the register shadow holds the queued values */
+    x = lgw_com_flush();
+    if (err != LGW_HAL_SUCCESS) {
         return LGW_HAL_ERROR;
     }
-
-    /* enable demodulators - to be done before starting AGC/ARB */
-    err = sx1302_modem_enable();
-    if (err != LGW_REG_SUCCESS) {
-        printf("ERROR: failed to enable SX1302 modems\n");
+    if (x != LGW_COM_SUCCESS) {
+        printf("ERROR: failed to flush the configuration writes\n");
         return LGW_HAL_ERROR;
     }
 
@@ -1222,10 +1335,7 @@ int lgw_stop(void) {
 
 int lgw_receive(uint8_t max_pkt, struct lgw_pkt_rx_s *pkt_data) {
     int res;
-    uint8_t nb_pkt_fetched = 0;
     uint8_t nb_pkt_found = 0;
-    uint8_t nb_pkt_left = 0;
-    // float current_temperature = 0.0, rssi_temperature_offset = 0.0;
     /* performances variables */
     struct timeval tm;
 
@@ -1234,53 +1344,13 @@ int lgw_receive(uint8_t max_pkt, struct lgw_pkt_rx_s *pkt_data) {
     /* Record function start time */
     _meas_time_start(&tm);
 
-    /* Get packets from SX1302, if any */
-    res = sx1302_fetch(&nb_pkt_fetched);
-    if (res != LGW_REG_SUCCESS) {
-        printf("ERROR: failed to fetch packets from SX1302\n");
-        return LGW_HAL_ERROR;
-    }
-
-    /* Update internal counter */
-    /* WARNING: this needs to be called regularly by the upper layer */
-    res = sx1302_update();
-    if (res != LGW_REG_SUCCESS) {
-        return LGW_HAL_ERROR;
-    }
-
-    /* Exit now if no packet fetched */
-    if (nb_pkt_fetched == 0) {
+    /* Get packets from SX1302, if any, and copy them with their payload */
+    res = receive_packets(max_pkt, NULL, pkt_data);
+    if (res <= 0) {
         _meas_time_stop(1, tm, __FUNCTION__);
-        return 0;
-    }
-    if (nb_pkt_fetched > max_pkt) {
-        nb_pkt_left = nb_pkt_fetched - max_pkt;
-        printf("WARNING: not enough space allocated, fetched %d packet(s), %d will be left in RX buffer\n", nb_pkt_fetched, nb_pkt_left);
+        return res;
     }
-
-    /* Iterate on the RX buffer to get parsed packets */
-    for (nb_pkt_found = 0; nb_pkt_found < ((nb_pkt_fetched <= max_pkt) ? nb_pkt_fetched : max_pkt); nb_pkt_found++) {
-        /* Get packet and move to next one */
-        res = sx1302_parse(&lgw_context, &pkt_data[nb_pkt_found]);
-        if (res == LGW_REG_WARNING) {
-            printf("WARNING: parsing error on packet %d, discarding fetched packets\n", nb_pkt_found);
-            return LGW_HAL_SUCCESS;
-        } else if (res == LGW_REG_ERROR) {
-            printf("ERROR: fatal parsing error on packet %d, aborting...\n", nb_pkt_found);
-            return LGW_HAL_ERROR;
-        }
-
-        /* Appli RSSI offset calibrated for the board */
-        pkt_data[nb_pkt_found].rssic += CONTEXT_RF_CHAIN[pkt_data[nb_pkt_found].rf_chain].rssi_offset;
-        pkt_data[nb_pkt_found].rssis += CONTEXT_RF_CHAIN[pkt_data[nb_pkt_found].rf_chain].rssi_offset;
-
-        // rssi_temperature_offset = sx1302_rssi_get_temperature_offset(&CONTEXT_RF_CHAIN[pkt_data[nb_pkt_found].rf_chain].rssi_tcomp, current_temperature);
-        // pkt_data[nb_pkt_found].rssic += rssi_temperature_offset;
-        // pkt_data[nb_pkt_found].rssis += rssi_temperature_offset;
-        // DEBUG_PRINTF("INFO: RSSI temperature offset applied: %.3f dB (current temperature %.1f C)\n", rssi_temperature_offset, current_temperature);
-    }
-
-    DEBUG_PRINTF("INFO: nb pkt found:%u left:%u\n", nb_pkt_found, nb_pkt_left);
+    nb_pkt_found = (uint8_t)res;
 
     /* Remove duplicated packets generated by double demod when precision timestamp is enabled */
     if ((nb_pkt_found > 0) && (CONTEXT_FINE_TIMESTAMP.enable == true)) {
@@ -1301,6 +1371,62 @@ int lgw_receive(uint8_t max_pkt, struct lgw_pkt_rx_s *pkt_data) {
 
 /* ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~ */
 
+int lgw_receive_desc(uint8_t max_pkt, struct lgw_pkt_rx_desc_s *desc) {
+    int res;
+    /* performances variables */
+    struct timeval tm;
+
+    DEBUG_PRINTF(" --- %s\n", "IN");
+
+    CHECK_NULL(desc);
+
+    /* Duplicates from double demodulation would have to be merged */
+    if (CONTEXT_FINE_TIMESTAMP.enable == true) {
+        printf("ERROR: packet descriptors not supported with fine timestamp, use lgw_receive()\n");
+        return LGW_HAL_ERROR;
+    }
+
+    /* Record function start time */
+    _meas_time_start(&tm);
+
+    /* Get packets from SX1302, if any, payloads are left in the RX buffer */
+    res = receive_packets(max_pkt, desc, NULL);
+
+    _meas_time_stop(1, tm, __FUNCTION__);
+
+    DEBUG_PRINTF(" --- %s\n", "OUT");
+
+    return res;
+}
+
+/* ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~ */
+
+void lgw_pkt_rx_from_desc(struct lgw_pkt_rx_s *pkt_data, const struct lgw_pkt_rx_desc_s *desc) {
+    pkt_data->freq_hz = desc->freq_hz;
+    pkt_data->freq_offset = desc->freq_offset;
+    pkt_data->if_chain = desc->if_chain;
+    pkt_data->status = desc->status;
+    pkt_data->count_us = desc->count_us;
+    pkt_data->rf_chain = desc->rf_chain;
+    pkt_data->modem_id = desc->modem_id;
+    pkt_data->modulation = desc->modulation;
+    pkt_data->bandwidth = desc->bandwidth;
+    pkt_data->datarate = desc->datarate;
+    pkt_data->coderate = desc->coderate;
+    pkt_data->rssic = desc->rssic;
+    pkt_data->rssis = desc->rssis;
+    pkt_data->snr = desc->snr;
+    pkt_data->snr_min = desc->snr_min;
+    pkt_data->snr_max = desc->snr_max;
+    pkt_data->crc = desc->crc;
+    pkt_data->size = desc->size;
+    memcpy(pkt_data->payload, desc->payload, desc->size);
+    pkt_data->ftime_received = desc->ftime_received;
+    pkt_data->ftime = desc->ftime;
+}
+
+/* ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~ */
+
 int lgw_send(struct lgw_pkt_tx_s * pkt_data) {
     int err;
     bool lbt_tx_allowed;
@@ -1401,6 +1527,11 @@ int lgw_send(struct lgw_pkt_tx_s * pkt_data) {
     if (err != LGW_REG_SUCCESS) {
         printf("ERROR: %s: Failed to send packet\n", __FUNCTION__);
 
+        /* sx1302_send() may have stopped with writes queued in bulk mode: send them, back to single write mode */
+        if (lgw_com_set_write_mode(LGW_COM_WRITE_MODE_SINGLE) != LGW_COM_SUCCESS) {
+            printf("ERROR: %s: Failed to set single write mode\n", __FUNCTION__);
+        }
+
         if (CONTEXT_SX1261.lbt_conf.enable == true) {
             err = lgw_lbt_stop();
             if (err != 0) {
@@ -1579,6 +1710,16 @@ int lgw_get_temperature(float* temperature) {
 
 /* ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~ */
 
+int lgw_get_rx_fetch_stat(struct lgw_rx_fetch_stat_s * stat, bool reset) {
+    CHECK_NULL(stat);
+
+    sx1302_rx_fetch_get_stat(stat, reset);
+
+    return LGW_HAL_SUCCESS;
+}
+
+/* ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~ */
+
 const char* lgw_version_info() {
     return lgw_version_string;
 }
@@ -1597,8 +1738,8 @@ uint32_t lgw_time_on_air(const struct lgw_pkt_tx_s *packet) {
     }
 
     if (packet->modulation == MOD_LORA) {
-        toa_us = lora_packet_time_on_air(packet->bandwidth, packet->datarate, packet->coderate, packet->preamble, packet->no_header, packet->no_crc, packet->size, NULL, NULL, NULL);
-        toa_ms = (uint32_t)( (double)toa_us / 1000.0 + 0.5 );
+        toa_us = lora_packet_toa_us(packet->bandwidth, packet->datarate, packet->coderate, packet->preamble, packet->no_header, packet->no_crc, packet->size);
+        toa_ms = (toa_us + 500) / 1000; /* rounded */
         DEBUG_PRINTF("INFO: LoRa packet ToA: %u ms\n", toa_ms);
     } else if (packet->modulation == MOD_FSK) {
         /* PREAMBLE + SYNC_WORD + PKT_LEN + PKT_PAYLOAD + CRC
@@ -38,6 +38,23 @@ License: Revised BSD License, see LICENSE.TXT file include in the project
 
 #define IS_TX_MODE(mode)        ((mode == IMMEDIATE) || (mode == TIMESTAMPED) || (mode == ON_GPS))
 
+/**
+@brief Signed distance (a - b) in microseconds between two concentrator timestamps
+Valid across the counter roll-over as long as a and b are less than 2^31 us apart
+*/
+#define TMST_DIFF(a, b)         ((int32_t)((lgw_tmst_t)(a) - (lgw_tmst_t)(b)))
+
+/**
+@brief True if timestamp a is strictly before timestamp b (serial number order)
+*/
+#define TMST_BEFORE(a, b)       (TMST_DIFF(a, b) < 0)
+
+/**
+@brief Time in microseconds from now until timestamp t, t being at or after now
+A timestamp in the past gives a value close to 2^32, i.e. far in the future
+*/
+#define TMST_UNTIL(t, now)      ((lgw_tmst_t)((lgw_tmst_t)(t) - (lgw_tmst_t)(now)))
+
 /* -------------------------------------------------------------------------- */
 /* --- PUBLIC CONSTANTS ----------------------------------------------------- */
 
@@ -137,6 +154,12 @@ License: Revised BSD License, see LICENSE.TXT file include in the project
 /* -------------------------------------------------------------------------- */
 /* --- PUBLIC TYPES --------------------------------------------------------- */
 
+/**
+@brief Concentrator internal counter, 1 microsecond resolution, wrapping every 2^32 us (~71 minutes)
+Timestamps must only be ordered with TMST_DIFF/TMST_BEFORE/TMST_UNTIL, never with < or >
+*/
+typedef uint32_t lgw_tmst_t;
+
 /**
 @enum lgw_radio_type_t
 @brief Radio types that can be found on the LoRa Gateway
@@ -223,7 +246,7 @@ struct lgw_pkt_rx_s {
     int32_t     freq_offset;
     uint8_t     if_chain;       /*!> by which IF chain was packet received */
     uint8_t     status;         /*!> status of the received packet */
-    uint32_t    count_us;       /*!> internal concentrator counter for timestamping, 1 microsecond resolution */
+    lgw_tmst_t  count_us;       /*!> internal concentrator counter for timestamping, 1 microsecond resolution */
     uint8_t     rf_chain;       /*!> through which RF chain the packet was received */
     uint8_t     modem_id;
     uint8_t     modulation;     /*!> modulation used by the packet */
@@ -242,6 +265,51 @@ struct lgw_pkt_rx_s {
     uint32_t    ftime;          /*!> packet fine timestamp (nanoseconds since last PPS) */
 };
 
+/**
+@struct lgw_pkt_rx_desc_s
+@brief Descriptor of a received packet: same metadata as lgw_pkt_rx_s, payload left in the HAL RX buffer
+*/
+struct lgw_pkt_rx_desc_s {
+    uint32_t    freq_hz;        /*!> central frequency of the IF chain */
+    int32_t     freq_offset;
+    uint8_t     if_chain;       /*!> by which IF chain was packet received */
+    uint8_t     status;         /*!> status of the received packet */
+    lgw_tmst_t  count_us;       /*!> internal concentrator counter for timestamping, 1 microsecond resolution */
+    uint8_t     rf_chain;       /*!> through which RF chain the packet was received */
+    uint8_t     modem_id;
+    uint8_t     modulation;     /*!> modulation used by the packet */
+    uint8_t     bandwidth;      /*!> modulation bandwidth (LoRa only) */
+    uint32_t    datarate;       /*!> RX datarate of the packet (SF for LoRa) */
+    uint8_t     coderate;       /*!> error-correcting code of the packet (LoRa only) */
+    float       rssic;          /*!> average RSSI of the channel in dB */
+    float       rssis;          /*!> average RSSI of the signal in dB */
+    float       snr;            /*!> average packet SNR, in dB (LoRa only) */
+    float       snr_min;        /*!> minimum packet SNR, in dB (LoRa only) */
+    float       snr_max;        /*!> maximum packet SNR, in dB (LoRa only) */
+    uint16_t    crc;            /*!> CRC that was received in the payload */
+    uint16_t    size;           /*!> payload size in bytes */
+    const uint8_t *payload;     /*!> payload in the HAL RX buffer, valid until next lgw_receive()/lgw_receive_desc() */
+    bool        ftime_received; /*!> a fine timestamp has been received */
+    uint32_t    ftime;          /*!> packet fine timestamp (nanoseconds since last PPS) */
+};
+
+/**
+@struct lgw_rx_fetch_stat_s
+@brief Statistics of the fetches of the concentrator RX buffer
+*/
+struct lgw_rx_fetch_stat_s {
+    uint32_t    nb_fetch;       /*!> fetches which brought data */
+    uint32_t    nb_prefetch;    /*!> fetches done in the background while the previous packets were parsed */
+    uint32_t    nb_byte;        /*!> bytes fetched */
+    uint64_t    bus_us;         /*!> SPI bus time of the fetches, in microseconds */
+    uint32_t    bus_us_max;     /*!> longest fetch */
+    uint64_t    latency_us;     /*!> time the fetched data waited before being parsed, in microseconds */
+    uint32_t    latency_us_max; /*!> longest wait */
+    uint64_t    scan_us;        /*!> time spent indexing the packets of the fetched data, in microseconds */
+    uint32_t    scan_us_max;    /*!> longest indexing */
+    uint64_t    period_us;      /*!> time covered by the statistics */
+};
+
 /**
 @struct lgw_pkt_tx_s
 @brief Structure containing the configuration of a packet to send and a pointer to the payload
@@ -249,7 +317,7 @@ struct lgw_pkt_rx_s {
 struct lgw_pkt_tx_s {
     uint32_t    freq_hz;        /*!> center frequency of TX */
     uint8_t     tx_mode;        /*!> select on what event/time the TX is triggered */
-    uint32_t    count_us;       /*!> timestamp or delay in microseconds for TX trigger */
+    lgw_tmst_t  count_us;       /*!> timestamp or delay in microseconds for TX trigger */
     uint8_t     rf_chain;       /*!> through which RF chain will the packet be sent */
     int8_t      rf_power;       /*!> TX power, in dBm */
     uint8_t     modulation;     /*!> modulation to use for the packet */
@@ -481,6 +549,24 @@ int lgw_stop(void);
 */
 int lgw_receive(uint8_t max_pkt, struct lgw_pkt_rx_s * pkt_data);
 
+/**
+@brief Same as lgw_receive(), but the payloads are not copied: they are left in the HAL RX buffer
+@param max_pkt maximum number of packet that must be retrieved (equal to the size of the array of struct)
+@param desc pointer to an array of descriptors that will receive the packet metadata and payload pointers
+@return LGW_HAL_ERROR id the operation failed, else the number of packets retrieved
+
+The payload pointers are only valid until the next call to lgw_receive() or lgw_receive_desc().
+Not available with fine timestamping, whose duplicated packets are only merged by lgw_receive().
+*/
+int lgw_receive_desc(uint8_t max_pkt, struct lgw_pkt_rx_desc_s * desc);
+
+/**
+@brief Copy a packet descriptor, and its payload, to a packet structure
+@param pkt_data pointer to the packet structure to be filled
+@param desc pointer to the descriptor returned by lgw_receive_desc()
+*/
+void lgw_pkt_rx_from_desc(struct lgw_pkt_rx_s * pkt_data, const struct lgw_pkt_rx_desc_s * desc);
+
 /**
 @brief Schedule a packet to be send immediately or after a delay depending on tx_mode
 @param pkt_data structure containing the data and metadata for the packet to send
@@ -549,6 +635,14 @@ int lgw_get_eui(uint64_t * eui);
 */
 int lgw_get_temperature(float * temperature);
 
+/**
+@brief Return the statistics of the fetches of the concentrator RX buffer
+@param stat pointer to receive the statistics
+@param reset reset the statistics once copied
+@return LGW_HAL_ERROR id the operation failed, LGW_HAL_SUCCESS else
+*/
+int lgw_get_rx_fetch_stat(struct lgw_rx_fetch_stat_s * stat, bool reset);
+
 /**
 @brief Allow user to check the version/options of the library once compiled
 @return pointer on a human-readable null terminated string
@@ -22,6 +22,7 @@ License: Revised BSD License, see LICENSE.TXT file include in the project
 #include <stdint.h>     /* C99 types */
 #include <stdbool.h>    /* bool type */
 #include <stdio.h>      /* printf fprintf */
+#include <string.h>     /* memset */
 
 #include "loragw_reg.h"
 
@@ -39,6 +40,10 @@ License: Revised BSD License, see LICENSE.TXT file include in the project
     #define CHECK_NULL(a)               if(a==NULL){return LGW_REG_ERROR;}
 #endif
 
+#define SHADOW_BIT_GET(map, i)  (((map)[(i) >> 3] >> ((i) & 7)) & 1)
+#define SHADOW_BIT_SET(map, i)  ((map)[(i) >> 3] |= (1 << ((i) & 7)))
+#define SHADOW_BIT_CLR(map, i)  ((map)[(i) >> 3] &= ~(1 << ((i) & 7)))
+
 /* -------------------------------------------------------------------------- */
 /* --- PRIVATE CONSTANTS ---------------------------------------------------- */
 
@@ -59,6 +64,11 @@ License: Revised BSD License, see LICENSE.TXT file include in the project
 #define SX1302_REG_TIMESTAMP_BASE_ADDR 0x6100
 #define SX1302_REG_OTP_BASE_ADDR 0x6180
 
+/* shadowed address range, the blocks above are MCU, capture and counter registers */
+#define SHADOW_ADDR_START   SX1302_REG_TX_TOP_A_BASE_ADDR
+#define SHADOW_ADDR_END     SX1302_REG_CAPTURE_RAM_BASE_ADDR
+#define SHADOW_SIZE         (SHADOW_ADDR_END - SHADOW_ADDR_START)
+
 const struct lgw_reg_s loregs[LGW_TOTALREGS+1] = {
     {0,SX1302_REG_COMMON_BASE_ADDR+0,0,0,2,0,1,0}, // COMMON_PAGE_PAGE
     {0,SX1302_REG_COMMON_BASE_ADDR+1,4,0,1,0,1,0}, // COMMON_CTRL0_CLK32_RIF_CTRL
@@ -1110,6 +1120,47 @@ const struct lgw_reg_s loregs[LGW_TOTALREGS+1] = {
 /* -------------------------------------------------------------------------- */
 /* --- PRIVATE VARIABLES ---------------------------------------------------- */
 
+/* register bytes with a side effect on write (start, trigger, clear, reset): their
+   value is never assumed and their writes are never merged with neighbouring ones */
+static const uint16_t side_effect_regs[] = {
+    SX1302_REG_AGC_MCU_CTRL_MCU_CLEAR,
+    SX1302_REG_AGC_MCU_RF_EN_A_RADIO_RST,
+    SX1302_REG_AGC_MCU_RF_EN_B_RADIO_RST,
+    SX1302_REG_AGC_MCU_UART_CFG_START_LEN,
+    SX1302_REG_TX_TOP_A_TX_TRIG_TX_FSM_CLR,
+    SX1302_REG_TX_TOP_A_TX_CTRL_WRITE_BUFFER,
+    SX1302_REG_TX_TOP_A_TX_FLAG_TX_TIMEOUT,
+    SX1302_REG_TX_TOP_A_TXRX_CFG1_1_MODEM_START,
+    SX1302_REG_TX_TOP_A_LORA_TX_FLAG_FRAME_DONE,
+    SX1302_REG_TX_TOP_B_TX_TRIG_TX_FSM_CLR,
+    SX1302_REG_TX_TOP_B_TX_CTRL_WRITE_BUFFER,
+    SX1302_REG_TX_TOP_B_TX_FLAG_TX_TIMEOUT,
+    SX1302_REG_TX_TOP_B_TXRX_CFG1_1_MODEM_START,
+    SX1302_REG_TX_TOP_B_LORA_TX_FLAG_FRAME_DONE,
+    SX1302_REG_GPIO_HOST_IRQ_TX_TIMEOUT_B,
+    SX1302_REG_RX_TOP_CORRELATOR_ENABLE_ACC_CLEAR_ENABLE_CORR_ACC_CLEAR,
+    SX1302_REG_RX_TOP_TXRX_CFG2_MODEM_START,
+    SX1302_REG_RX_TOP_LORA_SERVICE_FSK_TXRX_CFG2_MODEM_START,
+    SX1302_REG_ARB_MCU_CTRL_MCU_CLEAR,
+    SX1302_REG_RADIO_FE_SIG_ANA_CFG_START,
+    SX1302_REG_CAPTURE_RAM_CAPTURE_CFG_CAPTURESTART
+};
+
+#if LGW_REG_SHADOW == 1
+
+static struct {
+    bool     init;
+    bool     at_defaults;                   /* concentrator reset while not connected */
+    uint8_t  shadowable[SHADOW_SIZE / 8];   /* byte only holds host written fields */
+    uint8_t  valid[SHADOW_SIZE / 8];        /* byte value is known */
+    uint8_t  value[SHADOW_SIZE];
+    uint16_t reg_hit[LGW_TOTALREGS];
+    uint16_t reg_miss[LGW_TOTALREGS];
+    struct lgw_reg_shadow_stat_s stat;
+} shadow;
+
+#endif
+
 /* -------------------------------------------------------------------------- */
 /* --- PRIVATE FUNCTIONS ---------------------------------------------------- */
 
@@ -1135,6 +1186,158 @@ int reg_w(uint8_t spi_mux_target, struct lgw_reg_s r, int32_t reg_value) {
 
 /* ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~ */
 
+#if LGW_REG_SHADOW == 1
+
+/* index of a shadowable byte in the shadow, -1 otherwise */
+static int shadow_index(uint8_t spi_mux_target, uint16_t addr) {
+    int i;
+
+    if ((shadow.init == false) || (spi_mux_target != LGW_SPI_MUX_TARGET_SX1302) || (addr < SHADOW_ADDR_START) || (addr >= SHADOW_ADDR_END)) {
+        return -1;
+    }
+    i = addr - SHADOW_ADDR_START;
+
+    return (SHADOW_BIT_GET(shadow.shadowable, i) == 1) ? i : -1;
+}
+
+static void shadow_store(int i, uint8_t value) {
+    shadow.value[i] = value;
+    SHADOW_BIT_SET(shadow.valid, i);
+}
+
+/* the fields of a byte are consecutive in the register map, a byte is known when they cover all its bits */
+static void shadow_load_defaults(void) {
+    int i, k;
+    uint16_t addr;
+    uint8_t mask, byte;
+
+    for (i = 0; i < LGW_TOTALREGS; i = k) {
+        addr = loregs[i].addr;
+        mask = 0;
+        byte = 0;
+        for (k = i; (k < LGW_TOTALREGS) && (loregs[k].addr == addr); k++) {
+            mask |= ((1 << loregs[k].leng) - 1) << loregs[k].offs;
+            byte |= ((uint8_t)loregs[k].dflt << loregs[k].offs) & (((1 << loregs[k].leng) - 1) << loregs[k].offs);
+        }
+        if ((mask == 0xFF) && (shadow_index(LGW_SPI_MUX_TARGET_SX1302, addr) >= 0)) {
+            shadow_store(shadow_index(LGW_SPI_MUX_TARGET_SX1302, addr), byte);
+        }
+    }
+}
+
+static void shadow_init(void) {
+    int i;
+    uint16_t addr;
+
+    /* all bytes of the range, but the BIST engine, radio front-end and AGC MCU blocks */
+    memset(shadow.shadowable, 0, sizeof shadow.shadowable);
+    for (addr = SHADOW_ADDR_START; addr < SHADOW_ADDR_END; addr++) {
+        if ((addr < SX1302_REG_MBIST_BASE_ADDR) || (addr >= SX1302_REG_CLK_CTRL_BASE_ADDR)) {
+            SHADOW_BIT_SET(shadow.shadowable, addr - SHADOW_ADDR_START);
+        }
+    }
+
+    /* a byte holding a read-only, pulse or clear-on-write field is never shadowed */
+    for (i = 0; i < LGW_TOTALREGS; i++) {
+        addr = loregs[i].addr;
+        if ((addr >= SHADOW_ADDR_START) && (addr < SHADOW_ADDR_END) && ((loregs[i].rdon == 1) || (loregs[i].chck == 0))) {
+            SHADOW_BIT_CLR(shadow.shadowable, addr - SHADOW_ADDR_START);
+        }
+    }
+    for (i = 0; i < (int)ARRAY_SIZE(side_effect_regs); i++) {
+        addr = loregs[side_effect_regs[i]].addr;
+        if ((addr >= SHADOW_ADDR_START) && (addr < SHADOW_ADDR_END)) {
+            SHADOW_BIT_CLR(shadow.shadowable, addr - SHADOW_ADDR_START);
+        }
+    }
+
+    memset(shadow.valid, 0, sizeof shadow.valid);
+    shadow.init = true;
+
+    /* the concentrator was reset since the last connection, its registers hold their default values */
+    if (shadow.at_defaults == true) {
+        shadow_load_defaults();
+        shadow.at_defaults = false;
+    }
+}
+
+/* keep the shadow of the bytes covered by a burst write */
+static void shadow_store_burst(uint16_t addr, const uint8_t *data, uint16_t size) {
+    int i;
+    uint16_t k;
+
+    for (k = 0; k < size; k++) {
+        i = shadow_index(LGW_SPI_MUX_TARGET_SX1302, addr + k);
+        if (i >= 0) {
+            shadow_store(i, data[k]);
+        }
+    }
+}
+
+/* a failed burst write may have reached part of the bytes, forget them */
+static void shadow_forget_burst(uint16_t addr, uint16_t size) {
+    int i;
+    uint16_t k;
+
+    for (k = 0; k < size; k++) {
+        i = shadow_index(LGW_SPI_MUX_TARGET_SX1302, addr + k);
+        if (i >= 0) {
+            SHADOW_BIT_CLR(shadow.valid, i);
+        }
+    }
+}
+
+/* register write with the read of a read-modify-write served from the shadow */
+static int shadow_reg_w(uint16_t register_id, int32_t reg_value) {
+    int com_stat = LGW_COM_SUCCESS;
+    struct lgw_reg_s r = loregs[register_id];
+    int i = shadow_index(LGW_SPI_MUX_TARGET_SX1302, r.addr);
+    uint8_t mask, byte;
+
+    if ((i < 0) || ((r.offs + r.leng) > 8)) {
+        if ((r.leng != 8) || (r.offs != 0)) {
+            shadow.stat.nb_bypass += 1;
+        }
+        return reg_w(LGW_SPI_MUX_TARGET_SX1302, r, reg_value);
+    }
+
+    if ((r.leng == 8) && (r.offs == 0)) {
+        byte = (uint8_t)reg_value;
+    } else {
+        if (SHADOW_BIT_GET(shadow.valid, i) == 1) {
+            byte = shadow.value[i];
+            shadow.stat.nb_hit += 1;
+            if (shadow.reg_hit[register_id] < UINT16_MAX) {
+                shadow.reg_hit[register_id] += 1;
+            }
+        } else {
+            com_stat = lgw_com_r(LGW_SPI_MUX_TARGET_SX1302, r.addr, &byte);
+            shadow.stat.nb_miss += 1;
+            if (shadow.reg_miss[register_id] < UINT16_MAX) {
+                shadow.reg_miss[register_id] += 1;
+            }
+        }
+        mask = ((1 << r.leng) - 1) << r.offs;
+        byte = (~mask & byte) | (mask & ((uint8_t)reg_value << r.offs));
+    }
+
+    if (com_stat == LGW_COM_SUCCESS) {
+        com_stat = lgw_com_w(LGW_SPI_MUX_TARGET_SX1302, r.addr, byte);
+        DEBUG_PRINTF("==> SHADOWED WRITE @ 0x%04X (offs:%u leng:%u)\n", r.addr, r.offs, r.leng);
+    }
+    if (com_stat == LGW_COM_SUCCESS) {
+        shadow_store(i, byte);
+    } else {
+        SHADOW_BIT_CLR(shadow.valid, i);
+    }
+
+    return com_stat;
+}
+
+#endif
+
+/* ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~ */
+
 int reg_r(uint8_t spi_mux_target, struct lgw_reg_s r, int32_t *reg_value) {
     int com_stat = LGW_REG_SUCCESS;
     uint8_t bufu[4] = "\x00\x00\x00\x00";
@@ -1143,6 +1346,11 @@ int reg_r(uint8_t spi_mux_target, struct lgw_reg_s r, int32_t *reg_value) {
     if ((r.offs + r.leng) <= 8) {
         /* read one byte, then shift and mask bits to get reg value with sign extension if needed */
         com_stat = lgw_com_r(spi_mux_target, r.addr, &bufu[0]);
+#if LGW_REG_SHADOW == 1
+        if ((com_stat == LGW_COM_SUCCESS) && (shadow_index(spi_mux_target, r.addr) >= 0)) {
+            shadow_store(shadow_index(spi_mux_target, r.addr), bufu[0]);
+        }
+#endif
         bufu[1] = bufu[0] << (8 - r.leng - r.offs); /* left-align the data */
         if (r.sign == true) {
             bufs[2] = bufs[1] >> (8 - r.leng); /* right align the data with sign extension (ARITHMETIC right shift) */
@@ -1160,6 +1368,19 @@ int reg_r(uint8_t spi_mux_target, struct lgw_reg_s r, int32_t *reg_value) {
     return com_stat;
 }
 
+/* ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~ */
+
+bool lgw_reg_side_effect(uint16_t address) {
+    int i;
+
+    for (i = 0; i < (int)ARRAY_SIZE(side_effect_regs); i++) {
+        if (loregs[side_effect_regs[i]].addr == address) {
+            return true;
+        }
+    }
+    return false;
+}
+
 /* -------------------------------------------------------------------------- */
 /* --- PUBLIC FUNCTIONS DEFINITION ------------------------------------------ */
 
@@ -1189,6 +1410,11 @@ int lgw_connect(const lgw_com_type_t com_type, const char * com_path) {
     }
     printf("Note: chip version is 0x%02X (v%u.%u)\n", u, (u >> 4) & 0x0F, u & 0x0F) ;
 
+#if LGW_REG_SHADOW == 1
+    /* the concentrator may have been reset or configured by someone else */
+    shadow_init();
+#endif
+
     DEBUG_MSG("Note: success connecting the concentrator\n");
     return LGW_REG_SUCCESS;
 }
@@ -1199,6 +1425,11 @@ int lgw_connect(const lgw_com_type_t com_type, const char * com_path) {
 int lgw_disconnect(void) {
     int com_stat;
 
+#if LGW_REG_SHADOW == 1
+    shadow.init = false;
+    shadow.at_defaults = false;
+#endif
+
     com_stat = lgw_com_close();
     if (com_stat == LGW_COM_SUCCESS) {
         DEBUG_MSG("Note: success disconnecting the concentrator\n");
@@ -1231,7 +1462,11 @@ int lgw_reg_w(uint16_t register_id, int32_t reg_value) {
         return LGW_REG_ERROR;
     }
 
+#if LGW_REG_SHADOW == 1
+    com_stat = shadow_reg_w(register_id, reg_value);
+#else
     com_stat = reg_w(LGW_SPI_MUX_TARGET_SX1302, r, reg_value);
+#endif
 
     if (com_stat != LGW_COM_SUCCESS) {
         DEBUG_MSG("ERROR: COM ERROR DURING REGISTER WRITE\n");
@@ -1297,6 +1532,13 @@ int lgw_reg_wb(uint16_t register_id, uint8_t *data, uint16_t size) {
 
     /* do the burst write */
     com_stat = lgw_com_wb(LGW_SPI_MUX_TARGET_SX1302, r.addr, data, size);
+#if LGW_REG_SHADOW == 1
+    if (com_stat == LGW_COM_SUCCESS) {
+        shadow_store_burst(r.addr, data, size);
+    } else {
+        shadow_forget_burst(r.addr, size);
+    }
+#endif
 
     if (com_stat != LGW_COM_SUCCESS) {
         DEBUG_MSG("ERROR: COM ERROR DURING REGISTER BURST WRITE\n");
@@ -1355,13 +1597,20 @@ int lgw_mem_wb(uint16_t mem_addr, const uint8_t *data, uint16_t size) {
         return LGW_REG_ERROR;
     }
 
-    /* write memory by chunks */
-    while (sz_todo > 0) {
+    /* write memory by chunks, until one fails */
+    while ((sz_todo > 0) && (com_stat == LGW_COM_SUCCESS)) {
         /* full or partial chunk ? */
         chunk_size = (sz_todo > CHUNK_SIZE_MAX) ? CHUNK_SIZE_MAX : sz_todo;
 
         /* do the burst write */
         com_stat = lgw_com_wb(LGW_SPI_MUX_TARGET_SX1302, addr, &data[chunk_cnt * CHUNK_SIZE_MAX], chunk_size);
+#if LGW_REG_SHADOW == 1
+        if (com_stat == LGW_COM_SUCCESS) {
+            shadow_store_burst(addr, &data[chunk_cnt * CHUNK_SIZE_MAX], chunk_size);
+        } else {
+            shadow_forget_burst(addr, chunk_size);
+        }
+#endif
 
         /* prepare for next write */
         addr += chunk_size;
@@ -1420,4 +1669,137 @@ int lgw_mem_rb(uint16_t mem_addr, uint8_t *data, uint16_t size, bool fifo_mode)
     }
 }
 
+/* ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~ */
+
+int lgw_mem_rb_start(uint16_t mem_addr, uint8_t *data, uint16_t size, bool fifo_mode) {
+    int com_stat = LGW_COM_SUCCESS;
+    int chunk_cnt = 0;
+    uint16_t addr = mem_addr;
+    uint16_t sz_todo = size;
+    uint16_t chunk_size;
+    const uint16_t CHUNK_SIZE_MAX = lgw_com_chunk_size();
+
+    /* check input parameters */
+    CHECK_NULL(data);
+    if (size == 0) {
+        DEBUG_MSG("ERROR: BURST OF NULL LENGTH\n");
+        return LGW_REG_ERROR;
+    }
+
+    /* queue the chunks, as lgw_mem_rb() reads them */
+    while ((sz_todo > 0) && (com_stat == LGW_COM_SUCCESS)) {
+        chunk_size = (sz_todo > CHUNK_SIZE_MAX) ? CHUNK_SIZE_MAX : sz_todo;
+        com_stat = lgw_com_rb_start(LGW_SPI_MUX_TARGET_SX1302, addr, &data[chunk_cnt * CHUNK_SIZE_MAX], chunk_size);
+        if (fifo_mode == false) {
+            addr += chunk_size;
+        }
+        sz_todo -= chunk_size;
+        chunk_cnt += 1;
+    }
+
+    if (com_stat != LGW_COM_SUCCESS) {
+        DEBUG_MSG("ERROR: COM ERROR DURING REGISTER BURST READ\n");
+        return LGW_REG_ERROR;
+    } else {
+        return LGW_REG_SUCCESS;
+    }
+}
+
+/* ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~ */
+
+int lgw_mem_rb_wait(int64_t *done_us) {
+    if (lgw_com_rb_wait(done_us) != LGW_COM_SUCCESS) {
+        DEBUG_MSG("ERROR: COM ERROR DURING REGISTER BURST READ\n");
+        return LGW_REG_ERROR;
+    }
+    return LGW_REG_SUCCESS;
+}
+
+/* ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~ */
+
+void lgw_reg_shadow_reset(bool from_defaults) {
+#if LGW_REG_SHADOW == 1
+    if (shadow.init == false) {
+        /* reset before connecting, the shadow is loaded when connecting */
+        shadow.at_defaults = from_defaults;
+        return;
+    }
+
+    memset(shadow.valid, 0, sizeof shadow.valid);
+    if (from_defaults == true) {
+        shadow_load_defaults();
+    }
+#else
+    (void)from_defaults;
+#endif
+}
+
+/* ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~ */
+
+void lgw_reg_shadow_get_stat(struct lgw_reg_shadow_stat_s *stat, bool reset) {
+#if LGW_REG_SHADOW == 1
+    *stat = shadow.stat;
+    if (reset == true) {
+        memset(&shadow.stat, 0, sizeof shadow.stat);
+        memset(shadow.reg_hit, 0, sizeof shadow.reg_hit);
+        memset(shadow.reg_miss, 0, sizeof shadow.reg_miss);
+    }
+#else
+    (void)reset;
+    memset(stat, 0, sizeof *stat);
+#endif
+}
+
+/* ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~ */
+
+int lgw_reg_shadow_get_reg_stat(uint16_t register_id, uint16_t *nb_hit, uint16_t *nb_miss) {
+    CHECK_NULL(nb_hit);
+    CHECK_NULL(nb_miss);
+    if (register_id >= LGW_TOTALREGS) {
+        DEBUG_MSG("ERROR: REGISTER NUMBER OUT OF DEFINED RANGE\n");
+        return LGW_REG_ERROR;
+    }
+
+#if LGW_REG_SHADOW == 1
+    *nb_hit = shadow.reg_hit[register_id];
+    *nb_miss = shadow.reg_miss[register_id];
+#else
+    *nb_hit = 0;
+    *nb_miss = 0;
+#endif
+
+    return LGW_REG_SUCCESS;
+}
+
+/* ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~ */
+
+int lgw_reg_shadow_check(uint16_t *nb_mismatch) {
+    CHECK_NULL(nb_mismatch);
+
+    *nb_mismatch = 0;
+#if LGW_REG_SHADOW == 1
+    int i;
+    uint8_t byte;
+
+    if (shadow.init == false) {
+        return LGW_REG_SUCCESS;
+    }
+    for (i = 0; i < SHADOW_SIZE; i++) {
+        if (SHADOW_BIT_GET(shadow.valid, i) == 0) {
+            continue;
+        }
+        if (lgw_com_r(LGW_SPI_MUX_TARGET_SX1302, SHADOW_ADDR_START + i, &byte) != LGW_COM_SUCCESS) {
+            DEBUG_MSG("ERROR: COM ERROR DURING REGISTER SHADOW CHECK\n");
+            return LGW_REG_ERROR;
+        }
+        if (byte != shadow.value[i]) {
+            DEBUG_PRINTF("WARNING: shadow of 0x%04X is 0x%02X, register is 0x%02X\n", SHADOW_ADDR_START + i, shadow.value[i], byte);
+            *nb_mismatch += 1;
+        }
+    }
+#endif
+
+    return LGW_REG_SUCCESS;
+}
+
 /* --- EOF ------------------------------------------------------------------ */
@@ -43,9 +43,26 @@ struct lgw_reg_s {
     int32_t  dflt;        /*!< register default value */
 };
 
+/**
+@struct lgw_reg_shadow_stat_s
+@brief Register shadow statistics, counted on read-modify-writes
+*/
+struct lgw_reg_shadow_stat_s {
+    uint32_t nb_hit;            /*!> register byte taken from the shadow, one read saved */
+    uint32_t nb_miss;           /*!> register byte not known yet, read from the concentrator */
+    uint32_t nb_bypass;         /*!> register byte never shadowed (status, pulse, side effect or MCU registers) */
+};
+
 /* -------------------------------------------------------------------------- */
 /* --- INTERNAL SHARED FUNCTIONS -------------------------------------------- */
 
+/**
+@brief Tell if writing a SX1302 register byte has a side effect (start, trigger, clear, reset)
+@param address address of the register byte
+@return true if the write must be sent on its own, not merged in a burst with neighbouring writes
+*/
+bool lgw_reg_side_effect(uint16_t address);
+
 /* -------------------------------------------------------------------------- */
 /* --- PUBLIC CONSTANTS ----------------------------------------------------- */
 
@@ -53,6 +70,10 @@ struct lgw_reg_s {
 #define LGW_REG_ERROR    -1
 #define LGW_REG_WARNING  -2
 
+#ifndef LGW_REG_SHADOW
+    #define LGW_REG_SHADOW  1   /* keep a copy of the host written registers, read-modify-writes become single writes */
+#endif
+
 #define SX1302_REG_COMMON_PAGE_PAGE 0
 #define SX1302_REG_COMMON_CTRL0_CLK32_RIF_CTRL 1
 #define SX1302_REG_COMMON_CTRL0_HOST_RADIO_CTRL 2
@@ -1496,6 +1517,53 @@ int lgw_mem_wb(uint16_t mem_addr, const uint8_t *data, uint16_t size);
 */
 int lgw_mem_rb(uint16_t mem_addr, uint8_t *data, uint16_t size, bool fifo_mode);
 
+/**
+@brief Start a LoRa concentrator memory burst read, the caller keeps running until lgw_mem_rb_wait()
+@param mem_addr the address of the memory section to read from
+@param data pointer to byte array to store the data read, untouched until the read is done
+@param size size of the transfer, in byte(s)
+@param fifo_mode the type of memory to read from
+@return status of register operation (LGW_REG_SUCCESS/LGW_REG_ERROR)
+*/
+int lgw_mem_rb_start(uint16_t mem_addr, uint8_t *data, uint16_t size, bool fifo_mode);
+
+/**
+@brief Wait for the memory burst read started with lgw_mem_rb_start(), returns at once if none is pending
+@param done_us pointer to return the host time the read completed, can be NULL
+@return status of register operation (LGW_REG_SUCCESS/LGW_REG_ERROR)
+*/
+int lgw_mem_rb_wait(int64_t *done_us);
+
+/**
+@brief Forget the register shadow, or load it with the register defaults
+@param from_defaults true only right after a concentrator reset, when the registers hold their default values
+If the concentrator is not connected, the shadow is loaded with the defaults at the next connection.
+*/
+void lgw_reg_shadow_reset(bool from_defaults);
+
+/**
+@brief Get the register shadow statistics
+@param stat pointer to return the statistics
+@param reset reset the global and per register counters once copied
+*/
+void lgw_reg_shadow_get_stat(struct lgw_reg_shadow_stat_s *stat, bool reset);
+
+/**
+@brief Get the shadow hits and misses of a register, saturated at UINT16_MAX
+@param register_id register number in the data structure describing registers
+@param nb_hit pointer to return the number of read-modify-writes served from the shadow
+@param nb_miss pointer to return the number of read-modify-writes which read the concentrator
+@return LGW_REG_ERROR if the register number is out of range, LGW_REG_SUCCESS otherwise
+*/
+int lgw_reg_shadow_get_reg_stat(uint16_t register_id, uint16_t *nb_hit, uint16_t *nb_miss);
+
+/**
+@brief Compare the known bytes of the register shadow with the concentrator
+@param nb_mismatch pointer to return the number of shadow bytes differing from the concentrator
+@return status of register operation (LGW_REG_SUCCESS/LGW_REG_ERROR)
+*/
+int lgw_reg_shadow_check(uint16_t *nb_mismatch);
+
 #endif
 
 /* --- EOF ------------------------------------------------------------------ */
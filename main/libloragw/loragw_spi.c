@@ -23,7 +23,11 @@ License: Revised BSD License, see LICENSE.TXT file include in the project
 #include <fcntl.h>      /* open */
 #include <string.h>     /* memset */
 
+#include "esp_attr.h"
+#include "esp_timer.h"
+
 #include "loragw_spi.h"
+#include "loragw_reg.h"
 #include "loragw_aux.h"
 
 
@@ -58,9 +62,154 @@ License: Revised BSD License, see LICENSE.TXT file include in the project
 #define PIN_NUM_CS   15
 #endif
 
+#define SPI_QUEUE_SIZE  8   /* transactions in flight with spi_device_queue_trans */
+
 #define USE_SPI_TRANSACTION_EXT
 //#define DEBUG_SPI
 
+/* wait for the burst read in progress before any other access */
+#define SPI_ASYNC_WAIT(spi)             if(spi_async.nb_trans>0){int e=lgw_spi_rb_wait(spi,NULL);if(e!=LGW_SPI_SUCCESS){return e;}}
+
+#if LGW_SPI_BULK == 1
+    /* send the queued single writes before any other access, to keep the accesses in order */
+    #define SPI_BULK_SYNC(spi)          if(spi_bulk.nb_trans>0){esp_err_t e=spi_bulk_send(spi);if(e!=ESP_OK){return e;}}
+#else
+    #define SPI_BULK_SYNC(spi)
+#endif
+
+/* burst read in progress, its transactions are queued to the driver and done by DMA */
+static struct {
+    int nb_trans;
+    spi_transaction_ext_t trans[SPI_QUEUE_SIZE]; /* kept until the transactions are done, the driver works on them */
+    volatile int64_t done_us;   /* host time the last transaction completed, set from the driver interrupt */
+} spi_async = {
+    .nb_trans = 0
+};
+
+static uint8_t spi_async_tx[LGW_BURST_CHUNK]; /* zeros clocked out while reading, in DMA capable memory */
+
+/* called by the driver, from its interrupt, after each transaction */
+static void IRAM_ATTR spi_post_cb(spi_transaction_t *t)
+{
+    if (t->user == &spi_async) {
+        spi_async.done_us = esp_timer_get_time();
+    }
+}
+
+#if LGW_SPI_BULK == 1
+/* queued single writes, one transaction per run of writes to adjacent addresses */
+static struct {
+    lgw_com_write_mode_t mode;
+    int nb_trans;
+    int nb_byte;
+    bool extendable;    /* the last run can take a write to the next address */
+    struct {
+        uint8_t spi_mux_target;
+        uint16_t address;
+        uint8_t index;  /* first byte of the run in data[] */
+        uint8_t size;
+    } run[LGW_SPI_BULK_NB];
+    uint8_t data[LGW_SPI_BULK_NB];
+    spi_transaction_ext_t trans[LGW_SPI_BULK_NB]; /* kept until the transactions are done, the driver works on them */
+    struct lgw_com_bulk_stat_s stat;
+} spi_bulk = {
+    .mode = LGW_COM_WRITE_MODE_SINGLE,
+    .nb_trans = 0,
+    .nb_byte = 0,
+    .extendable = false
+};
+
+/* append a write to the last run when it writes the next address, a write with a side effect is sent on its own */
+static void spi_bulk_queue(uint8_t spi_mux_target, uint16_t address, uint8_t data)
+{
+    bool alone = (spi_mux_target == LGW_SPI_MUX_TARGET_SX1302) && lgw_reg_side_effect(address);
+    int n = spi_bulk.nb_trans - 1;
+
+    if ((spi_bulk.extendable == true) && (alone == false) && (spi_bulk.run[n].spi_mux_target == spi_mux_target) &&
+        ((uint16_t)(spi_bulk.run[n].address + spi_bulk.run[n].size) == address)) {
+        spi_bulk.run[n].size += 1;
+    } else {
+        n = spi_bulk.nb_trans;
+        spi_bulk.run[n].spi_mux_target = spi_mux_target;
+        spi_bulk.run[n].address = address;
+        spi_bulk.run[n].index = spi_bulk.nb_byte;
+        spi_bulk.run[n].size = 1;
+        spi_bulk.nb_trans += 1;
+        spi_bulk.extendable = (LGW_SPI_COMBINE == 1) && (alone == false);
+    }
+    spi_bulk.data[spi_bulk.nb_byte] = data;
+    spi_bulk.nb_byte += 1;
+    spi_bulk.stat.nb_write += 1;
+}
+
+/* burst write transaction of a run, short runs fit in the transaction itself */
+static spi_transaction_t * spi_bulk_trans(int n)
+{
+    spi_transaction_ext_t *et = &spi_bulk.trans[n];
+
+    memset(et, 0, sizeof *et);
+    et->command_bits = 8;
+    et->address_bits = 16;
+    et->base.cmd = spi_bulk.run[n].spi_mux_target;
+    et->base.addr = WRITE_ACCESS | (spi_bulk.run[n].address & ADDR_MASK);
+    et->base.flags = SPI_TRANS_VARIABLE_CMD | SPI_TRANS_VARIABLE_ADDR;
+    et->base.length = 8 * spi_bulk.run[n].size;
+    if (spi_bulk.run[n].size <= sizeof et->base.tx_data) {
+        et->base.flags |= SPI_TRANS_USE_TXDATA;
+        memcpy(et->base.tx_data, &spi_bulk.data[spi_bulk.run[n].index], spi_bulk.run[n].size);
+    } else {
+        et->base.tx_buffer = &spi_bulk.data[spi_bulk.run[n].index];
+    }
+
+    return (spi_transaction_t *)et;
+}
+
+/* queue the transaction list to the driver, SPI_QUEUE_SIZE at a time, and wait for all of them */
+static esp_err_t spi_bulk_send(spi_device_handle_t *spi)
+{
+    esp_err_t err, ret;
+    spi_transaction_t *done;
+    int nb_queued = 0;
+    int nb_done = 0;
+
+    SPI_ASYNC_WAIT(spi);
+
+    spi_bulk.stat.nb_trans += spi_bulk.nb_trans;
+    spi_bulk.extendable = false;
+    spi_bulk.nb_byte = 0;
+
+    err = spi_device_acquire_bus(*spi, portMAX_DELAY);
+    if(err != ESP_OK) {
+        spi_bulk.nb_trans = 0;
+        return err;
+    }
+
+    while (nb_queued < spi_bulk.nb_trans) {
+        if ((nb_queued - nb_done) == SPI_QUEUE_SIZE) {
+            ret = spi_device_get_trans_result(*spi, &done, portMAX_DELAY);
+            err = (err != ESP_OK) ? err : ret;
+            nb_done += 1;
+        }
+        ret = spi_device_queue_trans(*spi, spi_bulk_trans(nb_queued), portMAX_DELAY);
+        if(ret != ESP_OK) {
+            err = ret;
+            break;
+        }
+        nb_queued += 1;
+    }
+    while (nb_done < nb_queued) {
+        ret = spi_device_get_trans_result(*spi, &done, portMAX_DELAY);
+        err = (err != ESP_OK) ? err : ret;
+        nb_done += 1;
+    }
+
+    spi_device_release_bus(*spi);
+    DEBUG_PRINTF("BULK WRITE: %d transactions\n", spi_bulk.nb_trans);
+    spi_bulk.nb_trans = 0;
+    return err;
+}
+#endif
+
 
 /* SPI initialization and configuration */
 int lgw_spi_open(spi_device_handle_t **spi_target)
@@ -80,7 +229,8 @@ int lgw_spi_open(spi_device_handle_t **spi_target)
         .clock_speed_hz = SPI_SPEED,
         .mode = 0,
         .spics_io_num = PIN_NUM_CS,
-        .queue_size = 8,
+        .queue_size = SPI_QUEUE_SIZE,
+        .post_cb = spi_post_cb,
     };
 
     spi = malloc(sizeof(spi_device_handle_t));
@@ -97,6 +247,10 @@ int lgw_spi_open(spi_device_handle_t **spi_target)
     ret = spi_bus_add_device(SX1302_SPI_HOST, &devcfg, spi);
     ESP_ERROR_CHECK(ret);
 
+#if LGW_SPI_BULK == 1
+    memset(&spi_bulk.stat, 0, sizeof spi_bulk.stat);
+#endif
+
     *spi_target = (void *)spi;
     return LGW_SPI_SUCCESS;
 }
@@ -107,6 +261,10 @@ int lgw_spi_close(spi_device_handle_t *spi)
     esp_err_t ret;
 
     CHECK_NULL(spi);
+#if LGW_SPI_BULK == 1
+    lgw_spi_set_write_mode(spi, LGW_COM_WRITE_MODE_SINGLE);
+#endif
+    lgw_spi_rb_wait(spi, NULL);
     ret = spi_bus_remove_device(*spi);
     ESP_ERROR_CHECK(ret);
     // printf("ret = %d\n", ret);
@@ -125,6 +283,18 @@ int lgw_spi_w(spi_device_handle_t *spi, uint8_t spi_mux_target, uint16_t address
 {
     esp_err_t err;
 
+#if LGW_SPI_BULK == 1
+    if (spi_bulk.mode == LGW_COM_WRITE_MODE_BULK) {
+        if (spi_bulk.nb_byte == LGW_SPI_BULK_NB) {
+            SPI_BULK_SYNC(spi);
+        }
+        spi_bulk_queue(spi_mux_target, address, data);
+        return ESP_OK;
+    }
+#endif
+
+    SPI_ASYNC_WAIT(spi);
+
     err = spi_device_acquire_bus(*spi, portMAX_DELAY);
     if(err != ESP_OK)
         return err;
@@ -149,6 +319,9 @@ int lgw_spi_r(spi_device_handle_t *spi, uint8_t spi_mux_target, uint16_t address
 {
     spi_transaction_ext_t et;
 
+    SPI_ASYNC_WAIT(spi);
+    SPI_BULK_SYNC(spi);
+
     memset(&et, 0, sizeof(et));
     et.command_bits = 8 * 1;
     et.address_bits = 8 * 2;
@@ -200,6 +373,9 @@ int lgw_spi_r(spi_device_handle_t *spi, uint8_t spi_mux_target, uint16_t address
     uint8_t rbuf[5];
     uint8_t tbuf[5];
 
+    SPI_ASYNC_WAIT(spi);
+    SPI_BULK_SYNC(spi);
+
     tbuf[0] = spi_mux_target;
     tbuf[1] = ((READ_ACCESS | (address & ADDR_MASK)) >> 8);
     tbuf[2] = (address & 0xFF);
@@ -236,6 +412,9 @@ int lgw_spi_wb(spi_device_handle_t *spi, uint8_t spi_mux_target, uint16_t addres
     int byte_transfered = 0;
     uint8_t rbuf[LGW_BURST_CHUNK] = {0x00};
 
+    SPI_ASYNC_WAIT(spi);
+    SPI_BULK_SYNC(spi);
+
     err = spi_device_acquire_bus(*spi, portMAX_DELAY);
     if(err != ESP_OK)
         return err;
@@ -288,6 +467,9 @@ int lgw_spi_rb(spi_device_handle_t *spi, uint8_t spi_mux_target, uint16_t addres
     int byte_transfered = 0;
     uint8_t tbuf[LGW_BURST_CHUNK] = {0x00};
 
+    SPI_ASYNC_WAIT(spi);
+    SPI_BULK_SYNC(spi);
+
     err = spi_device_acquire_bus(*spi, portMAX_DELAY);
     if(err != ESP_OK)
         return err;
@@ -341,6 +523,9 @@ int radio_spi_wb(spi_device_handle_t *spi, uint8_t spi_mux_target, uint8_t op_co
     int cmd_size = 2; /* header + op_code */
     uint8_t rbuf[LGW_BURST_CHUNK] = {0x00};
 
+    SPI_ASYNC_WAIT(spi);
+    SPI_BULK_SYNC(spi);
+
     if(cmd_size + size > LGW_BURST_CHUNK) {
         DEBUG_PRINTF("size (%d) > LGW_BURST_CHUNK - %d, which is too big!\n", size, cmd_size);
         return LGW_SPI_ERROR;
@@ -377,6 +562,9 @@ int radio_spi_rb(spi_device_handle_t *spi, uint8_t spi_mux_target, uint8_t op_co
     int cmd_size = 3; /* header + op_code + 1 */
     uint8_t tbuf[LGW_BURST_CHUNK] = {0x00};
 
+    SPI_ASYNC_WAIT(spi);
+    SPI_BULK_SYNC(spi);
+
     if(cmd_size + size > LGW_BURST_CHUNK) {
         DEBUG_PRINTF("size (%d) > LGW_BURST_CHUNK - %d, which is too big!\n", size, cmd_size);
         return LGW_SPI_ERROR;
@@ -413,6 +601,9 @@ int sx1261_spi_wb(spi_device_handle_t *spi, uint8_t op_code, const uint8_t *data
     int cmd_size = 1; /* op_code */
     uint8_t rbuf[LGW_BURST_CHUNK] = {0x00};
 
+    SPI_ASYNC_WAIT(spi);
+    SPI_BULK_SYNC(spi);
+
     if(cmd_size + size > LGW_BURST_CHUNK) {
         DEBUG_PRINTF("size (%d) > LGW_BURST_CHUNK - %d, which is too big!\n", size, cmd_size);
         return LGW_SPI_ERROR;
@@ -447,6 +638,9 @@ int sx1261_spi_rb(spi_device_handle_t *spi, uint8_t op_code, uint8_t *data, uint
     int cmd_size = 2; /* op_code + 1 */
     uint8_t tbuf[LGW_BURST_CHUNK] = {0x00};
 
+    SPI_ASYNC_WAIT(spi);
+    SPI_BULK_SYNC(spi);
+
     if(cmd_size + size > LGW_BURST_CHUNK) {
         DEBUG_PRINTF("size (%d) > LGW_BURST_CHUNK - %d, which is too big!\n", size, cmd_size);
         return LGW_SPI_ERROR;
@@ -473,6 +667,123 @@ int sx1261_spi_rb(spi_device_handle_t *spi, uint8_t op_code, uint8_t *data, uint
     return err;
 }
 
+/* Burst (multiple-byte) read, queued to the driver */
+int lgw_spi_rb_start(spi_device_handle_t *spi, uint8_t spi_mux_target, uint16_t address, uint8_t *data, uint16_t size)
+{
+    esp_err_t err;
+    spi_transaction_ext_t *et;
+    int size_to_do, chunk_size, offset;
+
+    CHECK_NULL(spi);
+    CHECK_NULL(data);
+    SPI_BULK_SYNC(spi);
+
+    if ((spi_async.nb_trans + ((size + LGW_BURST_CHUNK - 1) / LGW_BURST_CHUNK)) > SPI_QUEUE_SIZE) {
+        DEBUG_PRINTF("ERROR: burst read of %u bytes does not fit in the transaction queue\n", size);
+        return LGW_SPI_ERROR;
+    }
+
+    size_to_do = size;
+    for(int i = 0; size_to_do > 0; ++i) {
+        chunk_size = (size_to_do < LGW_BURST_CHUNK) ? size_to_do : LGW_BURST_CHUNK;
+        offset = i * LGW_BURST_CHUNK;
+
+        et = &spi_async.trans[spi_async.nb_trans];
+        memset(et, 0, sizeof *et);
+        et->command_bits = 8;
+        et->address_bits = 8 * 3;
+        et->base.cmd = spi_mux_target;
+        et->base.addr = ((READ_ACCESS | (address & ADDR_MASK)) << 8) | 0x00;
+        et->base.flags = SPI_TRANS_VARIABLE_CMD | SPI_TRANS_VARIABLE_ADDR;
+        et->base.tx_buffer = spi_async_tx;
+        et->base.rx_buffer = (unsigned long *)(data + offset);
+        et->base.length = chunk_size * 8;
+        et->base.rxlength = chunk_size * 8;
+        et->base.user = &spi_async;
+
+        err = spi_device_queue_trans(*spi, (spi_transaction_t *)et, portMAX_DELAY);
+        if(err != ESP_OK) {
+            lgw_spi_rb_wait(spi, NULL);
+            return err;
+        }
+        spi_async.nb_trans += 1;
+
+        DEBUG_PRINTF("BURST READ QUEUED: to trans %d # chunk %d\n", size_to_do, chunk_size);
+        size_to_do -= chunk_size;
+    }
+
+    return LGW_SPI_SUCCESS;
+}
+
+int lgw_spi_rb_wait(spi_device_handle_t *spi, int64_t *done_us)
+{
+    esp_err_t err = ESP_OK;
+    esp_err_t ret;
+    spi_transaction_t *done;
+
+    CHECK_NULL(spi);
+
+    /* the task sleeps until the DMA is done */
+    while (spi_async.nb_trans > 0) {
+        ret = spi_device_get_trans_result(*spi, &done, portMAX_DELAY);
+        err = (err != ESP_OK) ? err : ret;
+        spi_async.nb_trans -= 1;
+    }
+    if (done_us != NULL) {
+        *done_us = spi_async.done_us;
+    }
+
+    return err;
+}
+
+int lgw_spi_set_write_mode(spi_device_handle_t *spi, lgw_com_write_mode_t write_mode)
+{
+    if (write_mode >= LGW_COM_WRITE_MODE_UNKNOWN) {
+        printf("ERROR: wrong write mode\n");
+        return LGW_SPI_ERROR;
+    }
+
+#if LGW_SPI_BULK == 1
+    CHECK_NULL(spi);
+    DEBUG_PRINTF("INFO: setting SPI write mode to %s\n", (write_mode == LGW_COM_WRITE_MODE_SINGLE) ? "SINGLE" : "BULK");
+    if (write_mode == LGW_COM_WRITE_MODE_SINGLE) {
+        SPI_BULK_SYNC(spi);
+    }
+    spi_bulk.mode = write_mode;
+#else
+    (void)spi;
+#endif
+
+    return LGW_SPI_SUCCESS;
+}
+
+int lgw_spi_flush(spi_device_handle_t *spi)
+{
+#if LGW_SPI_BULK == 1
+    CHECK_NULL(spi);
+    /* restore single mode after flushing */
+    spi_bulk.mode = LGW_COM_WRITE_MODE_SINGLE;
+    SPI_BULK_SYNC(spi);
+#else
+    (void)spi;
+#endif
+
+    return LGW_SPI_SUCCESS;
+}
+
+void lgw_spi_get_bulk_stat(struct lgw_com_bulk_stat_s *stat, bool reset)
+{
+#if LGW_SPI_BULK == 1
+    *stat = spi_bulk.stat;
+    if (reset == true) {
+        memset(&spi_bulk.stat, 0, sizeof spi_bulk.stat);
+    }
+#else
+    (void)reset;
+    memset(stat, 0, sizeof *stat);
+#endif
+}
+
 uint16_t lgw_spi_chunk_size(void) {
     return (uint16_t)LGW_BURST_CHUNK;
 }
@@ -23,6 +23,7 @@ License: Revised BSD License, see LICENSE.TXT file include in the project
 
 #include "driver/spi_master.h"
 #include "config.h"    /* library configuration options (dynamically generated) */
+#include "loragw_com.h"
 
 
 #define LGW_SPI_SUCCESS     0
@@ -32,6 +33,14 @@ License: Revised BSD License, see LICENSE.TXT file include in the project
 #define SPI_SPEED           2000000
 #define SX1302_SPI_HOST     SPI2_HOST
 
+#ifndef LGW_SPI_BULK
+    #define LGW_SPI_BULK    1   /* queue single writes in bulk write mode, as on USB */
+#endif
+#define LGW_SPI_BULK_NB     64  /* single writes queued before an automatic flush */
+#ifndef LGW_SPI_COMBINE
+    #define LGW_SPI_COMBINE 1   /* queued writes to adjacent addresses are sent as one burst */
+#endif
+
 
 /**
 @brief LoRa concentrator SPI setup (configure I/O and peripherals)
@@ -92,6 +101,26 @@ int lgw_spi_wb(spi_device_handle_t *spi, uint8_t spi_mux_target, uint16_t addres
 */
 int lgw_spi_rb(spi_device_handle_t *spi, uint8_t spi_mux_target, uint16_t address, uint8_t *data, uint16_t size);
 
+/**
+@brief LoRa concentrator SPI burst (multiple-byte) read, queued to the driver and done by DMA
+@param spi spi device handle
+@param address 7-bit register address
+@param data pointer to byte array that will be written from the LoRa concentrator, untouched until the read is done
+@param size size of the transfer, in byte(s)
+@return status of register operation (LGW_SPI_SUCCESS/LGW_SPI_ERROR)
+The caller keeps running during the transfer. Several reads can be started as long as their chunks fit
+in the driver queue. Any other access waits for them first.
+*/
+int lgw_spi_rb_start(spi_device_handle_t *spi, uint8_t spi_mux_target, uint16_t address, uint8_t *data, uint16_t size);
+
+/**
+@brief Wait for the burst reads started by lgw_spi_rb_start(), the calling task sleeps meanwhile
+@param spi spi device handle
+@param done_us host time (esp_timer) the last read completed, can be NULL
+@return status of register operation (LGW_SPI_SUCCESS/LGW_SPI_ERROR)
+*/
+int lgw_spi_rb_wait(spi_device_handle_t *spi, int64_t *done_us);
+
 /**
 @brief LoRa concentrator SPI burst (multiple-byte) write for radio
 */
@@ -113,6 +142,28 @@ int sx1261_spi_wb(spi_device_handle_t *spi, uint8_t op_code, const uint8_t *data
 */
 int sx1261_spi_rb(spi_device_handle_t *spi, uint8_t op_code, uint8_t *data, uint16_t size);
 
+/**
+@brief Select the write mode, in bulk mode single writes are queued until flushed
+@param spi spi device handle
+@param write_mode LGW_COM_WRITE_MODE_SINGLE or LGW_COM_WRITE_MODE_BULK, going back to single mode flushes
+@return status of register operation (LGW_SPI_SUCCESS/LGW_SPI_ERROR)
+Any read or burst access flushes the queued writes first, so the concentrator sees the accesses in order.
+*/
+int lgw_spi_set_write_mode(spi_device_handle_t *spi, lgw_com_write_mode_t write_mode);
+
+/**
+@brief Send the queued single writes as one list of SPI transactions, back to single write mode
+@param spi spi device handle
+@return status of register operation (LGW_SPI_SUCCESS/LGW_SPI_ERROR)
+*/
+int lgw_spi_flush(spi_device_handle_t *spi);
+
+/**
+@brief Get the bulk write mode statistics, reset when the SPI is opened
+@param stat pointer to the statistics: single writes queued, transactions sent for them
+@param reset reset the statistics once read
+*/
+void lgw_spi_get_bulk_stat(struct lgw_com_bulk_stat_s *stat, bool reset);
 
 uint16_t lgw_spi_chunk_size(void);
 
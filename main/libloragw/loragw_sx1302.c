@@ -23,11 +23,14 @@ License: Revised BSD License, see LICENSE.TXT file include in the project
 #include <inttypes.h>
 #include <time.h>
 
+#include "esp_timer.h"
+
 #include "loragw_reg.h"
 #include "loragw_aux.h"
 #include "loragw_hal.h"
 #include "loragw_sx1302.h"
 #include "loragw_sx1302_timestamp.h"
+#include "loragw_clock.h"
 #include "loragw_sx1302_rx.h"
 #include "loragw_sx1250.h"
 #include "loragw_agc_params.h"
@@ -121,8 +124,13 @@ const uint8_t ifmod_config[LGW_IF_CHAIN_NB] = LGW_IFMODEM_CONFIG;
 /* Radio calibration firmware */
 #include "cal_fw.var" /* text_cal_sx1257_16_Nov_1 */
 
-/* Buffer to hold RX data */
-rx_buffer_t rx_buffer;
+/* Buffers to hold RX data: packets are parsed from one while the next data is fetched into the other */
+rx_buffer_t rx_buffer[2];
+static int rx_buffer_cur = 0;               /* buffer the packets are parsed from */
+static bool rx_buffer_prefetch = false;     /* the other buffer is being filled */
+
+static struct lgw_rx_fetch_stat_s rx_fetch_stat;
+static int64_t rx_fetch_stat_start_us;
 
 /* Internal timestamp counter */
 timestamp_counter_t counter_us;
@@ -250,9 +258,15 @@ int sx1302_init(const struct lgw_conf_ftime_s * ftime_context) {
 
     /* Initialize internal counter */
     timestamp_counter_new(&counter_us);
+    lgw_clock_reset();
 
-    /* Initialize RX buffer */
-    rx_buffer_new(&rx_buffer);
+    /* Initialize RX buffers */
+    rx_buffer_new(&rx_buffer[0]);
+    rx_buffer_new(&rx_buffer[1]);
+    rx_buffer_cur = 0;
+    rx_buffer_prefetch = false;
+    memset(&rx_fetch_stat, 0, sizeof rx_fetch_stat);
+    rx_fetch_stat_start_us = esp_timer_get_time();
 
     /* Configure timestamping mode */
     if (ftime_context->enable == true) {
@@ -1860,32 +1874,65 @@ int sx1302_arb_start(uint8_t version, const struct lgw_conf_ftime_s * ftime_cont
 
 int sx1302_fetch(uint8_t * nb_pkt) {
     int err;
+    bool prefetched = false;
+    rx_buffer_t *rxb;
+    uint32_t bus_us, latency_us;
     struct timeval tm;
 
     /* Record function start time */
     _meas_time_start(&tm);
 
     /* Fetch packets from sx1302 if no more left in RX buffer */
-    if (rx_buffer.buffer_pkt_nb == 0) {
-        /* Initialize RX buffer */
-        err = rx_buffer_new(&rx_buffer);
-        if (err != LGW_REG_SUCCESS) {
-            printf("ERROR: Failed to initialize RX buffer\n");
-            return LGW_REG_ERROR;
-        }
+    if (rx_buffer[rx_buffer_cur].buffer_pkt_nb == 0) {
+        if (rx_buffer_prefetch == true) {
+            /* The other RX buffer was filled while the previous packets were parsed */
+            rx_buffer_prefetch = false;
+            rx_buffer_cur ^= 1;
+            prefetched = true;
+            err = rx_buffer_fetch_end(&rx_buffer[rx_buffer_cur]);
+        } else {
+            /* Initialize RX buffer */
+            err = rx_buffer_new(&rx_buffer[rx_buffer_cur]);
+            if (err != LGW_REG_SUCCESS) {
+                printf("ERROR: Failed to initialize RX buffer\n");
+                return LGW_REG_ERROR;
+            }
 
-        /* Fetch RX buffer if any data available */
-        err = rx_buffer_fetch(&rx_buffer);
+            /* Fetch RX buffer if any data available */
+            err = rx_buffer_fetch(&rx_buffer[rx_buffer_cur]);
+        }
         if (err != LGW_REG_SUCCESS) {
             printf("ERROR: Failed to fetch RX buffer\n");
             return LGW_REG_ERROR;
         }
+
+        /* Bus time of the fetch, and time its data waited to be parsed */
+        rxb = &rx_buffer[rx_buffer_cur];
+        if (rxb->buffer_size > 0) {
+            bus_us = (uint32_t)(rxb->done_us - rxb->fetch_us);
+            latency_us = (uint32_t)(esp_timer_get_time() - rxb->done_us);
+            rx_fetch_stat.nb_fetch += 1;
+            rx_fetch_stat.nb_prefetch += (prefetched == true) ? 1 : 0;
+            rx_fetch_stat.nb_byte += rxb->buffer_size;
+            rx_fetch_stat.bus_us += bus_us;
+            rx_fetch_stat.latency_us += latency_us;
+            rx_fetch_stat.scan_us += rxb->scan_us;
+            if (bus_us > rx_fetch_stat.bus_us_max) {
+                rx_fetch_stat.bus_us_max = bus_us;
+            }
+            if (latency_us > rx_fetch_stat.latency_us_max) {
+                rx_fetch_stat.latency_us_max = latency_us;
+            }
+            if (rxb->scan_us > rx_fetch_stat.scan_us_max) {
+                rx_fetch_stat.scan_us_max = rxb->scan_us;
+            }
+        }
     } else {
-        printf("Note: remaining %u packets in RX buffer, do not fetch sx1302 yet...\n", rx_buffer.buffer_pkt_nb);
+        printf("Note: remaining %u packets in RX buffer, do not fetch sx1302 yet...\n", rx_buffer[rx_buffer_cur].buffer_pkt_nb);
     }
 
     /* Return the number of packet fetched */
-    *nb_pkt = rx_buffer.buffer_pkt_nb;
+    *nb_pkt = rx_buffer[rx_buffer_cur].buffer_pkt_nb;
 
     _meas_time_stop(2, tm, __FUNCTION__);
 
@@ -1894,7 +1941,49 @@ int sx1302_fetch(uint8_t * nb_pkt) {
 
 /* ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~ */
 
-int sx1302_parse(lgw_context_t * context, struct lgw_pkt_rx_s * p) {
+int sx1302_prefetch(void) {
+#if LGW_RX_PREFETCH == 1
+    int err;
+    rx_buffer_t *next = &rx_buffer[rx_buffer_cur ^ 1];
+
+    if (rx_buffer_prefetch == true) {
+        return LGW_REG_SUCCESS;
+    }
+
+    err = rx_buffer_new(next);
+    if (err != LGW_REG_SUCCESS) {
+        printf("ERROR: Failed to initialize RX buffer\n");
+        return LGW_REG_ERROR;
+    }
+
+    /* The bytes are read by DMA until the next sx1302_fetch(), or any other access */
+    err = rx_buffer_fetch_start(next);
+    if (err != LGW_REG_SUCCESS) {
+        printf("ERROR: Failed to fetch RX buffer\n");
+        return LGW_REG_ERROR;
+    }
+    rx_buffer_prefetch = (next->buffer_size > 0);
+#endif
+
+    return LGW_REG_SUCCESS;
+}
+
+/* ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~ */
+
+void sx1302_rx_fetch_get_stat(struct lgw_rx_fetch_stat_s * stat, bool reset) {
+    int64_t now_us = esp_timer_get_time();
+
+    *stat = rx_fetch_stat;
+    stat->period_us = (uint64_t)(now_us - rx_fetch_stat_start_us);
+    if (reset == true) {
+        memset(&rx_fetch_stat, 0, sizeof rx_fetch_stat);
+        rx_fetch_stat_start_us = now_us;
+    }
+}
+
+/* ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~ */
+
+int sx1302_parse(lgw_context_t * context, struct lgw_pkt_rx_desc_s * p) {
     int err;
     int ifmod; /* type of if_chain/modem a packet was received by */
     int32_t if_freq_hz;
@@ -1921,16 +2010,16 @@ int sx1302_parse(lgw_context_t * context, struct lgw_pkt_rx_s * p) {
 #endif
 
     /* get packet from RX buffer */
-    err = rx_buffer_pop(&rx_buffer, &pkt);
+    err = rx_buffer_pop(&rx_buffer[rx_buffer_cur], &pkt);
     if (err == LGW_REG_WARNING) {
-        rx_buffer_del(&rx_buffer); /* clear the buffer */
+        rx_buffer_del(&rx_buffer[rx_buffer_cur]); /* clear the buffer */
         return err;
     } else if (err == LGW_REG_ERROR) {
         return err;
     }
 
-    /* copy payload to result struct */
-    memcpy((void *)p->payload, (void *)(&(pkt.payload)), pkt.rxbytenb_modem);
+    /* payload stays in the RX buffer */
+    p->payload = pkt.payload;
     p->size = pkt.rxbytenb_modem;
 
     /* process metadata */
@@ -1972,7 +2061,7 @@ int sx1302_parse(lgw_context_t * context, struct lgw_pkt_rx_s * p) {
                         printf("ERROR: Payload CRC16 check failed (got:0x%04X calc:0x%04X)\n", pkt.rx_crc16_value, payload_crc16_calc);
                         if (log_file != NULL) {
                             fprintf(log_file, "ERROR: Payload CRC16 check failed (got:0x%04X calc:0x%04X)\n", pkt.rx_crc16_value, payload_crc16_calc);
-                            dbg_log_buffer_to_file(log_file, rx_buffer.buffer, rx_buffer.buffer_size);
+                            dbg_log_buffer_to_file(log_file, rx_buffer[rx_buffer_cur].buffer, rx_buffer[rx_buffer_cur].buffer_size);
                         }
                         return LGW_REG_ERROR;
                     } else {
@@ -2001,7 +2090,7 @@ int sx1302_parse(lgw_context_t * context, struct lgw_pkt_rx_s * p) {
                     printf("ERROR: 0x%08X payload error\n", context->debug_cfg.ref_payload[i].id);
                     if (log_file != NULL) {
                         fprintf(log_file, "ERROR: 0x%08X payload error\n", context->debug_cfg.ref_payload[i].id);
-                        dbg_log_buffer_to_file(log_file, rx_buffer.buffer, rx_buffer.buffer_size);
+                        dbg_log_buffer_to_file(log_file, rx_buffer[rx_buffer_cur].buffer, rx_buffer[rx_buffer_cur].buffer_size);
                         dbg_log_payload_diff_to_file(log_file, p->payload, context->debug_cfg.ref_payload[i].payload, p->size);
                     }
                     return LGW_REG_ERROR;
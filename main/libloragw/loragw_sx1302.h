@@ -25,6 +25,10 @@ License: Revised BSD License, see LICENSE.TXT file include in the project
 /* -------------------------------------------------------------------------- */
 /* --- PUBLIC CONSTANTS ----------------------------------------------------- */
 
+#ifndef LGW_RX_PREFETCH
+    #define LGW_RX_PREFETCH 1   /* fetch the next RX data in the background while the last packets are parsed */
+#endif
+
 /* Default values */
 #define SX1302_AGC_RADIO_GAIN_AUTO  0xFF
 #define TX_START_DELAY_DEFAULT      1500    /* Calibrated value for 500KHz BW */
@@ -373,13 +377,27 @@ uint16_t sx1302_lora_payload_crc(const uint8_t * data, uint8_t size);
 */
 int sx1302_fetch(uint8_t * nb_pkt);
 
+/**
+@brief Start fetching the SX1302 RX data into the RX buffer not being parsed, if any data and not already done.
+@brief The next sx1302_fetch() takes it once the current RX buffer is parsed.
+@return LGW_REG_SUCCESS if success, LGW_REG_ERROR otherwise
+*/
+int sx1302_prefetch(void);
+
+/**
+@brief Get the RX buffer fetch statistics
+@param stat         pointer to receive the statistics
+@param reset        reset the statistics once copied
+*/
+void sx1302_rx_fetch_get_stat(struct lgw_rx_fetch_stat_s * stat, bool reset);
+
 /**
 @brief Parse and return the next packet available in rx_buffer.
 @param context      Gateway configuration context
-@param p            The structure to get the packet parsed
+@param p            The descriptor to get the packet parsed, its payload is left in rx_buffer
 @return LGW_REG_SUCCESS if a packet could be parsed, LGW_REG_ERROR otherwise
 */
-int sx1302_parse(lgw_context_t * context, struct lgw_pkt_rx_s * p);
+int sx1302_parse(lgw_context_t * context, struct lgw_pkt_rx_desc_s * p);
 
 /**
 @brief Configure the delay to be applied by the SX1302 for TX to start
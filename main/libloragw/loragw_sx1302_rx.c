@@ -17,10 +17,13 @@ License: Revised BSD License, see LICENSE.TXT file include in the project
 /* --- DEPENDANCIES --------------------------------------------------------- */
 
 #include <stdint.h>     /* C99 types */
+#include <stdbool.h>    /* bool type */
 #include <stdio.h>      /* printf fprintf */
-#include <string.h>     /* memset */
+#include <string.h>     /* memset memchr */
 #include <assert.h>     /* assert */
 
+#include "esp_timer.h"
+
 #include "loragw_aux.h"
 #include "loragw_reg.h"
 #include "loragw_sx1302_rx.h"
@@ -80,6 +83,11 @@ License: Revised BSD License, see LICENSE.TXT file include in the project
 #define SX1302_PKT_HEAD_METADATA    9
 #define SX1302_PKT_TAIL_METADATA    14
 
+/* packet checks */
+#define SX1302_PKT_OK               0
+#define SX1302_PKT_TRUNCATED        1
+#define SX1302_PKT_CHECKSUM         2
+
 /* modem IDs */
 #define SX1302_LORA_MODEM_ID_MAX    15
 #define SX1302_LORA_STD_MODEM_ID    16
@@ -94,6 +102,34 @@ License: Revised BSD License, see LICENSE.TXT file include in the project
 /* -------------------------------------------------------------------------- */
 /* --- PRIVATE FUNCTIONS DEFINITION ----------------------------------------- */
 
+/* Size of the packet starting with a syncword at idx, and its checksum if asked. Bytes beyond buffer_size are never read. */
+static int rx_buffer_pkt_check(const rx_buffer_t * self, int idx, bool checksum, uint16_t * pkt_num_bytes, uint8_t * checksum_calc) {
+    int i, checksum_idx;
+    uint8_t payload_len;
+    uint8_t sum = 0;
+
+    /* The number of fine timestamp metrics gives the size of the tail metadata */
+    payload_len = ((idx + 2) < self->buffer_size) ? SX1302_PKT_PAYLOAD_LENGTH(self->buffer, idx) : 0;
+    if ((idx + payload_len + 21) >= self->buffer_size) {
+        return SX1302_PKT_TRUNCATED;
+    }
+    *pkt_num_bytes = SX1302_PKT_HEAD_METADATA + payload_len + SX1302_PKT_TAIL_METADATA + (2 * SX1302_PKT_NUM_TS_METRICS(self->buffer, idx + payload_len));
+    if ((idx + *pkt_num_bytes) > self->buffer_size) {
+        return SX1302_PKT_TRUNCATED;
+    }
+
+    if (checksum == false) {
+        return SX1302_PKT_OK;
+    }
+    checksum_idx = idx + *pkt_num_bytes - 1;
+    for (i = idx; i < checksum_idx; i++) {
+        sum += self->buffer[i];
+    }
+    *checksum_calc = sum;
+
+    return (sum == self->buffer[checksum_idx]) ? SX1302_PKT_OK : SX1302_PKT_CHECKSUM;
+}
+
 /* -------------------------------------------------------------------------- */
 /* --- PUBLIC FUNCTIONS DEFINITION ------------------------------------------ */
 
@@ -101,11 +137,14 @@ int rx_buffer_new(rx_buffer_t * self) {
     /* Check input params */
     CHECK_NULL(self);
 
-    /* Initialize members */
-    memset(self->buffer, 0, sizeof self->buffer);
+    /* Initialize members, the buffer bytes beyond buffer_size are never read */
     self->buffer_size = 0;
     self->buffer_index = 0;
     self->buffer_pkt_nb = 0;
+    self->buffer_pkt_valid = 0;
+    self->fetch_us = 0;
+    self->done_us = 0;
+    self->scan_us = 0;
 
     return LGW_REG_SUCCESS;
 }
@@ -120,19 +159,17 @@ int rx_buffer_del(rx_buffer_t * self) {
     self->buffer_size = 0;
     self->buffer_index = 0;
     self->buffer_pkt_nb = 0;
+    self->buffer_pkt_valid = 0;
 
     return LGW_REG_SUCCESS;
 }
 
 /* ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~ */
 
-int rx_buffer_fetch(rx_buffer_t * self) {
-    int i, res;
+int rx_buffer_fetch_start(rx_buffer_t * self) {
+    int res;
     uint8_t buff_1[2];
     uint8_t buff_2[2];
-    uint8_t payload_len;
-    uint16_t next_pkt_idx;
-    int idx;
     uint16_t nb_bytes_1, nb_bytes_2;
 
     /* Check input params */
@@ -154,19 +191,76 @@ int rx_buffer_fetch(rx_buffer_t * self) {
     }
 
 
-    /* Fetch bytes from fifo if any */
+    /* Start fetching bytes from fifo if any */
     if (self->buffer_size > 0) {
         DEBUG_MSG   ("-----------------\n");
-        printf("nb_bytes_1:%u (%u %u),nb_bytes_2:%u (%u %u)\n",nb_bytes_1, buff_1[1], buff_1[0], nb_bytes_2, buff_2[1], buff_2[0]);
-        printf("%s: nb_bytes to be fetched: %u\n", __FUNCTION__, self->buffer_size);
+        DEBUG_PRINTF("nb_bytes_1:%u (%u %u),nb_bytes_2:%u (%u %u)\n",nb_bytes_1, buff_1[1], buff_1[0], nb_bytes_2, buff_2[1], buff_2[0]);
+        DEBUG_PRINTF("%s: nb_bytes to be fetched: %u\n", __FUNCTION__, self->buffer_size);
 
-        memset(self->buffer, 0, sizeof self->buffer);
-        res = lgw_mem_rb(0x4000, self->buffer, self->buffer_size, true);
+        self->fetch_us = esp_timer_get_time();
+        res = lgw_mem_rb_start(0x4000, self->buffer, self->buffer_size, true);
         if (res != LGW_REG_SUCCESS) {
             printf("ERROR: Failed to read RX buffer, SPI error\n");
             return LGW_REG_ERROR;
         }
+    }
+
+    return LGW_REG_SUCCESS;
+}
+
+/* ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~ */
+
+int rx_buffer_fetch_end(rx_buffer_t * self) {
+    int res;
+
+    /* Check input params */
+    CHECK_NULL(self);
+
+    /* Wait for the bytes fetched from fifo if any */
+    if (self->buffer_size > 0) {
+        res = lgw_mem_rb_wait(&self->done_us);
+        if (res != LGW_REG_SUCCESS) {
+            printf("ERROR: Failed to read RX buffer, SPI error\n");
+            return LGW_REG_ERROR;
+        }
+    }
+
+    return rx_buffer_scan(self);
+}
+
+/* ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~ */
+
+int rx_buffer_fetch(rx_buffer_t * self) {
+    int res;
 
+    res = rx_buffer_fetch_start(self);
+    if (res != LGW_REG_SUCCESS) {
+        return res;
+    }
+
+    return rx_buffer_fetch_end(self);
+}
+
+/* ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~ */
+
+int rx_buffer_scan(rx_buffer_t * self) {
+    int i, res;
+    int idx;
+    uint16_t pkt_num_bytes;
+    uint8_t checksum_calc;
+    const uint8_t *p;
+    int64_t start_us;
+
+    /* Check input params */
+    CHECK_NULL(self);
+
+    start_us = esp_timer_get_time();
+    self->buffer_index = 0;
+    self->buffer_pkt_nb = 0;
+    self->buffer_pkt_valid = 0;
+
+    /* Parse the bytes fetched from fifo if any */
+    if (self->buffer_size > 0) {
         /* print debug info */
         DEBUG_MSG("RX_BUFFER: ");
         for (i = 0; i < self->buffer_size; i++) {
@@ -180,16 +274,20 @@ int rx_buffer_fetch(rx_buffer_t * self) {
             return rx_buffer_del(self);
         }
 
-        /* Sanity check: is there a syncword at 0 ? If not, move to the first syncword found */
+        /* Sanity check: is there a syncword at 0 ? If not, start parsing at the first syncword found */
         idx = 0;
         while (idx <= (self->buffer_size - 2)) {
-            if ((self->buffer[idx] == SX1302_PKT_SYNCWORD_BYTE_0) && (self->buffer[idx + 1] == SX1302_PKT_SYNCWORD_BYTE_1)) {
+            p = memchr(&self->buffer[idx], SX1302_PKT_SYNCWORD_BYTE_0, self->buffer_size - 1 - idx);
+            if (p == NULL) {
+                idx = self->buffer_size;
+                break;
+            }
+            idx = (int)(p - self->buffer);
+            if (self->buffer[idx + 1] == SX1302_PKT_SYNCWORD_BYTE_1) {
                 DEBUG_PRINTF("INFO: syncword found at idx %d\n", idx);
                 break;
-            } else {
-                // printf("INFO: syncword not found at idx %d\n", idx);
-                idx += 1;
             }
+            idx += 1;
         }
         if (idx > self->buffer_size - 2) {
             printf("WARNING: no syncword found, discard rx_buffer\n");
@@ -197,34 +295,32 @@ int rx_buffer_fetch(rx_buffer_t * self) {
         }
         if (idx != 0) {
             printf("INFO: re-sync rx_buffer at idx %d\n", idx);
-            memmove((void *)(self->buffer), (void *)(self->buffer + idx), self->buffer_size - idx);
-            self->buffer_size -= idx;
         }
+        self->buffer_index = idx;
 
-        /* Rewind and parse buffer to get the number of packet fetched */
-        idx = 0;
+        /* Index the packets in one pass: a packet is popped only if it and all the ones before have a correct checksum */
         while (idx < self->buffer_size) {
-            if ((self->buffer[idx] != SX1302_PKT_SYNCWORD_BYTE_0) || (self->buffer[idx + 1] != SX1302_PKT_SYNCWORD_BYTE_1)) {
+            if (((idx + 1) >= self->buffer_size) || (self->buffer[idx] != SX1302_PKT_SYNCWORD_BYTE_0) || (self->buffer[idx + 1] != SX1302_PKT_SYNCWORD_BYTE_1)) {
                 printf("WARNING: syncword not found at idx %d, discard the rx_buffer\n", idx);
                 return rx_buffer_del(self);
             }
             /* One packet found in the buffer */
             self->buffer_pkt_nb += 1;
 
-            /* Compute the number of bytes for this packet */
-            payload_len = SX1302_PKT_PAYLOAD_LENGTH(self->buffer, idx);
-            next_pkt_idx =  SX1302_PKT_HEAD_METADATA +
-                            payload_len +
-                            SX1302_PKT_TAIL_METADATA +
-                            (2 * SX1302_PKT_NUM_TS_METRICS(self->buffer, idx + payload_len));
+            res = rx_buffer_pkt_check(self, idx, (self->buffer_pkt_valid == (self->buffer_pkt_nb - 1)), &pkt_num_bytes, &checksum_calc);
+            if (res == SX1302_PKT_TRUNCATED) {
+                break;
+            }
+            if ((res == SX1302_PKT_OK) && (self->buffer_pkt_valid == (self->buffer_pkt_nb - 1))) {
+                self->buffer_pkt_valid += 1;
+            }
 
             /* Move to next packet */
-            idx += (int)next_pkt_idx;
+            idx += (int)pkt_num_bytes;
         }
     }
 
-    /* Initialize the current buffer index to iterate on */
-    self->buffer_index = 0;
+    self->scan_us = (uint32_t)(esp_timer_get_time() - start_us);
 
     return LGW_REG_SUCCESS;
 }
@@ -233,8 +329,7 @@ int rx_buffer_fetch(rx_buffer_t * self) {
 
 int rx_buffer_pop(rx_buffer_t * self, rx_packet_t * pkt) {
     int i;
-    uint8_t checksum_rcv, checksum_calc = 0;
-    uint16_t checksum_idx;
+    uint8_t checksum_calc;
     uint16_t pkt_num_bytes;
 
     /* Check input params */
@@ -242,14 +337,19 @@ int rx_buffer_pop(rx_buffer_t * self, rx_packet_t * pkt) {
     CHECK_NULL(pkt);
 
     /* Is there any data to be parsed ? */
-    if (self->buffer_index >= self->buffer_size) {
+    if ((self->buffer_pkt_nb == 0) || (self->buffer_index >= self->buffer_size)) {
         DEBUG_MSG("INFO: No more data to be parsed\n");
         return LGW_REG_ERROR;
     }
 
-    /* Get pkt sync words */
-    if ((self->buffer[self->buffer_index] != SX1302_PKT_SYNCWORD_BYTE_0) || (self->buffer[self->buffer_index + 1] != SX1302_PKT_SYNCWORD_BYTE_1)) {
-        return LGW_REG_ERROR;
+    /* Packets were indexed by rx_buffer_scan(): tell why the first one with a bad checksum is discarded */
+    if (self->buffer_pkt_valid == 0) {
+        if (rx_buffer_pkt_check(self, self->buffer_index, true, &pkt_num_bytes, &checksum_calc) == SX1302_PKT_TRUNCATED) {
+            printf("WARNING: aborting truncated message (size=%u)\n", self->buffer_size);
+        } else {
+            printf("WARNING: checksum failed (got:0x%02X calc:0x%02X)\n", self->buffer[self->buffer_index + pkt_num_bytes - 1], checksum_calc);
+        }
+        return LGW_REG_WARNING;
     }
     DEBUG_PRINTF("INFO: pkt syncword found at index %u\n", self->buffer_index);
 
@@ -262,29 +362,6 @@ int rx_buffer_pop(rx_buffer_t * self, rx_packet_t * pkt) {
     /* Calculate the total number of bytes in the packet */
     pkt_num_bytes = SX1302_PKT_HEAD_METADATA + pkt->rxbytenb_modem + SX1302_PKT_TAIL_METADATA + (2 * pkt->num_ts_metrics_stored);
 
-    /* Check if we have a complete packet in the rx buffer fetched */
-    if((self->buffer_index + pkt_num_bytes) > self->buffer_size) {
-        printf("WARNING: aborting truncated message (size=%u)\n", self->buffer_size);
-        return LGW_REG_WARNING;
-    }
-
-    /* Get the checksum as received in the RX buffer */
-    checksum_idx = pkt_num_bytes - 1;
-    checksum_rcv = self->buffer[self->buffer_index + pkt_num_bytes - 1];
-
-    /* Calculate the checksum from the actual payload bytes received */
-    for (i = 0; i < (int)checksum_idx; i++) {
-        checksum_calc += self->buffer[self->buffer_index + i];
-    }
-
-    /* Check if the checksum is correct */
-    if (checksum_rcv != checksum_calc) {
-        printf("WARNING: checksum failed (got:0x%02X calc:0x%02X)\n", checksum_rcv, checksum_calc);
-        return LGW_REG_WARNING;
-    } else {
-        DEBUG_PRINTF("Packet checksum OK (0x%02X)\n", checksum_rcv);
-    }
-
     /* Parse packet metadata */
     pkt->modem_id = SX1302_PKT_MODEM_ID(self->buffer, self->buffer_index);
     pkt->rx_channel_in = SX1302_PKT_CHANNEL(self->buffer, self->buffer_index);
@@ -312,8 +389,8 @@ int rx_buffer_pop(rx_buffer_t * self, rx_packet_t * pkt) {
     pkt->timestamp_cnt |= (uint32_t)((SX1302_PKT_TIMESTAMP_23_16(self->buffer, self->buffer_index + pkt->rxbytenb_modem) << 16) & 0x00FF0000);
     pkt->timestamp_cnt |= (uint32_t)((SX1302_PKT_TIMESTAMP_31_24(self->buffer, self->buffer_index + pkt->rxbytenb_modem) << 24) & 0xFF000000);
 
-    /* TS metrics: it is expected the nb_symbols parameter is set to 0 here */
-    for (i = 0; i < (pkt->num_ts_metrics_stored * 2); i++) {
+    /* TS metrics: it is expected the nb_symbols parameter is set to 0 here, a corrupted count does not overflow the arrays */
+    for (i = 0; (i < (pkt->num_ts_metrics_stored * 2)) && (i < (int)sizeof pkt->timestamp_avg); i++) {
         pkt->timestamp_avg[i] = (int8_t)SX1302_PKT_NUM_TS_METRICS(self->buffer, self->buffer_index + pkt->rxbytenb_modem + 1 + i);
         pkt->timestamp_stddev[i] = 0; /* no stddev when nb_symbols == 0 */
     }
@@ -332,7 +409,7 @@ int rx_buffer_pop(rx_buffer_t * self, rx_packet_t * pkt) {
     DEBUG_PRINTF("  num_ts:     %u\n", pkt->num_ts_metrics_stored);
     if (pkt->num_ts_metrics_stored > 0) {
         DEBUG_MSG("  ts_avg:     ");
-        for (i = 0; i < (pkt->num_ts_metrics_stored * 2); i++) {
+        for (i = 0; (i < (pkt->num_ts_metrics_stored * 2)) && (i < (int)sizeof pkt->timestamp_avg); i++) {
             DEBUG_PRINTF("%d ", pkt->timestamp_avg[i]);
         }
         DEBUG_MSG("\n");
@@ -359,14 +436,15 @@ int rx_buffer_pop(rx_buffer_t * self, rx_packet_t * pkt) {
         }
     }
 
-    /* Parse & copy payload in packet struct */
-    memcpy((void *)pkt->payload, (void *)(&(self->buffer[self->buffer_index + SX1302_PKT_HEAD_METADATA])), pkt->rxbytenb_modem);
+    /* Payload is left in the buffer, no copy */
+    pkt->payload = &(self->buffer[self->buffer_index + SX1302_PKT_HEAD_METADATA]);
 
     /* Move buffer index toward next message */
-    self->buffer_index += (SX1302_PKT_HEAD_METADATA + pkt->rxbytenb_modem + SX1302_PKT_TAIL_METADATA + (2 * pkt->num_ts_metrics_stored));
+    self->buffer_index += pkt_num_bytes;
 
     /* Update the number of packets currently stored in the rx_buffer */
     self->buffer_pkt_nb -= 1;
+    self->buffer_pkt_valid -= 1;
 
     return LGW_REG_SUCCESS;
 }
@@ -44,7 +44,7 @@ typedef struct rx_packet_s {
     uint8_t     rx_rate_sf;                 /* LoRa only */
     uint8_t     modem_id;
     int32_t     frequency_offset_error;     /* LoRa only */
-    uint8_t     payload[255];
+    const uint8_t *payload;                 /* points into the rx_buffer, valid until next fetch */
     bool        payload_crc_error;
     bool        sync_error;                 /* LoRa only */
     bool        header_error;               /* LoRa only */
@@ -73,6 +73,10 @@ typedef struct rx_buffer_s {
     uint16_t buffer_size;   /*!> The number of bytes currently stored in the buffer */
     int buffer_index;       /*!> Current parsing index in the buffer */
     uint8_t buffer_pkt_nb;
+    uint8_t buffer_pkt_valid; /*!> packets left with a correct checksum, the packets after them are discarded */
+    int64_t fetch_us;       /*!> host time the fetch of the buffer started */
+    int64_t done_us;        /*!> host time the buffer was filled */
+    uint32_t scan_us;       /*!> time spent indexing the packets of the buffer */
 } rx_buffer_t;
 
 /* -------------------------------------------------------------------------- */
@@ -99,10 +103,31 @@ int rx_buffer_del(rx_buffer_t * self);
 */
 int rx_buffer_fetch(rx_buffer_t * self);
 
+/**
+@brief Start fetching the SX1302 internal RX buffer: the bytes are read in the background
+@param self     A pointer to a rx_buffer handler, its buffer is filled until rx_buffer_fetch_end()
+@return LGW_REG_SUCCESS if success, LGW_REG_ERROR otherwise
+*/
+int rx_buffer_fetch_start(rx_buffer_t * self);
+
+/**
+@brief Wait for the fetch started by rx_buffer_fetch_start(), and count packets available.
+@param self     A pointer to a rx_buffer handler
+@return LGW_REG_SUCCESS if success, LGW_REG_ERROR otherwise
+*/
+int rx_buffer_fetch_end(rx_buffer_t * self);
+
+/**
+@brief Index the packets of the bytes held in the buffer: syncwords, sizes and checksums are checked once here.
+@param self     A pointer to a rx_buffer handler, with buffer_size bytes in its buffer
+@return LGW_REG_SUCCESS if success, LGW_REG_ERROR otherwise
+*/
+int rx_buffer_scan(rx_buffer_t * self);
+
 /**
 @brief Parse the rx_buffer and return the first packet available in the given structure.
 @param self     A pointer to a rx_buffer handler
-@param pkt      A pointer to the structure to receive the packet parsed
+@param pkt      A pointer to the structure to receive the packet parsed, its payload points into the rx_buffer
 @return LGW_REG_SUCCESS if success, LGW_REG_ERROR otherwise
 */
 int rx_buffer_pop(rx_buffer_t * self, rx_packet_t * pkt);
@@ -28,9 +28,12 @@ License: Revised BSD License, see LICENSE.TXT file include in the project
 #include <inttypes.h>   /* PRIx64, PRIu64... */
 #include <assert.h>
 
+#include "esp_timer.h"
+
 #include "loragw_sx1302_timestamp.h"
 #include "loragw_reg.h"
 #include "loragw_aux.h"
+#include "loragw_clock.h"
 
 /* -------------------------------------------------------------------------- */
 /* --- PRIVATE MACROS ------------------------------------------------------- */
@@ -325,16 +328,25 @@ int timestamp_counter_get(timestamp_counter_t * self, uint32_t * inst, uint32_t
     uint8_t buff_wa[8];
     uint32_t counter_inst_us_raw_27bits_now;
     uint32_t counter_pps_us_raw_27bits_now;
+    int64_t host_us_before, host_us;
 
     /* Get the freerun and pps 32MHz timestamp counters - 8 bytes
             0 -> 3 : PPS counter
             4 -> 7 : Freerun counter (inst)
     */
+    /* Let a background RX buffer read complete first, the timed window only covers the counter read */
+    x = lgw_mem_rb_wait(NULL);
+    if (x != LGW_REG_SUCCESS) {
+        printf("ERROR: Failed to complete the pending RX buffer read\n");
+        return -1;
+    }
+    host_us_before = esp_timer_get_time();
     x = lgw_reg_rb(SX1302_REG_TIMESTAMP_TIMESTAMP_PPS_MSB2_TIMESTAMP_PPS, &buff[0], 8);
     if (x != LGW_REG_SUCCESS) {
         printf("ERROR: Failed to get timestamp counter value\n");
         return -1;
     }
+    host_us = (host_us_before + esp_timer_get_time()) / 2; /* middle of the SPI transfer, for the clock model */
 
     /* Workaround concentrator chip issue:
         - read MSB again
@@ -346,11 +358,13 @@ int timestamp_counter_get(timestamp_counter_t * self, uint32_t * inst, uint32_t
         return -1;
     }
     if ((buff[0] != buff_wa[0]) || (buff[4] != buff_wa[4])) {
+        host_us_before = esp_timer_get_time();
         x = lgw_reg_rb(SX1302_REG_TIMESTAMP_TIMESTAMP_PPS_MSB2_TIMESTAMP_PPS, &buff_wa[0], 8);
         if (x != LGW_REG_SUCCESS) {
             printf("ERROR: Failed to get timestamp counter MSB value\n");
             return -1;
         }
+        host_us = (host_us_before + esp_timer_get_time()) / 2;
         memcpy(buff, buff_wa, 8); /* use the new read value */
     }
 
@@ -371,6 +385,9 @@ int timestamp_counter_get(timestamp_counter_t * self, uint32_t * inst, uint32_t
     *inst = timestamp_counter_expand(self, false, counter_inst_us_raw_27bits_now);
     *pps  = timestamp_counter_expand(self, true, counter_pps_us_raw_27bits_now);
 
+    /* Every read keeps the host side clock model in sync */
+    lgw_clock_sample(*inst, host_us);
+
     return 0;
 }
 
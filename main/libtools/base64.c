@@ -34,72 +34,51 @@ License: Revised BSD License, see LICENSE.TXT file include in the project
 /* -------------------------------------------------------------------------- */
 /* --- PRIVATE CONSTANTS ---------------------------------------------------- */
 
+#define CODE_PAD            '='     /* RFC 1421 padding character if padding */
+#define CODE_INVALID        0xFF    /* marks characters out of the base64 alphabet */
+
 /* -------------------------------------------------------------------------- */
 /* --- PRIVATE MODULE-WIDE VARIABLES ---------------------------------------- */
 
-static char code_62 = '+';    /* RFC 1421 standard character for code 62 */
-static char code_63 = '/';    /* RFC 1421 standard character for code 63 */
-static char code_pad = '=';    /* RFC 1421 padding character if padding */
+/* RFC 1421 alphabet, code 62 is '+' and code 63 is '/' */
+static const char code_to_char[64] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+
+/* reverse alphabet, all characters out of the alphabet are CODE_INVALID */
+static const uint8_t char_to_code[256] = {
+    0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+    0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+    0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0x3E, 0xFF, 0xFF, 0xFF, 0x3F,
+    0x34, 0x35, 0x36, 0x37, 0x38, 0x39, 0x3A, 0x3B, 0x3C, 0x3D, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+    0xFF, 0x00, 0x01, 0x02, 0x03, 0x04, 0x05, 0x06, 0x07, 0x08, 0x09, 0x0A, 0x0B, 0x0C, 0x0D, 0x0E,
+    0x0F, 0x10, 0x11, 0x12, 0x13, 0x14, 0x15, 0x16, 0x17, 0x18, 0x19, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+    0xFF, 0x1A, 0x1B, 0x1C, 0x1D, 0x1E, 0x1F, 0x20, 0x21, 0x22, 0x23, 0x24, 0x25, 0x26, 0x27, 0x28,
+    0x29, 0x2A, 0x2B, 0x2C, 0x2D, 0x2E, 0x2F, 0x30, 0x31, 0x32, 0x33, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+    0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+    0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+    0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+    0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+    0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+    0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+    0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+    0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF
+};
 
 /* -------------------------------------------------------------------------- */
 /* --- PRIVATE FUNCTIONS DECLARATION ---------------------------------------- */
 
 /**
-@brief Convert a code in the range 0-63 to an ASCII character
-*/
-char code_to_char(uint8_t x);
-
-/**
-@brief Convert an ASCII character to a code in the range 0-63
+@brief Encode binary data, 3 bytes -> 4 characters per iteration
 */
-uint8_t char_to_code(char x);
+static int b64_encode(const uint8_t * in, int size, char * out, int max_len, int pad);
 
 /* -------------------------------------------------------------------------- */
 /* --- PRIVATE FUNCTIONS DEFINITION ----------------------------------------- */
 
-char code_to_char(uint8_t x) {
-    if (x <= 25) {
-        return 'A' + x;
-    } else if ((x >= 26) && (x <= 51)) {
-        return 'a' + (x-26);
-    } else if ((x >= 52) && (x <= 61)) {
-        return '0' + (x-52);
-    } else if (x == 62) {
-        return code_62;
-    } else if (x == 63) {
-        return code_63;
-    } else {
-        DEBUG("ERROR: %i IS OUT OF RANGE 0-63 FOR BASE64 ENCODING\n", x);
-        exit(EXIT_FAILURE);
-    } //TODO: improve error management
-}
-
-uint8_t char_to_code(char x) {
-    if ((x >= 'A') && (x <= 'Z')) {
-        return (uint8_t)x - (uint8_t)'A';
-    } else if ((x >= 'a') && (x <= 'z')) {
-        return (uint8_t)x - (uint8_t)'a' + 26;
-    } else if ((x >= '0') && (x <= '9')) {
-        return (uint8_t)x - (uint8_t)'0' + 52;
-    } else if (x == code_62) {
-        return 62;
-    } else if (x == code_63) {
-        return 63;
-    } else {
-        DEBUG("ERROR: %c (0x%x) IS INVALID CHARACTER FOR BASE64 DECODING\n", x, x);
-        exit(EXIT_FAILURE);
-    } //TODO: improve error management
-}
-
-/* -------------------------------------------------------------------------- */
-/* --- PUBLIC FUNCTIONS DEFINITION ------------------------------------------ */
-
-int bin_to_b64_nopad(const uint8_t * in, int size, char * out, int max_len) {
+static int b64_encode(const uint8_t * in, int size, char * out, int max_len, int pad) {
     int i;
     int result_len; /* size of the result */
     int full_blocks; /* number of 3 unsigned chars / 4 characters blocks */
     int last_bytes; /* number of unsigned chars <3 in the last block */
-    int last_chars; /* number of characters <4 in the last block */
     uint32_t b;
 
     /* check input values */
@@ -115,67 +94,73 @@ int bin_to_b64_nopad(const uint8_t * in, int size, char * out, int max_len) {
     /* calculate the number of base64 'blocks' */
     full_blocks = size / 3;
     last_bytes = size % 3;
-    switch (last_bytes) {
-        case 0: /* no byte left to encode */
-            last_chars = 0;
-            break;
-        case 1: /* 1 byte left to encode -> +2 chars */
-            last_chars = 2;
-            break;
-        case 2: /* 2 bytes left to encode -> +3 chars */
-            last_chars = 3;
-            break;
-        default:
-            CRIT("switch default that should not be possible");
-    }
 
-    /* check if output buffer is big enough */
-    result_len = (4*full_blocks) + last_chars;
+    /* check if output buffer is big enough (1 byte left -> +2 chars, 2 bytes left -> +3 chars) */
+    if (last_bytes == 0) {
+        result_len = 4 * full_blocks;
+    } else if (pad) {
+        result_len = 4 * (full_blocks + 1);
+    } else {
+        result_len = (4 * full_blocks) + last_bytes + 1;
+    }
     if (max_len < (result_len + 1)) { /* 1 char added for string terminator */
         DEBUG("ERROR: OUTPUT BUFFER TOO SMALL IN BIN_TO_B64\n");
         return -1;
     }
 
     /* process all the full blocks */
-    for (i=0; i < full_blocks; ++i) {
-        b  = (0xFF & in[3*i]    ) << 16;
-        b |= (0xFF & in[3*i + 1]) << 8;
-        b |=  0xFF & in[3*i + 2];
-        out[4*i + 0] = code_to_char((b >> 18) & 0x3F);
-        out[4*i + 1] = code_to_char((b >> 12) & 0x3F);
-        out[4*i + 2] = code_to_char((b >> 6 ) & 0x3F);
-        out[4*i + 3] = code_to_char( b        & 0x3F);
+    for (i = full_blocks; i > 0; --i) {
+        b = ((uint32_t)in[0] << 16) | ((uint32_t)in[1] << 8) | in[2];
+        out[0] = code_to_char[b >> 18];
+        out[1] = code_to_char[(b >> 12) & 0x3F];
+        out[2] = code_to_char[(b >> 6) & 0x3F];
+        out[3] = code_to_char[b & 0x3F];
+        in += 3;
+        out += 4;
     }
 
-    /* process the last 'partial' block and terminate string */
-    i = full_blocks;
-    if (last_chars == 0) {
-        out[4*i] =  0; /* null character to terminate string */
-    } else if (last_chars == 2) {
-        b  = (0xFF & in[3*i]    ) << 16;
-        out[4*i + 0] = code_to_char((b >> 18) & 0x3F);
-        out[4*i + 1] = code_to_char((b >> 12) & 0x3F);
-        out[4*i + 2] =  0; /* null character to terminate string */
-    } else if (last_chars == 3) {
-        b  = (0xFF & in[3*i]    ) << 16;
-        b |= (0xFF & in[3*i + 1]) << 8;
-        out[4*i + 0] = code_to_char((b >> 18) & 0x3F);
-        out[4*i + 1] = code_to_char((b >> 12) & 0x3F);
-        out[4*i + 2] = code_to_char((b >> 6 ) & 0x3F);
-        out[4*i + 3] = 0; /* null character to terminate string */
+    /* process the last 'partial' block, with its padding, and terminate string */
+    if (last_bytes == 1) {
+        out[0] = code_to_char[in[0] >> 2];
+        out[1] = code_to_char[(in[0] << 4) & 0x3F];
+        out += 2;
+        if (pad) {
+            out[0] = CODE_PAD;
+            out[1] = CODE_PAD;
+            out += 2;
+        }
+    } else if (last_bytes == 2) {
+        out[0] = code_to_char[in[0] >> 2];
+        out[1] = code_to_char[((in[0] << 4) | (in[1] >> 4)) & 0x3F];
+        out[2] = code_to_char[(in[1] << 2) & 0x3F];
+        out += 3;
+        if (pad) {
+            out[0] = CODE_PAD;
+            out += 1;
+        }
     }
+    *out = 0; /* null character to terminate string */
 
     return result_len;
 }
 
+/* -------------------------------------------------------------------------- */
+/* --- PUBLIC FUNCTIONS DEFINITION ------------------------------------------ */
+
+int bin_to_b64_nopad(const uint8_t * in, int size, char * out, int max_len) {
+    return b64_encode(in, size, out, max_len, 0);
+}
+
 int b64_to_bin_nopad(const char * in, int size, uint8_t * out, int max_len) {
     int i;
     int result_len; /* size of the result */
     int full_blocks; /* number of 3 unsigned chars / 4 characters blocks */
     int last_chars; /* number of characters <4 in the last block */
     int last_bytes; /* number of unsigned chars <3 in the last block */
+    const uint8_t *src = (const uint8_t *)in;
+    uint8_t c0, c1, c2, c3;
+    uint8_t invalid = 0; /* OR of all codes, CODE_INVALID bits show up if any character is invalid */
     uint32_t b;
-    ;
 
     /* check input values */
     if ((out == NULL) || (in == NULL)) {
@@ -213,76 +198,52 @@ int b64_to_bin_nopad(const char * in, int size, uint8_t * out, int max_len) {
         return -1;
     }
 
-    /* process all the full blocks */
-    for (i=0; i < full_blocks; ++i) {
-        b  = (0x3F & char_to_code(in[4*i]    )) << 18;
-        b |= (0x3F & char_to_code(in[4*i + 1])) << 12;
-        b |= (0x3F & char_to_code(in[4*i + 2])) << 6;
-        b |=  0x3F & char_to_code(in[4*i + 3]);
-        out[3*i + 0] = (b >> 16) & 0xFF;
-        out[3*i + 1] = (b >> 8 ) & 0xFF;
-        out[3*i + 2] =  b        & 0xFF;
+    /* process all the full blocks, characters are only validated at the end */
+    for (i = full_blocks; i > 0; --i) {
+        c0 = char_to_code[src[0]];
+        c1 = char_to_code[src[1]];
+        c2 = char_to_code[src[2]];
+        c3 = char_to_code[src[3]];
+        invalid |= c0 | c1 | c2 | c3;
+        b = ((uint32_t)c0 << 18) | ((uint32_t)c1 << 12) | ((uint32_t)c2 << 6) | c3;
+        out[0] = (b >> 16) & 0xFF;
+        out[1] = (b >> 8 ) & 0xFF;
+        out[2] =  b        & 0xFF;
+        src += 4;
+        out += 3;
     }
 
     /* process the last 'partial' block */
-    i = full_blocks;
     if (last_bytes == 1) {
-        b  = (0x3F & char_to_code(in[4*i]    )) << 18;
-        b |= (0x3F & char_to_code(in[4*i + 1])) << 12;
-        out[3*i + 0] = (b >> 16) & 0xFF;
-        if (((b >> 12) & 0x0F) != 0) {
+        c0 = char_to_code[src[0]];
+        c1 = char_to_code[src[1]];
+        invalid |= c0 | c1;
+        out[0] = (c0 << 2) | ((c1 >> 4) & 0x03);
+        if ((c1 & 0x0F) != 0) {
             DEBUG("WARNING: last character contains unusable bits\n");
         }
     } else if (last_bytes == 2) {
-        b  = (0x3F & char_to_code(in[4*i]    )) << 18;
-        b |= (0x3F & char_to_code(in[4*i + 1])) << 12;
-        b |= (0x3F & char_to_code(in[4*i + 2])) << 6;
-        out[3*i + 0] = (b >> 16) & 0xFF;
-        out[3*i + 1] = (b >> 8 ) & 0xFF;
-        if (((b >> 6) & 0x03) != 0) {
+        c0 = char_to_code[src[0]];
+        c1 = char_to_code[src[1]];
+        c2 = char_to_code[src[2]];
+        invalid |= c0 | c1 | c2;
+        out[0] = (c0 << 2) | ((c1 >> 4) & 0x03);
+        out[1] = (c1 << 4) | ((c2 >> 2) & 0x0F);
+        if ((c2 & 0x03) != 0) {
             DEBUG("WARNING: last character contains unusable bits\n");
         }
     }
 
+    if ((invalid & 0xC0) != 0) {
+        DEBUG("ERROR: INVALID CHARACTER FOR BASE64 DECODING\n");
+        return -1;
+    }
+
     return result_len;
 }
 
 int bin_to_b64(const uint8_t * in, int size, char * out, int max_len) {
-    int ret;
-
-    ret = bin_to_b64_nopad(in, size, out, max_len);
-
-    if (ret == -1) {
-        return -1;
-    }
-    switch (ret%4) {
-        case 0: /* nothing to do */
-            return ret;
-        case 1:
-            DEBUG("ERROR: INVALID UNPADDED BASE64 STRING\n");
-            return -1;
-        case 2: /* 2 chars in last block, must add 2 padding char */
-            if (max_len >= (ret + 2 + 1)) {
-                out[ret] = code_pad;
-                out[ret+1] = code_pad;
-                out[ret+2] = 0;
-                return ret+2;
-            } else {
-                DEBUG("ERROR: not enough room to add padding in bin_to_b64\n");
-                return -1;
-            }
-        case 3: /* 3 chars in last block, must add 1 padding char */
-            if (max_len >= (ret + 1 + 1)) {
-                out[ret] = code_pad;
-                out[ret+1] = 0;
-                return ret+1;
-            } else {
-                DEBUG("ERROR: not enough room to add padding in bin_to_b64\n");
-                return -1;
-            }
-        default:
-            CRIT("switch default that should not be possible");
-    }
+    return b64_encode(in, size, out, max_len, 1);
 }
 
 int b64_to_bin(const char * in, int size, uint8_t * out, int max_len) {
@@ -291,9 +252,9 @@ int b64_to_bin(const char * in, int size, uint8_t * out, int max_len) {
         return -1;
     }
     if ((size%4 == 0) && (size >= 4)) { /* potentially padded Base64 */
-        if (in[size-2] == code_pad) { /* 2 padding char to ignore */
+        if (in[size-2] == CODE_PAD) { /* 2 padding char to ignore */
             return b64_to_bin_nopad(in, size-2, out, max_len);
-        } else if (in[size-1] == code_pad) { /* 1 padding char to ignore */
+        } else if (in[size-1] == CODE_PAD) { /* 1 padding char to ignore */
             return b64_to_bin_nopad(in, size-1, out, max_len);
         } else { /* no padding to ignore */
             return b64_to_bin_nopad(in, size, out, max_len);
@@ -609,6 +609,7 @@ static JSON_Value * parse_object_value(const char **string, size_t nesting) {
         new_key = get_quoted_string(string);
         SKIP_WHITESPACES(string);
         if (new_key == NULL || **string != ':') {
+            parson_free(new_key);
             json_value_free(output_value);
             return NULL;
         }
@@ -621,7 +622,7 @@ static JSON_Value * parse_object_value(const char **string, size_t nesting) {
         }
         if(json_object_add(output_object, new_key, new_value) == JSONFailure) {
             parson_free(new_key);
-            parson_free(new_value);
+            json_value_free(new_value);
             json_value_free(output_value);
             return NULL;
         }
@@ -0,0 +1,99 @@
+/*
+ / _____)             _              | |
+( (____  _____ ____ _| |_ _____  ____| |__
+ \____ \| ___ |    (_   _) ___ |/ ___)  _ \
+ _____) ) ____| | | || |_| ____( (___| | | |
+(______/|_____)_|_|_| \__)_____)\____)_| |_|
+  (C)2019 Semtech
+
+Description:
+    LoRa concentrator : lock-free single producer / single consumer inbox of
+    downlink requests, between the network (PULL_RESP) stage and the JIT task
+
+License: Revised BSD License, see LICENSE.TXT file include in the project
+*/
+
+
+#include <string.h>     /* memset, memcpy */
+
+#include "downlink_inbox.h"
+
+
+#if ((DOWNLINK_INBOX_SIZE & (DOWNLINK_INBOX_SIZE - 1)) != 0)
+    #error "DOWNLINK_INBOX_SIZE must be a power of 2"
+#endif
+
+/* -------------------------------------------------------------------------- */
+/* --- PUBLIC FUNCTIONS DEFINITION ------------------------------------------ */
+
+void downlink_inbox_init(struct downlink_inbox_s *inbox) {
+    memset(inbox->req, 0, sizeof inbox->req);
+    atomic_init(&(inbox->head), 0);
+    atomic_init(&(inbox->tail), 0);
+    atomic_init(&(inbox->occupancy_max), 0);
+    atomic_init(&(inbox->nb_push), 0);
+    atomic_init(&(inbox->nb_full), 0);
+}
+
+bool downlink_inbox_push(struct downlink_inbox_s *inbox, const struct downlink_req_s *req) {
+    unsigned int head, tail, occupancy, occupancy_max;
+
+    /* the head is only written here, the tail is released by the consumer once a slot is free */
+    head = atomic_load_explicit(&(inbox->head), memory_order_relaxed);
+    tail = atomic_load_explicit(&(inbox->tail), memory_order_acquire);
+    occupancy = head - tail; /* unsigned arithmetic, indexes roll over */
+    if (occupancy >= DOWNLINK_INBOX_SIZE) {
+        atomic_fetch_add_explicit(&(inbox->nb_full), 1, memory_order_relaxed);
+        return false;
+    }
+
+    memcpy(&(inbox->req[head & (DOWNLINK_INBOX_SIZE - 1)]), req, sizeof *req);
+
+    /* publish the request: the consumer sees the copy completed once it sees the new head */
+    atomic_store_explicit(&(inbox->head), head + 1, memory_order_release);
+
+    atomic_fetch_add_explicit(&(inbox->nb_push), 1, memory_order_relaxed);
+    /* compare and swap: a reset by the statistics reader in between is not overwritten by a stale max */
+    occupancy_max = atomic_load_explicit(&(inbox->occupancy_max), memory_order_relaxed);
+    while ((occupancy + 1) > occupancy_max) {
+        if (atomic_compare_exchange_weak_explicit(&(inbox->occupancy_max), &occupancy_max, occupancy + 1, memory_order_relaxed, memory_order_relaxed)) {
+            break;
+        }
+    }
+
+    return true;
+}
+
+struct downlink_req_s *downlink_inbox_peek(struct downlink_inbox_s *inbox) {
+    unsigned int head, tail;
+
+    tail = atomic_load_explicit(&(inbox->tail), memory_order_relaxed);
+    head = atomic_load_explicit(&(inbox->head), memory_order_acquire);
+    if (head == tail) {
+        return NULL;
+    }
+
+    return &(inbox->req[tail & (DOWNLINK_INBOX_SIZE - 1)]);
+}
+
+void downlink_inbox_pop(struct downlink_inbox_s *inbox) {
+    unsigned int tail;
+
+    /* the slot is given back to the producer once the consumer is done reading it */
+    tail = atomic_load_explicit(&(inbox->tail), memory_order_relaxed);
+    atomic_store_explicit(&(inbox->tail), tail + 1, memory_order_release);
+}
+
+void downlink_inbox_get_stat(struct downlink_inbox_s *inbox, struct downlink_inbox_stat_s *stat, bool reset) {
+    if (reset == true) {
+        stat->occupancy_max = (uint16_t)atomic_exchange(&(inbox->occupancy_max), 0);
+        stat->nb_push = atomic_exchange(&(inbox->nb_push), 0);
+        stat->nb_full = atomic_exchange(&(inbox->nb_full), 0);
+    } else {
+        stat->occupancy_max = (uint16_t)atomic_load(&(inbox->occupancy_max));
+        stat->nb_push = atomic_load(&(inbox->nb_push));
+        stat->nb_full = atomic_load(&(inbox->nb_full));
+    }
+}
+
+/* --- EOF ------------------------------------------------------------------ */
@@ -0,0 +1,102 @@
+/*
+ / _____)             _              | |
+( (____  _____ ____ _| |_ _____  ____| |__
+ \____ \| ___ |    (_   _) ___ |/ ___)  _ \
+ _____) ) ____| | | || |_| ____( (___| | | |
+(______/|_____)_|_|_| \__)_____)\____)_| |_|
+  (C)2019 Semtech
+
+Description:
+    LoRa concentrator : lock-free single producer / single consumer inbox of
+    downlink requests, between the network (PULL_RESP) stage and the JIT task
+
+License: Revised BSD License, see LICENSE.TXT file include in the project
+*/
+
+
+#ifndef _LORA_PKTFWD_DOWNLINK_INBOX_H
+#define _LORA_PKTFWD_DOWNLINK_INBOX_H
+
+
+#include <stdint.h>     /* C99 types */
+#include <stdbool.h>    /* bool type */
+#include <stdatomic.h>  /* atomic_uint */
+
+#include "loragw_hal.h"
+#include "jitqueue.h"
+
+
+#define DOWNLINK_INBOX_SIZE     16  /* Number of pending downlink requests, must be a power of 2 */
+
+/* a downlink request, checked by the network stage, to be queued by the JIT task */
+struct downlink_req_s {
+    struct lgw_pkt_tx_s pkt;        /* TX packet */
+    enum jit_pkt_type_e pkt_type;   /* Packet type: Downlink class A, B or C */
+    enum jit_error_e warning;       /* Warning to be reported in TX_ACK if the packet is queued */
+    int32_t warning_value;          /* Value of the warning (actual TX power...) */
+    uint8_t token_h;                /* TX_ACK token, as given in PULL_RESP */
+    uint8_t token_l;
+};
+
+struct downlink_inbox_stat_s {
+    uint16_t occupancy_max;         /* Highest number of pending requests since last reset */
+    uint32_t nb_push;               /* Number of requests handed over to the JIT task */
+    uint32_t nb_full;               /* Number of requests rejected because the inbox was full */
+};
+
+struct downlink_inbox_s {
+    atomic_uint head;               /* Number of requests pushed, written by the producer only */
+    atomic_uint tail;               /* Number of requests popped, written by the consumer only */
+    atomic_uint occupancy_max;      /* Statistics, updated by the producer and read from any task */
+    atomic_uint nb_push;
+    atomic_uint nb_full;
+    struct downlink_req_s req[DOWNLINK_INBOX_SIZE];
+};
+
+/* -------------------------------------------------------------------------- */
+/* --- PUBLIC FUNCTIONS PROTOTYPES ------------------------------------------ */
+
+/**
+@brief Initialize a downlink inbox, before the producer and consumer tasks are started.
+
+@param inbox[in] Downlink inbox to be initialized. Memory should have been allocated already.
+*/
+void downlink_inbox_init(struct downlink_inbox_s *inbox);
+
+/**
+@brief Hand a downlink request over to the consumer (producer side).
+
+@param inbox[in/out] Downlink inbox
+@param req[in] Request to be copied in the inbox
+@return false if the inbox is full, the request is not stored
+
+Never blocks: the network stage is not held by the scheduling of the packet.
+*/
+bool downlink_inbox_push(struct downlink_inbox_s *inbox, const struct downlink_req_s *req);
+
+/**
+@brief Get the oldest pending request, without removing it (consumer side).
+
+@param inbox[in] Downlink inbox
+@return pointer on the request, owned by the consumer until downlink_inbox_pop(), NULL if empty
+*/
+struct downlink_req_s *downlink_inbox_peek(struct downlink_inbox_s *inbox);
+
+/**
+@brief Remove the request returned by downlink_inbox_peek() (consumer side).
+
+@param inbox[in/out] Downlink inbox
+*/
+void downlink_inbox_pop(struct downlink_inbox_s *inbox);
+
+/**
+@brief Get the inbox statistics, from any task.
+
+@param inbox[in/out] Downlink inbox
+@param stat[out] Copy of the statistics
+@param reset[in] Reset high watermark and counters after reading them
+*/
+void downlink_inbox_get_stat(struct downlink_inbox_s *inbox, struct downlink_inbox_stat_s *stat, bool reset);
+
+#endif
+/* --- EOF ------------------------------------------------------------------ */
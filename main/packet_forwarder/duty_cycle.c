@@ -0,0 +1,212 @@
+/*
+ / _____)             _              | |
+( (____  _____ ____ _| |_ _____  ____| |__
+ \____ \| ___ |    (_   _) ___ |/ ___)  _ \
+ _____) ) ____| | | || |_| ____( (___| | | |
+(______/|_____)_|_|_| \__)_____)\____)_| |_|
+  (C)2019 Semtech
+
+Description:
+    LoRa concentrator : regulatory duty-cycle and dwell-time accounting of
+    downlinks, per sub-band, over a sliding window
+
+License: Revised BSD License, see LICENSE.TXT file include in the project
+*/
+
+
+#include <stdio.h>      /* printf */
+#include <string.h>     /* memset, strcmp */
+#include <assert.h>
+
+#include "trace.h"
+#include "duty_cycle.h"
+
+
+/* -------------------------------------------------------------------------- */
+/* --- PRIVATE CONSTANTS ---------------------------------------------------- */
+
+/* ETSI EN 300 220 sub-bands, as used by LoRaWAN EU863-870 */
+static const struct duty_cycle_band_s region_eu868[] = {
+    { 863000000, 865000000,  0.1, 0 },
+    { 865000000, 868000000,  1.0, 0 },
+    { 868000000, 868600000,  1.0, 0 },
+    { 868700000, 869200000,  0.1, 0 },
+    { 869400000, 869650000, 10.0, 0 },
+    { 869700000, 870000000,  1.0, 0 }
+};
+
+/* FCC part 15.247, no duty-cycle but a 400 ms dwell time per channel */
+static const struct duty_cycle_band_s region_us915[] = {
+    { 902000000, 928000000, 100.0, 400 }
+};
+
+/* -------------------------------------------------------------------------- */
+/* --- PRIVATE FUNCTIONS DEFINITION ----------------------------------------- */
+
+/* first sub-band containing the frequency, nb_band if none */
+static int duty_find_band(struct duty_cycle_s *duty, uint32_t freq_hz) {
+    int i;
+
+    for (i = 0; i < duty->nb_band; i++) {
+        if ((freq_hz >= duty->band[i].freq_min) && (freq_hz <= duty->band[i].freq_max)) {
+            break;
+        }
+    }
+
+    return i;
+}
+
+/* move the current bucket up to now, expiring the airtime that left the window */
+static void duty_advance(struct duty_cycle_s *duty, int64_t now_ms) {
+    int64_t nb_bucket;
+    int i;
+
+    if (duty->head_ms < 0) {
+        duty->head_ms = now_ms;
+        return;
+    }
+
+    nb_bucket = (now_ms - duty->head_ms) / duty->bucket_ms;
+    if (nb_bucket <= 0) {
+        return;
+    }
+    if (nb_bucket >= DUTY_CYCLE_RING_SIZE) {
+        /* the whole window expired */
+        memset(duty->used_ms, 0, sizeof duty->used_ms);
+        memset(duty->bucket, 0, sizeof duty->bucket);
+    } else {
+        while (nb_bucket-- > 0) {
+            duty->head = (duty->head + 1) % DUTY_CYCLE_RING_SIZE;
+            for (i = 0; i < duty->nb_band; i++) {
+                duty->used_ms[i] -= duty->bucket[i][duty->head];
+                duty->bucket[i][duty->head] = 0;
+            }
+        }
+    }
+    duty->head_ms = now_ms - ((now_ms - duty->head_ms) % duty->bucket_ms);
+}
+
+/* -------------------------------------------------------------------------- */
+/* --- PUBLIC FUNCTIONS DEFINITION ----------------------------------------- */
+
+void duty_cycle_init(struct duty_cycle_s *duty, uint32_t window_s) {
+    memset(duty, 0, sizeof(*duty));
+
+    duty->bucket_ms = (window_s * 1000) / DUTY_CYCLE_BUCKET_NB;
+    if (duty->bucket_ms == 0) {
+        duty->bucket_ms = 1;
+    }
+    duty->head_ms = -1;
+    duty->mx_duty = xSemaphoreCreateMutex();
+    assert(duty->mx_duty);
+}
+
+int duty_cycle_add_band(struct duty_cycle_s *duty, const struct duty_cycle_band_s *band) {
+    if ((duty->nb_band == DUTY_CYCLE_BAND_MAX) || (band->freq_min > band->freq_max) || (band->duty_cycle <= 0.0) || (band->duty_cycle > 100.0)) {
+        return -1;
+    }
+
+    xSemaphoreTake(duty->mx_duty, portMAX_DELAY);
+
+    duty->band[duty->nb_band] = *band;
+    duty->budget_ms[duty->nb_band] = (uint32_t)((double)duty->bucket_ms * DUTY_CYCLE_BUCKET_NB * band->duty_cycle / 100.0);
+    duty->nb_band += 1;
+
+    xSemaphoreGive(duty->mx_duty);
+
+    return 0;
+}
+
+int duty_cycle_add_region(struct duty_cycle_s *duty, const char *region) {
+    const struct duty_cycle_band_s *table;
+    int nb_band;
+    int i;
+
+    if (strcmp(region, "EU868") == 0) {
+        table = region_eu868;
+        nb_band = sizeof region_eu868 / sizeof region_eu868[0];
+    } else if (strcmp(region, "US915") == 0) {
+        table = region_us915;
+        nb_band = sizeof region_us915 / sizeof region_us915[0];
+    } else {
+        return -1;
+    }
+
+    for (i = 0; i < nb_band; i++) {
+        if (duty_cycle_add_band(duty, &table[i]) != 0) {
+            return -1;
+        }
+    }
+
+    return 0;
+}
+
+enum duty_cycle_error_e duty_cycle_charge(struct duty_cycle_s *duty, uint32_t freq_hz, uint32_t toa_ms, int64_t now_ms, bool force) {
+    enum duty_cycle_error_e err = DUTY_CYCLE_OK;
+    int i;
+
+    xSemaphoreTake(duty->mx_duty, portMAX_DELAY);
+
+    i = duty_find_band(duty, freq_hz);
+    if (i == duty->nb_band) {
+        duty->stat.nb_out_of_band += 1;
+    } else {
+        duty_advance(duty, now_ms);
+        if ((force == false) && (duty->band[i].dwell_max_ms > 0) && (toa_ms > duty->band[i].dwell_max_ms)) {
+            err = DUTY_CYCLE_DWELL_TIME;
+            duty->stat.nb_dwell_time += 1;
+        } else if ((force == false) && ((duty->used_ms[i] + toa_ms) > duty->budget_ms[i])) {
+            err = DUTY_CYCLE_EXCEEDED;
+            duty->stat.nb_exceeded += 1;
+        } else {
+            duty->used_ms[i] += toa_ms;
+            duty->bucket[i][duty->head] += toa_ms;
+            duty->stat.nb_charged += 1;
+        }
+    }
+
+    xSemaphoreGive(duty->mx_duty);
+
+    return err;
+}
+
+void duty_cycle_refund(struct duty_cycle_s *duty, uint32_t freq_hz, uint32_t toa_ms, int64_t charge_ms, int64_t now_ms) {
+    int64_t nb_bucket;
+    int i, b;
+
+    xSemaphoreTake(duty->mx_duty, portMAX_DELAY);
+
+    i = duty_find_band(duty, freq_hz);
+    if ((i < duty->nb_band) && (duty->head_ms >= 0)) {
+        duty_advance(duty, now_ms);
+
+        /* buckets between the one the airtime was charged to and the current one */
+        nb_bucket = (charge_ms >= duty->head_ms) ? 0 : ((duty->head_ms - charge_ms + duty->bucket_ms - 1) / duty->bucket_ms);
+        if (nb_bucket < DUTY_CYCLE_RING_SIZE) {
+            b = (duty->head + DUTY_CYCLE_RING_SIZE - (int)nb_bucket) % DUTY_CYCLE_RING_SIZE;
+            if (toa_ms > duty->bucket[i][b]) {
+                toa_ms = duty->bucket[i][b]; /* not expected, keeps the sums from wrapping */
+            }
+            duty->bucket[i][b] -= toa_ms;
+            duty->used_ms[i] -= toa_ms;
+            duty->stat.nb_refunded += 1;
+        }
+    }
+
+    xSemaphoreGive(duty->mx_duty);
+}
+
+void duty_cycle_get_stat(struct duty_cycle_s *duty, int64_t now_ms, struct duty_cycle_stat_s *stat, bool reset) {
+    xSemaphoreTake(duty->mx_duty, portMAX_DELAY);
+
+    duty_advance(duty, now_ms);
+    memcpy(duty->stat.used_ms, duty->used_ms, sizeof duty->stat.used_ms);
+    *stat = duty->stat;
+    if (reset == true) {
+        memset(&(duty->stat), 0, sizeof(duty->stat));
+    }
+
+    xSemaphoreGive(duty->mx_duty);
+}
+
+/* --- EOF ------------------------------------------------------------------ */
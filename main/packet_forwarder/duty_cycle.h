@@ -0,0 +1,138 @@
+/*
+ / _____)             _              | |
+( (____  _____ ____ _| |_ _____  ____| |__
+ \____ \| ___ |    (_   _) ___ |/ ___)  _ \
+ _____) ) ____| | | || |_| ____( (___| | | |
+(______/|_____)_|_|_| \__)_____)\____)_| |_|
+  (C)2019 Semtech
+
+Description:
+    LoRa concentrator : regulatory duty-cycle and dwell-time accounting of
+    downlinks, per sub-band, over a sliding window
+
+License: Revised BSD License, see LICENSE.TXT file include in the project
+*/
+
+
+#ifndef _LORA_PKTFWD_DUTY_CYCLE_H
+#define _LORA_PKTFWD_DUTY_CYCLE_H
+
+
+#include <stdint.h>     /* C99 types */
+#include <stdbool.h>    /* bool type */
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+
+
+#define DUTY_CYCLE_BAND_MAX     8       /* Max number of sub-bands in a region table */
+#define DUTY_CYCLE_BUCKET_NB    60      /* Time buckets in the sliding window, airtime expires one bucket late at most */
+#define DUTY_CYCLE_RING_SIZE    (DUTY_CYCLE_BUCKET_NB + 1) /* The current bucket is only partly in the window */
+#define DUTY_CYCLE_WINDOW_S     3600    /* Default observation period (ETSI EN 300 220) */
+
+enum duty_cycle_error_e {
+    DUTY_CYCLE_OK,                  /* Airtime charged, or frequency outside of any sub-band */
+    DUTY_CYCLE_EXCEEDED,            /* Not enough airtime left in the sub-band window */
+    DUTY_CYCLE_DWELL_TIME           /* Time on air above the sub-band max dwell time */
+};
+
+struct duty_cycle_band_s {
+    uint32_t freq_min;              /* Lowest frequency of the sub-band, in Hz */
+    uint32_t freq_max;              /* Highest frequency of the sub-band, in Hz */
+    float duty_cycle;               /* Max share of the window on air, in percent */
+    uint32_t dwell_max_ms;          /* Max time on air of a single packet, in milliseconds (0 = no limit) */
+};
+
+struct duty_cycle_stat_s {
+    uint32_t nb_charged;            /* Number of packets charged */
+    uint32_t nb_exceeded;           /* Number of packets rejected, the sub-band budget was exhausted */
+    uint32_t nb_dwell_time;         /* Number of packets rejected, their time on air was too long */
+    uint32_t nb_out_of_band;        /* Number of packets outside of any sub-band, not limited */
+    uint32_t nb_refunded;           /* Number of packets charged but never sent, their airtime given back */
+    uint32_t used_ms[DUTY_CYCLE_BAND_MAX]; /* Airtime currently in the window of each sub-band */
+};
+
+struct duty_cycle_s {
+    SemaphoreHandle_t mx_duty;      /* control access to the ledger and statistics */
+    uint32_t bucket_ms;             /* Length of a time bucket */
+    int nb_band;
+    struct duty_cycle_band_s band[DUTY_CYCLE_BAND_MAX]; /* Region table */
+    uint32_t budget_ms[DUTY_CYCLE_BAND_MAX]; /* Airtime allowed in the window of each sub-band */
+    uint32_t used_ms[DUTY_CYCLE_BAND_MAX];   /* Airtime in the window, sum of the buckets */
+    uint32_t bucket[DUTY_CYCLE_BAND_MAX][DUTY_CYCLE_RING_SIZE]; /* Airtime charged in each time bucket */
+    int head;                       /* Current time bucket */
+    int64_t head_ms;                /* Start time of the current bucket, -1 until the first charge */
+    struct duty_cycle_stat_s stat;
+};
+
+/* -------------------------------------------------------------------------- */
+/* --- PUBLIC FUNCTIONS PROTOTYPES ------------------------------------------ */
+
+/**
+@brief Initialize an empty ledger, with no sub-band.
+
+@param duty[in] Ledger to be initialized. Memory should have been allocated already.
+@param window_s[in] Observation period of the duty-cycle, in seconds
+*/
+void duty_cycle_init(struct duty_cycle_s *duty, uint32_t window_s);
+
+/**
+@brief Add a sub-band to the region table.
+
+@param duty[in/out] Ledger
+@param band[in] Sub-band limits
+@return -1 if the table is full or the sub-band is invalid, 0 otherwise
+
+A packet is charged to the first sub-band added that contains its frequency.
+*/
+int duty_cycle_add_band(struct duty_cycle_s *duty, const struct duty_cycle_band_s *band);
+
+/**
+@brief Add the sub-bands of a built-in region table.
+
+@param duty[in/out] Ledger
+@param region[in] Region name, "EU868" or "US915"
+@return -1 if the region is unknown or the table is full, 0 otherwise
+*/
+int duty_cycle_add_region(struct duty_cycle_s *duty, const char *region);
+
+/**
+@brief Check that a packet fits in the budget of its sub-band, and charge its airtime.
+
+@param duty[in/out] Ledger
+@param freq_hz[in] TX frequency
+@param toa_ms[in] Time on air of the packet
+@param now_ms[in] Host monotonic time, in milliseconds
+@param force[in] Charge the packet even if it does not fit (beacons)
+@return DUTY_CYCLE_OK if the packet was charged, the reason of the rejection otherwise
+
+The airtime is charged at enqueue time. Updates are O(1) amortized: the window is a ring of
+time buckets, the expired buckets are subtracted from the running sum as time goes by.
+*/
+enum duty_cycle_error_e duty_cycle_charge(struct duty_cycle_s *duty, uint32_t freq_hz, uint32_t toa_ms, int64_t now_ms, bool force);
+
+/**
+@brief Give back the airtime of a packet charged but never sent.
+
+@param duty[in/out] Ledger
+@param freq_hz[in] TX frequency
+@param toa_ms[in] Time on air the packet was charged
+@param charge_ms[in] Host monotonic time the packet was charged at, in milliseconds
+@param now_ms[in] Host monotonic time, in milliseconds
+
+Nothing is given back once the airtime has left the window.
+*/
+void duty_cycle_refund(struct duty_cycle_s *duty, uint32_t freq_hz, uint32_t toa_ms, int64_t charge_ms, int64_t now_ms);
+
+/**
+@brief Get the ledger statistics.
+
+@param duty[in/out] Ledger
+@param now_ms[in] Host monotonic time, in milliseconds, to expire the old airtime
+@param stat[out] Copy of the statistics
+@param reset[in] Reset the counters after reading them
+*/
+void duty_cycle_get_stat(struct duty_cycle_s *duty, int64_t now_ms, struct duty_cycle_stat_s *stat, bool reset);
+
+#endif
+/* --- EOF ------------------------------------------------------------------ */
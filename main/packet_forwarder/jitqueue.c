@@ -13,11 +13,6 @@ License: Revised BSD License, see LICENSE.TXT file include in the project
 */
 
 
-#ifndef _GNU_SOURCE
-#define _GNU_SOURCE     /* needed for qsort_r to be defined */
-#endif
-
-#include <stdlib.h>     /* qsort_r */
 #include <stdio.h>      /* printf, fprintf, snprintf, fopen, fputs */
 #include <string.h>     /* memset, memcpy */
 #include <pthread.h>
@@ -29,29 +24,50 @@ License: Revised BSD License, see LICENSE.TXT file include in the project
 
 #include "freertos/FreeRTOS.h"
 #include "freertos/semphr.h"
+#include "esp_timer.h"
 
 
 #define TX_START_DELAY          1500    /* microseconds */
 #define TX_MARGIN_DELAY         1000    /* Packet overlap margin in microseconds */
 
-#define TX_JIT_DELAY            40000   /* Pre-delay to program packet for TX in microseconds */
 #define TX_MAX_ADVANCE_DELAY    ((JIT_NUM_BEACON_IN_QUEUE + 1) * 128 * 1E6) /* Maximum advance delay accepted for a TX packet, compared to current time */
 
 #define BEACON_GUARD            3000000 /* Interval where no ping slot can be placed,
                                             to ensure beacon can be sent */
 #define BEACON_RESERVED         2120000 /* Time on air of the beacon, with some margin */
 
+#if ((JIT_GAP_LEAVES <= JIT_QUEUE_MAX) || ((JIT_GAP_LEAVES & (JIT_GAP_LEAVES - 1)) != 0))
+    #error "JIT_GAP_LEAVES must be a power of 2 above JIT_QUEUE_MAX"
+#endif
+
+
+static TaskHandle_t jit_notify_task = NULL; /* dispatcher to wake up on a new head of queue */
+static struct duty_cycle_s *jit_duty_cycle = NULL; /* regulatory ledger, shared by all RF chains */
 
-static SemaphoreHandle_t mx_jit_queue; /* control access to JIT queue */
+static void jit_gap_update(struct jit_queue_s *queue);
+
+/* Each queue has its own lock, so that the RF chains are scheduled independently.
+ * The lock is tried first without waiting to count contention. */
+static void jit_lock(struct jit_queue_s *queue) {
+    if (xSemaphoreTake(queue->mx_queue, 0) != pdTRUE) {
+        xSemaphoreTake(queue->mx_queue, portMAX_DELAY);
+        queue->stat.nb_contended += 1;
+    }
+    queue->stat.nb_lock += 1;
+}
+
+static void jit_unlock(struct jit_queue_s *queue) {
+    xSemaphoreGive(queue->mx_queue);
+}
 
 bool jit_queue_is_full(struct jit_queue_s *queue) {
     bool result;
 
-    xSemaphoreTake(mx_jit_queue, portMAX_DELAY);
+    jit_lock(queue);
 
     result = (queue->num_pkt == JIT_QUEUE_MAX)?true:false;
 
-    xSemaphoreGive(mx_jit_queue);
+    jit_unlock(queue);
 
     return result;
 }
@@ -59,75 +75,323 @@ bool jit_queue_is_full(struct jit_queue_s *queue) {
 bool jit_queue_is_empty(struct jit_queue_s *queue) {
     bool result;
 
-    xSemaphoreTake(mx_jit_queue, portMAX_DELAY);
+    jit_lock(queue);
 
     result = (queue->num_pkt == 0)?true:false;
 
-    xSemaphoreGive(mx_jit_queue);
+    jit_unlock(queue);
 
     return result;
 }
 
 void jit_queue_init(struct jit_queue_s *queue) {
     int i;
+    SemaphoreHandle_t mx_queue;
 
-    mx_jit_queue = xSemaphoreCreateMutex();
-    assert(mx_jit_queue);
-    xSemaphoreTake(mx_jit_queue, portMAX_DELAY);
+    if (queue->mx_queue == NULL) {
+        queue->mx_queue = xSemaphoreCreateMutex();
+        assert(queue->mx_queue);
+    }
+    jit_lock(queue);
 
+    mx_queue = queue->mx_queue;
     memset(queue, 0, sizeof(*queue));
+    queue->mx_queue = mx_queue;
     for (i=0; i<JIT_QUEUE_MAX; i++) {
         queue->nodes[i].pre_delay = 0;
         queue->nodes[i].post_delay = 0;
     }
+    jit_gap_update(queue);
+
+    jit_unlock(queue);
+}
+
+bool jit_queue_next(struct jit_queue_s *queue, lgw_tmst_t *count_us) {
+    bool result = false;
+
+    jit_lock(queue);
+
+    if (queue->num_pkt > 0) {
+        *count_us = queue->nodes[queue->heap[0]].pkt.count_us;
+        result = true;
+    }
+
+    jit_unlock(queue);
+
+    return result;
+}
+
+void jit_queue_set_notify(TaskHandle_t task) {
+    jit_notify_task = task;
+}
+
+void jit_queue_set_duty_cycle(struct duty_cycle_s *duty) {
+    jit_duty_cycle = duty;
+}
+
+void jit_queue_get_stat(struct jit_queue_s *queue, struct jit_queue_stat_s *stat, bool reset) {
+    jit_lock(queue);
+
+    *stat = queue->stat;
+    if (reset == true) {
+        memset(&(queue->stat), 0, sizeof(queue->stat));
+    }
 
-    xSemaphoreGive(mx_jit_queue);
+    jit_unlock(queue);
 }
 
-int compare(const void *a, const void *b, void *arg)
-{
-    struct jit_node_s *p = (struct jit_node_s *)a;
-    struct jit_node_s *q = (struct jit_node_s *)b;
-    int *counter = (int *)arg;
-    int p_count, q_count;
+/* Packet timestamp order, valid across the counter roll-over as long as the
+   queued packets are less than 2^31 us apart (they are within TX_MAX_ADVANCE_DELAY) */
+static bool jit_node_before(const struct jit_queue_s *queue, uint16_t a, uint16_t b) {
+    return TMST_BEFORE(queue->nodes[a].pkt.count_us, queue->nodes[b].pkt.count_us);
+}
 
-    p_count = p->pkt.count_us;
-    q_count = q->pkt.count_us;
+/* heap operations, pos can be NULL when the heap is a scratch copy */
+static void jit_heap_set(uint16_t *heap, uint16_t *pos, int h, uint16_t node) {
+    heap[h] = node;
+    if (pos != NULL) {
+        pos[node] = h;
+    }
+}
 
-    if (p_count > q_count)
-        *counter = *counter + 1;
+static void jit_heap_sift_up(const struct jit_queue_s *queue, uint16_t *heap, uint16_t *pos, int h) {
+    uint16_t node = heap[h];
+    int parent;
 
-    return p_count - q_count;
+    while (h > 0) {
+        parent = (h - 1) / 2;
+        if (!jit_node_before(queue, node, heap[parent])) {
+            break;
+        }
+        jit_heap_set(heap, pos, h, heap[parent]);
+        h = parent;
+    }
+    jit_heap_set(heap, pos, h, node);
 }
 
-void jit_sort_queue(struct jit_queue_s *queue) {
-    int counter = 0;
+static void jit_heap_sift_down(const struct jit_queue_s *queue, uint16_t *heap, uint16_t *pos, int n, int h) {
+    uint16_t node = heap[h];
+    int child;
+
+    while ((child = (2 * h) + 1) < n) {
+        if (((child + 1) < n) && jit_node_before(queue, heap[child + 1], heap[child])) {
+            child += 1;
+        }
+        if (!jit_node_before(queue, heap[child], node)) {
+            break;
+        }
+        jit_heap_set(heap, pos, h, heap[child]);
+        h = child;
+    }
+    jit_heap_set(heap, pos, h, node);
+}
+
+/* Free intervals between reservations (pre delay to post delay of each packet), interval g is
+   before order[g]: interval 0 has no start and interval num_pkt has no end. A reservation may
+   extend over its neighbours (beacon guard), so an interval starts at the latest end of the
+   reservations before it and ends at the earliest start of the ones after it. */
+static void jit_gap_update(struct jit_queue_s *queue) {
+    struct jit_node_s *node;
+    lgw_tmst_t t;
+    int32_t len;
+    int g;
+    int n = queue->num_pkt;
+
+    for (g = 1; g <= n; g++) {
+        node = &(queue->nodes[queue->order[g - 1]]);
+        t = node->pkt.count_us + node->post_delay;
+        queue->gap_start[g] = ((g == 1) || TMST_BEFORE(queue->gap_start[g - 1], t)) ? t : queue->gap_start[g - 1];
+    }
+    for (g = n - 1; g >= 0; g--) {
+        node = &(queue->nodes[queue->order[g]]);
+        t = node->pkt.count_us - node->pre_delay;
+        queue->gap_end[g] = ((g == (n - 1)) || TMST_BEFORE(t, queue->gap_end[g + 1])) ? t : queue->gap_end[g + 1];
+    }
+
+    /* interval 0 is only used for the ASAP time, it is never searched by length */
+    for (g = 0; g < JIT_GAP_LEAVES; g++) {
+        if (g == n) {
+            queue->gap_tree[JIT_GAP_LEAVES + g] = UINT32_MAX;
+        } else if ((g == 0) || (g > n)) {
+            queue->gap_tree[JIT_GAP_LEAVES + g] = 0;
+        } else {
+            len = TMST_DIFF(queue->gap_end[g], queue->gap_start[g]);
+            queue->gap_tree[JIT_GAP_LEAVES + g] = (len > 0) ? (uint32_t)len : 0;
+        }
+    }
+    for (g = JIT_GAP_LEAVES - 1; g > 0; g--) {
+        queue->gap_tree[g] = (queue->gap_tree[2 * g] > queue->gap_tree[(2 * g) + 1]) ? queue->gap_tree[2 * g] : queue->gap_tree[(2 * g) + 1];
+    }
+}
+
+/* First free interval from g with at least len_min microseconds, the last one is endless */
+static int jit_gap_first_fit(const struct jit_queue_s *queue, int g, uint32_t len_min) {
+    int i = JIT_GAP_LEAVES + g;
+
+    /* go up until a subtree on the right of g has a long enough interval */
+    while (queue->gap_tree[i] < len_min) {
+        while ((i & 1) == 1) {
+            i >>= 1;
+        }
+        if (i == 0) {
+            return -1; /* cannot happen, the last interval is endless */
+        }
+        i += 1;
+    }
+    /* and down to its leftmost long enough interval */
+    while (i < JIT_GAP_LEAVES) {
+        i = 2 * i;
+        if (queue->gap_tree[i] < len_min) {
+            i += 1;
+        }
+    }
+    return i - JIT_GAP_LEAVES;
+}
+
+/* Earliest timestamp from asap_us where a packet fits between the reservations, in O(log n) */
+static lgw_tmst_t jit_gap_find(const struct jit_queue_s *queue, lgw_tmst_t asap_us, uint32_t pre_delay, uint32_t post_delay) {
+    int lo = 0;
+    int hi = queue->num_pkt; /* the last interval has no end */
+    int mid, g;
+    lgw_tmst_t count_us;
+
+    /* first interval ending after the packet, if sent ASAP (interval ends are in ascending order) */
+    while (lo < hi) {
+        mid = (lo + hi) / 2;
+        if (TMST_DIFF(queue->gap_end[mid], asap_us) > (int32_t)(post_delay + TX_MARGIN_DELAY)) {
+            hi = mid;
+        } else {
+            lo = mid + 1;
+        }
+    }
+    g = lo;
+
+    /* the packet can start at ASAP time in this interval */
+    if ((g == 0) || (TMST_DIFF(asap_us, queue->gap_start[g]) > (int32_t)(pre_delay + TX_MARGIN_DELAY))) {
+        return asap_us;
+    }
+
+    /* or at the start of this interval, as after any packet */
+    count_us = queue->gap_start[g] + pre_delay + TX_JIT_DELAY + TX_MARGIN_DELAY;
+    if ((g == queue->num_pkt) || (TMST_DIFF(queue->gap_end[g], count_us) > (int32_t)(post_delay + TX_MARGIN_DELAY))) {
+        return count_us;
+    }
+
+    /* or at the start of the next interval long enough */
+    g = jit_gap_first_fit(queue, g + 1, pre_delay + TX_JIT_DELAY + TX_MARGIN_DELAY + post_delay + TX_MARGIN_DELAY + 1);
+    if (g < 0) {
+        g = queue->num_pkt;
+    }
+    return queue->gap_start[g] + pre_delay + TX_JIT_DELAY + TX_MARGIN_DELAY;
+}
+
+/* Insert a node in the timestamp order, before num_pkt is incremented */
+static void jit_order_insert(struct jit_queue_s *queue, uint16_t node) {
+    int lo = 0;
+    int hi = queue->num_pkt;
+    int mid;
+
+    while (lo < hi) {
+        mid = (lo + hi) / 2;
+        if (jit_node_before(queue, node, queue->order[mid])) {
+            hi = mid;
+        } else {
+            lo = mid + 1;
+        }
+    }
+    memmove(&(queue->order[lo + 1]), &(queue->order[lo]), (queue->num_pkt - lo) * sizeof(queue->order[0]));
+    queue->order[lo] = node;
+}
+
+/* Remove a node from the queue, the last node is moved in its place to keep nodes packed */
+static void jit_remove_node(struct jit_queue_s *queue, int index) {
+    int h = queue->pos[index];
+    int last;
+    int k;
+
+    /* take it out of the heap */
+    queue->num_pkt--;
+    if (h < queue->num_pkt) {
+        jit_heap_set(queue->heap, queue->pos, h, queue->heap[queue->num_pkt]);
+        if ((h > 0) && jit_node_before(queue, queue->heap[h], queue->heap[(h - 1) / 2])) {
+            jit_heap_sift_up(queue, queue->heap, queue->pos, h);
+        } else {
+            jit_heap_sift_down(queue, queue->heap, queue->pos, queue->num_pkt, h);
+        }
+    }
 
-    if (queue->num_pkt == 0) {
-        return;
+    /* and out of the timestamp order */
+    for (k = 0; queue->order[k] != index; k++);
+    memmove(&(queue->order[k]), &(queue->order[k + 1]), (queue->num_pkt - k) * sizeof(queue->order[0]));
+
+    /* fill the hole in the nodes array */
+    last = queue->num_pkt;
+    if (index != last) {
+        memcpy(&(queue->nodes[index]), &(queue->nodes[last]), sizeof(struct jit_node_s));
+        jit_heap_set(queue->heap, queue->pos, queue->pos[last], index);
+        for (k = 0; queue->order[k] != last; k++);
+        queue->order[k] = index;
     }
+    memset(&(queue->nodes[last]), 0, sizeof(struct jit_node_s));
 
-    MSG_DEBUG(DEBUG_JIT, "sorting queue in ascending order packet timestamp - queue size:%u\n", queue->num_pkt);
-    qsort_r(queue->nodes, queue->num_pkt, sizeof(queue->nodes[0]), compare, &counter);
-    MSG_DEBUG(DEBUG_JIT, "sorting queue done - swapped:%d\n", counter);
+    jit_gap_update(queue);
 }
 
-bool jit_collision_test(uint32_t p1_count_us, uint32_t p1_pre_delay, uint32_t p1_post_delay, uint32_t p2_count_us, uint32_t p2_pre_delay, uint32_t p2_post_delay) {
-    if (((p1_count_us - p2_count_us) <= (p1_pre_delay + p2_post_delay + TX_MARGIN_DELAY)) ||
-        ((p2_count_us - p1_count_us) <= (p2_pre_delay + p1_post_delay + TX_MARGIN_DELAY))) {
+bool jit_collision_test(lgw_tmst_t p1_count_us, uint32_t p1_pre_delay, uint32_t p1_post_delay, lgw_tmst_t p2_count_us, uint32_t p2_pre_delay, uint32_t p2_post_delay) {
+    int32_t p1_after_p2 = TMST_DIFF(p1_count_us, p2_count_us);
+
+    /* p1 starts in p2 post delay, or p1 ends in p2 pre delay */
+    if (((p1_after_p2 >= 0) && ((uint32_t)p1_after_p2 <= (p1_pre_delay + p2_post_delay + TX_MARGIN_DELAY))) ||
+        ((p1_after_p2 <= 0) && ((uint32_t)(-(int64_t)p1_after_p2) <= (p2_pre_delay + p1_post_delay + TX_MARGIN_DELAY)))) {
         return true;
     } else {
         return false;
     }
 }
 
-enum jit_error_e jit_enqueue(struct jit_queue_s *queue, uint32_t time_us, struct lgw_pkt_tx_s *packet, enum jit_pkt_type_e pkt_type) {
+/* Time to be reserved before and after a packet, depending on its type */
+static void jit_pkt_delays(struct lgw_pkt_tx_s *packet, enum jit_pkt_type_e pkt_type, uint32_t *pre_delay, uint32_t *post_delay) {
+    switch (pkt_type) {
+        case JIT_PKT_TYPE_DOWNLINK_CLASS_A:
+        case JIT_PKT_TYPE_DOWNLINK_CLASS_B:
+        case JIT_PKT_TYPE_DOWNLINK_CLASS_C:
+            *pre_delay = TX_START_DELAY + TX_JIT_DELAY;
+            *post_delay = lgw_time_on_air(packet) * 1000UL; /* in us */
+            break;
+        case JIT_PKT_TYPE_BEACON:
+            /* As defined in LoRaWAN spec */
+            *pre_delay = TX_START_DELAY + BEACON_GUARD + TX_JIT_DELAY;
+            *post_delay = BEACON_RESERVED;
+            break;
+        default:
+            *pre_delay = 0;
+            *post_delay = 0;
+            break;
+    }
+}
+
+lgw_tmst_t jit_queue_asap(struct jit_queue_s *queue, lgw_tmst_t time_us, struct lgw_pkt_tx_s *packet) {
+    uint32_t packet_pre_delay, packet_post_delay;
+    lgw_tmst_t asap_count_us;
+
+    jit_pkt_delays(packet, JIT_PKT_TYPE_DOWNLINK_CLASS_C, &packet_pre_delay, &packet_post_delay);
+
+    jit_lock(queue);
+    asap_count_us = jit_gap_find(queue, time_us + 2 * TX_JIT_DELAY, packet_pre_delay, packet_post_delay);
+    jit_unlock(queue);
+
+    return asap_count_us;
+}
+
+enum jit_error_e jit_enqueue(struct jit_queue_s *queue, lgw_tmst_t time_us, struct lgw_pkt_tx_s *packet, enum jit_pkt_type_e pkt_type) {
     int i = 0;
     uint32_t packet_post_delay = 0;
     uint32_t packet_pre_delay = 0;
     uint32_t target_pre_delay = 0;
+    uint32_t toa_ms;
+    int64_t charge_ms;
     enum jit_error_e err_collision;
-    uint32_t asap_count_us;
+    bool new_head;
 
     MSG_DEBUG(DEBUG_JIT, "Current concentrator time is %lu, pkt_type=%d\n", time_us, pkt_type);
 
@@ -136,81 +400,30 @@ enum jit_error_e jit_enqueue(struct jit_queue_s *queue, uint32_t time_us, struct
         return JIT_ERROR_INVALID;
     }
 
-    if (jit_queue_is_full(queue)) {
+    /* Compute packet pre/post delays depending on packet's type */
+    jit_pkt_delays(packet, pkt_type, &packet_pre_delay, &packet_post_delay);
+
+    jit_lock(queue);
+
+    /* Checked under the lock: beacons and downlinks are enqueued by different tasks */
+    if (queue->num_pkt == JIT_QUEUE_MAX) {
         MSG_DEBUG(DEBUG_JIT_ERROR, "ERROR: cannot enqueue packet, JIT queue is full\n");
+        jit_unlock(queue);
         return JIT_ERROR_FULL;
     }
 
-    /* Compute packet pre/post delays depending on packet's type */
-    switch (pkt_type) {
-        case JIT_PKT_TYPE_DOWNLINK_CLASS_A:
-        case JIT_PKT_TYPE_DOWNLINK_CLASS_B:
-        case JIT_PKT_TYPE_DOWNLINK_CLASS_C:
-            packet_pre_delay = TX_START_DELAY + TX_JIT_DELAY;
-            packet_post_delay = lgw_time_on_air(packet) * 1000UL; /* in us */
-            break;
-        case JIT_PKT_TYPE_BEACON:
-            /* As defined in LoRaWAN spec */
-            packet_pre_delay = TX_START_DELAY + BEACON_GUARD + TX_JIT_DELAY;
-            packet_post_delay = BEACON_RESERVED;
-            break;
-        default:
-            break;
-    }
-
-    xSemaphoreTake(mx_jit_queue, portMAX_DELAY);
-
     /* An immediate downlink becomes a timestamped downlink "ASAP" */
     /* Set the packet count_us to the first available slot */
     if (pkt_type == JIT_PKT_TYPE_DOWNLINK_CLASS_C) {
         /* change tx_mode to timestamped */
         packet->tx_mode = TIMESTAMPED;
 
-        /* Search for the ASAP timestamp to be given to the packet */
-        asap_count_us = time_us + 2 * TX_JIT_DELAY; /* margin */
-        if (queue->num_pkt == 0) {
-            /* If the jit queue is empty, we can insert this packet */
-            MSG_DEBUG(DEBUG_JIT, "DEBUG: insert IMMEDIATE downlink, first in JiT queue (count_us=%lu)\n", asap_count_us);
-        } else {
-            /* Else we can try to insert it:
-                - ASAP meaning NOW + MARGIN
-                - at the last index of the queue
-                - between 2 downlinks in the queue
-            */
-
-            /* First, try if the ASAP time collides with an already enqueued downlink */
-            for (i=0; i<queue->num_pkt; i++) {
-                if (jit_collision_test(asap_count_us, packet_pre_delay, packet_post_delay, queue->nodes[i].pkt.count_us, queue->nodes[i].pre_delay, queue->nodes[i].post_delay) == true) {
-                    MSG_DEBUG(DEBUG_JIT, "DEBUG: cannot insert IMMEDIATE downlink at count_us=%lu, collides with %lu (index=%d)\n", asap_count_us, queue->nodes[i].pkt.count_us, i);
-                    break;
-                }
-            }
-            if (i == queue->num_pkt) {
-                /* No collision with ASAP time, we can insert it */
-                MSG_DEBUG(DEBUG_JIT, "DEBUG: insert IMMEDIATE downlink ASAP at %lu (no collision)\n", asap_count_us);
-            } else {
-                /* Search for the best slot then */
-                for (i=0; i<queue->num_pkt; i++) {
-                    asap_count_us = queue->nodes[i].pkt.count_us + queue->nodes[i].post_delay + packet_pre_delay + TX_JIT_DELAY + TX_MARGIN_DELAY;
-                    if (i == (queue->num_pkt - 1)) {
-                        /* Last packet index, we can insert after this one */
-                        MSG_DEBUG(DEBUG_JIT, "DEBUG: insert IMMEDIATE downlink, last in JiT queue (count_us=%lu)\n", asap_count_us);
-                    } else {
-                        /* Check if packet can be inserted between this index and the next one */
-                        MSG_DEBUG(DEBUG_JIT, "DEBUG: try to insert IMMEDIATE downlink (count_us=%lu) between index %d and index %d?\n", asap_count_us, i, i+1);
-                        if (jit_collision_test(asap_count_us, packet_pre_delay, packet_post_delay, queue->nodes[i+1].pkt.count_us, queue->nodes[i+1].pre_delay, queue->nodes[i+1].post_delay) == true) {
-                            MSG_DEBUG(DEBUG_JIT, "DEBUG: failed to insert IMMEDIATE downlink (count_us=%lu), continue...\n", asap_count_us);
-                            continue;
-                        } else {
-                            MSG_DEBUG(DEBUG_JIT, "DEBUG: insert IMMEDIATE downlink (count_us=%lu)\n", asap_count_us);
-                            break;
-                        }
-                    }
-                }
-            }
-        }
-        /* Set packet with ASAP timestamp */
-        packet->count_us = asap_count_us;
+        /* Search for the ASAP timestamp to be given to the packet:
+            - ASAP meaning NOW + MARGIN, if it does not collide
+            - else after the first enqueued packet followed by a free interval long enough
+        */
+        packet->count_us = jit_gap_find(queue, time_us + 2 * TX_JIT_DELAY, packet_pre_delay, packet_post_delay);
+        MSG_DEBUG(DEBUG_JIT, "DEBUG: insert IMMEDIATE downlink at count_us=%lu\n", packet->count_us);
     }
 
     /* Check criteria_1: is it already too late to send this packet ?
@@ -221,9 +434,9 @@ enum jit_error_e jit_enqueue(struct jit_queue_s *queue, uint32_t time_us, struct
      *  Warning: unsigned arithmetic (handle roll-over)
      *      t_packet < t_current + TX_START_DELAY + MARGIN
      */
-    if ((packet->count_us - time_us) <= (TX_START_DELAY + TX_MARGIN_DELAY + TX_JIT_DELAY)) {
+    if (TMST_UNTIL(packet->count_us, time_us) <= (TX_START_DELAY + TX_MARGIN_DELAY + TX_JIT_DELAY)) {
         MSG_DEBUG(DEBUG_JIT_ERROR, "ERROR: Packet REJECTED, already too late to send it (current=%lu, packet=%lu, type=%d)\n", time_us, packet->count_us, pkt_type);
-        xSemaphoreGive(mx_jit_queue);
+        jit_unlock(queue);
         return JIT_ERROR_TOO_LATE;
     }
 
@@ -239,9 +452,9 @@ enum jit_error_e jit_enqueue(struct jit_queue_s *queue, uint32_t time_us, struct
                 t_packet > t_current + TX_MAX_ADVANCE_DELAY
      */
     if ((pkt_type == JIT_PKT_TYPE_DOWNLINK_CLASS_A) || (pkt_type == JIT_PKT_TYPE_DOWNLINK_CLASS_B)) {
-        if ((packet->count_us - time_us) > TX_MAX_ADVANCE_DELAY) {
+        if (TMST_UNTIL(packet->count_us, time_us) > TX_MAX_ADVANCE_DELAY) {
             MSG_DEBUG(DEBUG_JIT_ERROR, "ERROR: Packet REJECTED, timestamp seems wrong, too much in advance (current=%lu, packet=%lu, type=%d)\n", time_us, packet->count_us, pkt_type);
-            xSemaphoreGive(mx_jit_queue);
+            jit_unlock(queue);
             return JIT_ERROR_TOO_EARLY;
         }
     }
@@ -284,26 +497,60 @@ enum jit_error_e jit_enqueue(struct jit_queue_s *queue, uint32_t time_us, struct
                     assert(0);
                     break;
             }
-            xSemaphoreGive(mx_jit_queue);
+            jit_unlock(queue);
             return err_collision;
         }
     }
 
+    /* Check criteria_4: does the sub-band have enough airtime left ?
+     *  Note: - airtime is charged now, on the host clock, not at departure time
+     *        - it is given back if jit_peek() drops the packet
+     *        - Beacons are charged but cannot be rejected
+     */
+    toa_ms = 0;
+    charge_ms = esp_timer_get_time() / 1000;
+    if (jit_duty_cycle != NULL) {
+        toa_ms = (pkt_type == JIT_PKT_TYPE_BEACON) ? lgw_time_on_air(packet) : (packet_post_delay / 1000); /* beacon post delay has a margin */
+        switch (duty_cycle_charge(jit_duty_cycle, packet->freq_hz, toa_ms, charge_ms, (pkt_type == JIT_PKT_TYPE_BEACON))) {
+            case DUTY_CYCLE_EXCEEDED:
+                MSG_DEBUG(DEBUG_JIT_ERROR, "ERROR: Packet (type=%d) REJECTED, duty-cycle exhausted at %lu Hz\n", pkt_type, packet->freq_hz);
+                jit_unlock(queue);
+                return JIT_ERROR_DUTY_CYCLE;
+            case DUTY_CYCLE_DWELL_TIME:
+                MSG_DEBUG(DEBUG_JIT_ERROR, "ERROR: Packet (type=%d) REJECTED, time on air %lu ms above dwell time at %lu Hz\n", pkt_type, toa_ms, packet->freq_hz);
+                jit_unlock(queue);
+                return JIT_ERROR_DWELL_TIME;
+            default:
+                break;
+        }
+    }
+
     /* Finally enqueue it */
     /* Insert packet at the end of the queue */
     memcpy(&(queue->nodes[queue->num_pkt].pkt), packet, sizeof(struct lgw_pkt_tx_s));
     queue->nodes[queue->num_pkt].pre_delay = packet_pre_delay;
     queue->nodes[queue->num_pkt].post_delay = packet_post_delay;
     queue->nodes[queue->num_pkt].pkt_type = pkt_type;
+    queue->nodes[queue->num_pkt].charge_toa_ms = toa_ms;
+    queue->nodes[queue->num_pkt].charge_ms = charge_ms;
     if (pkt_type == JIT_PKT_TYPE_BEACON) {
         queue->num_beacon++;
     }
+    /* Keep the heap and the free intervals ordered on packet timestamp */
+    jit_heap_set(queue->heap, queue->pos, queue->num_pkt, queue->num_pkt);
+    jit_heap_sift_up(queue, queue->heap, queue->pos, queue->num_pkt);
+    new_head = (queue->heap[0] == queue->num_pkt);
+    jit_order_insert(queue, queue->num_pkt);
     queue->num_pkt++;
-    /* Sort the queue in ascending order of packet timestamp */
-    jit_sort_queue(queue);
+    jit_gap_update(queue);
 
     /* Done */
-    xSemaphoreGive(mx_jit_queue);
+    jit_unlock(queue);
+
+    /* The dispatcher may be sleeping until a later packet (no need when it is the one enqueuing) */
+    if ((new_head == true) && (jit_notify_task != NULL) && (jit_notify_task != xTaskGetCurrentTaskHandle())) {
+        xTaskNotifyGive(jit_notify_task);
+    }
 
     jit_print_queue(queue, false, DEBUG_JIT);
 
@@ -312,13 +559,39 @@ enum jit_error_e jit_enqueue(struct jit_queue_s *queue, uint32_t time_us, struct
     return JIT_ERROR_OK;
 }
 
+enum jit_error_e jit_enqueue_other_chain(struct jit_queue_s queue[], int nb_queue, lgw_tmst_t time_us, struct lgw_pkt_tx_s *packet, enum jit_pkt_type_e pkt_type, bool (*chain_ok)(uint8_t rf_chain, const struct lgw_pkt_tx_s *packet)) {
+    enum jit_error_e err = JIT_ERROR_INVALID;
+    uint8_t rf_chain;
+    int i;
+
+    if ((packet == NULL) || (chain_ok == NULL)) {
+        return JIT_ERROR_INVALID;
+    }
+
+    /* the packet is copied in the queue: it must hold the RF chain it will be sent on */
+    rf_chain = packet->rf_chain;
+    for (i = 0; i < nb_queue; i++) {
+        if ((i == rf_chain) || (chain_ok(i, packet) == false)) {
+            continue;
+        }
+        packet->rf_chain = i;
+        err = jit_enqueue(&queue[i], time_us, packet, pkt_type);
+        if (err == JIT_ERROR_OK) {
+            return JIT_ERROR_OK;
+        }
+        packet->rf_chain = rf_chain;
+    }
+
+    return err;
+}
+
 enum jit_error_e jit_dequeue(struct jit_queue_s *queue, int index, struct lgw_pkt_tx_s *packet, enum jit_pkt_type_e *pkt_type) {
     if (packet == NULL) {
         MSG("ERROR: invalid parameter\n");
         return JIT_ERROR_INVALID;
     }
 
-    if ((index < 0) || (index >= JIT_QUEUE_MAX)) {
+    if ((index < 0) || (index >= queue->num_pkt)) {
         MSG("ERROR: invalid parameter\n");
         return JIT_ERROR_INVALID;
     }
@@ -328,11 +601,10 @@ enum jit_error_e jit_dequeue(struct jit_queue_s *queue, int index, struct lgw_pk
         return JIT_ERROR_EMPTY;
     }
 
-    xSemaphoreTake(mx_jit_queue, portMAX_DELAY);
+    jit_lock(queue);
 
     /* Dequeue requested packet */
     memcpy(packet, &(queue->nodes[index].pkt), sizeof(struct lgw_pkt_tx_s));
-    queue->num_pkt--;
     *pkt_type = queue->nodes[index].pkt_type;
     if (*pkt_type == JIT_PKT_TYPE_BEACON) {
         queue->num_beacon--;
@@ -340,14 +612,10 @@ enum jit_error_e jit_dequeue(struct jit_queue_s *queue, int index, struct lgw_pk
     }
 
     /* Replace dequeued packet with last packet of the queue */
-    memcpy(&(queue->nodes[index]), &(queue->nodes[queue->num_pkt]), sizeof(struct jit_node_s));
-    memset(&(queue->nodes[queue->num_pkt]), 0, sizeof(struct jit_node_s));
-
-    /* Sort queue in ascending order of packet timestamp */
-    jit_sort_queue(queue);
+    jit_remove_node(queue, index);
 
     /* Done */
-    xSemaphoreGive(mx_jit_queue);
+    jit_unlock(queue);
 
     jit_print_queue(queue, false, DEBUG_JIT);
 
@@ -356,7 +624,7 @@ enum jit_error_e jit_dequeue(struct jit_queue_s *queue, int index, struct lgw_pk
     return JIT_ERROR_OK;
 }
 
-enum jit_error_e jit_peek(struct jit_queue_s *queue, uint32_t time_us, int *pkt_idx) {
+enum jit_error_e jit_peek(struct jit_queue_s *queue, lgw_tmst_t time_us, int *pkt_idx) {
     /* Return index of node containing a packet inline with given time */
     int i = 0;
     int idx_highest_priority = -1;
@@ -369,53 +637,41 @@ enum jit_error_e jit_peek(struct jit_queue_s *queue, uint32_t time_us, int *pkt_
         return JIT_ERROR_EMPTY;
     }
 
-    xSemaphoreTake(mx_jit_queue, portMAX_DELAY);
-
-    /* Search for highest priority packet to be sent */
-    for (i=0; i<queue->num_pkt; i++) {
-        /* First check if that packet is outdated:
-         *  If a packet seems too much in advance, and was not rejected at enqueue time,
-         *  it means that we missed it for peeking, we need to drop it
-         *
-         *  Warning: unsigned arithmetic
-         *      t_packet > t_current + TX_MAX_ADVANCE_DELAY
-         */
-        if ((queue->nodes[i].pkt.count_us - time_us) >= TX_MAX_ADVANCE_DELAY) {
-            /* We drop the packet to avoid lock-up */
-            queue->num_pkt--;
-            if (queue->nodes[i].pkt_type == JIT_PKT_TYPE_BEACON) {
-                queue->num_beacon--;
-                MSG("WARNING: --- Beacon dropped (current_time=%lu, packet_time=%lu) ---\n", time_us, queue->nodes[i].pkt.count_us);
-            } else {
-                MSG("WARNING: --- Packet dropped (current_time=%lu, packet_time=%lu) ---\n", time_us, queue->nodes[i].pkt.count_us);
-            }
-
-            /* Replace dropped packet with last packet of the queue */
-            memcpy(&(queue->nodes[i]), &(queue->nodes[queue->num_pkt]), sizeof(struct jit_node_s));
-            memset(&(queue->nodes[queue->num_pkt]), 0, sizeof(struct jit_node_s));
+    jit_lock(queue);
 
-            /* Sort queue in ascending order of packet timestamp */
-            jit_sort_queue(queue);
-
-            /* restart loop  after purge to find packet to be sent */
-            i = 0;
-            continue;
+    /* The highest priority packet is at the head of the heap, drop it while it is outdated:
+     *  If a packet seems too much in advance, and was not rejected at enqueue time,
+     *  it means that we missed it for peeking, we need to drop it
+     *
+     *  Warning: unsigned arithmetic
+     *      t_packet > t_current + TX_MAX_ADVANCE_DELAY
+     */
+    while (queue->num_pkt > 0) {
+        i = queue->heap[0];
+        if (TMST_UNTIL(queue->nodes[i].pkt.count_us, time_us) < TX_MAX_ADVANCE_DELAY) {
+            idx_highest_priority = i;
+            break;
         }
 
-        /* Then look for highest priority packet to be sent:
-         *  Warning: unsigned arithmetic (handle roll-over)
-         *      t_packet < t_highest
-         */
-        if ((idx_highest_priority == -1) || (((queue->nodes[i].pkt.count_us - time_us) < (queue->nodes[idx_highest_priority].pkt.count_us - time_us)))) {
-            idx_highest_priority = i;
+        /* We drop the packet to avoid lock-up */
+        if (queue->nodes[i].pkt_type == JIT_PKT_TYPE_BEACON) {
+            queue->num_beacon--;
+            MSG("WARNING: --- Beacon dropped (current_time=%lu, packet_time=%lu) ---\n", time_us, queue->nodes[i].pkt.count_us);
+        } else {
+            MSG("WARNING: --- Packet dropped (current_time=%lu, packet_time=%lu) ---\n", time_us, queue->nodes[i].pkt.count_us);
+        }
+        /* it will never be on air, its airtime can be used by other packets */
+        if ((jit_duty_cycle != NULL) && (queue->nodes[i].charge_toa_ms > 0)) {
+            duty_cycle_refund(jit_duty_cycle, queue->nodes[i].pkt.freq_hz, queue->nodes[i].charge_toa_ms, queue->nodes[i].charge_ms, esp_timer_get_time() / 1000);
         }
+        jit_remove_node(queue, i);
     }
 
     /* Peek criteria 1: look for a packet to be sent in next TX_JIT_DELAY ms timeframe
      *  Warning: unsigned arithmetic (handle roll-over)
      *      t_packet < t_current + TX_JIT_DELAY
      */
-    if ((queue->nodes[idx_highest_priority].pkt.count_us - time_us) < TX_JIT_DELAY) {
+    if ((idx_highest_priority != -1) && (TMST_UNTIL(queue->nodes[idx_highest_priority].pkt.count_us, time_us) < TX_JIT_DELAY)) {
         *pkt_idx = idx_highest_priority;
         MSG_DEBUG(DEBUG_JIT, "peek packet with count_us=%lu at index %d\n",
             queue->nodes[idx_highest_priority].pkt.count_us, idx_highest_priority);
@@ -423,7 +679,7 @@ enum jit_error_e jit_peek(struct jit_queue_s *queue, uint32_t time_us, int *pkt_
         *pkt_idx = -1;
     }
 
-    xSemaphoreGive(mx_jit_queue);
+    jit_unlock(queue);
 
     return JIT_ERROR_OK;
 }
@@ -435,7 +691,7 @@ void jit_print_queue(struct jit_queue_s *queue, bool show_all, int debug_level)
     if (jit_queue_is_empty(queue)) {
         MSG_DEBUG(debug_level, "INFO: [jit] queue is empty\n");
     } else {
-        xSemaphoreTake(mx_jit_queue, portMAX_DELAY);
+        jit_lock(queue);
 
         MSG_DEBUG(debug_level, "INFO: [jit] queue contains %d packets:\n", queue->num_pkt);
         MSG_DEBUG(debug_level, "INFO: [jit] queue contains %d beacons:\n", queue->num_beacon);
@@ -447,6 +703,6 @@ void jit_print_queue(struct jit_queue_s *queue, bool show_all, int debug_level)
                         queue->nodes[i].pkt_type);
         }
 
-        xSemaphoreGive(mx_jit_queue);
+        jit_unlock(queue);
     }
 }
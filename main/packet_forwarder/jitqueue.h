@@ -22,10 +22,23 @@ License: Revised BSD License, see LICENSE.TXT file include in the project
 #include <sys/time.h>   /* timeval */
 
 #include "loragw_hal.h"
+#include "duty_cycle.h"
 
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/semphr.h"
 
-#define JIT_QUEUE_MAX           32  /* Maximum number of packets to be stored in JiT queue */
+
+#ifndef JIT_QUEUE_MAX
+#define JIT_QUEUE_MAX           64  /* Maximum number of packets to be stored in JiT queue, can be set at build time */
+#endif
 #define JIT_NUM_BEACON_IN_QUEUE 3   /* Number of beacons to be loaded in JiT queue at any time */
+#ifndef JIT_GAP_LEAVES
+#define JIT_GAP_LEAVES          128 /* Leaves of the free interval tree, a power of 2 above JIT_QUEUE_MAX */
+#endif
+#ifndef TX_JIT_DELAY
+#define TX_JIT_DELAY            40000   /* Pre-delay to program packet for TX in microseconds, can be set at build time */
+#endif
 
 
 enum jit_pkt_type_e {
@@ -46,6 +59,8 @@ enum jit_error_e {
     JIT_ERROR_TX_FREQ,      /* The required frequency for downlink is not supported */
     JIT_ERROR_TX_POWER,     /* The required power for downlink is not supported */
     JIT_ERROR_GPS_UNLOCKED, /* GPS timestamp could not be used as GPS is unlocked */
+    JIT_ERROR_DUTY_CYCLE,   /* The sub-band duty-cycle budget is exhausted */
+    JIT_ERROR_DWELL_TIME,   /* The time on air is above the sub-band max dwell time */
     JIT_ERROR_INVALID       /* Packet is invalid */
 };
 
@@ -57,12 +72,27 @@ struct jit_node_s {
     /* Internal fields */
     uint32_t pre_delay;             /* Amount of time before packet timestamp to be reserved */
     uint32_t post_delay;            /* Amount of time after packet timestamp to be reserved (time on air) */
+    uint32_t charge_toa_ms;         /* Airtime charged to the duty-cycle ledger at enqueue time, 0 if none */
+    int64_t charge_ms;              /* Host time it was charged at */
+};
+
+struct jit_queue_stat_s {
+    uint32_t nb_lock;               /* Number of times the queue lock was taken */
+    uint32_t nb_contended;          /* Number of times the lock was held by another task and had to be waited for */
 };
 
 struct jit_queue_s {
-    uint8_t num_pkt;                /* Total number of packets in the queue (downlinks, beacons...) */
+    SemaphoreHandle_t mx_queue;     /* Control access to this queue only, kept across jit_queue_init() */
+    struct jit_queue_stat_s stat;   /* Lock contention counters */
+    uint16_t num_pkt;               /* Total number of packets in the queue (downlinks, beacons...) */
     uint8_t num_beacon;             /* Number of beacons in the queue */
-    struct jit_node_s nodes[JIT_QUEUE_MAX]; /* Nodes/packets array in the queue */
+    uint16_t heap[JIT_QUEUE_MAX];   /* Node indexes, as a min-heap on packet timestamp (heap[0] is the next one) */
+    uint16_t pos[JIT_QUEUE_MAX];    /* Position of each node in the heap */
+    uint16_t order[JIT_QUEUE_MAX];  /* Node indexes in ascending timestamp order, free interval g is before order[g] */
+    lgw_tmst_t gap_start[JIT_QUEUE_MAX + 1]; /* Free interval g starts at the latest end of reservation of order[0..g-1]... */
+    lgw_tmst_t gap_end[JIT_QUEUE_MAX + 1];   /* ...and ends at the earliest start of reservation of order[g..num_pkt-1] */
+    uint32_t gap_tree[2 * JIT_GAP_LEAVES];   /* Max-tree of the free interval lengths, interval g is leaf JIT_GAP_LEAVES + g */
+    struct jit_node_s nodes[JIT_QUEUE_MAX]; /* Nodes/packets array in the queue, nodes[0..num_pkt-1] are used */
 };
 
 /* -------------------------------------------------------------------------- */
@@ -106,7 +136,23 @@ This function is typically used when a packet is received from server for downli
 It will check if packet can be queued, with several criterias. Once the packet is queued, it has to be
 sent over the air. So all checks should happen before the packet being actually in the queue.
 */
-enum jit_error_e jit_enqueue(struct jit_queue_s *queue, uint32_t time_us, struct lgw_pkt_tx_s *packet, enum jit_pkt_type_e pkt_type);
+enum jit_error_e jit_enqueue(struct jit_queue_s *queue, lgw_tmst_t time_us, struct lgw_pkt_tx_s *packet, enum jit_pkt_type_e pkt_type);
+
+/**
+@brief Add a packet in the Just-in-Time queue of another RF chain
+
+@param queue[in/out] Just in Time queues, one per RF chain
+@param nb_queue[in] Number of queues
+@param time_us[in] Current concentrator time
+@param packet[in/out] Packet to be queued, its rf_chain is set to the chain it was queued for
+@param pkt_type[in] Type of packet to be queued: Downlink, Beacon
+@param chain_ok[in] Tells if an RF chain can send the packet
+@return success if one of the other chains took the packet, the error of the last attempt otherwise
+
+This function is used when the requested RF chain cannot take the packet (collision or full queue).
+The chains are tried in order, packet->rf_chain is left unchanged if none takes the packet.
+*/
+enum jit_error_e jit_enqueue_other_chain(struct jit_queue_s queue[], int nb_queue, lgw_tmst_t time_us, struct lgw_pkt_tx_s *packet, enum jit_pkt_type_e pkt_type, bool (*chain_ok)(uint8_t rf_chain, const struct lgw_pkt_tx_s *packet));
 
 /**
 @brief Dequeue a packet from a Just-in-Time queue
@@ -134,7 +180,69 @@ This function is typically used to check in JiT queue if there is a packet soon
 It search the packet with the highest priority in queue, and check if its timestamp is near
 enough the current concentrator time.
 */
-enum jit_error_e jit_peek(struct jit_queue_s *queue, uint32_t time_us, int *pkt_idx);
+enum jit_error_e jit_peek(struct jit_queue_s *queue, lgw_tmst_t time_us, int *pkt_idx);
+
+/**
+@brief Get the earliest timestamp an immediate (Class C) downlink could be sent at from a JiT queue
+
+@param queue[in] Just in Time queue
+@param time_us[in] Current concentrator time
+@param packet[in] Packet to be sent, for its time on air
+@return Timestamp that jit_enqueue() would give to the packet
+
+The free intervals between queued packets are kept up to date, so the slot is found in O(log n).
+This is used to compare the RF chains before choosing the one to enqueue the packet in.
+*/
+lgw_tmst_t jit_queue_asap(struct jit_queue_s *queue, lgw_tmst_t time_us, struct lgw_pkt_tx_s *packet);
+
+/**
+@brief Get the timestamp of the next packet to be sent from a JiT queue
+
+@param queue[in] Just in Time queue
+@param count_us[out] Timestamp of the packet at the head of the queue
+@return false if the queue is empty
+*/
+bool jit_queue_next(struct jit_queue_s *queue, lgw_tmst_t *count_us);
+
+/**
+@brief Set the task to be notified when a packet becomes the head of any JiT queue
+
+@param task[in] Task woken with xTaskNotifyGive(), NULL to disable notifications
+
+The dispatcher task sleeps until the next departure time, a new head may be earlier.
+*/
+void jit_queue_set_notify(TaskHandle_t task);
+
+/**
+@brief Set the regulatory ledger downlinks are charged to when enqueued in any JiT queue
+
+@param duty[in] Duty-cycle and dwell-time ledger, NULL to disable the check
+
+Beacons are always charged but never rejected. The airtime of a packet dropped by jit_peek() is given back.
+*/
+void jit_queue_set_duty_cycle(struct duty_cycle_s *duty);
+
+/**
+@brief Get the lock contention counters of a JiT queue
+
+@param queue[in] Just in Time queue
+@param stat[out] Lock contention counters
+@param reset[in] Reset the counters once copied
+*/
+void jit_queue_get_stat(struct jit_queue_s *queue, struct jit_queue_stat_s *stat, bool reset);
+
+/**
+@brief Check if two packets overlap on air, including their reserved pre and post delays
+
+@param p1_count_us[in] Timestamp of the first packet
+@param p1_pre_delay[in] Time reserved before the first packet, in microseconds
+@param p1_post_delay[in] Time reserved after the first packet (time on air), in microseconds
+@param p2_count_us[in] Timestamp of the second packet
+@param p2_pre_delay[in] Time reserved before the second packet, in microseconds
+@param p2_post_delay[in] Time reserved after the second packet (time on air), in microseconds
+@return true if the packets collide, whichever side of the counter roll-over they are
+*/
+bool jit_collision_test(lgw_tmst_t p1_count_us, uint32_t p1_pre_delay, uint32_t p1_post_delay, lgw_tmst_t p2_count_us, uint32_t p2_pre_delay, uint32_t p2_post_delay);
 
 /**
 @brief Debug function to print the queue's content on console
@@ -37,6 +37,7 @@ License: Revised BSD License, see LICENSE.TXT file include in the project
 #include <math.h>           /* modf */
 
 #include <sys/socket.h>     /* socket specific definitions */
+#include <sys/select.h>     /* select */
 #include <netinet/in.h>     /* INET constants and stuff */
 #include <arpa/inet.h>      /* IP address conversion stuff */
 #include <netdb.h>          /* gai_strerror */
@@ -45,6 +46,14 @@ License: Revised BSD License, see LICENSE.TXT file include in the project
 
 #include "trace.h"
 #include "jitqueue.h"
+#include "downlink_inbox.h"
+#include "uplink_ring.h"
+#include "rxpk_encoder.h"
+#include "txpk_decoder.h"
+#include "uplink_spool.h"
+#include "uplink_filter.h"
+#include "uplink_dedup.h"
+#include "duty_cycle.h"
 #include "parson.h"
 #include "base64.h"
 #include "loragw_hal.h"
@@ -52,6 +61,7 @@ License: Revised BSD License, see LICENSE.TXT file include in the project
 #include "loragw_reg.h"
 #include "loragw_gps.h"
 #include "loragw_gpio.h"
+#include "loragw_clock.h"
 
 /// For ESP32
 #include "freertos/FreeRTOS.h"
@@ -114,12 +124,18 @@ License: Revised BSD License, see LICENSE.TXT file include in the project
 #define DEFAULT_STAT        30          /* default time interval for statistics */
 #define PUSH_TIMEOUT_MS     100
 #define PULL_TIMEOUT_MS     200
+#define PUSH_INFLIGHT_MAX   8           /* max number of PUSH_DATA datagrams waiting for their PUSH_ACK */
+#define PUSH_ACK_LATE_MS    5000        /* time after which an unacknowledged PUSH_DATA is forgotten */
+#define SPOOL_REPLAY_MS     200         /* default time interval between two replayed PUSH_DATA */
 #define GPS_REF_MAX_AGE     30          /* maximum admitted delay in seconds of GPS loss before considering latest GPS sync unusable */
 #define FETCH_SLEEP_MS      10          /* nb of ms waited when a fetch return no packets */
 #define BEACON_POLL_MS      50          /* time in ms between polling of beacon TX status */
+#define JIT_IDLE_WAIT_US    1000000     /* max sleep of the JiT dispatcher, when its queues are empty */
+#define JIT_WAKE_MARGIN_US  1000        /* wake-up this much after the start of the TX_JIT_DELAY window, for clock estimate errors */
+#define JIT_MIN_WAIT_US     1000        /* min sleep, when the head packet could not be dispatched */
+#define JIT_LATE_NB         6           /* number of dispatch lateness histogram bins */
 
 #define PROTOCOL_VERSION    2           /* v1.6 */
-#define PROTOCOL_JSON_RXPK_FRAME_FORMAT 1
 
 #define XERR_INIT_AVG       16          /* nb of measurements the XTAL correction is averaged on as initial value */
 #define XERR_FILT_COEF      256         /* coefficient for low-pass XTAL error tracking */
@@ -133,14 +149,9 @@ License: Revised BSD License, see LICENSE.TXT file include in the project
 
 #define NB_PKT_MAX      24 /* max number of packets per fetch/send cycle */
 
-#define MIN_LORA_PREAMB 6 /* minimum Lora preamble length for this application */
-#define STD_LORA_PREAMB 8
-#define MIN_FSK_PREAMB  3 /* minimum FSK preamble length for this application */
-#define STD_FSK_PREAMB  5
-
-#define STATUS_SIZE     200
-#define TX_BUFF_SIZE    ((540 * NB_PKT_MAX) + 30 + STATUS_SIZE)
-#define ACK_BUFF_SIZE   64
+#define STATUS_SIZE     352
+#define TX_BUFF_SIZE    (((RXPK_JSON_SIZE_MAX + 1) * NB_PKT_MAX) + 30 + STATUS_SIZE)
+#define ACK_BUFF_SIZE   80
 
 #define UNIX_GPS_EPOCH_OFFSET 315964800 /* Number of seconds ellapsed between 01.Jan.1970 00:00:00
                                                                           and 06.Jan.1980 00:00:00 */
@@ -250,10 +261,26 @@ struct sockaddr_in dest_addr;
 struct sockaddr_in source_addr;
 
 /* network protocol variables */
+static uint32_t max_batch_latency_ms = 0; /* max time a packet waits for other ones to share its PUSH_DATA (0 = no batching) */
+static uint32_t max_batch_bytes = TX_BUFF_SIZE; /* PUSH_DATA size from which it is sent without waiting */
+static uint32_t max_batch_pkts = NB_PKT_MAX; /* nb of packets in a PUSH_DATA from which it is sent without waiting */
+static uint16_t uplink_watermark = UPLINK_RING_WATERMARK_DEFAULT; /* backlog from which uplinks are forwarded by priority */
 static struct timeval push_timeout_half = {0, (PUSH_TIMEOUT_MS * 500)}; /* cut in half, critical for throughput */
+static bool spool_enable = false; /* keep unacknowledged uplinks on SD card, and replay them when the server is back */
+static uint32_t spool_max_bytes = SPOOL_DEFAULT_MAX_BYTES; /* SD card space the spool can use */
+static uint32_t spool_replay_ms = SPOOL_REPLAY_MS; /* time interval between two replayed PUSH_DATA */
+static uint32_t dedup_window_ms = 0; /* window in which an identical uplink from the same device is dropped (0 = disabled) */
+static bool asap_any_chain = false; /* immediate downlinks are sent on the RF chain with the earliest free slot */
+static bool chain_balancing = false; /* downlinks colliding on the requested RF chain are tried on the other ones */
+static bool duty_enable = false; /* downlinks are charged to a regulatory duty-cycle and dwell-time ledger */
+static uint32_t duty_window_s = DUTY_CYCLE_WINDOW_S; /* duty-cycle observation period */
+static char duty_region[16] = "\0"; /* built-in sub-band table, overridden by duty_band */
+static struct duty_cycle_band_s duty_band[DUTY_CYCLE_BAND_MAX];
+static int duty_nb_band = 0;
 static struct timeval pull_timeout = {0, (PULL_TIMEOUT_MS * 1000)}; /* non critical for throughput */
 
 /* hardware access control and correction */
+static bool ftime_enabled = false; /* fine timestamp needs the HAL to merge packets, no zero-copy fetch */
 SemaphoreHandle_t mx_concent; /* control access to the concentrator */
 static SemaphoreHandle_t mx_xcorr; /* control access to the XTAL correction */
 static bool xtal_correct_ok = false; /* set true when XTAL correction is stable enough */
@@ -284,7 +311,12 @@ static uint32_t meas_up_pkt_fwd = 0; /* number of radio packet forwarded to the
 static uint32_t meas_up_network_byte = 0; /* sum of UDP bytes sent for upstream traffic */
 static uint32_t meas_up_payload_byte = 0; /* sum of radio payload bytes sent for upstream traffic */
 static uint32_t meas_up_dgram_sent = 0; /* number of datagrams sent for upstream traffic */
+static uint32_t meas_up_dgram_rxpk = 0; /* number of datagrams sent with at least one radio packet */
 static uint32_t meas_up_ack_rcv = 0; /* number of datagrams acknowledged for upstream traffic */
+static uint32_t meas_up_ack_late = 0; /* number of datagrams acknowledged after the PUSH_DATA time-out */
+static uint32_t meas_up_ack_lost = 0; /* number of datagrams never acknowledged */
+static uint32_t meas_up_ack_rtt_sum = 0; /* sum of PUSH_ACK round-trip times, in ms */
+static uint32_t meas_up_ack_rtt_max = 0; /* highest PUSH_ACK round-trip time, in ms */
 
 static SemaphoreHandle_t mx_meas_dw; /* control access to the downstream measurements */
 static uint32_t meas_dw_pull_sent = 0; /* number of PULL requests sent for downstream traffic */
@@ -294,14 +326,22 @@ static uint32_t meas_dw_network_byte = 0; /* sum of UDP bytes sent for upstream
 static uint32_t meas_dw_payload_byte = 0; /* sum of radio payload bytes sent for upstream traffic */
 static uint32_t meas_nb_tx_ok = 0; /* count packets emitted successfully */
 static uint32_t meas_nb_tx_fail = 0; /* count packets were TX failed for other reasons */
+static uint32_t meas_tx_send_us_sum = 0; /* sum of lgw_send() durations, concentrator lock held */
+static uint32_t meas_tx_send_us_max = 0; /* max lgw_send() duration */
 static uint32_t meas_nb_tx_requested = 0; /* count TX request from server (downlinks) */
 static uint32_t meas_nb_tx_rejected_collision_packet = 0; /* count packets were TX request were rejected due to collision with another packet already programmed */
 static uint32_t meas_nb_tx_rejected_collision_beacon = 0; /* count packets were TX request were rejected due to collision with a beacon already programmed */
 static uint32_t meas_nb_tx_rejected_too_late = 0; /* count packets were TX request were rejected because it is too late to program it */
 static uint32_t meas_nb_tx_rejected_too_early = 0; /* count packets were TX request were rejected because timestamp is too much in advance */
+static uint32_t meas_nb_tx_rejected_duty_cycle = 0; /* count packets were TX request were rejected because the sub-band duty-cycle is exhausted */
+static uint32_t meas_nb_tx_rejected_dwell_time = 0; /* count packets were TX request were rejected because the time on air is above the dwell time */
+static uint32_t meas_nb_tx_rebalanced = 0; /* count packets queued on another RF chain than requested, to avoid a collision */
 static uint32_t meas_nb_beacon_queued = 0; /* count beacon inserted in jit queue */
 static uint32_t meas_nb_beacon_sent = 0; /* count beacon actually sent to concentrator */
 static uint32_t meas_nb_beacon_rejected = 0; /* count beacon rejected for queuing */
+static uint32_t meas_jit_wakeup = 0; /* count JiT dispatcher wake-ups, each one reads the concentrator counter once */
+static uint32_t meas_jit_late[JIT_LATE_NB] = {0}; /* histogram of dispatch lateness, after the start of the TX_JIT_DELAY window */
+static uint32_t meas_jit_late_max = 0; /* max dispatch lateness in microseconds */
 
 static SemaphoreHandle_t mx_meas_gps; /* control access to the GPS statistics */
 static bool gps_coord_valid; /* could we get valid GPS coordinates ? */
@@ -328,6 +368,21 @@ static uint32_t autoquit_threshold = 0; /* enable auto-quit after a number of no
 /* Just In Time TX scheduling */
 static struct jit_queue_s jit_queue[LGW_RF_CHAIN_NB];
 
+/* Downlink requests checked by thread_down, to be queued by thread_jit */
+static struct downlink_inbox_s downlink_inbox;
+
+/* Packets fetched from the concentrator, waiting to be sent to the server */
+static struct uplink_ring_s uplink_ring;
+static const char *up_class_name[UPLINK_CLASS_NB] = { "join:", "confirmed:", "unconfirmed:", "CRC error:" };
+static const uint32_t jit_late_bound_us[JIT_LATE_NB - 1] = { 1000, 2000, 5000, 10000, 20000 }; /* upper bounds of the lateness bins, the last one is open */
+
+/* DevAddr/NetID and JoinEUI rules applied before forwarding */
+static struct uplink_filter_s uplink_filter;
+
+/* Last frame of each device, to drop copies received on several channels */
+static struct uplink_dedup_s uplink_dedup;
+static struct duty_cycle_s duty_cycle;
+
 /* Gateway specificities */
 static int8_t antenna_gain = 0;
 
@@ -363,6 +418,8 @@ TaskHandle_t pHttpServer;
 TaskHandle_t pLed;
 TaskHandle_t pkt_fwd_handle;
 TaskHandle_t pGps;
+TaskHandle_t pFetch;
+TaskHandle_t pSpool;
 
 
 //static void sig_handler(int sigio);
@@ -371,6 +428,10 @@ static int parse_SX130x_configuration(const char *conf_array);
 
 static int parse_gateway_configuration(const char *conf_array);
 
+static int parse_filter_rules(JSON_Array *conf_array, enum uplink_filter_table_e table);
+
+static int parse_duty_cycle_configuration(JSON_Object *conf_obj);
+
 static int parse_debug_configuration(const char *conf_array);
 
 static uint16_t crc16(const uint8_t *data, unsigned size);
@@ -383,7 +444,12 @@ static void gps_process_coords(void);
 
 static int get_tx_gain_lut_index(uint8_t rf_chain, int8_t rf_power, uint8_t *lut_index);
 
+static bool tx_chain_supports(uint8_t rf_chain, const struct lgw_pkt_tx_s *pkt);
+
+static uint32_t get_concentrator_time(void);
+
 /* threads */
+void thread_fetch(void);
 void thread_up(void);
 void thread_down(void);
 void thread_jit(void);
@@ -553,6 +619,7 @@ static int parse_SX130x_configuration(const char *conf_array)
                 return -1;
             }
             MSG("INFO: Configuring fine timestamp with %s mode\n", str);
+            ftime_enabled = true;
 
             /* all parameters parsed, submitting configuration to the HAL */
             if (lgw_ftime_setconf(&tsconf) != LGW_HAL_SUCCESS) {
@@ -1118,6 +1185,7 @@ static int parse_gateway_configuration(const char *conf_array)
     JSON_Value *root_val;
     JSON_Object *conf_obj = NULL;
     JSON_Value *val = NULL; /* needed to detect the absence of some fields */
+    JSON_Object *filter_obj = NULL;
     const char *str; /* pointer to sub-strings in the JSON data */
     unsigned long long ull = 0;
 
@@ -1186,6 +1254,101 @@ static int parse_gateway_configuration(const char *conf_array)
         MSG("INFO: upstream PUSH_DATA time-out is configured to %u ms\n", (unsigned)(push_timeout_half.tv_usec / 500));
     }
 
+    /* upstream batching: packets of several fetch cycles sent in one PUSH_DATA (optional) */
+    val = json_object_get_value(conf_obj, "max_batch_latency_ms");
+    if (val != NULL) {
+        max_batch_latency_ms = (uint32_t)json_value_get_number(val);
+    }
+    val = json_object_get_value(conf_obj, "max_batch_bytes");
+    if (val != NULL) {
+        max_batch_bytes = (uint32_t)json_value_get_number(val);
+        if ((max_batch_bytes == 0) || (max_batch_bytes > TX_BUFF_SIZE)) {
+            max_batch_bytes = TX_BUFF_SIZE;
+        }
+    }
+    val = json_object_get_value(conf_obj, "max_batch_pkts");
+    if (val != NULL) {
+        max_batch_pkts = (uint32_t)json_value_get_number(val);
+        if (max_batch_pkts == 0) {
+            max_batch_pkts = NB_PKT_MAX;
+        }
+    }
+    if (max_batch_latency_ms > 0) {
+        MSG("INFO: upstream batching enabled, PUSH_DATA sent after %lu ms, %lu bytes or %lu packets\n", max_batch_latency_ms, max_batch_bytes, max_batch_pkts);
+    } else {
+        MSG("INFO: upstream batching disabled\n");
+    }
+
+    /* uplink backlog from which packets are forwarded by priority class (optional) */
+    val = json_object_get_value(conf_obj, "uplink_prio_watermark");
+    if (val != NULL) {
+        uplink_watermark = (uint16_t)json_value_get_number(val);
+        if (uplink_watermark > UPLINK_RING_SIZE) {
+            uplink_watermark = UPLINK_RING_SIZE;
+        }
+        MSG("INFO: uplinks forwarded by priority when more than %u are waiting\n", uplink_watermark);
+    }
+
+    /* store-and-forward of unacknowledged uplinks on SD card (optional) */
+    val = json_object_get_value(conf_obj, "spool_enable");
+    if (json_value_get_type(val) == JSONBoolean) {
+        spool_enable = (bool)json_value_get_boolean(val);
+    }
+    val = json_object_get_value(conf_obj, "spool_max_bytes");
+    if (val != NULL) {
+        spool_max_bytes = (uint32_t)json_value_get_number(val);
+    }
+    val = json_object_get_value(conf_obj, "spool_replay_ms");
+    if (val != NULL) {
+        spool_replay_ms = (uint32_t)json_value_get_number(val);
+    }
+    if (spool_enable == true) {
+        MSG("INFO: unacknowledged uplinks will be spooled on SD card (%lu bytes max), replayed every %lu ms\n", spool_max_bytes, spool_replay_ms);
+    }
+
+    /* uplink filtering by DevAddr/NetID and JoinEUI (optional) */
+    filter_obj = json_object_get_object(conf_obj, "uplink_filter");
+    if (filter_obj != NULL) {
+        if ((parse_filter_rules(json_object_get_array(filter_obj, "devaddr"), FILTER_TABLE_DEVADDR) != 0) ||
+                (parse_filter_rules(json_object_get_array(filter_obj, "join_eui"), FILTER_TABLE_JOINEUI) != 0)) {
+            json_value_free(root_val);
+            return -1;
+        }
+    }
+
+    /* duplicated uplinks suppression (optional) */
+    val = json_object_get_value(conf_obj, "dedup_window_ms");
+    if (val != NULL) {
+        dedup_window_ms = (uint32_t)json_value_get_number(val);
+    }
+    if (dedup_window_ms > 0) {
+        MSG("INFO: identical uplinks from the same device within %lu ms will NOT be forwarded\n", dedup_window_ms);
+    }
+
+    /* immediate downlinks on any RF chain able to send them (optional) */
+    val = json_object_get_value(conf_obj, "downlink_asap_any_chain");
+    if (json_value_get_type(val) == JSONBoolean) {
+        asap_any_chain = (bool)json_value_get_boolean(val);
+    }
+    if (asap_any_chain == true) {
+        MSG("INFO: immediate downlinks will be sent on the RF chain with the earliest free slot\n");
+    }
+
+    /* downlinks moved to another RF chain instead of being rejected on collision (optional) */
+    val = json_object_get_value(conf_obj, "downlink_chain_balancing");
+    if (json_value_get_type(val) == JSONBoolean) {
+        chain_balancing = (bool)json_value_get_boolean(val);
+    }
+    if (chain_balancing == true) {
+        MSG("INFO: downlinks colliding on the requested RF chain will be tried on the other ones\n");
+    }
+
+    /* regulatory duty-cycle and dwell-time limits of downlinks (optional) */
+    if (parse_duty_cycle_configuration(json_object_get_object(conf_obj, "duty_cycle")) != 0) {
+        json_value_free(root_val);
+        return -1;
+    }
+
     /* packet filtering parameters */
     val = json_object_get_value(conf_obj, "forward_crc_valid");
     if (json_value_get_type(val) == JSONBoolean) {
@@ -1312,6 +1475,119 @@ static int parse_gateway_configuration(const char *conf_array)
     return 0;
 }
 
+static int parse_filter_rules(JSON_Array *conf_array, enum uplink_filter_table_e table)
+{
+    int i;
+    JSON_Object *rule_obj;
+    const char *str;
+    enum uplink_filter_action_e action;
+    unsigned long long min, max;
+    int x;
+
+    if (conf_array == NULL) {
+        return 0;
+    }
+
+    for (i = 0; i < (int)json_array_get_count(conf_array); i++) {
+        rule_obj = json_array_get_object(conf_array, i);
+        if (rule_obj == NULL) {
+            MSG("ERROR: filter rule %d is not a JSON object\n", i);
+            return -1;
+        }
+
+        /* action: "allow" or "deny" */
+        str = json_object_get_string(rule_obj, "action");
+        if ((str != NULL) && (strcmp(str, "allow") == 0)) {
+            action = FILTER_ACTION_ALLOW;
+        } else if ((str != NULL) && (strcmp(str, "deny") == 0)) {
+            action = FILTER_ACTION_DENY;
+        } else {
+            MSG("ERROR: filter rule %d has no valid action (allow or deny)\n", i);
+            return -1;
+        }
+
+        /* range of keys: NetID (DevAddr table only), or min/max */
+        str = json_object_get_string(rule_obj, "netid");
+        if ((str != NULL) && (table == FILTER_TABLE_DEVADDR)) {
+            if (sscanf(str, "%llx", &min) != 1) {
+                MSG("ERROR: filter rule %d has an invalid NetID\n", i);
+                return -1;
+            }
+            x = uplink_filter_add_netid(&uplink_filter, (uint32_t)min, action);
+            MSG("INFO: uplink filter, %s NetID %06llX\n", (action == FILTER_ACTION_ALLOW) ? "allow" : "deny", min);
+        } else {
+            str = json_object_get_string(rule_obj, "min");
+            if ((str == NULL) || (sscanf(str, "%llx", &min) != 1)) {
+                MSG("ERROR: filter rule %d has no valid min\n", i);
+                return -1;
+            }
+            str = json_object_get_string(rule_obj, "max");
+            if ((str == NULL) || (sscanf(str, "%llx", &max) != 1)) {
+                max = min;
+            }
+            x = uplink_filter_add(&uplink_filter, table, min, max, action);
+            MSG("INFO: uplink filter, %s %s %llX-%llX\n", (action == FILTER_ACTION_ALLOW) ? "allow" : "deny", (table == FILTER_TABLE_DEVADDR) ? "DevAddr" : "JoinEUI", min, max);
+        }
+        if (x != 0) {
+            return -1;
+        }
+    }
+
+    return 0;
+}
+
+static int parse_duty_cycle_configuration(JSON_Object *conf_obj)
+{
+    int i;
+    JSON_Array *band_array;
+    JSON_Object *band_obj;
+    JSON_Value *val;
+    const char *str;
+
+    if (conf_obj == NULL) {
+        return 0;
+    }
+
+    val = json_object_get_value(conf_obj, "enable");
+    if (json_value_get_type(val) == JSONBoolean) {
+        duty_enable = (bool)json_value_get_boolean(val);
+    }
+    if (duty_enable == false) {
+        return 0;
+    }
+    val = json_object_get_value(conf_obj, "window_s");
+    if (val != NULL) {
+        duty_window_s = (uint32_t)json_value_get_number(val);
+        if (duty_window_s == 0) {
+            duty_window_s = DUTY_CYCLE_WINDOW_S;
+        }
+    }
+    str = json_object_get_string(conf_obj, "region");
+    if (str != NULL) {
+        strncpy(duty_region, str, sizeof duty_region);
+        duty_region[sizeof duty_region - 1] = '\0'; /* ensure string termination */
+    }
+
+    /* sub-bands looked up before the built-in region table, they override it where they overlap */
+    band_array = json_object_get_array(conf_obj, "bands");
+    for (i = 0; (band_array != NULL) && (i < (int)json_array_get_count(band_array)); i++) {
+        band_obj = json_array_get_object(band_array, i);
+        if ((band_obj == NULL) || (duty_nb_band == DUTY_CYCLE_BAND_MAX)) {
+            MSG("ERROR: duty-cycle band %d is not a JSON object, or too many bands\n", i);
+            return -1;
+        }
+        duty_band[duty_nb_band].freq_min = (uint32_t)json_object_get_number(band_obj, "freq_min");
+        duty_band[duty_nb_band].freq_max = (uint32_t)json_object_get_number(band_obj, "freq_max");
+        duty_band[duty_nb_band].duty_cycle = (float)json_object_get_number(band_obj, "duty_cycle");
+        duty_band[duty_nb_band].dwell_max_ms = (uint32_t)json_object_get_number(band_obj, "dwell_max_ms");
+        duty_nb_band += 1;
+    }
+
+    MSG("INFO: downlinks limited by duty-cycle over %lu s (region %s, %d more sub-bands)\n", duty_window_s, (duty_region[0] != '\0') ? duty_region : "none", duty_nb_band);
+
+    return 0;
+}
+
 static int parse_debug_configuration(const char *config_array)
 {
     int i;
@@ -1413,7 +1689,7 @@ static double difftimespec(struct timespec end, struct timespec beginning)
     return x;
 }
 
-static int send_tx_ack(uint8_t token_h, uint8_t token_l, enum jit_error_e error, int32_t error_value)
+static int send_tx_ack(uint8_t token_h, uint8_t token_l, enum jit_error_e error, int32_t error_value, int rf_chain)
 {
     uint8_t buff_ack[ACK_BUFF_SIZE]; /* buffer to give feedback to server */
     int buff_index;
@@ -1432,10 +1708,12 @@ static int send_tx_ack(uint8_t token_h, uint8_t token_l, enum jit_error_e error,
     buff_index = 12; /* 12-byte header */
 
     /* Put no JSON string if there is nothing to report */
-    if (error != JIT_ERROR_OK) {
+    if ((error != JIT_ERROR_OK) || (rf_chain >= 0)) {
         /* start of JSON structure */
         memcpy((void *)(buff_ack + buff_index), (void *)"{\"txpk_ack\":{", 13);
         buff_index += 13;
+    }
+    if (error != JIT_ERROR_OK) {
         /* set downlink error/warning status in JSON structure */
         switch ( error ) {
         case JIT_ERROR_TX_POWER:
@@ -1494,6 +1772,22 @@ static int send_tx_ack(uint8_t token_h, uint8_t token_l, enum jit_error_e error,
             memcpy((void *)(buff_ack + buff_index), (void *)"\"GPS_UNLOCKED\"", 14);
             buff_index += 14;
             break;
+        case JIT_ERROR_DUTY_CYCLE:
+            memcpy((void *)(buff_ack + buff_index), (void *)"\"DUTY_CYCLE\"", 12);
+            buff_index += 12;
+            /* update stats */
+            xSemaphoreTake(mx_meas_dw, portMAX_DELAY);
+            meas_nb_tx_rejected_duty_cycle += 1;
+            xSemaphoreGive(mx_meas_dw);
+            break;
+        case JIT_ERROR_DWELL_TIME:
+            memcpy((void *)(buff_ack + buff_index), (void *)"\"DWELL_TIME\"", 12);
+            buff_index += 12;
+            /* update stats */
+            xSemaphoreTake(mx_meas_dw, portMAX_DELAY);
+            meas_nb_tx_rejected_dwell_time += 1;
+            xSemaphoreGive(mx_meas_dw);
+            break;
         default:
             memcpy((void *)(buff_ack + buff_index), (void *)"\"UNKNOWN\"", 9);
             buff_index += 9;
@@ -1514,6 +1808,18 @@ static int send_tx_ack(uint8_t token_h, uint8_t token_l, enum jit_error_e error,
             /* Do nothing */
             break;
         }
+    }
+    if (rf_chain >= 0) {
+        /* RF chain actually used, when it is not the requested one */
+        j = snprintf((char *)(buff_ack + buff_index), ACK_BUFF_SIZE - buff_index, "%s\"rfch\":%d", (error != JIT_ERROR_OK) ? "," : "", rf_chain);
+        if (j > 0) {
+            buff_index += j;
+        } else {
+            MSG("ERROR: [up] snprintf failed line %d\n", (__LINE__ - 4));
+            exit(EXIT_FAILURE);
+        }
+    }
+    if ((error != JIT_ERROR_OK) || (rf_chain >= 0)) {
         /* end of JSON structure */
         memcpy((void *)(buff_ack + buff_index), (void *)"}}", 2);
         buff_index += 2;
@@ -1550,6 +1856,8 @@ int pkt_fwd_main(void)
     int i; /* loop variable and temporary variable for return value */
     int x;
     int l, m;
+    int64_t start_us;
+    struct lgw_com_bulk_stat_s bulk_stat;
 
     /* variables to get local copies of measurements */
     uint32_t cp_nb_rx_rcv;
@@ -1560,7 +1868,12 @@ int pkt_fwd_main(void)
     uint32_t cp_up_network_byte;
     uint32_t cp_up_payload_byte;
     uint32_t cp_up_dgram_sent;
+    uint32_t cp_up_dgram_rxpk;
     uint32_t cp_up_ack_rcv;
+    uint32_t cp_up_ack_late;
+    uint32_t cp_up_ack_lost;
+    uint32_t cp_up_ack_rtt_sum;
+    uint32_t cp_up_ack_rtt_max;
     uint32_t cp_dw_pull_sent;
     uint32_t cp_dw_ack_rcv;
     uint32_t cp_dw_dgram_rcv;
@@ -1568,14 +1881,32 @@ int pkt_fwd_main(void)
     uint32_t cp_dw_payload_byte;
     uint32_t cp_nb_tx_ok;
     uint32_t cp_nb_tx_fail;
+    uint32_t cp_tx_send_us_sum;
+    uint32_t cp_tx_send_us_max;
     uint32_t cp_nb_tx_requested = 0;
     uint32_t cp_nb_tx_rejected_collision_packet = 0;
     uint32_t cp_nb_tx_rejected_collision_beacon = 0;
     uint32_t cp_nb_tx_rejected_too_late = 0;
     uint32_t cp_nb_tx_rejected_too_early = 0;
+    uint32_t cp_nb_tx_rejected_duty_cycle = 0;
+    uint32_t cp_nb_tx_rejected_dwell_time = 0;
+    uint32_t cp_nb_tx_rebalanced = 0;
     uint32_t cp_nb_beacon_queued = 0;
     uint32_t cp_nb_beacon_sent = 0;
     uint32_t cp_nb_beacon_rejected = 0;
+    uint32_t cp_jit_wakeup = 0;
+    struct lgw_clock_stat_s cp_clock;
+    struct lgw_reg_shadow_stat_s cp_reg_shadow;
+    struct lgw_rx_fetch_stat_s cp_rx_fetch;
+    struct jit_queue_stat_s cp_jit_lock[LGW_RF_CHAIN_NB];
+    struct downlink_inbox_stat_s cp_dw_inbox;
+    uint32_t cp_jit_late[JIT_LATE_NB];
+    uint32_t cp_jit_late_max = 0;
+    struct uplink_ring_stat_s cp_up_ring;
+    struct uplink_spool_stat_s cp_up_spool;
+    uint32_t cp_up_filter_drop;
+    struct uplink_dedup_stat_s cp_up_dedup;
+    struct duty_cycle_stat_s cp_duty;
 
     /* GPS coordinates variables */
     bool coord_ok = false;
@@ -1592,7 +1923,9 @@ int pkt_fwd_main(void)
     float rx_bad_ratio;
     float rx_nocrc_ratio;
     float up_ack_ratio;
+    float up_batch_avg;
     float dw_ack_ratio;
+    int stat_len;
 
     // init all mutexes
     mx_concent = xSemaphoreCreateMutex();
@@ -1677,6 +2010,7 @@ int pkt_fwd_main(void)
     }
 
     /* load configuration files */
+    uplink_filter_init(&uplink_filter);
     x = parse_SX130x_configuration(conf_array);
     if (x != 0) {
         MSG("INFO: no SX130x configuration\n");
@@ -1811,9 +2145,13 @@ int pkt_fwd_main(void)
     }
 
     /* starting the concentrator */
+    start_us = esp_timer_get_time();
     i = lgw_start();
     if (i == LGW_HAL_SUCCESS) {
-        MSG("INFO: [main] concentrator started, packet can now be received\n");
+        MSG("INFO: [main] concentrator started in %lld ms, packet can now be received\n", (esp_timer_get_time() - start_us) / 1000);
+        if (lgw_com_get_bulk_stat(&bulk_stat, true) == LGW_COM_SUCCESS) {
+            MSG("INFO: [main] %lu register writes sent in %lu SPI transactions at start\n", (unsigned long)bulk_stat.nb_write, (unsigned long)bulk_stat.nb_trans);
+        }
     } else {
         MSG("ERROR: [main] failed to start the concentrator\n");
         exit(EXIT_FAILURE);
@@ -1840,6 +2178,41 @@ int pkt_fwd_main(void)
     jit_queue_init(&jit_queue[0]);
     jit_queue_init(&jit_queue[1]);
 
+    /* downlink inbox initialization */
+    downlink_inbox_init(&downlink_inbox);
+
+    /* uplink ring initialization */
+    uplink_ring_init(&uplink_ring, uplink_watermark);
+
+    /* duplicated uplinks table initialization */
+    uplink_dedup_init(&uplink_dedup, dedup_window_ms);
+
+    /* downlink duty-cycle ledger initialization, shared by the JIT queues */
+    if (duty_enable == true) {
+        duty_cycle_init(&duty_cycle, duty_window_s);
+        /* first match: the configured sub-bands take precedence over the region table */
+        for (i = 0; i < duty_nb_band; i++) {
+            if (duty_cycle_add_band(&duty_cycle, &duty_band[i]) != 0) {
+                MSG("ERROR: [main] invalid duty-cycle band %d, or too many bands\n", i);
+                exit(EXIT_FAILURE);
+            }
+        }
+        if ((duty_region[0] != '\0') && (duty_cycle_add_region(&duty_cycle, duty_region) != 0)) {
+            MSG("ERROR: [main] unknown duty-cycle region %s, or too many bands\n", duty_region);
+            exit(EXIT_FAILURE);
+        }
+        jit_queue_set_duty_cycle(&duty_cycle);
+    }
+
+    /* uplink spool initialization, the SD card is only written by a low priority task */
+    if ((spool_enable == true) && (uplink_spool_init(spool_max_bytes) == 0)) {
+        if ( xTaskCreatePinnedToCore(((TaskFunction_t) uplink_spool_task), "uplink_spool", 4096, NULL, 2, &pSpool, tskNO_AFFINITY) == errCOULD_NOT_ALLOCATE_REQUIRED_MEMORY) {
+            printf( "Failed to spawn uplink_spool\n");
+        } else {
+            printf( "Uplink_spool spawned\n" );
+        }
+    }
+
     if ( xTaskCreatePinnedToCore(((TaskFunction_t) thread_up), "thread_up", (4096 * 4), NULL, 6, &pThreadUp, tskNO_AFFINITY) == errCOULD_NOT_ALLOCATE_REQUIRED_MEMORY) {
         printf( "Failed to spawn thread_up\n");
         printf( "largest_free_block: %d\n", heap_caps_get_largest_free_block( MALLOC_CAP_INTERNAL | MALLOC_CAP_8BIT ));
@@ -1847,6 +2220,13 @@ int pkt_fwd_main(void)
         printf( "Thread_up spawned\n" );
     }
 
+    if ( xTaskCreatePinnedToCore(((TaskFunction_t) thread_fetch), "thread_fetch", (4096 * 4), NULL, 6, &pFetch, tskNO_AFFINITY) == errCOULD_NOT_ALLOCATE_REQUIRED_MEMORY) {
+        printf( "Failed to spawn thread_fetch\n");
+        printf( "largest_free_block: %d\n", heap_caps_get_largest_free_block( MALLOC_CAP_INTERNAL | MALLOC_CAP_8BIT ));
+    } else {
+        printf( "Thread_fetch spawned\n" );
+    }
+
     if ( xTaskCreatePinnedToCore(((TaskFunction_t) thread_down), "thread_down", 4096 * 2, NULL, 6, &pThreadDn, tskNO_AFFINITY) == errCOULD_NOT_ALLOCATE_REQUIRED_MEMORY) {
         printf( "Failed to spawn thread_down\n");
     } else {
@@ -1919,7 +2299,12 @@ int pkt_fwd_main(void)
         cp_up_network_byte = meas_up_network_byte;
         cp_up_payload_byte = meas_up_payload_byte;
         cp_up_dgram_sent   = meas_up_dgram_sent;
+        cp_up_dgram_rxpk   = meas_up_dgram_rxpk;
         cp_up_ack_rcv      = meas_up_ack_rcv;
+        cp_up_ack_late     = meas_up_ack_late;
+        cp_up_ack_lost     = meas_up_ack_lost;
+        cp_up_ack_rtt_sum  = meas_up_ack_rtt_sum;
+        cp_up_ack_rtt_max  = meas_up_ack_rtt_max;
         meas_nb_rx_rcv = 0;
         meas_nb_rx_ok = 0;
         meas_nb_rx_bad = 0;
@@ -1928,7 +2313,12 @@ int pkt_fwd_main(void)
         meas_up_network_byte = 0;
         meas_up_payload_byte = 0;
         meas_up_dgram_sent = 0;
+        meas_up_dgram_rxpk = 0;
         meas_up_ack_rcv = 0;
+        meas_up_ack_late = 0;
+        meas_up_ack_lost = 0;
+        meas_up_ack_rtt_sum = 0;
+        meas_up_ack_rtt_max = 0;
         xSemaphoreGive(mx_meas_up);
         if (cp_nb_rx_rcv > 0) {
             rx_ok_ratio = (float)cp_nb_rx_ok / (float)cp_nb_rx_rcv;
@@ -1944,6 +2334,25 @@ int pkt_fwd_main(void)
         } else {
             up_ack_ratio = 0.0;
         }
+        if (cp_up_dgram_rxpk > 0) {
+            up_batch_avg = (float)cp_up_pkt_fwd / (float)cp_up_dgram_rxpk;
+        } else {
+            up_batch_avg = 0.0;
+        }
+
+        /* access uplink ring statistics, copy and reset them */
+        uplink_ring_get_stat(&uplink_ring, &cp_up_ring, true);
+        uplink_spool_get_stat(&cp_up_spool, true);
+        uplink_dedup_get_stat(&uplink_dedup, &cp_up_dedup, true);
+
+        /* access JIT locking and downlink handoff statistics, copy and reset them */
+        for (i = 0; i < LGW_RF_CHAIN_NB; i++) {
+            jit_queue_get_stat(&jit_queue[i], &cp_jit_lock[i], true);
+        }
+        downlink_inbox_get_stat(&downlink_inbox, &cp_dw_inbox, true);
+        if (duty_enable == true) {
+            duty_cycle_get_stat(&duty_cycle, esp_timer_get_time() / 1000, &cp_duty, true);
+        }
 
         /* access downstream statistics, copy and reset them */
         xSemaphoreTake(mx_meas_dw, portMAX_DELAY);
@@ -1954,14 +2363,22 @@ int pkt_fwd_main(void)
         cp_dw_payload_byte =  meas_dw_payload_byte;
         cp_nb_tx_ok        =  meas_nb_tx_ok;
         cp_nb_tx_fail      =  meas_nb_tx_fail;
+        cp_tx_send_us_sum  =  meas_tx_send_us_sum;
+        cp_tx_send_us_max  =  meas_tx_send_us_max;
         cp_nb_tx_requested                 +=  meas_nb_tx_requested;
         cp_nb_tx_rejected_collision_packet +=  meas_nb_tx_rejected_collision_packet;
         cp_nb_tx_rejected_collision_beacon +=  meas_nb_tx_rejected_collision_beacon;
         cp_nb_tx_rejected_too_late         +=  meas_nb_tx_rejected_too_late;
         cp_nb_tx_rejected_too_early        +=  meas_nb_tx_rejected_too_early;
+        cp_nb_tx_rejected_duty_cycle       +=  meas_nb_tx_rejected_duty_cycle;
+        cp_nb_tx_rejected_dwell_time       +=  meas_nb_tx_rejected_dwell_time;
+        cp_nb_tx_rebalanced                +=  meas_nb_tx_rebalanced;
         cp_nb_beacon_queued   +=  meas_nb_beacon_queued;
         cp_nb_beacon_sent     +=  meas_nb_beacon_sent;
         cp_nb_beacon_rejected +=  meas_nb_beacon_rejected;
+        cp_jit_wakeup      =  meas_jit_wakeup;
+        memcpy(cp_jit_late, meas_jit_late, sizeof cp_jit_late);
+        cp_jit_late_max    =  meas_jit_late_max;
         meas_dw_pull_sent = 0;
         meas_dw_ack_rcv = 0;
         meas_dw_dgram_rcv = 0;
@@ -1969,14 +2386,22 @@ int pkt_fwd_main(void)
         meas_dw_payload_byte = 0;
         meas_nb_tx_ok = 0;
         meas_nb_tx_fail = 0;
+        meas_tx_send_us_sum = 0;
+        meas_tx_send_us_max = 0;
         meas_nb_tx_requested = 0;
         meas_nb_tx_rejected_collision_packet = 0;
         meas_nb_tx_rejected_collision_beacon = 0;
         meas_nb_tx_rejected_too_late = 0;
         meas_nb_tx_rejected_too_early = 0;
+        meas_nb_tx_rejected_duty_cycle = 0;
+        meas_nb_tx_rejected_dwell_time = 0;
+        meas_nb_tx_rebalanced = 0;
         meas_nb_beacon_queued = 0;
         meas_nb_beacon_sent = 0;
         meas_nb_beacon_rejected = 0;
+        meas_jit_wakeup = 0;
+        memset(meas_jit_late, 0, sizeof meas_jit_late);
+        meas_jit_late_max = 0;
         xSemaphoreGive(mx_meas_dw);
         if (cp_dw_pull_sent > 0) {
             dw_ack_ratio = (float)cp_dw_ack_rcv / (float)cp_dw_pull_sent;
@@ -2006,21 +2431,61 @@ int pkt_fwd_main(void)
         printf("# RF packets forwarded: %lu (%lu bytes)\n", cp_up_pkt_fwd, cp_up_payload_byte);
         printf("# PUSH_DATA datagrams sent: %lu (%lu bytes)\n", cp_up_dgram_sent, cp_up_network_byte);
         printf("# PUSH_DATA acknowledged: %.2f%%\n", 100.0 * up_ack_ratio);
+        printf("# PUSH_DATA batching: %.2f RF packets per datagram\n", up_batch_avg);
+        if (cp_up_ack_rcv > 0) {
+            printf("# PUSH_ACK round-trip: avg %lu ms, max %lu ms (%lu late, %lu lost)\n", cp_up_ack_rtt_sum / cp_up_ack_rcv, cp_up_ack_rtt_max, cp_up_ack_late, cp_up_ack_lost);
+        } else {
+            printf("# PUSH_ACK round-trip: no acknowledge (%lu lost)\n", cp_up_ack_lost);
+        }
+        printf("# Uplink ring: %u/%u slots used (max %u), %lu packets dropped on overflow\n", cp_up_ring.occupancy, UPLINK_RING_SIZE, cp_up_ring.occupancy_max, cp_up_ring.nb_overflow);
+        for (i = 0; i < UPLINK_CLASS_NB; i++) {
+            printf("# Uplink class %-12s %lu forwarded (avg %lu ms, max %lu ms), %lu dropped\n", up_class_name[i], cp_up_ring.cls[i].nb_pkt,
+                   (cp_up_ring.cls[i].nb_pkt > 0) ? (cp_up_ring.cls[i].latency_sum_ms / cp_up_ring.cls[i].nb_pkt) : 0, cp_up_ring.cls[i].latency_max_ms, cp_up_ring.cls[i].nb_drop);
+        }
+        if (uplink_spool_enabled() == true) {
+            printf("# Uplink spool: %lu datagrams spooled, %lu replayed, %lu dropped, %lu segments discarded (%lu bytes on SD card)\n", cp_up_spool.nb_spooled, cp_up_spool.nb_replayed, cp_up_spool.nb_dropped, cp_up_spool.nb_seg_discarded, cp_up_spool.disk_bytes);
+        }
+        cp_up_filter_drop = uplink_filter_report(&uplink_filter, true);
+        printf("# RF packets dropped by uplink filter: %lu\n", cp_up_filter_drop);
+        if (dedup_window_ms > 0) {
+            printf("# Duplicated RF packets dropped: %lu (%lu new, %lu devices evicted, %.2f slots probed per lookup)\n", cp_up_dedup.nb_hit, cp_up_dedup.nb_miss, cp_up_dedup.nb_evict,
+                   ((cp_up_dedup.nb_hit + cp_up_dedup.nb_miss) > 0) ? ((float)cp_up_dedup.nb_probe / (cp_up_dedup.nb_hit + cp_up_dedup.nb_miss)) : 0.0);
+        }
         printf("### [DOWNSTREAM] ###\n");
         printf("# PULL_DATA sent: %lu (%.2f%% acknowledged)\n", cp_dw_pull_sent, 100.0 * dw_ack_ratio);
         printf("# PULL_RESP(onse) datagrams received: %lu (%lu bytes)\n", cp_dw_dgram_rcv, cp_dw_network_byte);
         printf("# RF packets sent to concentrator: %lu (%lu bytes)\n", (cp_nb_tx_ok + cp_nb_tx_fail), cp_dw_payload_byte);
         printf("# TX errors: %lu\n", cp_nb_tx_fail);
+        if ((cp_nb_tx_ok + cp_nb_tx_fail) > 0) {
+            printf("# TX lgw_send time: avg %lu us, max %lu us\n", cp_tx_send_us_sum / (cp_nb_tx_ok + cp_nb_tx_fail), cp_tx_send_us_max);
+        }
         if (cp_nb_tx_requested != 0 ) {
             printf("# TX rejected (collision packet): %.2f%% (req:%lu, rej:%lu)\n", 100.0 * cp_nb_tx_rejected_collision_packet / cp_nb_tx_requested, cp_nb_tx_requested, cp_nb_tx_rejected_collision_packet);
             printf("# TX rejected (collision beacon): %.2f%% (req:%lu, rej:%lu)\n", 100.0 * cp_nb_tx_rejected_collision_beacon / cp_nb_tx_requested, cp_nb_tx_requested, cp_nb_tx_rejected_collision_beacon);
             printf("# TX rejected (too late): %.2f%% (req:%lu, rej:%lu)\n", 100.0 * cp_nb_tx_rejected_too_late / cp_nb_tx_requested, cp_nb_tx_requested, cp_nb_tx_rejected_too_late);
             printf("# TX rejected (too early): %.2f%% (req:%lu, rej:%lu)\n", 100.0 * cp_nb_tx_rejected_too_early / cp_nb_tx_requested, cp_nb_tx_requested, cp_nb_tx_rejected_too_early);
+            if (duty_enable == true) {
+                printf("# TX rejected (duty cycle): %.2f%% (req:%lu, rej:%lu)\n", 100.0 * cp_nb_tx_rejected_duty_cycle / cp_nb_tx_requested, cp_nb_tx_requested, cp_nb_tx_rejected_duty_cycle);
+                printf("# TX rejected (dwell time): %.2f%% (req:%lu, rej:%lu)\n", 100.0 * cp_nb_tx_rejected_dwell_time / cp_nb_tx_requested, cp_nb_tx_requested, cp_nb_tx_rejected_dwell_time);
+            }
+            if (chain_balancing == true) {
+                printf("# TX moved to another RF chain: %.2f%% (req:%lu, moved:%lu), %.2f%% fewer collision packet rejections\n", 100.0 * cp_nb_tx_rebalanced / cp_nb_tx_requested, cp_nb_tx_requested, cp_nb_tx_rebalanced,
+                       (cp_nb_tx_rebalanced > 0) ? (100.0 * cp_nb_tx_rebalanced / (cp_nb_tx_rebalanced + cp_nb_tx_rejected_collision_packet)) : 0.0);
+            }
+        }
+        if (duty_enable == true) {
+            printf("# Duty-cycle ledger: %lu packets charged, %lu refunded, %lu out of sub-bands\n", cp_duty.nb_charged, cp_duty.nb_refunded, cp_duty.nb_out_of_band);
+            for (i = 0; i < duty_cycle.nb_band; i++) {
+                printf("# Duty-cycle %.1f-%.1f MHz: %lu/%lu ms on air over %lu s\n", duty_cycle.band[i].freq_min / 1E6, duty_cycle.band[i].freq_max / 1E6,
+                       cp_duty.used_ms[i], duty_cycle.budget_ms[i], duty_window_s);
+            }
         }
         printf("### SX1302 Status ###\n");
         xSemaphoreTake(mx_concent, portMAX_DELAY);
         i  = lgw_get_instcnt(&inst_tstamp);
         i |= lgw_get_trigcnt(&trig_tstamp);
+        lgw_reg_shadow_get_stat(&cp_reg_shadow, true);
+        lgw_get_rx_fetch_stat(&cp_rx_fetch, true);
         xSemaphoreGive(mx_concent);
         if (i != LGW_HAL_SUCCESS) {
             printf("# SX1302 counter unknown\n");
@@ -2028,10 +2493,27 @@ int pkt_fwd_main(void)
             printf("# SX1302 counter (INST): %lu\n", inst_tstamp);
             printf("# SX1302 counter (PPS):  %lu\n", trig_tstamp);
         }
+        printf("# SX1302 register shadow: %lu read-modify-writes without read, %lu with read, %lu not shadowed\n", cp_reg_shadow.nb_hit, cp_reg_shadow.nb_miss, cp_reg_shadow.nb_bypass);
+        printf("# SX1302 RX fetch: %lu fetches (%lu in background), %lu bytes, SPI bus %.2f%% (max %lu us)\n", cp_rx_fetch.nb_fetch, cp_rx_fetch.nb_prefetch, cp_rx_fetch.nb_byte,
+               (cp_rx_fetch.period_us > 0) ? (100.0 * cp_rx_fetch.bus_us / cp_rx_fetch.period_us) : 0.0, cp_rx_fetch.bus_us_max);
+        if (cp_rx_fetch.nb_fetch > 0) {
+            printf("# SX1302 RX fetch-to-parse latency: avg %llu us, max %lu us\n", cp_rx_fetch.latency_us / cp_rx_fetch.nb_fetch, cp_rx_fetch.latency_us_max);
+            printf("# SX1302 RX buffer indexing: avg %llu us, max %lu us\n", cp_rx_fetch.scan_us / cp_rx_fetch.nb_fetch, cp_rx_fetch.scan_us_max);
+        }
+        lgw_clock_get_stat(&cp_clock, true);
+        printf("# SX1302 clock model: %lu estimates (%lu stale), %lu counter reads, drift %.2f ppm\n", cp_clock.nb_estimate, cp_clock.nb_stale, cp_clock.nb_sample, cp_clock.drift_ppm);
+        printf("# SX1302 clock model error: max %lu us, %lu reads above %d us\n", cp_clock.err_max_us, cp_clock.nb_over_budget, LGW_CLOCK_ERROR_MAX_US);
         printf("# BEACON queued: %lu\n", cp_nb_beacon_queued);
         printf("# BEACON sent so far: %lu\n", cp_nb_beacon_sent);
         printf("# BEACON rejected: %lu\n", cp_nb_beacon_rejected);
         printf("### [JIT] ###\n");
+        printf("# Dispatcher wake-ups: %lu\n", cp_jit_wakeup);
+        printf("# Dispatch lateness: <1ms %lu, <2ms %lu, <5ms %lu, <10ms %lu, <20ms %lu, more %lu (max %lu us)\n",
+               cp_jit_late[0], cp_jit_late[1], cp_jit_late[2], cp_jit_late[3], cp_jit_late[4], cp_jit_late[5], cp_jit_late_max);
+        printf("# Downlink inbox: %lu requests handed over (max %u/%u pending), %lu rejected full\n", cp_dw_inbox.nb_push, cp_dw_inbox.occupancy_max, DOWNLINK_INBOX_SIZE, cp_dw_inbox.nb_full);
+        for (i = 0; i < LGW_RF_CHAIN_NB; i++) {
+            printf("# Queue lock rf_chain %d: %lu taken, %lu contended\n", i, cp_jit_lock[i].nb_lock, cp_jit_lock[i].nb_contended);
+        }
         /* get timestamp captured on PPM pulse  */
         jit_print_queue (&jit_queue[0], false, DEBUG_LOG);
         printf("#--------\n");
@@ -2059,10 +2541,11 @@ int pkt_fwd_main(void)
         /* generate a JSON report (will be sent to server by upstream thread) */
         xSemaphoreTake(mx_stat_rep, portMAX_DELAY);
         if (((gps_enabled == true) && (coord_ok == true)) || (gps_fake_enable == true)) {
-            snprintf(status_report, STATUS_SIZE, "\"stat\":{\"time\":\"%s\",\"lati\":%.5f,\"long\":%.5f,\"alti\":%i,\"rxnb\":%lu,\"rxok\":%lu,\"rxfw\":%lu,\"ackr\":%.1f,\"dwnb\":%lu,\"txnb\":%lu}", stat_timestamp, cp_gps_coord.lat, cp_gps_coord.lon, cp_gps_coord.alt, cp_nb_rx_rcv, cp_nb_rx_ok, cp_up_pkt_fwd, 100.0 * up_ack_ratio, cp_dw_dgram_rcv, cp_nb_tx_ok);
+            stat_len = snprintf(status_report, STATUS_SIZE, "\"stat\":{\"time\":\"%s\",\"lati\":%.5f,\"long\":%.5f,\"alti\":%i", stat_timestamp, cp_gps_coord.lat, cp_gps_coord.lon, cp_gps_coord.alt);
         } else {
-            snprintf(status_report, STATUS_SIZE, "\"stat\":{\"time\":\"%s\",\"rxnb\":%lu,\"rxok\":%lu,\"rxfw\":%lu,\"ackr\":%.1f,\"dwnb\":%lu,\"txnb\":%lu}", stat_timestamp, cp_nb_rx_rcv, cp_nb_rx_ok, cp_up_pkt_fwd, 100.0 * up_ack_ratio, cp_dw_dgram_rcv, cp_nb_tx_ok);
+            stat_len = snprintf(status_report, STATUS_SIZE, "\"stat\":{\"time\":\"%s\"", stat_timestamp);
         }
+        snprintf(status_report + stat_len, STATUS_SIZE - stat_len, ",\"rxnb\":%lu,\"rxok\":%lu,\"rxfw\":%lu,\"ackr\":%.1f,\"dwnb\":%lu,\"txnb\":%lu,\"upqm\":%u,\"upqd\":%lu,\"uppd\":%.1f,\"fltd\":%lu,\"dupd\":%lu}", cp_nb_rx_rcv, cp_nb_rx_ok, cp_up_pkt_fwd, 100.0 * up_ack_ratio, cp_dw_dgram_rcv, cp_nb_tx_ok, cp_up_ring.occupancy_max, cp_up_ring.nb_overflow, up_batch_avg, cp_up_filter_drop, cp_up_dedup.nb_hit);
         report_ready = true;
         xSemaphoreGive(mx_stat_rep);
     }
@@ -2126,16 +2609,204 @@ int pkt_fwd_main(void)
 
 
 /* --- THREAD 1: RECEIVING PACKETS AND FORWARDING THEM ---------------------- */
-uint8_t buff_up[TX_BUFF_SIZE]; /* buffer to compose the upstream packet */
+
+/* PUSH_DATA datagrams sent and waiting for their PUSH_ACK, matched by token */
+struct push_inflight_s {
+    bool used;
+    uint8_t token_h;            /* token of the datagram */
+    uint8_t token_l;
+    struct timespec send_time;  /* time at which the datagram was sent */
+    uint32_t nb_byte;           /* size of the datagram */
+    uint16_t nb_pkt;            /* number of RF packets in the datagram */
+    char *rxpk;                 /* copy of the rxpk array content, spooled if never acknowledged */
+    uint16_t rxpk_len;
+};
+
+static struct push_inflight_s push_inflight[PUSH_INFLIGHT_MAX];
+
+/* release an in-flight slot, its packets go to the spool if the datagram was lost */
+static void push_inflight_free(struct push_inflight_s *slot, bool lost)
+{
+    if (slot->rxpk != NULL) {
+        if (lost == true) {
+            uplink_spool_write(slot->rxpk, slot->rxpk_len); /* spool takes ownership */
+        } else {
+            free(slot->rxpk);
+        }
+        slot->rxpk = NULL;
+    }
+    slot->used = false;
+}
+
+/* reserve an in-flight slot with a token unique among the pending datagrams */
+static struct push_inflight_s *push_inflight_new(void)
+{
+    int i;
+    struct push_inflight_s *slot = NULL;
+    struct push_inflight_s *oldest = NULL;
+    bool unique;
+
+    for (i = 0; i < PUSH_INFLIGHT_MAX; i++) {
+        if (push_inflight[i].used == false) {
+            slot = &push_inflight[i];
+            break;
+        }
+        if ((oldest == NULL) || (difftimespec(push_inflight[i].send_time, oldest->send_time) < 0)) {
+            oldest = &push_inflight[i];
+        }
+    }
+
+    /* table is full, forget the oldest datagram */
+    if (slot == NULL) {
+        MSG("WARNING: [up] too many PUSH_DATA in flight, token[0x%02x:0x%02x] considered lost\n", oldest->token_h, oldest->token_l);
+        xSemaphoreTake(mx_meas_up, portMAX_DELAY);
+        meas_up_ack_lost += 1;
+        xSemaphoreGive(mx_meas_up);
+        push_inflight_free(oldest, true);
+        slot = oldest;
+    }
+
+    memset(slot, 0, sizeof *slot);
+    do {
+        slot->token_h = (uint8_t)rand(); /* random token */
+        slot->token_l = (uint8_t)rand(); /* random token */
+        unique = true;
+        for (i = 0; i < PUSH_INFLIGHT_MAX; i++) {
+            if ((&push_inflight[i] != slot) && (push_inflight[i].used == true) &&
+                    (push_inflight[i].token_h == slot->token_h) && (push_inflight[i].token_l == slot->token_l)) {
+                unique = false;
+                break;
+            }
+        }
+    } while (unique == false);
+    slot->used = true;
+
+    return slot;
+}
+
+/* credit a PUSH_ACK to the matching in-flight datagram, return false if none matches */
+static bool push_inflight_ack(uint8_t token_h, uint8_t token_l, struct timespec recv_time)
+{
+    int i;
+    uint32_t rtt_ms;
+
+    for (i = 0; i < PUSH_INFLIGHT_MAX; i++) {
+        if ((push_inflight[i].used == true) && (push_inflight[i].token_h == token_h) && (push_inflight[i].token_l == token_l)) {
+            break;
+        }
+    }
+    if (i == PUSH_INFLIGHT_MAX) {
+        return false;
+    }
+
+    rtt_ms = (uint32_t)(1000 * difftimespec(recv_time, push_inflight[i].send_time));
+    MSG("INFO: [up] PUSH_ACK received in %lu ms (token[0x%02x:0x%02x], %u packets, %lu bytes)\n", rtt_ms, token_h, token_l, push_inflight[i].nb_pkt, push_inflight[i].nb_byte);
+    xSemaphoreTake(mx_meas_up, portMAX_DELAY);
+    meas_up_ack_rcv += 1;
+    if (rtt_ms > (uint32_t)(push_timeout_half.tv_usec / 500)) {
+        meas_up_ack_late += 1;
+    }
+    meas_up_ack_rtt_sum += rtt_ms;
+    if (rtt_ms > meas_up_ack_rtt_max) {
+        meas_up_ack_rtt_max = rtt_ms;
+    }
+    xSemaphoreGive(mx_meas_up);
+    push_inflight_free(&push_inflight[i], false);
+
+    return true;
+}
+
+/* forget datagrams that were never acknowledged, return the number still waiting within the push time-out */
+static int push_inflight_expire(struct timespec now)
+{
+    int i;
+    int nb_waiting = 0;
+    double age;
+
+    for (i = 0; i < PUSH_INFLIGHT_MAX; i++) {
+        if (push_inflight[i].used == false) {
+            continue;
+        }
+        age = difftimespec(now, push_inflight[i].send_time);
+        if (age > (PUSH_ACK_LATE_MS / 1E3)) {
+            MSG("WARNING: [up] PUSH_ACK not received for token[0x%02x:0x%02x]\n", push_inflight[i].token_h, push_inflight[i].token_l);
+            xSemaphoreTake(mx_meas_up, portMAX_DELAY);
+            meas_up_ack_lost += 1;
+            xSemaphoreGive(mx_meas_up);
+            push_inflight_free(&push_inflight[i], true);
+        } else if (age <= ((double)push_timeout_half.tv_usec / 5E5)) {
+            nb_waiting += 1;
+        }
+    }
+
+    return nb_waiting;
+}
+
+/* check if a datagram has reached one of its batching limits, or cannot take one more packet */
+static bool batch_full(int buff_index, unsigned pkt_in_dgram)
+{
+    if ((pkt_in_dgram >= max_batch_pkts) || ((uint32_t)buff_index >= max_batch_bytes)) {
+        return true;
+    }
+    /* keep room for the largest packet, the end of the array and a status report */
+    return ((buff_index + 1 + RXPK_JSON_SIZE_MAX + 3 + STATUS_SIZE) > TX_BUFF_SIZE);
+}
+
+/* Fetch stage: only drains the concentrator into the uplink ring, so that the
+   SX1302 RX buffer never waits for the network */
 struct lgw_pkt_rx_s rxpkt[NB_PKT_MAX]; /* array containing inbound packets + metadata */
+struct lgw_pkt_rx_desc_s rxdesc[NB_PKT_MAX]; /* array of descriptors pointing into the HAL RX buffer */
+void thread_fetch(void)
+{
+    int nb_pkt;
+
+    while (!exit_sig && !quit_sig) {
+
+        /* fetch packets, payloads are copied straight into the ring when possible */
+        xSemaphoreTake(mx_concent, portMAX_DELAY);
+        if (ftime_enabled == false) {
+            nb_pkt = lgw_receive_desc(NB_PKT_MAX, rxdesc);
+            if (nb_pkt > 0) {
+                /* the descriptors are only valid until the next fetch */
+                uplink_ring_push_desc(&uplink_ring, rxdesc, nb_pkt);
+            }
+        } else {
+            nb_pkt = lgw_receive(NB_PKT_MAX, rxpkt);
+            if (nb_pkt > 0) {
+                uplink_ring_push(&uplink_ring, rxpkt, nb_pkt);
+            }
+        }
+        xSemaphoreGive(mx_concent);
+        if (nb_pkt == LGW_HAL_ERROR) {
+            MSG("ERROR: [fetch] failed packet fetch, exiting\n");
+            exit(EXIT_FAILURE);
+        }
+
+        /* wait a short time if no packets */
+        if (nb_pkt == 0) {
+            vTaskDelay(FETCH_SLEEP_MS / portTICK_PERIOD_MS);
+            continue;
+        }
+        vUplinkFlash(10);
+
+        /* hand the packets over to the network stage */
+        xTaskNotifyGive(pThreadUp);
+    }
+    MSG("\nINFO: End of fetch thread\n");
+}
+
+/* Network stage: serializes packets from the uplink ring, sends PUSH_DATA and
+   collects PUSH_ACK without blocking the fetch stage */
+uint8_t buff_up[TX_BUFF_SIZE]; /* buffer to compose the upstream packet */
 void thread_up(void)
 {
     int i, j, k; /* loop variables */
-    unsigned pkt_in_dgram; /* nb on Lora packet in the current datagram */
+    unsigned pkt_in_dgram = 0; /* nb on Lora packet in the current datagram */
     char stat_timestamp[24];
     time_t t;
 
-    /* allocate memory for packet fetching and processing */
+    /* packets waiting in the uplink ring */
+    struct lgw_pkt_rx_s *rxpkt_ring[NB_PKT_MAX]; /* packets to be processed, in forwarding order */
     struct lgw_pkt_rx_s *p; /* pointer on a RX packet */
     int nb_pkt;
 
@@ -2144,23 +2815,33 @@ void thread_up(void)
     struct tref local_ref; /* time reference used for UTC <-> timestamp conversion */
 
     /* data buffers */
-    int buff_index;
+    int buff_index = 0; /* 0 when no datagram is being composed */
+    int rxpk_end = 0; /* end of the rxpk array content in the datagram */
     uint8_t buff_ack[32]; /* buffer to receive acknowledges */
 
+    /* batching variables */
+    struct timespec batch_start = {0, 0}; /* time at which the first packet of the datagram was serialized */
+    uint32_t batch_age_ms = 0;
+    bool flush; /* send the datagram now, or wait for more packets */
+    uint32_t wait_ms;
+
+    /* spool replay variables */
+    bool ack_seen = false; /* at least one PUSH_ACK received since start */
+    struct timespec last_ack_time; /* time at which the latest PUSH_ACK was received */
+    struct timespec replay_time = {0, 0}; /* time at which the latest spooled datagram was replayed */
+    char *rec;
+    uint16_t rec_len;
+
     /* protocol variables */
-    uint8_t token_h; /* random token for acknowledgement matching */
-    uint8_t token_l; /* random token for acknowledgement matching */
+    struct push_inflight_s *inflight; /* in-flight slot of the datagram being composed */
+    int nb_ack_waiting = 0; /* nb of datagrams still expected to be acknowledged in time */
+    socklen_t socklen;
+    fd_set ack_fds; /* to wait for an acknowledge on the socket */
+    struct timeval ack_wait;
 
     /* ping measurement variables */
-    struct timespec send_time;
     struct timespec recv_time;
 
-    /* GPS synchronization variables */
-    struct timespec pkt_utc_time;
-    struct tm *x;  /* broken-up UTC time */
-    struct timespec pkt_gps_time;
-    uint64_t pkt_gps_time_ms;
-
     /* report management variable */
     bool send_report = false;
 
@@ -2168,13 +2849,6 @@ void thread_up(void)
     uint32_t mote_addr = 0;
     uint16_t mote_fcnt = 0;
 
-    /* set upstream socket RX timeout */
-    i = setsockopt(sock_up, SOL_SOCKET, SO_RCVTIMEO, (void *)&push_timeout_half, sizeof push_timeout_half);
-    if (i != 0) {
-        MSG("ERROR: [up] setsockopt returned %s\n", strerror(errno));
-        exit(EXIT_FAILURE);
-    }
-
     /* pre-fill the data buffer with fixed fields */
     buff_up[0] = PROTOCOL_VERSION;
     buff_up[3] = PKT_PUSH_DATA;
@@ -2183,27 +2857,95 @@ void thread_up(void)
 
     while (!exit_sig && !quit_sig) {
 
-        /* fetch packets */
-        xSemaphoreTake(mx_concent, portMAX_DELAY);
-        nb_pkt = lgw_receive(NB_PKT_MAX, rxpkt);
-        xSemaphoreGive(mx_concent);
-        if (nb_pkt == LGW_HAL_ERROR) {
-            MSG("ERROR: [up] failed packet fetch, exiting\n");
-            exit(EXIT_FAILURE);
+        /* collect acknowledges of datagrams in flight, without waiting for them */
+        while (true) {
+            socklen = sizeof(source_addr);
+            j = recvfrom(sock_up, (void *)buff_ack, sizeof buff_ack, MSG_DONTWAIT, (struct sockaddr *)&source_addr, &socklen);
+            if (j == -1) {
+                /* nothing more received (or server connection error) */
+                break;
+            }
+            clock_gettime(CLOCK_MONOTONIC, &recv_time);
+            if ((j < 4) || (buff_ack[0] != PROTOCOL_VERSION) || (buff_ack[3] != PKT_PUSH_ACK)) {
+                MSG("WARNING: [up] ignored invalid non-ACL packet\n");
+            } else if (push_inflight_ack(buff_ack[1], buff_ack[2], recv_time) == false) {
+                MSG("WARNING: [up] ignored ACK packet with unknown token, recv[0x%02x:0x%02x]\n", buff_ack[1], buff_ack[2]);
+            } else {
+                last_ack_time = recv_time;
+                ack_seen = true;
+                vBackhaulFlash( 10 );
+            }
+        }
+        clock_gettime(CLOCK_MONOTONIC, &recv_time);
+        nb_ack_waiting = push_inflight_expire(recv_time);
+
+        /* replay spooled packets at a limited rate, once the server acknowledges again */
+        if ((buff_index == 0) && (ack_seen == true) && (nb_ack_waiting < (PUSH_INFLIGHT_MAX / 2)) &&
+                (difftimespec(recv_time, last_ack_time) < (PUSH_ACK_LATE_MS / 1E3)) &&
+                (difftimespec(recv_time, replay_time) >= (spool_replay_ms / 1E3)) &&
+                ((rec = uplink_spool_take(&rec_len)) != NULL)) {
+            if ((12 + 9 + rec_len + 2) > TX_BUFF_SIZE) {
+                MSG("WARNING: [up] spooled record too large (%u bytes), dropped\n", rec_len);
+                free(rec);
+            } else {
+                inflight = push_inflight_new();
+                buff_up[1] = inflight->token_h;
+                buff_up[2] = inflight->token_l;
+                buff_index = 12; /* 12-byte header */
+                memcpy((void *)(buff_up + buff_index), (void *)"{\"rxpk\":[", 9);
+                buff_index += 9;
+                memcpy((void *)(buff_up + buff_index), (void *)rec, rec_len);
+                buff_index += rec_len;
+                buff_up[buff_index++] = ']';
+                buff_up[buff_index++] = '}';
+                sendto(sock_up, (void *)buff_up, buff_index, 0, (struct sockaddr *)&dest_addr, sizeof(dest_addr));
+                clock_gettime(CLOCK_MONOTONIC, &(inflight->send_time));
+                inflight->nb_byte = buff_index;
+                inflight->rxpk = rec; /* spooled again if not acknowledged */
+                inflight->rxpk_len = rec_len;
+                xSemaphoreTake(mx_meas_up, portMAX_DELAY);
+                meas_up_dgram_sent += 1;
+                meas_up_network_byte += buff_index;
+                xSemaphoreGive(mx_meas_up);
+                MSG("INFO: [up] spooled datagram replayed (%d bytes)\n", buff_index);
+                replay_time = recv_time;
+                buff_index = 0;
+                nb_ack_waiting += 1;
+            }
         }
 
+        /* get packets stored by the fetch stage */
+        nb_pkt = uplink_ring_peek(&uplink_ring, rxpkt_ring, NB_PKT_MAX);
+
         /* check if there are status report to send */
         send_report = report_ready; /* copy the variable so it doesn't change mid-function */
         /* no mutex, we're only reading */
 
-        /* wait a short time if no packets, nor status report */
-        if ((nb_pkt == 0) && (send_report == false)) {
-            //wait_ms(FETCH_SLEEP_MS);
-            vTaskDelay(FETCH_SLEEP_MS / portTICK_PERIOD_MS);
+        /* check how long the packets of the datagram being composed have waited */
+        if (pkt_in_dgram > 0) {
+            batch_age_ms = (uint32_t)(1000 * difftimespec(recv_time, batch_start));
+        }
+        flush = (pkt_in_dgram > 0) && (batch_age_ms >= max_batch_latency_ms);
+
+        /* wait for the fetch stage if no packets, nor status report, nor datagram to be sent */
+        if ((nb_pkt == 0) && (send_report == false) && (flush == false)) {
+            wait_ms = FETCH_SLEEP_MS;
+            if ((pkt_in_dgram > 0) && ((max_batch_latency_ms - batch_age_ms) < wait_ms)) {
+                wait_ms = max_batch_latency_ms - batch_age_ms;
+            }
+            if (nb_ack_waiting == 0) {
+                ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(wait_ms));
+            } else if (ulTaskNotifyTake(pdTRUE, 0) == 0) {
+                /* an acknowledge is expected: wait on the socket, so that its RTT is measured when it arrives,
+                   packets fetched meanwhile are picked up at the latest after wait_ms (the fetch stage cadence) */
+                FD_ZERO(&ack_fds);
+                FD_SET(sock_up, &ack_fds);
+                ack_wait.tv_sec = 0;
+                ack_wait.tv_usec = wait_ms * 1000;
+                select(sock_up + 1, &ack_fds, NULL, NULL, &ack_wait);
+            }
             continue;
         }
-        if (nb_pkt > 0)
-            vUplinkFlash(10);
 
         /* get a copy of GPS time reference (avoid 1 mutex per packet) */
         if ((nb_pkt > 0) && (gps_enabled == true)) {
@@ -2220,21 +2962,30 @@ void thread_up(void)
         strftime(stat_timestamp, sizeof stat_timestamp, "%F %T %Z", gmtime(&t));
         MSG_DEBUG(DEBUG_PKT_FWD, "\nCurrent time: %s \n", stat_timestamp);
 
-        /* start composing datagram with the header */
-        token_h = (uint8_t)rand(); /* random token */
-        token_l = (uint8_t)rand(); /* random token */
-        buff_up[1] = token_h;
-        buff_up[2] = token_l;
-        buff_index = 12; /* 12-byte header */
+        /* start composing datagram with the header (token is set when sending) */
+        if (buff_index == 0) {
+            buff_index = 12; /* 12-byte header */
 
-        /* start of JSON structure */
-        memcpy((void *)(buff_up + buff_index), (void *)"{\"rxpk\":[", 9);
-        buff_index += 9;
+            /* start of JSON structure */
+            memcpy((void *)(buff_up + buff_index), (void *)"{\"rxpk\":[", 9);
+            buff_index += 9;
+            pkt_in_dgram = 0;
+        }
+
+        /* without batching, packets of each fetch cycle are sent right away */
+        if ((max_batch_latency_ms == 0) || (send_report == true)) {
+            flush = true;
+        }
 
         /* serialize Lora packets metadata and payload */
-        pkt_in_dgram = 0;
         for (i = 0; i < nb_pkt; ++i) {
-            p = &rxpkt[i];
+            p = rxpkt_ring[i];
+
+            /* remaining packets stay in the ring for the next datagram */
+            if (batch_full(buff_index, pkt_in_dgram) == true) {
+                flush = true;
+                break;
+            }
 
             /* Get mote information from current packet (addr, fcnt) */
             /* FHDR - DevAddr */
@@ -2282,272 +3033,46 @@ void thread_up(void)
                 continue; /* skip that packet */
                 // exit(EXIT_FAILURE);
             }
-            meas_up_pkt_fwd += 1;
-            meas_up_payload_byte += p->size;
             xSemaphoreGive(mx_meas_up);
-            printf( "\nINFO: Received pkt from mote: %08lX (fcnt=%u)\n", mote_addr, mote_fcnt );
-
-            /* Start of packet, add inter-packet separator if necessary */
-            if (pkt_in_dgram == 0) {
-                buff_up[buff_index] = '{';
-                ++buff_index;
-            } else {
-                buff_up[buff_index] = ',';
-                buff_up[buff_index + 1] = '{';
-                buff_index += 2;
-            }
-
-            /* JSON rxpk frame format version, 8 useful chars */
-            j = snprintf((char *)(buff_up + buff_index), TX_BUFF_SIZE - buff_index, "\"jver\":%d", PROTOCOL_JSON_RXPK_FRAME_FORMAT );
-            if (j > 0) {
-                buff_index += j;
-            } else {
-                MSG("ERROR: [up] snprintf failed line %d\n", (__LINE__ - 4));
-                exit(EXIT_FAILURE);
-            }
-
-            /* RAW timestamp, 8-17 useful chars */
-            j = snprintf((char *)(buff_up + buff_index), TX_BUFF_SIZE - buff_index, ",\"tmst\":%lu", p->count_us);
-            if (j > 0) {
-                buff_index += j;
-            } else {
-                MSG("ERROR: [up] snprintf failed line %d\n", (__LINE__ - 4));
-                exit(EXIT_FAILURE);
-            }
-
-            /* Packet RX time (GPS based), 37 useful chars */
-            if (ref_ok == true) {
-                /* convert packet timestamp to UTC absolute time */
-                j = lgw_cnt2utc(local_ref, p->count_us, &pkt_utc_time);
-                if (j == LGW_GPS_SUCCESS) {
-                    /* split the UNIX timestamp to its calendar components */
-                    x = gmtime(&(pkt_utc_time.tv_sec));
-                    j = snprintf((char *)(buff_up + buff_index), TX_BUFF_SIZE - buff_index, ",\"time\":\"%04i-%02i-%02iT%02i:%02i:%02i.%06liZ\"", (x->tm_year) + 1900, (x->tm_mon) + 1, x->tm_mday, x->tm_hour, x->tm_min, x->tm_sec, (pkt_utc_time.tv_nsec) / 1000); /* ISO 8601 format */
-                    if (j > 0) {
-                        buff_index += j;
-                    } else {
-                        MSG("ERROR: [up] snprintf failed line %d\n", (__LINE__ - 4));
-                        exit(EXIT_FAILURE);
-                    }
-                }
-                /* convert packet timestamp to GPS absolute time */
-                j = lgw_cnt2gps(local_ref, p->count_us, &pkt_gps_time);
-                if (j == LGW_GPS_SUCCESS) {
-                    pkt_gps_time_ms = pkt_gps_time.tv_sec * 1E3 + pkt_gps_time.tv_nsec / 1E6;
-                    j = snprintf((char *)(buff_up + buff_index), TX_BUFF_SIZE - buff_index, ",\"tmms\":%" PRIu64 "", pkt_gps_time_ms); /* GPS time in milliseconds since 06.Jan.1980 */
-                    if (j > 0) {
-                        buff_index += j;
-                    } else {
-                        MSG("ERROR: [up] snprintf failed line %d\n", (__LINE__ - 4));
-                        exit(EXIT_FAILURE);
-                    }
-                }
-            }
 
-            /* Fine timestamp */
-            if (p->ftime_received == true) {
-                j = snprintf((char *)(buff_up + buff_index), TX_BUFF_SIZE - buff_index, ",\"ftime\":%lu", p->ftime);
-                if (j > 0) {
-                    buff_index += j;
-                } else {
-                    MSG("ERROR: [up] snprintf failed line %d\n", (__LINE__ - 4));
-                    exit(EXIT_FAILURE);
-                }
-            }
-
-            /* Packet concentrator channel, RF chain & RX frequency, 34-36 useful chars */
-            j = snprintf((char *)(buff_up + buff_index), TX_BUFF_SIZE - buff_index, ",\"chan\":%1u,\"rfch\":%1u,\"freq\":%.6lf,\"mid\":%2u", p->if_chain, p->rf_chain, ((double)p->freq_hz / 1e6), p->modem_id);
-            if (j > 0) {
-                buff_index += j;
-            } else {
-                MSG("ERROR: [up] snprintf failed line %d\n", (__LINE__ - 4));
-                exit(EXIT_FAILURE);
+            /* skip packets of foreign networks, before paying for their serialization (the filter has its own lock) */
+            if ((p->modulation == MOD_LORA) && (uplink_filter_check(&uplink_filter, p->payload, p->size) == false)) {
+                continue;
             }
-
-            /* Packet status, 9-10 useful chars */
-            switch (p->status) {
-            case STAT_CRC_OK:
-                memcpy((void *)(buff_up + buff_index), (void *)",\"stat\":1", 9);
-                buff_index += 9;
-                break;
-            case STAT_CRC_BAD:
-                memcpy((void *)(buff_up + buff_index), (void *)",\"stat\":-1", 10);
-                buff_index += 10;
-                break;
-            case STAT_NO_CRC:
-                memcpy((void *)(buff_up + buff_index), (void *)",\"stat\":0", 9);
-                buff_index += 9;
-                break;
-            default:
-                MSG("ERROR: [up] received packet with unknown status 0x%02X\n", p->status);
-                memcpy((void *)(buff_up + buff_index), (void *)",\"stat\":?", 9);
-                buff_index += 9;
-                exit(EXIT_FAILURE);
+            /* skip copies of a frame already forwarded (e.g. heard on an adjacent channel, the table has its own lock) */
+            if ((dedup_window_ms > 0) && (p->modulation == MOD_LORA) && (p->status == STAT_CRC_OK) && (uplink_dedup_check(&uplink_dedup, p->payload, p->size, p->count_us) == true)) {
+                continue;
             }
 
-            /* Packet modulation, 13-14 useful chars */
-            if (p->modulation == MOD_LORA) {
-                memcpy((void *)(buff_up + buff_index), (void *)",\"modu\":\"LORA\"", 14);
-                buff_index += 14;
-
-                /* Lora datarate & bandwidth, 16-19 useful chars */
-                switch (p->datarate) {
-                case DR_LORA_SF5:
-                    memcpy((void *)(buff_up + buff_index), (void *)",\"datr\":\"SF5", 12);
-                    buff_index += 12;
-                    break;
-                case DR_LORA_SF6:
-                    memcpy((void *)(buff_up + buff_index), (void *)",\"datr\":\"SF6", 12);
-                    buff_index += 12;
-                    break;
-                case DR_LORA_SF7:
-                    memcpy((void *)(buff_up + buff_index), (void *)",\"datr\":\"SF7", 12);
-                    buff_index += 12;
-                    break;
-                case DR_LORA_SF8:
-                    memcpy((void *)(buff_up + buff_index), (void *)",\"datr\":\"SF8", 12);
-                    buff_index += 12;
-                    break;
-                case DR_LORA_SF9:
-                    memcpy((void *)(buff_up + buff_index), (void *)",\"datr\":\"SF9", 12);
-                    buff_index += 12;
-                    break;
-                case DR_LORA_SF10:
-                    memcpy((void *)(buff_up + buff_index), (void *)",\"datr\":\"SF10", 13);
-                    buff_index += 13;
-                    break;
-                case DR_LORA_SF11:
-                    memcpy((void *)(buff_up + buff_index), (void *)",\"datr\":\"SF11", 13);
-                    buff_index += 13;
-                    break;
-                case DR_LORA_SF12:
-                    memcpy((void *)(buff_up + buff_index), (void *)",\"datr\":\"SF12", 13);
-                    buff_index += 13;
-                    break;
-                default:
-                    MSG("ERROR: [up] lora packet with unknown datarate 0x%02X\n", (uint16_t)p->datarate);
-                    memcpy((void *)(buff_up + buff_index), (void *)",\"datr\":\"SF?", 12);
-                    buff_index += 12;
-                    exit(EXIT_FAILURE);
-                }
-                switch (p->bandwidth) {
-                case BW_125KHZ:
-                    memcpy((void *)(buff_up + buff_index), (void *)"BW125\"", 6);
-                    buff_index += 6;
-                    break;
-                case BW_250KHZ:
-                    memcpy((void *)(buff_up + buff_index), (void *)"BW250\"", 6);
-                    buff_index += 6;
-                    break;
-                case BW_500KHZ:
-                    memcpy((void *)(buff_up + buff_index), (void *)"BW500\"", 6);
-                    buff_index += 6;
-                    break;
-                default:
-                    MSG("ERROR: [up] lora packet with unknown bandwidth 0x%02X\n", p->bandwidth);
-                    memcpy((void *)(buff_up + buff_index), (void *)"BW?\"", 4);
-                    buff_index += 4;
-                    exit(EXIT_FAILURE);
-                }
-
-                /* Packet ECC coding rate, 11-13 useful chars */
-                switch (p->coderate) {
-                case CR_LORA_4_5:
-                    memcpy((void *)(buff_up + buff_index), (void *)",\"codr\":\"4/5\"", 13);
-                    buff_index += 13;
-                    break;
-                case CR_LORA_4_6:
-                    memcpy((void *)(buff_up + buff_index), (void *)",\"codr\":\"4/6\"", 13);
-                    buff_index += 13;
-                    break;
-                case CR_LORA_4_7:
-                    memcpy((void *)(buff_up + buff_index), (void *)",\"codr\":\"4/7\"", 13);
-                    buff_index += 13;
-                    break;
-                case CR_LORA_4_8:
-                    memcpy((void *)(buff_up + buff_index), (void *)",\"codr\":\"4/8\"", 13);
-                    buff_index += 13;
-                    break;
-                case 0: /* treat the CR0 case (mostly false sync) */
-                    memcpy((void *)(buff_up + buff_index), (void *)",\"codr\":\"OFF\"", 13);
-                    buff_index += 13;
-                    break;
-                default:
-                    MSG("ERROR: [up] lora packet with unknown coderate 0x%02X\n", p->coderate);
-                    memcpy((void *)(buff_up + buff_index), (void *)",\"codr\":\"?\"", 11);
-                    buff_index += 11;
-                    exit(EXIT_FAILURE);
-                }
-
-                /* Signal RSSI, payload size */
-                j = snprintf((char *)(buff_up + buff_index), TX_BUFF_SIZE - buff_index, ",\"rssis\":%.0f", roundf(p->rssis));
-                if (j > 0) {
-                    buff_index += j;
-                } else {
-                    MSG("ERROR: [up] snprintf failed line %d\n", (__LINE__ - 4));
-                    exit(EXIT_FAILURE);
-                }
-
-                /* Lora SNR */
-                j = snprintf((char *)(buff_up + buff_index), TX_BUFF_SIZE - buff_index, ",\"lsnr\":%.1f", p->snr);
-                if (j > 0) {
-                    buff_index += j;
-                } else {
-                    MSG("ERROR: [up] snprintf failed line %d\n", (__LINE__ - 4));
-                    exit(EXIT_FAILURE);
-                }
-
-                /* Lora frequency offset */
-                j = snprintf((char *)(buff_up + buff_index), TX_BUFF_SIZE - buff_index, ",\"foff\":%ld", p->freq_offset);
-                if (j > 0) {
-                    buff_index += j;
-                } else {
-                    MSG("ERROR: [up] snprintf failed line %d\n", (__LINE__ - 4));
-                    exit(EXIT_FAILURE);
-                }
-            } else if (p->modulation == MOD_FSK) {
-                memcpy((void *)(buff_up + buff_index), (void *)",\"modu\":\"FSK\"", 13);
-                buff_index += 13;
+            xSemaphoreTake(mx_meas_up, portMAX_DELAY);
+            meas_up_pkt_fwd += 1;
+            meas_up_payload_byte += p->size;
+            xSemaphoreGive(mx_meas_up);
+            printf( "\nINFO: Received pkt from mote: %08lX (fcnt=%u)\n", mote_addr, mote_fcnt );
 
-                /* FSK datarate, 11-14 useful chars */
-                j = snprintf((char *)(buff_up + buff_index), TX_BUFF_SIZE - buff_index, ",\"datr\":%lu", p->datarate);
-                if (j > 0) {
-                    buff_index += j;
-                } else {
-                    MSG("ERROR: [up] snprintf failed line %d\n", (__LINE__ - 4));
-                    exit(EXIT_FAILURE);
-                }
-            } else {
-                MSG("ERROR: [up] received packet with unknown modulation 0x%02X\n", p->modulation);
-                exit(EXIT_FAILURE);
+            /* add inter-packet separator if necessary */
+            if (pkt_in_dgram > 0) {
+                buff_up[buff_index] = ',';
+                ++buff_index;
             }
 
-            /* Channel RSSI, payload size, 18-23 useful chars */
-            j = snprintf((char *)(buff_up + buff_index), TX_BUFF_SIZE - buff_index, ",\"rssi\":%.0f,\"size\":%u", roundf(p->rssic), p->size);
+            /* serialize packet metadata and payload, with GPS time if available */
+            j = rxpk_encode(p, (ref_ok == true) ? &local_ref : NULL, (char *)(buff_up + buff_index), TX_BUFF_SIZE - buff_index);
             if (j > 0) {
                 buff_index += j;
             } else {
-                MSG("ERROR: [up] snprintf failed line %d\n", (__LINE__ - 4));
+                MSG("ERROR: [up] rxpk_encode failed line %d\n", (__LINE__ - 4));
                 exit(EXIT_FAILURE);
             }
-
-            /* Packet base64-encoded payload, 14-350 useful chars */
-            memcpy((void *)(buff_up + buff_index), (void *)",\"data\":\"", 9);
-            buff_index += 9;
-            j = bin_to_b64(p->payload, p->size, (char *)(buff_up + buff_index), 341); /* 255 bytes = 340 chars in b64 + null char */
-            if (j >= 0) {
-                buff_index += j;
-            } else {
-                MSG("ERROR: [up] bin_to_b64 failed line %d\n", (__LINE__ - 5));
-                exit(EXIT_FAILURE);
+            if (pkt_in_dgram == 0) {
+                batch_start = recv_time;
+                batch_age_ms = 0;
             }
-            buff_up[buff_index] = '"';
-            ++buff_index;
-
-            /* End of packet serialization */
-            buff_up[buff_index] = '}';
-            ++buff_index;
             ++pkt_in_dgram;
+            /* join-requests and rejoin-requests are not delayed, their join-accept window is short */
+            if (uplink_ring_class(p) == UPLINK_CLASS_JOIN) {
+                flush = true;
+            }
 
             if (p->modulation == MOD_LORA) {
                 /* Log nb of packets per channel, per SF */
@@ -2590,6 +3115,12 @@ void thread_up(void)
             }
         }
 
+        /* packets are serialized, give their slots back to the fetch stage */
+        uplink_ring_release(&uplink_ring, i);
+        if (batch_full(buff_index, pkt_in_dgram) == true) {
+            flush = true;
+        }
+
         /* restart fetch sequence without sending empty JSON if all packets have been filtered out */
         if (pkt_in_dgram == 0) {
             if (send_report == true) {
@@ -2597,10 +3128,15 @@ void thread_up(void)
                 buff_index -= 8; /* removes "rxpk":[ */
             } else {
                 /* all packet have been filtered out and no report, restart loop */
+                buff_index = 0;
                 continue;
             }
+        } else if (flush == false) {
+            /* wait for more packets to share this datagram */
+            continue;
         } else {
             /* end of packet array */
+            rxpk_end = buff_index;
             buff_up[buff_index] = ']';
             ++buff_index;
             /* add separator if needed */
@@ -2632,40 +3168,36 @@ void thread_up(void)
         printf("\nJSON up: %s\n", (char *)(buff_up + 12)); /* DEBUG: display JSON payload */
 
         /* send datagram to server */
+        inflight = push_inflight_new();
+        buff_up[1] = inflight->token_h;
+        buff_up[2] = inflight->token_l;
         //send(sock_up, (void *)buff_up, buff_index, 0);
         sendto(sock_up, (void *)buff_up, buff_index, 0, (struct sockaddr *)&dest_addr, sizeof(dest_addr));
-        clock_gettime(CLOCK_MONOTONIC, &send_time);
+        clock_gettime(CLOCK_MONOTONIC, &(inflight->send_time));
+        inflight->nb_byte = buff_index;
+        inflight->nb_pkt = pkt_in_dgram;
+        if ((pkt_in_dgram > 0) && (uplink_spool_enabled() == true)) {
+            /* keep the packets, in case the datagram is never acknowledged */
+            inflight->rxpk_len = rxpk_end - (12 + 9);
+            inflight->rxpk = malloc(inflight->rxpk_len);
+            if (inflight->rxpk != NULL) {
+                memcpy(inflight->rxpk, buff_up + 12 + 9, inflight->rxpk_len);
+            }
+        }
         xSemaphoreTake(mx_meas_up, portMAX_DELAY);
         meas_up_dgram_sent += 1;
-        meas_up_network_byte += buff_index;
-
-        /* wait for acknowledge (in 2 times, to catch extra packets) */
-        socklen_t socklen = sizeof(source_addr);
-        for (i = 0; i < 2; ++i) {
-            //j = recv(sock_up, (void *)buff_ack, sizeof buff_ack, 0);
-            j = recvfrom(sock_up, (void *)buff_ack, sizeof buff_ack, 0, (struct sockaddr *)&dest_addr, &socklen);
-            clock_gettime(CLOCK_MONOTONIC, &recv_time);
-            if (j == -1) {
-                if (errno == EAGAIN) { /* timeout */
-                    continue;
-                } else { /* server connection error */
-                    break;
-                }
-            } else if ((j < 4) || (buff_ack[0] != PROTOCOL_VERSION) || (buff_ack[3] != PKT_PUSH_ACK)) {
-                MSG("WARNING: [up] ignored invalid non-ACL packet\n");
-                continue;
-            } else if ((buff_ack[1] != token_h) || (buff_ack[2] != token_l)) {
-                MSG("WARNING: [up] ignored out-of sync ACK packet,token[0x%02x:0x%02x],recv[0x%02x:0x%02x]\n",
-                    token_h, token_l, buff_ack[1], buff_ack[2]);
-                continue;
-            } else {
-                MSG("INFO: [up] PUSH_ACK received in %i ms\n", (int)(1000 * difftimespec(recv_time, send_time)));
-                meas_up_ack_rcv += 1;
-                vBackhaulFlash( 10 );
-                break;
-            }
+        if (pkt_in_dgram > 0) {
+            meas_up_dgram_rxpk += 1;
         }
+        meas_up_network_byte += buff_index;
         xSemaphoreGive(mx_meas_up);
+
+        /* next packets go in a new datagram */
+        buff_index = 0;
+        pkt_in_dgram = 0;
+
+        /* acknowledge will be collected on next iterations, other datagrams can be sent meanwhile */
+        nb_ack_waiting += 1;
     }
     MSG("\nINFO: End of upstream thread\n");
 }
@@ -2713,6 +3245,22 @@ static int get_tx_gain_lut_index(uint8_t rf_chain, int8_t rf_power, uint8_t *lut
     return 0;
 }
 
+/* check if a downlink can be sent as is on an RF chain: TX enabled, frequency and power supported */
+static bool tx_chain_supports(uint8_t rf_chain, const struct lgw_pkt_tx_s *pkt)
+{
+    int i;
+
+    if ((tx_enable[rf_chain] == false) || (pkt->freq_hz < tx_freq_min[rf_chain]) || (pkt->freq_hz > tx_freq_max[rf_chain])) {
+        return false;
+    }
+    for (i = 0; i < txlut[rf_chain].size; i++) {
+        if (txlut[rf_chain].lut[i].rf_power == pkt->rf_power) {
+            return true;
+        }
+    }
+    return false;
+}
+
 uint8_t buff_down[1000]; /* buffer to receive downstream packets */
 void thread_down(void)
 {
@@ -2720,7 +3268,7 @@ void thread_down(void)
 
     /* configuration and metadata for an outbound packet */
     struct lgw_pkt_tx_s txpkt;
-    bool sent_immediate = false; /* option to sent the packet immediately */
+    struct txpk_info_s txpk_info; /* scheduling of the packet */
 
     /* local timekeeping variables */
     struct timespec send_time; /* time of the pull request */
@@ -2735,13 +3283,7 @@ void thread_down(void)
     uint8_t token_l; /* random token for acknowledgement matching */
     bool req_ack = false; /* keep track of whether PULL_DATA was acknowledged or not */
 
-    /* JSON parsing variables */
-    JSON_Value *root_val = NULL;
-    JSON_Object *txpk_obj = NULL;
-    JSON_Value *val = NULL; /* needed to detect the absence of some fields */
-    const char *str; /* pointer to sub-strings in the JSON data */
-    short x0, x1;
-    uint64_t x2;
+    /* GPS time conversion variables */
     double x3, x4;
 
     /* variables to send on GPS timestamp */
@@ -2774,6 +3316,7 @@ void thread_down(void)
     enum jit_pkt_type_e downlink_type;
     enum jit_error_e warning_result = JIT_ERROR_OK;
     int32_t warning_value = 0;
+    struct downlink_req_s downlink_req;
     uint8_t tx_lut_idx = 0;
 
     /* set downstream socket RX timeout */
@@ -2987,9 +3530,7 @@ void thread_down(void)
                     beacon_pkt.payload[beacon_pyld_idx++] = 0xFF & (field_crc1 >> 8);
 
                     /* Insert beacon packet in JiT queue */
-                    xSemaphoreTake(mx_concent, portMAX_DELAY);
-                    lgw_get_instcnt(&current_concentrator_time);
-                    xSemaphoreGive(mx_concent);
+                    current_concentrator_time = get_concentrator_time();
                     jit_result = jit_enqueue(&jit_queue[0], current_concentrator_time, &beacon_pkt, JIT_PKT_TYPE_BEACON);
                     if (jit_result == JIT_ERROR_OK) {
                         /* update stats */
@@ -3069,289 +3610,69 @@ void thread_down(void)
             MSG("INFO: [down] PULL_RESP received  - token[%d:%d] :)\n", buff_down[1], buff_down[2]); /* very verbose */
             printf("\nJSON down: %s\n", (char *)(buff_down + 4)); /* DEBUG: display JSON payload */
 
-            /* initialize TX struct and try to parse JSON */
-            memset(&txpkt, 0, sizeof txpkt);
-            root_val = json_parse_string_with_comments((const char *)(buff_down + 4)); /* JSON offset */
-            if (root_val == NULL) {
-                MSG("WARNING: [down] invalid JSON, TX aborted\n");
-                continue;
-            }
-
-            /* look for JSON sub-object 'txpk' */
-            txpk_obj = json_object_get_object(json_value_get_object(root_val), "txpk");
-            if (txpk_obj == NULL) {
-                MSG("WARNING: [down] no \"txpk\" object in JSON, TX aborted\n");
-                json_value_free(root_val);
+            /* decode the txpk object into the TX struct */
+            if (txpk_decode((const char *)(buff_down + 4), &txpkt, &txpk_info) != 0) { /* JSON offset */
                 continue;
             }
 
-            /* Parse "immediate" tag, or target timestamp, or UTC time to be converted by GPS (mandatory) */
-            i = json_object_get_boolean(txpk_obj, "imme"); /* can be 1 if true, 0 if false, or -1 if not a JSON boolean */
-            if (i == 1) {
+            /* select the JIT downlink type from the timing given by the server */
+            if (txpk_info.timing == TXPK_TIMING_IMMEDIATE) {
                 /* TX procedure: send immediately */
-                sent_immediate = true;
                 downlink_type = JIT_PKT_TYPE_DOWNLINK_CLASS_C;
                 MSG("INFO: [down] a packet will be sent in \"immediate\" mode\n");
+            } else if (txpk_info.timing == TXPK_TIMING_TIMESTAMP) {
+                /* Concentrator timestamp is given, we consider it is a Class A downlink */
+                downlink_type = JIT_PKT_TYPE_DOWNLINK_CLASS_A;
             } else {
-                sent_immediate = false;
-                val = json_object_get_value(txpk_obj, "tmst");
-                if (val != NULL) {
-                    /* TX procedure: send on timestamp value */
-                    txpkt.count_us = (uint32_t)json_value_get_number(val);
-
-                    /* Concentrator timestamp is given, we consider it is a Class A downlink */
-                    downlink_type = JIT_PKT_TYPE_DOWNLINK_CLASS_A;
-                } else {
-                    /* TX procedure: send on GPS time (converted to timestamp value) */
-                    val = json_object_get_value(txpk_obj, "tmms");
-                    if (val == NULL) {
-                        MSG("WARNING: [down] no mandatory \"txpk.tmst\" or \"txpk.tmms\" objects in JSON, TX aborted\n");
-                        json_value_free(root_val);
-                        continue;
-                    }
-                    if (gps_enabled == true) {
-                        xSemaphoreTake(mx_timeref, portMAX_DELAY);
-                        if (gps_ref_valid == true) {
-                            local_ref = time_reference_gps;
-                            xSemaphoreGive(mx_timeref);
-                        } else {
-                            xSemaphoreGive(mx_timeref);
-                            MSG("WARNING: [down] no valid GPS time reference yet, impossible to send packet on specific GPS time, TX aborted\n");
-                            json_value_free(root_val);
-
-                            /* send acknoledge datagram to server */
-                            send_tx_ack(buff_down[1], buff_down[2], JIT_ERROR_GPS_UNLOCKED, 0);
-                            continue;
-                        }
+                /* TX procedure: send on GPS time (converted to timestamp value) */
+                if (gps_enabled == true) {
+                    xSemaphoreTake(mx_timeref, portMAX_DELAY);
+                    if (gps_ref_valid == true) {
+                        local_ref = time_reference_gps;
+                        xSemaphoreGive(mx_timeref);
                     } else {
-                        MSG("WARNING: [down] GPS disabled, impossible to send packet on specific GPS time, TX aborted\n");
-                        json_value_free(root_val);
+                        xSemaphoreGive(mx_timeref);
+                        MSG("WARNING: [down] no valid GPS time reference yet, impossible to send packet on specific GPS time, TX aborted\n");
 
                         /* send acknoledge datagram to server */
-                        send_tx_ack(buff_down[1], buff_down[2], JIT_ERROR_GPS_UNLOCKED, 0);
-                        continue;
-                    }
-
-                    /* Get GPS time from JSON */
-                    x2 = (uint64_t)json_value_get_number(val);
-
-                    /* Convert GPS time from milliseconds to timespec */
-                    x3 = modf((double)x2 / 1E3, &x4);
-                    gps_tx.tv_sec = (time_t)x4; /* get seconds from integer part */
-                    gps_tx.tv_nsec = (long)(x3 * 1E9); /* get nanoseconds from fractional part */
-
-                    /* transform GPS time to timestamp */
-                    i = lgw_gps2cnt(local_ref, gps_tx, &(txpkt.count_us));
-                    if (i != LGW_GPS_SUCCESS) {
-                        MSG("WARNING: [down] could not convert GPS time to timestamp, TX aborted\n");
-                        json_value_free(root_val);
+                        send_tx_ack(buff_down[1], buff_down[2], JIT_ERROR_GPS_UNLOCKED, 0, -1);
                         continue;
-                    } else {
-                        MSG("INFO: [down] a packet will be sent on timestamp value %lu (calculated from GPS time)\n", txpkt.count_us);
-                    }
-
-                    /* GPS timestamp is given, we consider it is a Class B downlink */
-                    downlink_type = JIT_PKT_TYPE_DOWNLINK_CLASS_B;
-                }
-            }
-
-            /* Parse "No CRC" flag (optional field) */
-            val = json_object_get_value(txpk_obj, "ncrc");
-            if (val != NULL) {
-                txpkt.no_crc = (bool)json_value_get_boolean(val);
-            }
-
-            /* Parse "No header" flag (optional field) */
-            val = json_object_get_value(txpk_obj, "nhdr");
-            if (val != NULL) {
-                txpkt.no_header = (bool)json_value_get_boolean(val);
-            }
-
-            /* parse target frequency (mandatory) */
-            val = json_object_get_value(txpk_obj, "freq");
-            if (val == NULL) {
-                MSG("WARNING: [down] no mandatory \"txpk.freq\" object in JSON, TX aborted\n");
-                json_value_free(root_val);
-                continue;
-            }
-            txpkt.freq_hz = (uint32_t)((double)(1.0e6) * json_value_get_number(val));
-
-            /* parse RF chain used for TX (mandatory) */
-            val = json_object_get_value(txpk_obj, "rfch");
-            if (val == NULL) {
-                MSG("WARNING: [down] no mandatory \"txpk.rfch\" object in JSON, TX aborted\n");
-                json_value_free(root_val);
-                continue;
-            }
-            txpkt.rf_chain = (uint8_t)json_value_get_number(val);
-            if (tx_enable[txpkt.rf_chain] == false) {
-                MSG("WARNING: [down] TX is not enabled on RF chain %u, TX aborted\n", txpkt.rf_chain);
-                json_value_free(root_val);
-                continue;
-            }
-
-            /* parse TX power (optional field) */
-            val = json_object_get_value(txpk_obj, "powe");
-            if (val != NULL) {
-                txpkt.rf_power = (int8_t)json_value_get_number(val) - antenna_gain;
-            }
-
-            /* Parse modulation (mandatory) */
-            str = json_object_get_string(txpk_obj, "modu");
-            if (str == NULL) {
-                MSG("WARNING: [down] no mandatory \"txpk.modu\" object in JSON, TX aborted\n");
-                json_value_free(root_val);
-                continue;
-            }
-            if (strcmp(str, "LORA") == 0) {
-                /* Lora modulation */
-                txpkt.modulation = MOD_LORA;
-
-                /* Parse Lora spreading-factor and modulation bandwidth (mandatory) */
-                str = json_object_get_string(txpk_obj, "datr");
-                if (str == NULL) {
-                    MSG("WARNING: [down] no mandatory \"txpk.datr\" object in JSON, TX aborted\n");
-                    json_value_free(root_val);
-                    continue;
-                }
-                i = sscanf(str, "SF%2hdBW%3hd", &x0, &x1);
-                if (i != 2) {
-                    MSG("WARNING: [down] format error in \"txpk.datr\", TX aborted\n");
-                    json_value_free(root_val);
-                    continue;
-                }
-                switch (x0) {
-                case  5: txpkt.datarate = DR_LORA_SF5;  break;
-                case  6: txpkt.datarate = DR_LORA_SF6;  break;
-                case  7: txpkt.datarate = DR_LORA_SF7;  break;
-                case  8: txpkt.datarate = DR_LORA_SF8;  break;
-                case  9: txpkt.datarate = DR_LORA_SF9;  break;
-                case 10: txpkt.datarate = DR_LORA_SF10; break;
-                case 11: txpkt.datarate = DR_LORA_SF11; break;
-                case 12: txpkt.datarate = DR_LORA_SF12; break;
-                default:
-                    MSG("WARNING: [down] format error in \"txpk.datr\", invalid SF, TX aborted\n");
-                    json_value_free(root_val);
-                    continue;
-                }
-                switch (x1) {
-                case 125: txpkt.bandwidth = BW_125KHZ; break;
-                case 250: txpkt.bandwidth = BW_250KHZ; break;
-                case 500: txpkt.bandwidth = BW_500KHZ; break;
-                default:
-                    MSG("WARNING: [down] format error in \"txpk.datr\", invalid BW, TX aborted\n");
-                    json_value_free(root_val);
-                    continue;
-                }
-
-                /* Parse ECC coding rate (optional field) */
-                str = json_object_get_string(txpk_obj, "codr");
-                if (str == NULL) {
-                    MSG("WARNING: [down] no mandatory \"txpk.codr\" object in json, TX aborted\n");
-                    json_value_free(root_val);
-                    continue;
-                }
-                if      (strcmp(str, "4/5") == 0) txpkt.coderate = CR_LORA_4_5;
-                else if (strcmp(str, "4/6") == 0) txpkt.coderate = CR_LORA_4_6;
-                else if (strcmp(str, "2/3") == 0) txpkt.coderate = CR_LORA_4_6;
-                else if (strcmp(str, "4/7") == 0) txpkt.coderate = CR_LORA_4_7;
-                else if (strcmp(str, "4/8") == 0) txpkt.coderate = CR_LORA_4_8;
-                else if (strcmp(str, "1/2") == 0) txpkt.coderate = CR_LORA_4_8;
-                else {
-                    MSG("WARNING: [down] format error in \"txpk.codr\", TX aborted\n");
-                    json_value_free(root_val);
-                    continue;
-                }
-
-                /* Parse signal polarity switch (optional field) */
-                val = json_object_get_value(txpk_obj, "ipol");
-                if (val != NULL) {
-                    txpkt.invert_pol = (bool)json_value_get_boolean(val);
-                }
-
-                /* parse Lora preamble length (optional field, optimum min value enforced) */
-                val = json_object_get_value(txpk_obj, "prea");
-                if (val != NULL) {
-                    i = (int)json_value_get_number(val);
-                    if (i >= MIN_LORA_PREAMB) {
-                        txpkt.preamble = (uint16_t)i;
-                    } else {
-                        txpkt.preamble = (uint16_t)MIN_LORA_PREAMB;
                     }
                 } else {
-                    txpkt.preamble = (uint16_t)STD_LORA_PREAMB;
-                }
-
-            } else if (strcmp(str, "FSK") == 0) {
-                /* FSK modulation */
-                txpkt.modulation = MOD_FSK;
+                    MSG("WARNING: [down] GPS disabled, impossible to send packet on specific GPS time, TX aborted\n");
 
-                /* parse FSK bitrate (mandatory) */
-                val = json_object_get_value(txpk_obj, "datr");
-                if (val == NULL) {
-                    MSG("WARNING: [down] no mandatory \"txpk.datr\" object in JSON, TX aborted\n");
-                    json_value_free(root_val);
+                    /* send acknoledge datagram to server */
+                    send_tx_ack(buff_down[1], buff_down[2], JIT_ERROR_GPS_UNLOCKED, 0, -1);
                     continue;
                 }
-                txpkt.datarate = (uint32_t)(json_value_get_number(val));
 
-                /* parse frequency deviation (mandatory) */
-                val = json_object_get_value(txpk_obj, "fdev");
-                if (val == NULL) {
-                    MSG("WARNING: [down] no mandatory \"txpk.fdev\" object in JSON, TX aborted\n");
-                    json_value_free(root_val);
+                /* Convert GPS time from milliseconds to timespec */
+                x3 = modf((double)txpk_info.tmms / 1E3, &x4);
+                gps_tx.tv_sec = (time_t)x4; /* get seconds from integer part */
+                gps_tx.tv_nsec = (long)(x3 * 1E9); /* get nanoseconds from fractional part */
+
+                /* transform GPS time to timestamp */
+                i = lgw_gps2cnt(local_ref, gps_tx, &(txpkt.count_us));
+                if (i != LGW_GPS_SUCCESS) {
+                    MSG("WARNING: [down] could not convert GPS time to timestamp, TX aborted\n");
                     continue;
-                }
-                txpkt.f_dev = (uint8_t)(json_value_get_number(val) / 1000.0); /* JSON value in Hz, txpkt.f_dev in kHz */
-
-                /* parse FSK preamble length (optional field, optimum min value enforced) */
-                val = json_object_get_value(txpk_obj, "prea");
-                if (val != NULL) {
-                    i = (int)json_value_get_number(val);
-                    if (i >= MIN_FSK_PREAMB) {
-                        txpkt.preamble = (uint16_t)i;
-                    } else {
-                        txpkt.preamble = (uint16_t)MIN_FSK_PREAMB;
-                    }
                 } else {
-                    txpkt.preamble = (uint16_t)STD_FSK_PREAMB;
+                    MSG("INFO: [down] a packet will be sent on timestamp value %lu (calculated from GPS time)\n", txpkt.count_us);
                 }
 
-            } else {
-                MSG("WARNING: [down] invalid modulation in \"txpk.modu\", TX aborted\n");
-                json_value_free(root_val);
-                continue;
-            }
-
-            /* Parse payload length (mandatory) */
-            val = json_object_get_value(txpk_obj, "size");
-            if (val == NULL) {
-                MSG("WARNING: [down] no mandatory \"txpk.size\" object in JSON, TX aborted\n");
-                json_value_free(root_val);
-                continue;
+                /* GPS timestamp is given, we consider it is a Class B downlink */
+                downlink_type = JIT_PKT_TYPE_DOWNLINK_CLASS_B;
             }
-            txpkt.size = (uint16_t)json_value_get_number(val);
 
-            /* Parse payload data (mandatory) */
-            str = json_object_get_string(txpk_obj, "data");
-            if (str == NULL) {
-                MSG("WARNING: [down] no mandatory \"txpk.data\" object in JSON, TX aborted\n");
-                json_value_free(root_val);
+            /* check the RF chain used for TX */
+            if (tx_enable[txpkt.rf_chain] == false) {
+                MSG("WARNING: [down] TX is not enabled on RF chain %u, TX aborted\n", txpkt.rf_chain);
                 continue;
             }
-            i = b64_to_bin(str, strlen(str), txpkt.payload, sizeof txpkt.payload);
-            if (i != txpkt.size) {
-                MSG("WARNING: [down] mismatch between .size and .data size once converter to binary\n");
-            }
 
-            /* free the JSON parse tree from memory */
-            json_value_free(root_val);
-
-            /* select TX mode */
-            if (sent_immediate) {
-                txpkt.tx_mode = IMMEDIATE;
-            } else {
-                txpkt.tx_mode = TIMESTAMPED;
+            /* TX power is given at the antenna */
+            if (txpk_info.powe == true) {
+                txpkt.rf_power -= antenna_gain;
             }
 
             /* record measurement data */
@@ -3383,25 +3704,29 @@ void thread_down(void)
                 }
             }
 
-            /* insert packet to be sent into JIT queue */
+            /* hand the packet over to the JIT task, which queues it and acknowledges it */
             if (jit_result == JIT_ERROR_OK) {
-                xSemaphoreTake(mx_concent, portMAX_DELAY);
-                lgw_get_instcnt(&current_concentrator_time);
-                xSemaphoreGive(mx_concent);
-                jit_result = jit_enqueue(&jit_queue[txpkt.rf_chain], current_concentrator_time, &txpkt, downlink_type);
-                if (jit_result != JIT_ERROR_OK) {
-                    printf("ERROR: Packet REJECTED (jit error=%d)\n", jit_result);
-                } else {
-                    /* In case of a warning having been raised before, we notify it */
-                    jit_result = warning_result;
-                }
+                downlink_req.pkt = txpkt;
+                downlink_req.pkt_type = downlink_type;
+                downlink_req.warning = warning_result;
+                downlink_req.warning_value = warning_value;
+                downlink_req.token_h = buff_down[1];
+                downlink_req.token_l = buff_down[2];
                 xSemaphoreTake(mx_meas_dw, portMAX_DELAY);
                 meas_nb_tx_requested += 1;
                 xSemaphoreGive(mx_meas_dw);
+                if (downlink_inbox_push(&downlink_inbox, &downlink_req) == true) {
+                    if (pJit != NULL) {
+                        xTaskNotifyGive(pJit);
+                    }
+                    continue;
+                }
+                jit_result = JIT_ERROR_FULL;
+                printf("ERROR: Packet REJECTED, downlink inbox is full\n");
             }
 
             /* Send acknoledge datagram to server */
-            send_tx_ack(buff_down[1], buff_down[2], jit_result, warning_value);
+            send_tx_ack(buff_down[1], buff_down[2], jit_result, warning_value, -1);
         }
     }
     MSG("\nINFO: End of downstream thread\n");
@@ -3432,31 +3757,172 @@ void print_tx_status(uint8_t tx_status)
 /* -------------------------------------------------------------------------- */
 /* --- THREAD 3: CHECKING PACKETS TO BE SENT FROM JIT QUEUE AND SEND THEM --- */
 
+/* current concentrator time, without SPI access while the clock model is in sync */
+static uint32_t get_concentrator_time(void)
+{
+    uint32_t time_us;
+
+    if (lgw_clock_estimate(esp_timer_get_time(), &time_us) == false) {
+        xSemaphoreTake(mx_concent, portMAX_DELAY);
+        lgw_get_instcnt(&time_us); /* resyncs the clock model */
+        xSemaphoreGive(mx_concent);
+    }
+
+    return time_us;
+}
+
+static void jit_wake_callback(void *arg)
+{
+    xTaskNotifyGive((TaskHandle_t)arg);
+}
+
+/* time to sleep until the earliest head of queue enters its TX_JIT_DELAY window */
+static uint32_t jit_wait_us(lgw_tmst_t time_us)
+{
+    lgw_tmst_t next_count_us;
+    uint32_t wait_us = JIT_IDLE_WAIT_US;
+    int32_t until_us;
+    int i;
+
+    for (i = 0; i < LGW_RF_CHAIN_NB; i++) {
+        if (jit_queue_next(&jit_queue[i], &next_count_us) == false) {
+            continue;
+        }
+        until_us = TMST_DIFF(next_count_us, time_us) - TX_JIT_DELAY + JIT_WAKE_MARGIN_US;
+        if (until_us < (int32_t)wait_us) {
+            wait_us = (until_us > JIT_MIN_WAIT_US) ? (uint32_t)until_us : JIT_MIN_WAIT_US;
+        }
+    }
+
+    return wait_us;
+}
+
+static void jit_record_lateness(lgw_tmst_t count_us, lgw_tmst_t time_us)
+{
+    uint32_t late_us;
+    int k;
+
+    late_us = TX_JIT_DELAY - TMST_UNTIL(count_us, time_us); /* peek guarantees the packet is in the window */
+    for (k = 0; k < (JIT_LATE_NB - 1); k++) {
+        if (late_us < jit_late_bound_us[k]) {
+            break;
+        }
+    }
+
+    xSemaphoreTake(mx_meas_dw, portMAX_DELAY);
+    meas_jit_late[k] += 1;
+    if (late_us > meas_jit_late_max) {
+        meas_jit_late_max = late_us;
+    }
+    xSemaphoreGive(mx_meas_dw);
+}
+
+/* move an immediate downlink to the RF chain where it can be sent first */
+static void jit_select_asap_chain(struct lgw_pkt_tx_s *pkt)
+{
+    lgw_tmst_t time_us;
+    lgw_tmst_t asap_us, best_us;
+    uint8_t rf_chain = pkt->rf_chain;
+    int i;
+
+    time_us = get_concentrator_time();
+    best_us = jit_queue_asap(&jit_queue[rf_chain], time_us, pkt);
+    for (i = 0; i < LGW_RF_CHAIN_NB; i++) {
+        if ((i == rf_chain) || (tx_chain_supports(i, pkt) == false)) {
+            continue;
+        }
+        asap_us = jit_queue_asap(&jit_queue[i], time_us, pkt);
+        if (TMST_BEFORE(asap_us, best_us)) {
+            best_us = asap_us;
+            pkt->rf_chain = i;
+        }
+    }
+    if (pkt->rf_chain != rf_chain) {
+        MSG_DEBUG(DEBUG_JIT, "immediate downlink moved from rf_chain %u to %u, sent at %lu\n", rf_chain, pkt->rf_chain, best_us);
+    }
+}
+
+/* queue the downlink requests handed over by thread_down, and acknowledge them */
+static void jit_drain_inbox(void)
+{
+    struct downlink_req_s *req;
+    enum jit_error_e jit_result;
+    uint8_t rf_chain;
+    int ack_chain;
+
+    while ((req = downlink_inbox_peek(&downlink_inbox)) != NULL) {
+        rf_chain = req->pkt.rf_chain; /* as requested by the server */
+        if ((req->pkt_type == JIT_PKT_TYPE_DOWNLINK_CLASS_C) && (asap_any_chain == true)) {
+            jit_select_asap_chain(&(req->pkt));
+        }
+        jit_result = jit_enqueue(&jit_queue[req->pkt.rf_chain], get_concentrator_time(), &(req->pkt), req->pkt_type);
+
+        /* the other RF chains may be free at that time */
+        if (((jit_result == JIT_ERROR_COLLISION_PACKET) || (jit_result == JIT_ERROR_FULL)) && (chain_balancing == true)) {
+            if (jit_enqueue_other_chain(jit_queue, LGW_RF_CHAIN_NB, get_concentrator_time(), &(req->pkt), req->pkt_type, tx_chain_supports) == JIT_ERROR_OK) {
+                MSG("INFO: [jit] downlink moved from rf_chain %u to %u, to avoid a collision\n", rf_chain, req->pkt.rf_chain);
+                jit_result = JIT_ERROR_OK;
+                xSemaphoreTake(mx_meas_dw, portMAX_DELAY);
+                meas_nb_tx_rebalanced += 1;
+                xSemaphoreGive(mx_meas_dw);
+            }
+        }
+
+        if (jit_result != JIT_ERROR_OK) {
+            printf("ERROR: Packet REJECTED (jit error=%d)\n", jit_result);
+            ack_chain = -1;
+        } else {
+            /* In case of a warning having been raised before, we notify it */
+            jit_result = req->warning;
+            ack_chain = (req->pkt.rf_chain != rf_chain) ? req->pkt.rf_chain : -1;
+        }
+
+        /* Send acknoledge datagram to server, with the RF chain used if it was changed */
+        send_tx_ack(req->token_h, req->token_l, jit_result, req->warning_value, ack_chain);
+
+        downlink_inbox_pop(&downlink_inbox);
+    }
+}
+
 void thread_jit(void)
 {
     int result = LGW_HAL_SUCCESS;
     struct lgw_pkt_tx_s pkt;
     int pkt_index = -1;
-    uint32_t current_concentrator_time;
+    lgw_tmst_t time_us;
     enum jit_error_e jit_result;
     enum jit_pkt_type_e pkt_type;
     uint8_t tx_status;
     int i;
+    int64_t send_us;
+    esp_timer_handle_t wake_timer;
+    const esp_timer_create_args_t wake_timer_args = {
+        .callback = &jit_wake_callback,
+        .arg = xTaskGetCurrentTaskHandle(),
+        .name = "jit_wake"
+    };
+
+    /* sleep until a packet is due, a new packet is at the head of a queue or a downlink request is handed over, instead of polling */
+    ESP_ERROR_CHECK(esp_timer_create(&wake_timer_args, &wake_timer));
+    jit_queue_set_notify(xTaskGetCurrentTaskHandle());
 
     while (!exit_sig && !quit_sig) {
-        //wait_ms(10);
-        vTaskDelay(10 / portTICK_PERIOD_MS);
+        xSemaphoreTake(mx_meas_dw, portMAX_DELAY);
+        meas_jit_wakeup += 1;
+        xSemaphoreGive(mx_meas_dw);
+
+        jit_drain_inbox();
 
         for (i = 0; i < LGW_RF_CHAIN_NB; i++) {
             /* transfer data and metadata to the concentrator, and schedule TX */
-            xSemaphoreTake(mx_concent, portMAX_DELAY);
-            lgw_get_instcnt(&current_concentrator_time);
-            xSemaphoreGive(mx_concent);
-            jit_result = jit_peek(&jit_queue[i], current_concentrator_time, &pkt_index);
+            time_us = get_concentrator_time(); /* a TX may have been programmed for the previous chain */
+            jit_result = jit_peek(&jit_queue[i], time_us, &pkt_index);
             if (jit_result == JIT_ERROR_OK) {
                 if (pkt_index > -1) {
                     jit_result = jit_dequeue(&jit_queue[i], pkt_index, &pkt, &pkt_type);
                     if (jit_result == JIT_ERROR_OK) {
+                        jit_record_lateness(pkt.count_us, time_us);
+
                         /* update beacon stats */
                         if (pkt_type == JIT_PKT_TYPE_BEACON) {
                             /* Compensate breacon frequency with xtal error */
@@ -3499,8 +3965,16 @@ void thread_jit(void)
                                 MSG("WARNING: [jit%d] lgw_spectral_scan_abort failed\n", i);
                             }
                         }
+                        send_us = esp_timer_get_time();
                         result = lgw_send(&pkt);
+                        send_us = esp_timer_get_time() - send_us;
                         xSemaphoreGive(mx_concent); /* free concentrator ASAP */
+                        xSemaphoreTake(mx_meas_dw, portMAX_DELAY);
+                        meas_tx_send_us_sum += (uint32_t)send_us;
+                        if ((uint32_t)send_us > meas_tx_send_us_max) {
+                            meas_tx_send_us_max = (uint32_t)send_us;
+                        }
+                        xSemaphoreGive(mx_meas_dw);
                         if (result != LGW_HAL_SUCCESS) {
                             xSemaphoreTake(mx_meas_dw, portMAX_DELAY);
                             meas_nb_tx_fail += 1;
@@ -3524,7 +3998,15 @@ void thread_jit(void)
                 MSG("ERROR: jit_peek failed on rf_chain %d with %d\n", i, jit_result);
             }
         }
+
+        /* arm the wake-up timer on the next departure, a notification from jit_enqueue() may come first */
+        esp_timer_stop(wake_timer); /* fails if not running, nothing to do */
+        ESP_ERROR_CHECK(esp_timer_start_once(wake_timer, jit_wait_us(get_concentrator_time())));
+        ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
     }
+    jit_queue_set_notify(NULL);
+    esp_timer_stop(wake_timer);
+    esp_timer_delete(wake_timer);
     vTaskDelete( pJit );
     MSG("\nINFO: End of JIT thread\n");
 }
@@ -0,0 +1,334 @@
+/*
+ / _____)             _              | |
+( (____  _____ ____ _| |_ _____  ____| |__
+ \____ \| ___ |    (_   _) ___ |/ ___)  _ \
+ _____) ) ____| | | || |_| ____( (___| | | |
+(______/|_____)_|_|_| \__)_____)\____)_| |_|
+  (C)2019 Semtech
+
+Description:
+    LoRa concentrator : JSON "rxpk" object serializer for upstream packets,
+    without any call to the printf family
+
+License: Revised BSD License, see LICENSE.TXT file include in the project
+*/
+
+
+#include <stdio.h>      /* printf */
+#include <string.h>     /* memcpy */
+#include <time.h>       /* gmtime_r */
+#include <math.h>       /* roundf, lrint, signbit */
+
+#include "trace.h"
+#include "base64.h"
+#include "rxpk_encoder.h"
+
+
+/* copy a string literal and move the cursor after it */
+#define ENC_LIT(dst, lit)   (memcpy((dst), (lit), sizeof(lit) - 1), (dst) + sizeof(lit) - 1)
+
+/* pairs of decimal digits, to convert 2 digits per division */
+static const char digit_pairs[201] =
+    "00010203040506070809"
+    "10111213141516171819"
+    "20212223242526272829"
+    "30313233343536373839"
+    "40414243444546474849"
+    "50515253545556575859"
+    "60616263646566676869"
+    "70717273747576777879"
+    "80818283848586878889"
+    "90919293949596979899";
+
+/* ",\"datr\":\"SFx" prefixes, indexed by spreading factor - 5 */
+static const struct {
+    const char *str;
+    uint8_t len;
+} datr_sf_lut[8] = {
+    { ",\"datr\":\"SF5",  12 },
+    { ",\"datr\":\"SF6",  12 },
+    { ",\"datr\":\"SF7",  12 },
+    { ",\"datr\":\"SF8",  12 },
+    { ",\"datr\":\"SF9",  12 },
+    { ",\"datr\":\"SF10", 13 },
+    { ",\"datr\":\"SF11", 13 },
+    { ",\"datr\":\"SF12", 13 }
+};
+
+/* ",\"codr\":\"4/x\"" strings, indexed by coderate (0 is mostly false sync) */
+static const char codr_lut[5][14] = {
+    ",\"codr\":\"OFF\"",
+    ",\"codr\":\"4/5\"",
+    ",\"codr\":\"4/6\"",
+    ",\"codr\":\"4/7\"",
+    ",\"codr\":\"4/8\""
+};
+
+/* -------------------------------------------------------------------------- */
+/* --- PRIVATE FUNCTIONS DEFINITION ----------------------------------------- */
+
+/* same as "%lu" */
+static char *enc_uint(char *dst, uint32_t v) {
+    char tmp[10];
+    char *t = tmp + sizeof tmp;
+    unsigned idx;
+    int n;
+
+    while (v >= 100) {
+        idx = (v % 100) * 2;
+        v /= 100;
+        *--t = digit_pairs[idx + 1];
+        *--t = digit_pairs[idx];
+    }
+    if (v >= 10) {
+        *--t = digit_pairs[v * 2 + 1];
+        *--t = digit_pairs[v * 2];
+    } else {
+        *--t = (char)('0' + v);
+    }
+
+    n = (tmp + sizeof tmp) - t;
+    memcpy(dst, t, n);
+    return dst + n;
+}
+
+/* same as "%" PRIu64 */
+static char *enc_uint64(char *dst, uint64_t v) {
+    char tmp[20];
+    char *t = tmp + sizeof tmp;
+    int n;
+
+    if (v <= UINT32_MAX) {
+        return enc_uint(dst, (uint32_t)v);
+    }
+    while (v > 0) {
+        *--t = (char)('0' + (v % 10));
+        v /= 10;
+    }
+
+    n = (tmp + sizeof tmp) - t;
+    memcpy(dst, t, n);
+    return dst + n;
+}
+
+/* same as "%ld" */
+static char *enc_int(char *dst, int32_t v) {
+    if (v < 0) {
+        *dst++ = '-';
+        return enc_uint(dst, 0U - (uint32_t)v);
+    }
+    return enc_uint(dst, (uint32_t)v);
+}
+
+/* same as "%0<width>lu" (pad='0') or "%<width>lu" (pad=' ') */
+static char *enc_uint_pad(char *dst, uint32_t v, int width, char pad) {
+    char tmp[10];
+    char *end = enc_uint(tmp, v);
+    int n = end - tmp;
+
+    while (n < width) {
+        *dst++ = pad;
+        width--;
+    }
+    memcpy(dst, tmp, n);
+    return dst + n;
+}
+
+/* same as "%.0f" applied on roundf(v) */
+static char *enc_round(char *dst, float v) {
+    float r = roundf(v);
+
+    if (signbit(r)) {
+        *dst++ = '-'; /* "-0" is printed for values in ]-0.5, 0] */
+        return enc_uint(dst, (uint32_t)(-r));
+    }
+    return enc_uint(dst, (uint32_t)r);
+}
+
+/* same as "%.1f", the float value multiplied by 10 is exact in double, so
+   lrint() gives the correctly rounded (ties to even) digits like printf */
+static char *enc_fixed1(char *dst, float v) {
+    long r = lrint((double)v * 10.0);
+
+    if (signbit(v)) {
+        *dst++ = '-';
+        r = -r;
+    }
+    dst = enc_uint(dst, (uint32_t)(r / 10));
+    *dst++ = '.';
+    *dst++ = (char)('0' + (r % 10));
+    return dst;
+}
+
+/* same as "%.6lf" applied on freq_hz / 1e6 */
+static char *enc_freq(char *dst, uint32_t freq_hz) {
+    dst = enc_uint(dst, freq_hz / 1000000);
+    *dst++ = '.';
+    return enc_uint_pad(dst, freq_hz % 1000000, 6, '0');
+}
+
+/* -------------------------------------------------------------------------- */
+/* --- PUBLIC FUNCTIONS DEFINITION ------------------------------------------ */
+
+int rxpk_encode(const struct lgw_pkt_rx_s *p, const struct tref *ref, char *buff, int buff_size) {
+    char *dst = buff;
+    struct timespec pkt_utc_time;
+    struct timespec pkt_gps_time;
+    uint64_t pkt_gps_time_ms;
+    struct tm x; /* broken-up UTC time */
+    int j;
+
+    if ((p == NULL) || (buff == NULL) || (buff_size < RXPK_JSON_SIZE_MAX)) {
+        MSG("ERROR: [up] invalid parameter for rxpk serialization\n");
+        return -1;
+    }
+
+    /* JSON rxpk frame format version, 8 useful chars */
+    dst = ENC_LIT(dst, "{\"jver\":");
+    dst = enc_uint(dst, RXPK_JSON_VERSION);
+
+    /* RAW timestamp, 8-17 useful chars */
+    dst = ENC_LIT(dst, ",\"tmst\":");
+    dst = enc_uint(dst, p->count_us);
+
+    /* Packet RX time (GPS based), 37 useful chars */
+    if (ref != NULL) {
+        /* convert packet timestamp to UTC absolute time */
+        j = lgw_cnt2utc(*ref, p->count_us, &pkt_utc_time);
+        if ((j == LGW_GPS_SUCCESS) && (gmtime_r(&(pkt_utc_time.tv_sec), &x) != NULL)) {
+            /* ISO 8601 format */
+            dst = ENC_LIT(dst, ",\"time\":\"");
+            dst = enc_uint_pad(dst, x.tm_year + 1900, 4, '0');
+            *dst++ = '-';
+            dst = enc_uint_pad(dst, x.tm_mon + 1, 2, '0');
+            *dst++ = '-';
+            dst = enc_uint_pad(dst, x.tm_mday, 2, '0');
+            *dst++ = 'T';
+            dst = enc_uint_pad(dst, x.tm_hour, 2, '0');
+            *dst++ = ':';
+            dst = enc_uint_pad(dst, x.tm_min, 2, '0');
+            *dst++ = ':';
+            dst = enc_uint_pad(dst, x.tm_sec, 2, '0');
+            *dst++ = '.';
+            dst = enc_uint_pad(dst, pkt_utc_time.tv_nsec / 1000, 6, '0');
+            dst = ENC_LIT(dst, "Z\"");
+        }
+        /* convert packet timestamp to GPS absolute time */
+        j = lgw_cnt2gps(*ref, p->count_us, &pkt_gps_time);
+        if (j == LGW_GPS_SUCCESS) {
+            /* GPS time in milliseconds since 06.Jan.1980, same rounding as before */
+            pkt_gps_time_ms = pkt_gps_time.tv_sec * 1E3 + pkt_gps_time.tv_nsec / 1E6;
+            dst = ENC_LIT(dst, ",\"tmms\":");
+            dst = enc_uint64(dst, pkt_gps_time_ms);
+        }
+    }
+
+    /* Fine timestamp */
+    if (p->ftime_received == true) {
+        dst = ENC_LIT(dst, ",\"ftime\":");
+        dst = enc_uint(dst, p->ftime);
+    }
+
+    /* Packet concentrator channel, RF chain & RX frequency, 34-36 useful chars */
+    dst = ENC_LIT(dst, ",\"chan\":");
+    dst = enc_uint(dst, p->if_chain);
+    dst = ENC_LIT(dst, ",\"rfch\":");
+    dst = enc_uint(dst, p->rf_chain);
+    dst = ENC_LIT(dst, ",\"freq\":");
+    dst = enc_freq(dst, p->freq_hz);
+    dst = ENC_LIT(dst, ",\"mid\":");
+    dst = enc_uint_pad(dst, p->modem_id, 2, ' ');
+
+    /* Packet status, 9-10 useful chars */
+    switch (p->status) {
+        case STAT_CRC_OK:
+            dst = ENC_LIT(dst, ",\"stat\":1");
+            break;
+        case STAT_CRC_BAD:
+            dst = ENC_LIT(dst, ",\"stat\":-1");
+            break;
+        case STAT_NO_CRC:
+            dst = ENC_LIT(dst, ",\"stat\":0");
+            break;
+        default:
+            MSG("ERROR: [up] received packet with unknown status 0x%02X\n", p->status);
+            return -1;
+    }
+
+    /* Packet modulation, 13-14 useful chars */
+    if (p->modulation == MOD_LORA) {
+        dst = ENC_LIT(dst, ",\"modu\":\"LORA\"");
+
+        /* Lora datarate & bandwidth, 16-19 useful chars */
+        if ((p->datarate < DR_LORA_SF5) || (p->datarate > DR_LORA_SF12)) {
+            MSG("ERROR: [up] lora packet with unknown datarate 0x%02X\n", (uint16_t)p->datarate);
+            return -1;
+        }
+        memcpy(dst, datr_sf_lut[p->datarate - DR_LORA_SF5].str, datr_sf_lut[p->datarate - DR_LORA_SF5].len);
+        dst += datr_sf_lut[p->datarate - DR_LORA_SF5].len;
+        switch (p->bandwidth) {
+            case BW_125KHZ:
+                dst = ENC_LIT(dst, "BW125\"");
+                break;
+            case BW_250KHZ:
+                dst = ENC_LIT(dst, "BW250\"");
+                break;
+            case BW_500KHZ:
+                dst = ENC_LIT(dst, "BW500\"");
+                break;
+            default:
+                MSG("ERROR: [up] lora packet with unknown bandwidth 0x%02X\n", p->bandwidth);
+                return -1;
+        }
+
+        /* Packet ECC coding rate, 11-13 useful chars */
+        if (p->coderate > CR_LORA_4_8) {
+            MSG("ERROR: [up] lora packet with unknown coderate 0x%02X\n", p->coderate);
+            return -1;
+        }
+        memcpy(dst, codr_lut[p->coderate], sizeof codr_lut[0] - 1);
+        dst += sizeof codr_lut[0] - 1;
+
+        /* Signal RSSI */
+        dst = ENC_LIT(dst, ",\"rssis\":");
+        dst = enc_round(dst, p->rssis);
+
+        /* Lora SNR */
+        dst = ENC_LIT(dst, ",\"lsnr\":");
+        dst = enc_fixed1(dst, p->snr);
+
+        /* Lora frequency offset */
+        dst = ENC_LIT(dst, ",\"foff\":");
+        dst = enc_int(dst, p->freq_offset);
+    } else if (p->modulation == MOD_FSK) {
+        dst = ENC_LIT(dst, ",\"modu\":\"FSK\"");
+
+        /* FSK datarate, 11-14 useful chars */
+        dst = ENC_LIT(dst, ",\"datr\":");
+        dst = enc_uint(dst, p->datarate);
+    } else {
+        MSG("ERROR: [up] received packet with unknown modulation 0x%02X\n", p->modulation);
+        return -1;
+    }
+
+    /* Channel RSSI, payload size, 18-23 useful chars */
+    dst = ENC_LIT(dst, ",\"rssi\":");
+    dst = enc_round(dst, p->rssic);
+    dst = ENC_LIT(dst, ",\"size\":");
+    dst = enc_uint(dst, p->size);
+
+    /* Packet base64-encoded payload, 14-350 useful chars */
+    dst = ENC_LIT(dst, ",\"data\":\"");
+    j = bin_to_b64(p->payload, p->size, dst, 341); /* 255 bytes = 340 chars in b64 + null char */
+    if (j < 0) {
+        MSG("ERROR: [up] bin_to_b64 failed line %d\n", (__LINE__ - 2));
+        return -1;
+    }
+    dst += j;
+
+    /* End of packet serialization */
+    dst = ENC_LIT(dst, "\"}");
+    *dst = '\0';
+
+    return dst - buff;
+}
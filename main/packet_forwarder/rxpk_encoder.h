@@ -0,0 +1,48 @@
+/*
+ / _____)             _              | |
+( (____  _____ ____ _| |_ _____  ____| |__
+ \____ \| ___ |    (_   _) ___ |/ ___)  _ \
+ _____) ) ____| | | || |_| ____( (___| | | |
+(______/|_____)_|_|_| \__)_____)\____)_| |_|
+  (C)2019 Semtech
+
+Description:
+    LoRa concentrator : JSON "rxpk" object serializer for upstream packets,
+    without any call to the printf family
+
+License: Revised BSD License, see LICENSE.TXT file include in the project
+*/
+
+
+#ifndef _LORA_PKTFWD_RXPK_ENCODER_H
+#define _LORA_PKTFWD_RXPK_ENCODER_H
+
+
+#include <stdint.h>     /* C99 types */
+#include <stdbool.h>    /* bool type */
+
+#include "loragw_hal.h"
+#include "loragw_gps.h"
+
+
+#define RXPK_JSON_VERSION   1   /* JSON rxpk frame format version (jver field) */
+#define RXPK_JSON_SIZE_MAX  664 /* Maximum size of a serialized rxpk object, including a 255 bytes payload and null char */
+
+/* -------------------------------------------------------------------------- */
+/* --- PUBLIC FUNCTIONS PROTOTYPES ------------------------------------------ */
+
+/**
+@brief Serialize a received packet as a JSON rxpk object, as described in PROTOCOL.md
+
+@param p[in] Received packet, as returned by lgw_receive()
+@param ref[in] GPS time reference used to add "time" and "tmms" fields, NULL if not valid
+@param buff[out] Buffer where the object is written, from '{' to '}'
+@param buff_size[in] Size of the buffer, must be at least RXPK_JSON_SIZE_MAX
+@return number of characters written (w/o null char), -1 for error
+
+The output is byte-identical to the former snprintf based serializer of thread_up.
+*/
+int rxpk_encode(const struct lgw_pkt_rx_s *p, const struct tref *ref, char *buff, int buff_size);
+
+#endif
+/* --- EOF ------------------------------------------------------------------ */
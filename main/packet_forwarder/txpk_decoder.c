@@ -0,0 +1,590 @@
+/*
+ / _____)             _              | |
+( (____  _____ ____ _| |_ _____  ____| |__
+ \____ \| ___ |    (_   _) ___ |/ ___)  _ \
+ _____) ) ____| | | || |_| ____( (___| | | |
+(______/|_____)_|_|_| \__)_____)\____)_| |_|
+  (C)2019 Semtech
+
+Description:
+    LoRa concentrator : JSON "txpk" object decoder for downstream packets,
+    single pass and without heap allocation
+
+License: Revised BSD License, see LICENSE.TXT file include in the project
+*/
+
+
+#include <stdio.h>      /* printf */
+#include <stdlib.h>     /* strtod */
+#include <string.h>     /* memset, memcmp, strlen */
+
+#include "trace.h"
+#include "parson.h"
+#include "base64.h"
+#include "txpk_decoder.h"
+
+
+#define MIN_LORA_PREAMB 6 /* minimum Lora preamble length for this application */
+#define STD_LORA_PREAMB 8
+#define MIN_FSK_PREAMB  3 /* minimum FSK preamble length for this application */
+#define STD_FSK_PREAMB  5
+
+#define FAST_NUMBER_DIGITS  15  /* up to 15 digits, mantissa and power of ten are exact doubles */
+#define OBJECT_KEYS_MAX     24  /* members of an object checked for duplicates, larger objects are left to parson */
+
+/* fields of the txpk object used by the packet forwarder */
+enum txpk_field_e {
+    TXPK_IMME,
+    TXPK_TMST,
+    TXPK_TMMS,
+    TXPK_NCRC,
+    TXPK_NHDR,
+    TXPK_FREQ,
+    TXPK_RFCH,
+    TXPK_POWE,
+    TXPK_MODU,
+    TXPK_DATR,
+    TXPK_CODR,
+    TXPK_IPOL,
+    TXPK_PREA,
+    TXPK_FDEV,
+    TXPK_SIZE,
+    TXPK_DATA,
+    TXPK_FIELD_NB
+};
+
+static const char txpk_field_name[TXPK_FIELD_NB][5] = {
+    "imme", "tmst", "tmms", "ncrc", "nhdr", "freq", "rfch", "powe",
+    "modu", "datr", "codr", "ipol", "prea", "fdev", "size", "data"
+};
+
+/* JSON value of a field, read the same way as with the parson accessors */
+struct txpk_value_s {
+    bool present;
+    int boolean;                    /* 1 if true, 0 if false, -1 if not a boolean */
+    double number;                  /* 0 if not a number */
+    const char *str;                /* NULL if not a string, not null terminated */
+    int len;
+};
+
+/* member names already met in an object, pointing into the JSON string */
+struct object_keys_s {
+    int nb;
+    const char *key[OBJECT_KEYS_MAX];
+    int len[OBJECT_KEYS_MAX];
+};
+
+static const double pow10_lut[FAST_NUMBER_DIGITS + 1] = {
+    1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11, 1e12, 1e13, 1e14, 1e15
+};
+
+/* -------------------------------------------------------------------------- */
+/* --- PRIVATE FUNCTIONS DEFINITION ----------------------------------------- */
+
+static bool is_digit(char c) {
+    return ((c >= '0') && (c <= '9'));
+}
+
+/* comments are left to parson, so '/' is not skipped */
+static const char *skip_ws(const char *s) {
+    while ((*s == ' ') || (*s == '\t') || (*s == '\n') || (*s == '\r')) {
+        s++;
+    }
+    return s;
+}
+
+/* string without escaped characters, return NULL if not supported */
+static const char *scan_string(const char *s, const char **str, int *len) {
+    const char *start;
+
+    if (*s != '"') {
+        return NULL;
+    }
+    start = ++s;
+    while (*s != '"') {
+        if ((*s == '\\') || ((uint8_t)*s < 0x20)) { /* includes the null char */
+            return NULL;
+        }
+        s++;
+    }
+    *str = start;
+    *len = s - start;
+    return s + 1;
+}
+
+/* same value as strtod(), return NULL if not a plain JSON number */
+static const char *scan_number(const char *s, double *number) {
+    const char *start = s;
+    char *end;
+    uint64_t mant = 0;
+    int nb_digits = 0;
+    int nb_frac = 0;
+    bool neg = false;
+
+    if (*s == '-') {
+        neg = true;
+        s++;
+    }
+    if (!is_digit(*s) || ((s[0] == '0') && is_digit(s[1]))) {
+        return NULL;
+    }
+    while (is_digit(*s)) {
+        mant = (mant * 10) + (*s++ - '0');
+        nb_digits++;
+    }
+    if (*s == '.') {
+        s++;
+        if (!is_digit(*s)) {
+            return NULL;
+        }
+        while (is_digit(*s)) {
+            mant = (mant * 10) + (*s++ - '0');
+            nb_digits++;
+            nb_frac++;
+        }
+    }
+
+    if ((*s == 'e') || (*s == 'E') || (nb_digits > FAST_NUMBER_DIGITS)) {
+        /* not exact with a single division, let the C library round it */
+        *number = strtod(start, &end);
+        return (end > start) ? end : NULL;
+    }
+
+    /* both operands are exact, so the division is correctly rounded like strtod() */
+    *number = (double)mant / pow10_lut[nb_frac];
+    if (neg == true) {
+        *number = -(*number);
+    }
+    return s;
+}
+
+/* scalar value, objects and arrays are left to parson */
+static const char *scan_value(const char *s, struct txpk_value_s *v) {
+    v->present = true;
+    v->boolean = -1;
+    v->number = 0.0;
+    v->str = NULL;
+    v->len = 0;
+
+    switch (*s) {
+        case '"':
+            return scan_string(s, &(v->str), &(v->len));
+        case 't':
+            v->boolean = 1;
+            return (strncmp(s, "true", 4) == 0) ? s + 4 : NULL;
+        case 'f':
+            v->boolean = 0;
+            return (strncmp(s, "false", 5) == 0) ? s + 5 : NULL;
+        case 'n':
+            return (strncmp(s, "null", 4) == 0) ? s + 4 : NULL;
+        default:
+            return scan_number(s, &(v->number));
+    }
+}
+
+static int find_field(const char *key, int len) {
+    int k;
+
+    if (len != 4) {
+        return -1;
+    }
+    for (k = 0; k < TXPK_FIELD_NB; k++) {
+        if (memcmp(key, txpk_field_name[k], 4) == 0) {
+            return k;
+        }
+    }
+    return -1;
+}
+
+/* remember a member name, false if it was already met (parson rejects the object) or too many to check */
+static bool add_key(struct object_keys_s *keys, const char *key, int len) {
+    int k;
+
+    for (k = 0; k < keys->nb; k++) {
+        if ((keys->len[k] == len) && (memcmp(keys->key[k], key, len) == 0)) {
+            return false;
+        }
+    }
+    if (keys->nb >= OBJECT_KEYS_MAX) {
+        return false;
+    }
+    keys->key[keys->nb] = key;
+    keys->len[keys->nb] = len;
+    keys->nb += 1;
+    return true;
+}
+
+/* members of an object, known fields are stored in v (NULL to skip them all), return NULL if not supported */
+static const char *scan_object(const char *s, struct txpk_value_s *v) {
+    struct txpk_value_s skipped;
+    struct object_keys_s keys;
+    const char *key;
+    int len;
+    int k;
+
+    if (*s != '{') {
+        return NULL;
+    }
+    s = skip_ws(s + 1);
+    if (*s == '}') {
+        return s + 1;
+    }
+    keys.nb = 0;
+    while (true) {
+        s = scan_string(s, &key, &len);
+        if ((s == NULL) || (add_key(&keys, key, len) == false)) {
+            return NULL; /* duplicated member, parson rejects it */
+        }
+        s = skip_ws(s);
+        if (*s != ':') {
+            return NULL;
+        }
+        s = skip_ws(s + 1);
+        k = (v != NULL) ? find_field(key, len) : -1;
+        if (k < 0) {
+            s = scan_value(s, &skipped);
+        } else {
+            s = scan_value(s, &v[k]);
+        }
+        if (s == NULL) {
+            return NULL;
+        }
+        s = skip_ws(s);
+        if (*s == '}') {
+            return s + 1;
+        } else if (*s != ',') {
+            return NULL;
+        }
+        s = skip_ws(s + 1);
+    }
+}
+
+/* single pass over the string, return -1 if it must be decoded by parson */
+static int stream_parse(const char *json, struct txpk_value_s *v) {
+    struct txpk_value_s skipped;
+    struct object_keys_s keys;
+    bool txpk_found = false;
+    const char *s = skip_ws(json);
+    const char *key;
+    int len;
+
+    if (*s != '{') {
+        return -1;
+    }
+    s = skip_ws(s + 1);
+    keys.nb = 0;
+    while (true) {
+        s = scan_string(s, &key, &len);
+        if ((s == NULL) || (add_key(&keys, key, len) == false)) {
+            return -1;
+        }
+        s = skip_ws(s);
+        if (*s != ':') {
+            return -1;
+        }
+        s = skip_ws(s + 1);
+        if ((len == 4) && (memcmp(key, "txpk", 4) == 0)) {
+            txpk_found = true;
+            s = scan_object(s, v);
+        } else if (*s == '{') {
+            s = scan_object(s, NULL);
+        } else {
+            s = scan_value(s, &skipped);
+        }
+        if (s == NULL) {
+            return -1;
+        }
+        s = skip_ws(s);
+        if (*s == '}') {
+            break;
+        } else if (*s != ',') {
+            return -1;
+        }
+        s = skip_ws(s + 1);
+    }
+    s = skip_ws(s + 1);
+
+    return ((*s == '\0') && (txpk_found == true)) ? 0 : -1;
+}
+
+/* "SF%2hdBW%3hd" */
+static bool parse_lora_datr(const char *s, int len, short *sf, short *bw) {
+    const char *end = s + len;
+    int n;
+
+    if ((len < 2) || (s[0] != 'S') || (s[1] != 'F')) {
+        return false;
+    }
+    s += 2;
+    for (*sf = 0, n = 0; (s < end) && (n < 2) && is_digit(*s); n++) {
+        *sf = (*sf * 10) + (*s++ - '0');
+    }
+    if ((n == 0) || ((end - s) < 2) || (s[0] != 'B') || (s[1] != 'W')) {
+        return false;
+    }
+    s += 2;
+    for (*bw = 0, n = 0; (s < end) && (n < 3) && is_digit(*s); n++) {
+        *bw = (*bw * 10) + (*s++ - '0');
+    }
+    return (n > 0);
+}
+
+static bool str_equal(const struct txpk_value_s *v, const char *lit) {
+    return ((v->str != NULL) && (v->len == (int)strlen(lit)) && (memcmp(v->str, lit, v->len) == 0));
+}
+
+/* fill the packet from the values of the txpk fields, whatever the way they were parsed */
+static int txpk_convert(const struct txpk_value_s *v, struct lgw_pkt_tx_s *pkt, struct txpk_info_s *info) {
+    short sf, bw;
+    int i;
+
+    /* Parse "immediate" tag, or target timestamp, or UTC time to be converted by GPS (mandatory) */
+    if (v[TXPK_IMME].boolean == 1) {
+        info->timing = TXPK_TIMING_IMMEDIATE;
+        pkt->tx_mode = IMMEDIATE;
+    } else if (v[TXPK_TMST].present == true) {
+        info->timing = TXPK_TIMING_TIMESTAMP;
+        pkt->tx_mode = TIMESTAMPED;
+        pkt->count_us = (uint32_t)v[TXPK_TMST].number;
+    } else if (v[TXPK_TMMS].present == true) {
+        info->timing = TXPK_TIMING_GPS;
+        pkt->tx_mode = TIMESTAMPED;
+        info->tmms = (uint64_t)v[TXPK_TMMS].number;
+    } else {
+        MSG("WARNING: [down] no mandatory \"txpk.tmst\" or \"txpk.tmms\" objects in JSON, TX aborted\n");
+        return -1;
+    }
+
+    /* Parse "No CRC" flag (optional field) */
+    if (v[TXPK_NCRC].present == true) {
+        pkt->no_crc = (bool)v[TXPK_NCRC].boolean;
+    }
+
+    /* Parse "No header" flag (optional field) */
+    if (v[TXPK_NHDR].present == true) {
+        pkt->no_header = (bool)v[TXPK_NHDR].boolean;
+    }
+
+    /* parse target frequency (mandatory) */
+    if (v[TXPK_FREQ].present == false) {
+        MSG("WARNING: [down] no mandatory \"txpk.freq\" object in JSON, TX aborted\n");
+        return -1;
+    }
+    pkt->freq_hz = (uint32_t)((double)(1.0e6) * v[TXPK_FREQ].number);
+
+    /* parse RF chain used for TX (mandatory) */
+    if (v[TXPK_RFCH].present == false) {
+        MSG("WARNING: [down] no mandatory \"txpk.rfch\" object in JSON, TX aborted\n");
+        return -1;
+    }
+    pkt->rf_chain = (uint8_t)v[TXPK_RFCH].number;
+
+    /* parse TX power (optional field) */
+    if (v[TXPK_POWE].present == true) {
+        info->powe = true;
+        pkt->rf_power = (int8_t)v[TXPK_POWE].number;
+    }
+
+    /* Parse modulation (mandatory) */
+    if (v[TXPK_MODU].str == NULL) {
+        MSG("WARNING: [down] no mandatory \"txpk.modu\" object in JSON, TX aborted\n");
+        return -1;
+    }
+    if (str_equal(&v[TXPK_MODU], "LORA")) {
+        /* Lora modulation */
+        pkt->modulation = MOD_LORA;
+
+        /* Parse Lora spreading-factor and modulation bandwidth (mandatory) */
+        if (v[TXPK_DATR].str == NULL) {
+            MSG("WARNING: [down] no mandatory \"txpk.datr\" object in JSON, TX aborted\n");
+            return -1;
+        }
+        if (parse_lora_datr(v[TXPK_DATR].str, v[TXPK_DATR].len, &sf, &bw) == false) {
+            MSG("WARNING: [down] format error in \"txpk.datr\", TX aborted\n");
+            return -1;
+        }
+        switch (sf) {
+            case  5: pkt->datarate = DR_LORA_SF5;  break;
+            case  6: pkt->datarate = DR_LORA_SF6;  break;
+            case  7: pkt->datarate = DR_LORA_SF7;  break;
+            case  8: pkt->datarate = DR_LORA_SF8;  break;
+            case  9: pkt->datarate = DR_LORA_SF9;  break;
+            case 10: pkt->datarate = DR_LORA_SF10; break;
+            case 11: pkt->datarate = DR_LORA_SF11; break;
+            case 12: pkt->datarate = DR_LORA_SF12; break;
+            default:
+                MSG("WARNING: [down] format error in \"txpk.datr\", invalid SF, TX aborted\n");
+                return -1;
+        }
+        switch (bw) {
+            case 125: pkt->bandwidth = BW_125KHZ; break;
+            case 250: pkt->bandwidth = BW_250KHZ; break;
+            case 500: pkt->bandwidth = BW_500KHZ; break;
+            default:
+                MSG("WARNING: [down] format error in \"txpk.datr\", invalid BW, TX aborted\n");
+                return -1;
+        }
+
+        /* Parse ECC coding rate (optional field) */
+        if (v[TXPK_CODR].str == NULL) {
+            MSG("WARNING: [down] no mandatory \"txpk.codr\" object in json, TX aborted\n");
+            return -1;
+        }
+        if      (str_equal(&v[TXPK_CODR], "4/5")) pkt->coderate = CR_LORA_4_5;
+        else if (str_equal(&v[TXPK_CODR], "4/6")) pkt->coderate = CR_LORA_4_6;
+        else if (str_equal(&v[TXPK_CODR], "2/3")) pkt->coderate = CR_LORA_4_6;
+        else if (str_equal(&v[TXPK_CODR], "4/7")) pkt->coderate = CR_LORA_4_7;
+        else if (str_equal(&v[TXPK_CODR], "4/8")) pkt->coderate = CR_LORA_4_8;
+        else if (str_equal(&v[TXPK_CODR], "1/2")) pkt->coderate = CR_LORA_4_8;
+        else {
+            MSG("WARNING: [down] format error in \"txpk.codr\", TX aborted\n");
+            return -1;
+        }
+
+        /* Parse signal polarity switch (optional field) */
+        if (v[TXPK_IPOL].present == true) {
+            pkt->invert_pol = (bool)v[TXPK_IPOL].boolean;
+        }
+
+        /* parse Lora preamble length (optional field, optimum min value enforced) */
+        if (v[TXPK_PREA].present == true) {
+            i = (int)v[TXPK_PREA].number;
+            if (i >= MIN_LORA_PREAMB) {
+                pkt->preamble = (uint16_t)i;
+            } else {
+                pkt->preamble = (uint16_t)MIN_LORA_PREAMB;
+            }
+        } else {
+            pkt->preamble = (uint16_t)STD_LORA_PREAMB;
+        }
+
+    } else if (str_equal(&v[TXPK_MODU], "FSK")) {
+        /* FSK modulation */
+        pkt->modulation = MOD_FSK;
+
+        /* parse FSK bitrate (mandatory) */
+        if (v[TXPK_DATR].present == false) {
+            MSG("WARNING: [down] no mandatory \"txpk.datr\" object in JSON, TX aborted\n");
+            return -1;
+        }
+        pkt->datarate = (uint32_t)(v[TXPK_DATR].number);
+
+        /* parse frequency deviation (mandatory) */
+        if (v[TXPK_FDEV].present == false) {
+            MSG("WARNING: [down] no mandatory \"txpk.fdev\" object in JSON, TX aborted\n");
+            return -1;
+        }
+        pkt->f_dev = (uint8_t)(v[TXPK_FDEV].number / 1000.0); /* JSON value in Hz, pkt->f_dev in kHz */
+
+        /* parse FSK preamble length (optional field, optimum min value enforced) */
+        if (v[TXPK_PREA].present == true) {
+            i = (int)v[TXPK_PREA].number;
+            if (i >= MIN_FSK_PREAMB) {
+                pkt->preamble = (uint16_t)i;
+            } else {
+                pkt->preamble = (uint16_t)MIN_FSK_PREAMB;
+            }
+        } else {
+            pkt->preamble = (uint16_t)STD_FSK_PREAMB;
+        }
+
+    } else {
+        MSG("WARNING: [down] invalid modulation in \"txpk.modu\", TX aborted\n");
+        return -1;
+    }
+
+    /* Parse payload length (mandatory) */
+    if (v[TXPK_SIZE].present == false) {
+        MSG("WARNING: [down] no mandatory \"txpk.size\" object in JSON, TX aborted\n");
+        return -1;
+    }
+    pkt->size = (uint16_t)v[TXPK_SIZE].number;
+
+    /* Parse payload data (mandatory), decoded straight from the JSON string */
+    if (v[TXPK_DATA].str == NULL) {
+        MSG("WARNING: [down] no mandatory \"txpk.data\" object in JSON, TX aborted\n");
+        return -1;
+    }
+    i = b64_to_bin(v[TXPK_DATA].str, v[TXPK_DATA].len, pkt->payload, sizeof pkt->payload);
+    if (i < 0) {
+        MSG("WARNING: [down] invalid base64 in \"txpk.data\", TX aborted\n");
+        return -1;
+    }
+    if (i != pkt->size) {
+        MSG("WARNING: [down] mismatch between .size and .data size once converter to binary\n");
+    }
+
+    return 0;
+}
+
+/* -------------------------------------------------------------------------- */
+/* --- PUBLIC FUNCTIONS DEFINITION ------------------------------------------ */
+
+int txpk_decode(const char *json, struct lgw_pkt_tx_s *pkt, struct txpk_info_s *info) {
+    struct txpk_value_s v[TXPK_FIELD_NB];
+
+    if ((json == NULL) || (pkt == NULL) || (info == NULL)) {
+        return -1;
+    }
+
+    memset(v, 0, sizeof v);
+    if (stream_parse(json, v) != 0) {
+        MSG_DEBUG(DEBUG_PKT_FWD, "INFO: [down] txpk not decoded in a single pass, using parson\n");
+        return txpk_decode_dom(json, pkt, info);
+    }
+
+    memset(pkt, 0, sizeof *pkt);
+    memset(info, 0, sizeof *info);
+    return txpk_convert(v, pkt, info);
+}
+
+int txpk_decode_dom(const char *json, struct lgw_pkt_tx_s *pkt, struct txpk_info_s *info) {
+    struct txpk_value_s v[TXPK_FIELD_NB];
+    JSON_Value *root_val;
+    JSON_Object *txpk_obj;
+    JSON_Value *val;
+    int k;
+    int x;
+
+    if ((json == NULL) || (pkt == NULL) || (info == NULL)) {
+        return -1;
+    }
+
+    memset(pkt, 0, sizeof *pkt);
+    memset(info, 0, sizeof *info);
+    info->dom = true;
+
+    root_val = json_parse_string_with_comments(json);
+    if (root_val == NULL) {
+        MSG("WARNING: [down] invalid JSON, TX aborted\n");
+        return -1;
+    }
+
+    /* look for JSON sub-object 'txpk' */
+    txpk_obj = json_object_get_object(json_value_get_object(root_val), "txpk");
+    if (txpk_obj == NULL) {
+        MSG("WARNING: [down] no \"txpk\" object in JSON, TX aborted\n");
+        json_value_free(root_val);
+        return -1;
+    }
+
+    /* the strings point into the tree, which is freed once the packet is filled */
+    memset(v, 0, sizeof v);
+    for (k = 0; k < TXPK_FIELD_NB; k++) {
+        val = json_object_get_value(txpk_obj, txpk_field_name[k]);
+        if (val != NULL) {
+            v[k].present = true;
+            v[k].boolean = json_value_get_boolean(val);
+            v[k].number = json_value_get_number(val);
+            v[k].str = json_value_get_string(val);
+            v[k].len = (v[k].str != NULL) ? (int)strlen(v[k].str) : 0;
+        }
+    }
+    x = txpk_convert(v, pkt, info);
+
+    json_value_free(root_val);
+
+    return x;
+}
+
+/* --- EOF ------------------------------------------------------------------ */
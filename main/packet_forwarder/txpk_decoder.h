@@ -0,0 +1,70 @@
+/*
+ / _____)             _              | |
+( (____  _____ ____ _| |_ _____  ____| |__
+ \____ \| ___ |    (_   _) ___ |/ ___)  _ \
+ _____) ) ____| | | || |_| ____( (___| | | |
+(______/|_____)_|_|_| \__)_____)\____)_| |_|
+  (C)2019 Semtech
+
+Description:
+    LoRa concentrator : JSON "txpk" object decoder for downstream packets,
+    single pass and without heap allocation
+
+License: Revised BSD License, see LICENSE.TXT file include in the project
+*/
+
+
+#ifndef _LORA_PKTFWD_TXPK_DECODER_H
+#define _LORA_PKTFWD_TXPK_DECODER_H
+
+
+#include <stdint.h>     /* C99 types */
+#include <stdbool.h>    /* bool type */
+
+#include "loragw_hal.h"
+
+
+/* how the downlink has to be scheduled */
+enum txpk_timing_e {
+    TXPK_TIMING_IMMEDIATE,          /* "imme" is true: class C */
+    TXPK_TIMING_TIMESTAMP,          /* "tmst" concentrator counter: class A */
+    TXPK_TIMING_GPS                 /* "tmms" GPS time, to be converted by the caller: class B */
+};
+
+struct txpk_info_s {
+    enum txpk_timing_e timing;
+    uint64_t tmms;                  /* GPS time in milliseconds, for TXPK_TIMING_GPS */
+    bool powe;                      /* "powe" was given, rf_power is not corrected by the antenna gain yet */
+    bool dom;                       /* the JSON could only be decoded by building a parson tree */
+};
+
+/* -------------------------------------------------------------------------- */
+/* --- PUBLIC FUNCTIONS PROTOTYPES ------------------------------------------ */
+
+/**
+@brief Decode the JSON txpk object of a PULL_RESP, as described in PROTOCOL.md
+
+@param json[in] Null terminated JSON string, it is not modified
+@param pkt[out] Packet to be sent, all fields but count_us for TXPK_TIMING_GPS are set
+@param info[out] Scheduling information not held by the packet structure
+@return 0 if the packet can be sent, -1 if the TX must be aborted (a warning is printed)
+
+The fields are decoded in a single pass, straight from the string, and the payload is
+base64 decoded into pkt. The parson tree is only built when the string uses something
+this pass does not handle: comments, escaped characters, or objects and arrays in
+fields which are not part of the txpk schema.
+*/
+int txpk_decode(const char *json, struct lgw_pkt_tx_s *pkt, struct txpk_info_s *info);
+
+/**
+@brief Same as txpk_decode(), always building the parson tree.
+
+@param json[in] Null terminated JSON string
+@param pkt[out] Packet to be sent
+@param info[out] Scheduling information not held by the packet structure
+@return 0 if the packet can be sent, -1 if the TX must be aborted (a warning is printed)
+*/
+int txpk_decode_dom(const char *json, struct lgw_pkt_tx_s *pkt, struct txpk_info_s *info);
+
+#endif
+/* --- EOF ------------------------------------------------------------------ */
@@ -0,0 +1,140 @@
+/*
+ / _____)             _              | |
+( (____  _____ ____ _| |_ _____  ____| |__
+ \____ \| ___ |    (_   _) ___ |/ ___)  _ \
+ _____) ) ____| | | || |_| ____( (___| | | |
+(______/|_____)_|_|_| \__)_____)\____)_| |_|
+  (C)2019 Semtech
+
+Description:
+    LoRa concentrator : suppression of duplicated uplinks (same DevAddr, FCnt
+    and payload) received within a short window, e.g. on both radios
+
+License: Revised BSD License, see LICENSE.TXT file include in the project
+*/
+
+
+#include <stdio.h>      /* printf */
+#include <string.h>     /* memset */
+#include <assert.h>
+
+#include "trace.h"
+#include "uplink_dedup.h"
+
+
+/* LoRaWAN MHDR message types */
+#define MTYPE_UNCONF_DATA_UP    0x02
+#define MTYPE_CONF_DATA_UP      0x04
+
+/* MHDR + DevAddr + FCtrl + FCnt */
+#define FHDR_MIN_SIZE           8
+
+/* -------------------------------------------------------------------------- */
+/* --- PRIVATE FUNCTIONS DEFINITION ----------------------------------------- */
+
+/* FNV-1a */
+static uint32_t dedup_hash(const uint8_t *data, uint16_t size) {
+    uint32_t h = 2166136261UL;
+    uint16_t i;
+
+    for (i = 0; i < size; i++) {
+        h ^= data[i];
+        h *= 16777619UL;
+    }
+
+    return h;
+}
+
+/* -------------------------------------------------------------------------- */
+/* --- PUBLIC FUNCTIONS DEFINITION ----------------------------------------- */
+
+void uplink_dedup_init(struct uplink_dedup_s *dedup, uint32_t window_ms) {
+    memset(dedup, 0, sizeof(*dedup));
+
+    dedup->window_us = window_ms * 1000;
+    dedup->mx_dedup = xSemaphoreCreateMutex();
+    assert(dedup->mx_dedup);
+}
+
+bool uplink_dedup_check(struct uplink_dedup_s *dedup, const uint8_t *payload, uint16_t size, uint32_t count_us) {
+    struct uplink_dedup_entry_s *e;
+    struct uplink_dedup_entry_s *slot = NULL; /* slot to be used if the device is not found */
+    uint8_t mtype;
+    uint32_t devaddr;
+    uint16_t fcnt;
+    uint32_t hash;
+    uint32_t idx;
+    int i;
+    bool in_window;
+    bool dup = false;
+
+    if (size < FHDR_MIN_SIZE) {
+        return false;
+    }
+    mtype = payload[0] >> 5;
+    if ((mtype != MTYPE_UNCONF_DATA_UP) && (mtype != MTYPE_CONF_DATA_UP)) {
+        return false;
+    }
+
+    devaddr  = payload[1];
+    devaddr |= payload[2] << 8;
+    devaddr |= payload[3] << 16;
+    devaddr |= (uint32_t)payload[4] << 24;
+    fcnt  = payload[6];
+    fcnt |= payload[7] << 8;
+    hash = dedup_hash(payload, size);
+
+    xSemaphoreTake(dedup->mx_dedup, portMAX_DELAY);
+
+    /* slots are never emptied, so the device cannot be further than the first unused slot */
+    idx = (devaddr * 2654435761UL) >> (32 - DEDUP_TABLE_BITS);
+    for (i = 0; i < DEDUP_PROBE_MAX; i++) {
+        e = &(dedup->table[(idx + i) & (DEDUP_TABLE_SIZE - 1)]);
+        dedup->stat.nb_probe += 1;
+        if (e->used == false) {
+            if (slot == NULL) {
+                slot = e;
+            }
+            break;
+        }
+        in_window = ((uint32_t)(count_us - e->count_us) < dedup->window_us);
+        if (e->devaddr == devaddr) {
+            slot = e;
+            dup = in_window && (e->fcnt == fcnt) && (e->hash == hash);
+            break;
+        }
+        /* the least recently seen device is replaced, it is outdated if any is */
+        if ((slot == NULL) || ((uint32_t)(count_us - e->count_us) > (uint32_t)(count_us - slot->count_us))) {
+            slot = e;
+        }
+    }
+
+    if (dup == true) {
+        dedup->stat.nb_hit += 1;
+    } else {
+        dedup->stat.nb_miss += 1;
+        if ((slot->used == true) && (slot->devaddr != devaddr) && ((uint32_t)(count_us - slot->count_us) < dedup->window_us)) {
+            dedup->stat.nb_evict += 1;
+        }
+        slot->used = true;
+        slot->devaddr = devaddr;
+        slot->fcnt = fcnt;
+        slot->hash = hash;
+        slot->count_us = count_us;
+    }
+
+    xSemaphoreGive(dedup->mx_dedup);
+
+    return dup;
+}
+
+void uplink_dedup_get_stat(struct uplink_dedup_s *dedup, struct uplink_dedup_stat_s *stat, bool reset) {
+    xSemaphoreTake(dedup->mx_dedup, portMAX_DELAY);
+
+    *stat = dedup->stat;
+    if (reset == true) {
+        memset(&(dedup->stat), 0, sizeof(dedup->stat));
+    }
+
+    xSemaphoreGive(dedup->mx_dedup);
+}
@@ -0,0 +1,88 @@
+/*
+ / _____)             _              | |
+( (____  _____ ____ _| |_ _____  ____| |__
+ \____ \| ___ |    (_   _) ___ |/ ___)  _ \
+ _____) ) ____| | | || |_| ____( (___| | | |
+(______/|_____)_|_|_| \__)_____)\____)_| |_|
+  (C)2019 Semtech
+
+Description:
+    LoRa concentrator : suppression of duplicated uplinks (same DevAddr, FCnt
+    and payload) received within a short window, e.g. on both radios
+
+License: Revised BSD License, see LICENSE.TXT file include in the project
+*/
+
+
+#ifndef _LORA_PKTFWD_UPLINK_DEDUP_H
+#define _LORA_PKTFWD_UPLINK_DEDUP_H
+
+
+#include <stdint.h>     /* C99 types */
+#include <stdbool.h>    /* bool type */
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+
+
+#define DEDUP_TABLE_BITS    8                           /* log2 of the number of devices tracked */
+#define DEDUP_TABLE_SIZE    (1 << DEDUP_TABLE_BITS)
+#define DEDUP_PROBE_MAX     8                           /* max number of slots probed per lookup */
+
+struct uplink_dedup_entry_s {
+    bool used;                      /* slot has been used at least once */
+    uint16_t fcnt;                  /* last FCnt received (16 LSBs) */
+    uint32_t devaddr;               /* DevAddr of the device */
+    uint32_t hash;                  /* hash of the last PHYPayload received */
+    uint32_t count_us;              /* concentrator timestamp of the last packet received */
+};
+
+struct uplink_dedup_stat_s {
+    uint32_t nb_hit;                /* Number of duplicates suppressed */
+    uint32_t nb_miss;               /* Number of packets not found in the table */
+    uint32_t nb_evict;              /* Number of devices evicted from the table while still in window */
+    uint32_t nb_probe;              /* Number of slots probed, to measure the lookup cost */
+};
+
+struct uplink_dedup_s {
+    SemaphoreHandle_t mx_dedup;     /* control access to the statistics */
+    uint32_t window_us;             /* duplicates are only suppressed within this window */
+    struct uplink_dedup_stat_s stat;
+    struct uplink_dedup_entry_s table[DEDUP_TABLE_SIZE]; /* open addressing, linear probing */
+};
+
+/* -------------------------------------------------------------------------- */
+/* --- PUBLIC FUNCTIONS PROTOTYPES ------------------------------------------ */
+
+/**
+@brief Initialize an empty duplicate suppression table.
+
+@param dedup[in] Table to be initialized. Memory should have been allocated already.
+@param window_ms[in] Time window in which a packet identical to a previous one is a duplicate
+*/
+void uplink_dedup_init(struct uplink_dedup_s *dedup, uint32_t window_ms);
+
+/**
+@brief Check if a received frame is a duplicate, and remember it otherwise.
+
+@param dedup[in/out] Table
+@param payload[in] PHYPayload
+@param size[in] Size of the PHYPayload
+@param count_us[in] Concentrator timestamp of the packet
+@return true if the same frame from the same device was received within the window
+
+Only data uplinks are tracked, other frames are never duplicates.
+*/
+bool uplink_dedup_check(struct uplink_dedup_s *dedup, const uint8_t *payload, uint16_t size, uint32_t count_us);
+
+/**
+@brief Get the table statistics.
+
+@param dedup[in/out] Table
+@param stat[out] Copy of the statistics
+@param reset[in] Reset the statistics after reading them
+*/
+void uplink_dedup_get_stat(struct uplink_dedup_s *dedup, struct uplink_dedup_stat_s *stat, bool reset);
+
+#endif
+/* --- EOF ------------------------------------------------------------------ */
@@ -0,0 +1,215 @@
+/*
+ / _____)             _              | |
+( (____  _____ ____ _| |_ _____  ____| |__
+ \____ \| ___ |    (_   _) ___ |/ ___)  _ \
+ _____) ) ____| | | || |_| ____( (___| | | |
+(______/|_____)_|_|_| \__)_____)\____)_| |_|
+  (C)2019 Semtech
+
+Description:
+    LoRa concentrator : filtering of uplinks by DevAddr/NetID and JoinEUI,
+    before they are serialized and sent to the server
+
+License: Revised BSD License, see LICENSE.TXT file include in the project
+*/
+
+
+#include <stdio.h>      /* printf */
+#include <string.h>     /* memset, memmove */
+#include <assert.h>
+
+#include "trace.h"
+#include "uplink_filter.h"
+
+
+/* LoRaWAN MHDR message types */
+#define MTYPE_JOIN_REQUEST      0x00
+#define MTYPE_UNCONF_DATA_UP    0x02
+#define MTYPE_CONF_DATA_DOWN    0x05
+
+/* nb of NwkID bits in DevAddr, per NetID type */
+static const uint8_t nwkid_bits[8] = { 6, 6, 9, 11, 12, 13, 15, 17 };
+
+static const char *table_name[FILTER_TABLE_NB] = { "DevAddr", "JoinEUI" };
+
+/* -------------------------------------------------------------------------- */
+/* --- PRIVATE FUNCTIONS DEFINITION ----------------------------------------- */
+
+/* index of the rule with the highest min <= key, -1 if none */
+static int filter_search(const struct uplink_filter_table_s *t, uint64_t key) {
+    int lo = 0;
+    int hi = t->nb_rule - 1;
+    int mid;
+    int found = -1;
+
+    while (lo <= hi) {
+        mid = (lo + hi) / 2;
+        if (t->rule[mid].min <= key) {
+            found = mid;
+            lo = mid + 1;
+        } else {
+            hi = mid - 1;
+        }
+    }
+
+    return found;
+}
+
+static bool filter_lookup(struct uplink_filter_table_s *t, uint64_t key) {
+    int i;
+
+    if (t->nb_rule == 0) {
+        return true;
+    }
+
+    i = filter_search(t, key);
+    if ((i >= 0) && (key <= t->rule[i].max)) {
+        t->rule[i].nb_match += 1;
+        return (t->rule[i].action == FILTER_ACTION_ALLOW);
+    }
+
+    if (t->allow_only == true) {
+        t->nb_unmatched_drop += 1;
+        return false;
+    }
+    return true;
+}
+
+/* -------------------------------------------------------------------------- */
+/* --- PUBLIC FUNCTIONS DEFINITION ----------------------------------------- */
+
+void uplink_filter_init(struct uplink_filter_s *filter) {
+    memset(filter, 0, sizeof(*filter));
+
+    filter->mx_filter = xSemaphoreCreateMutex();
+    assert(filter->mx_filter);
+}
+
+int uplink_filter_add(struct uplink_filter_s *filter, enum uplink_filter_table_e table, uint64_t min, uint64_t max, enum uplink_filter_action_e action) {
+    struct uplink_filter_table_s *t;
+    int i;
+
+    if ((table >= FILTER_TABLE_NB) || (min > max)) {
+        MSG("ERROR: invalid filter rule\n");
+        return -1;
+    }
+    t = &(filter->table[table]);
+    if (t->nb_rule >= FILTER_RULES_MAX) {
+        MSG("ERROR: too many %s filter rules (max %d)\n", table_name[table], FILTER_RULES_MAX);
+        return -1;
+    }
+
+    /* keep rules sorted, ranges must not overlap so that a key matches one rule only */
+    i = filter_search(t, min);
+    if (((i >= 0) && (t->rule[i].max >= min)) || ((i + 1 < t->nb_rule) && (t->rule[i + 1].min <= max))) {
+        MSG("ERROR: %s filter rule 0x%llX-0x%llX overlaps another rule\n", table_name[table], (unsigned long long)min, (unsigned long long)max);
+        return -1;
+    }
+    i += 1;
+    memmove(&(t->rule[i + 1]), &(t->rule[i]), (t->nb_rule - i) * sizeof(t->rule[0]));
+    t->rule[i].min = min;
+    t->rule[i].max = max;
+    t->rule[i].action = action;
+    t->rule[i].nb_match = 0;
+    t->nb_rule += 1;
+    if (action == FILTER_ACTION_ALLOW) {
+        t->allow_only = true;
+    }
+
+    return 0;
+}
+
+int uplink_filter_add_netid(struct uplink_filter_s *filter, uint32_t netid, enum uplink_filter_action_e action) {
+    uint8_t type;
+    uint8_t prefix_len;
+    uint32_t prefix;
+    uint32_t nwkid;
+
+    if (netid > 0xFFFFFF) {
+        MSG("ERROR: invalid NetID 0x%lX\n", (unsigned long)netid);
+        return -1;
+    }
+
+    /* DevAddr = type prefix (type ones and a zero) | NwkID (LSBs of NetID) | NwkAddr */
+    type = (uint8_t)(netid >> 21);
+    nwkid = netid & ((1UL << nwkid_bits[type]) - 1);
+    prefix_len = (type + 1) + nwkid_bits[type];
+    prefix = (((0xFF00UL >> type) & 0xFF) << 24) | (nwkid << (32 - prefix_len));
+
+    return uplink_filter_add(filter, FILTER_TABLE_DEVADDR, prefix, prefix | (0xFFFFFFFFUL >> prefix_len), action);
+}
+
+bool uplink_filter_check(struct uplink_filter_s *filter, const uint8_t *payload, uint16_t size) {
+    uint8_t mtype;
+    uint64_t key;
+    int i;
+    bool fwd;
+
+    if (size < 1) {
+        return true;
+    }
+    mtype = payload[0] >> 5;
+
+    if ((mtype >= MTYPE_UNCONF_DATA_UP) && (mtype <= MTYPE_CONF_DATA_DOWN) && (size >= 5)) {
+        if (filter->table[FILTER_TABLE_DEVADDR].nb_rule == 0) {
+            return true;
+        }
+        key  = payload[1];
+        key |= payload[2] << 8;
+        key |= payload[3] << 16;
+        key |= (uint32_t)payload[4] << 24;
+        xSemaphoreTake(filter->mx_filter, portMAX_DELAY);
+        fwd = filter_lookup(&(filter->table[FILTER_TABLE_DEVADDR]), key);
+        xSemaphoreGive(filter->mx_filter);
+        return fwd;
+    }
+
+    if ((mtype == MTYPE_JOIN_REQUEST) && (size >= 9)) {
+        if (filter->table[FILTER_TABLE_JOINEUI].nb_rule == 0) {
+            return true;
+        }
+        key = 0;
+        for (i = 8; i >= 1; i--) {
+            key = (key << 8) | payload[i]; /* little endian on air */
+        }
+        xSemaphoreTake(filter->mx_filter, portMAX_DELAY);
+        fwd = filter_lookup(&(filter->table[FILTER_TABLE_JOINEUI]), key);
+        xSemaphoreGive(filter->mx_filter);
+        return fwd;
+    }
+
+    return true;
+}
+
+uint32_t uplink_filter_report(struct uplink_filter_s *filter, bool reset) {
+    struct uplink_filter_table_s *t;
+    struct uplink_filter_rule_s *r;
+    int i, j;
+    uint32_t nb_drop = 0;
+
+    xSemaphoreTake(filter->mx_filter, portMAX_DELAY);
+    for (i = 0; i < FILTER_TABLE_NB; i++) {
+        t = &(filter->table[i]);
+        for (j = 0; j < t->nb_rule; j++) {
+            r = &(t->rule[j]);
+            if (r->action == FILTER_ACTION_DENY) {
+                nb_drop += r->nb_match;
+            }
+            printf("# %s filter %s 0x%llX-0x%llX: %lu packets %s\n", table_name[i], (r->action == FILTER_ACTION_ALLOW) ? "allow" : "deny",
+                   (unsigned long long)r->min, (unsigned long long)r->max, (unsigned long)r->nb_match, (r->action == FILTER_ACTION_ALLOW) ? "forwarded" : "dropped");
+            if (reset == true) {
+                r->nb_match = 0;
+            }
+        }
+        if (t->allow_only == true) {
+            nb_drop += t->nb_unmatched_drop;
+            printf("# %s filter, no allow rule matched: %lu packets dropped\n", table_name[i], (unsigned long)t->nb_unmatched_drop);
+            if (reset == true) {
+                t->nb_unmatched_drop = 0;
+            }
+        }
+    }
+    xSemaphoreGive(filter->mx_filter);
+
+    return nb_drop;
+}
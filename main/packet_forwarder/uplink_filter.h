@@ -0,0 +1,114 @@
+/*
+ / _____)             _              | |
+( (____  _____ ____ _| |_ _____  ____| |__
+ \____ \| ___ |    (_   _) ___ |/ ___)  _ \
+ _____) ) ____| | | || |_| ____( (___| | | |
+(______/|_____)_|_|_| \__)_____)\____)_| |_|
+  (C)2019 Semtech
+
+Description:
+    LoRa concentrator : filtering of uplinks by DevAddr/NetID and JoinEUI,
+    before they are serialized and sent to the server
+
+License: Revised BSD License, see LICENSE.TXT file include in the project
+*/
+
+
+#ifndef _LORA_PKTFWD_UPLINK_FILTER_H
+#define _LORA_PKTFWD_UPLINK_FILTER_H
+
+
+#include <stdint.h>     /* C99 types */
+#include <stdbool.h>    /* bool type */
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+
+
+#define FILTER_RULES_MAX    32  /* Maximum number of rules per table */
+
+enum uplink_filter_table_e {
+    FILTER_TABLE_DEVADDR,       /* data frames, by DevAddr (or NetID) */
+    FILTER_TABLE_JOINEUI,       /* join-requests, by JoinEUI */
+    FILTER_TABLE_NB
+};
+
+enum uplink_filter_action_e {
+    FILTER_ACTION_DENY,
+    FILTER_ACTION_ALLOW
+};
+
+struct uplink_filter_rule_s {
+    uint64_t min;                   /* first key of the range */
+    uint64_t max;                   /* last key of the range */
+    enum uplink_filter_action_e action;
+    uint32_t nb_match;              /* Number of packets matching the rule since last reset */
+};
+
+struct uplink_filter_table_s {
+    int nb_rule;
+    bool allow_only;                /* at least one allow rule: packets matching no rule are dropped */
+    uint32_t nb_unmatched_drop;     /* Number of packets dropped because they match no allow rule */
+    struct uplink_filter_rule_s rule[FILTER_RULES_MAX]; /* sorted by range, ranges do not overlap */
+};
+
+struct uplink_filter_s {
+    SemaphoreHandle_t mx_filter;    /* control access to the counters */
+    struct uplink_filter_table_s table[FILTER_TABLE_NB];
+};
+
+/* -------------------------------------------------------------------------- */
+/* --- PUBLIC FUNCTIONS PROTOTYPES ------------------------------------------ */
+
+/**
+@brief Initialize a filter with no rules (everything is forwarded).
+
+@param filter[in] Filter to be initialized. Memory should have been allocated already.
+*/
+void uplink_filter_init(struct uplink_filter_s *filter);
+
+/**
+@brief Add a rule on a range of keys.
+
+@param filter[in/out] Filter to be updated
+@param table[in] Table in which the rule is added (DevAddr or JoinEUI)
+@param min[in] First key of the range
+@param max[in] Last key of the range
+@param action[in] Action when a packet matches the rule
+@return 0 for success, -1 if the table is full or the range overlaps an existing rule
+*/
+int uplink_filter_add(struct uplink_filter_s *filter, enum uplink_filter_table_e table, uint64_t min, uint64_t max, enum uplink_filter_action_e action);
+
+/**
+@brief Add a rule on all the DevAddr allocated to a NetID (LoRaWAN Backend Interfaces).
+
+@param filter[in/out] Filter to be updated
+@param netid[in] 24-bit NetID
+@param action[in] Action when a packet matches the rule
+@return 0 for success, -1 for error
+*/
+int uplink_filter_add_netid(struct uplink_filter_s *filter, uint32_t netid, enum uplink_filter_action_e action);
+
+/**
+@brief Check if a received LoRaWAN frame has to be forwarded.
+
+@param filter[in/out] Filter to be applied, its counters are updated
+@param payload[in] PHYPayload
+@param size[in] Size of the PHYPayload
+@return true if the frame has to be forwarded
+
+Frames too short to carry a DevAddr or JoinEUI, and other frame types, are always forwarded.
+*/
+bool uplink_filter_check(struct uplink_filter_s *filter, const uint8_t *payload, uint16_t size);
+
+/**
+@brief Display the rules with their counters, and get the total number of packets dropped.
+
+@param filter[in/out] Filter
+@param reset[in] Reset the counters after reading them
+@return number of packets dropped since last reset
+*/
+uint32_t uplink_filter_report(struct uplink_filter_s *filter, bool reset);
+
+#endif
+/* --- EOF ------------------------------------------------------------------ */
@@ -0,0 +1,284 @@
+/*
+ / _____)             _              | |
+( (____  _____ ____ _| |_ _____  ____| |__
+ \____ \| ___ |    (_   _) ___ |/ ___)  _ \
+ _____) ) ____| | | || |_| ____( (___| | | |
+(______/|_____)_|_|_| \__)_____)\____)_| |_|
+  (C)2019 Semtech
+
+Description:
+    LoRa concentrator : bounded ring of received packets, between the
+    concentrator fetch stage and the network (PUSH_DATA) stage
+
+License: Revised BSD License, see LICENSE.TXT file include in the project
+*/
+
+
+#include <stdio.h>      /* printf */
+#include <string.h>     /* memset, memcpy */
+#include <assert.h>
+
+#include "trace.h"
+#include "uplink_ring.h"
+
+
+/* LoRaWAN MHDR message types */
+#define MTYPE_JOIN_REQUEST      0x00
+#define MTYPE_CONF_DATA_UP      0x04
+#define MTYPE_REJOIN_REQUEST    0x06
+
+/* -------------------------------------------------------------------------- */
+/* --- PRIVATE FUNCTIONS DEFINITION ----------------------------------------- */
+
+static void fifo_push_back(struct uplink_class_fifo_s *fifo, uint8_t slot) {
+    fifo->slot[(fifo->first + fifo->nb) % UPLINK_RING_SIZE] = slot;
+    fifo->nb += 1;
+}
+
+static void fifo_push_front(struct uplink_class_fifo_s *fifo, uint8_t slot) {
+    fifo->first = (fifo->first + UPLINK_RING_SIZE - 1) % UPLINK_RING_SIZE;
+    fifo->slot[fifo->first] = slot;
+    fifo->nb += 1;
+}
+
+static uint8_t fifo_pop_front(struct uplink_class_fifo_s *fifo) {
+    uint8_t slot = fifo->slot[fifo->first];
+
+    fifo->first = (fifo->first + 1) % UPLINK_RING_SIZE;
+    fifo->nb -= 1;
+    return slot;
+}
+
+static enum uplink_class_e ring_class(uint8_t status, uint8_t modulation, uint16_t size, const uint8_t *payload) {
+    uint8_t mtype;
+
+    if (status != STAT_CRC_OK) {
+        return UPLINK_CLASS_CRC_ERROR;
+    }
+    if ((modulation != MOD_LORA) || (size == 0)) {
+        return UPLINK_CLASS_UNCONFIRMED;
+    }
+
+    mtype = payload[0] >> 5; /* MHDR - MType */
+    if ((mtype == MTYPE_JOIN_REQUEST) || (mtype == MTYPE_REJOIN_REQUEST)) {
+        return UPLINK_CLASS_JOIN;
+    } else if (mtype == MTYPE_CONF_DATA_UP) {
+        return UPLINK_CLASS_CONFIRMED;
+    } else {
+        return UPLINK_CLASS_UNCONFIRMED;
+    }
+}
+
+/* get a free slot for a new packet, return -1 if the packet must be dropped */
+static int ring_alloc(struct uplink_ring_s *ring, enum uplink_class_e cls, TickType_t now) {
+    int k;
+    uint8_t slot;
+
+    /* backlogged: packets with a CRC error are not worth the wait */
+    if ((cls == UPLINK_CLASS_CRC_ERROR) && (ring->stat.occupancy > ring->watermark)) {
+        ring->stat.cls[cls].nb_drop += 1;
+        return -1;
+    }
+
+    /* full: make room by evicting the oldest packet of the lowest class below this one */
+    if (ring->nb_free == 0) {
+        for (k = UPLINK_CLASS_NB - 1; k > (int)cls; k--) {
+            if (ring->fifo[k].nb > 0) {
+                break;
+            }
+        }
+        ring->stat.nb_overflow += 1;
+        if (k == (int)cls) {
+            ring->stat.cls[cls].nb_drop += 1;
+            MSG_DEBUG(DEBUG_PKT_FWD, "WARNING: uplink ring full, packet dropped\n");
+            return -1;
+        }
+        ring->stat.cls[k].nb_drop += 1;
+        ring->free[ring->nb_free++] = fifo_pop_front(&(ring->fifo[k]));
+        ring->stat.occupancy -= 1;
+        MSG_DEBUG(DEBUG_PKT_FWD, "WARNING: uplink ring full, packet of class %d evicted\n", k);
+    }
+
+    slot = ring->free[--ring->nb_free];
+    ring->meta[slot].seq = ring->seq++;
+    ring->meta[slot].tick = now;
+    ring->meta[slot].cls = cls;
+    fifo_push_back(&(ring->fifo[cls]), slot);
+    ring->stat.occupancy += 1;
+    if (ring->stat.occupancy > ring->stat.occupancy_max) {
+        ring->stat.occupancy_max = ring->stat.occupancy;
+    }
+
+    return slot;
+}
+
+/* put the slots peeked but not released back in front of their FIFO, in the same order */
+static void ring_untake(struct uplink_ring_s *ring, int first) {
+    int i;
+    uint8_t slot;
+
+    for (i = ring->nb_taken - 1; i >= first; i--) {
+        slot = ring->taken[i];
+        fifo_push_front(&(ring->fifo[ring->meta[slot].cls]), slot);
+    }
+    ring->nb_taken = 0;
+}
+
+/* -------------------------------------------------------------------------- */
+/* --- PUBLIC FUNCTIONS DEFINITION ----------------------------------------- */
+
+void uplink_ring_init(struct uplink_ring_s *ring, uint16_t watermark) {
+    int i;
+
+    memset(ring, 0, sizeof(*ring));
+
+    ring->mx_ring = xSemaphoreCreateMutex();
+    assert(ring->mx_ring);
+
+    ring->watermark = watermark;
+    for (i = 0; i < UPLINK_RING_SIZE; i++) {
+        ring->free[i] = UPLINK_RING_SIZE - 1 - i;
+    }
+    ring->nb_free = UPLINK_RING_SIZE;
+}
+
+enum uplink_class_e uplink_ring_class(const struct lgw_pkt_rx_s *pkt) {
+    return ring_class(pkt->status, pkt->modulation, pkt->size, pkt->payload);
+}
+
+int uplink_ring_push(struct uplink_ring_s *ring, const struct lgw_pkt_rx_s *pkt, int nb_pkt) {
+    int i;
+    int slot;
+    int nb_stored = 0;
+    TickType_t now = xTaskGetTickCount();
+
+    if ((pkt == NULL) || (nb_pkt <= 0)) {
+        return 0;
+    }
+
+    xSemaphoreTake(ring->mx_ring, portMAX_DELAY);
+
+    for (i = 0; i < nb_pkt; i++) {
+        slot = ring_alloc(ring, uplink_ring_class(&pkt[i]), now);
+        if (slot >= 0) {
+            memcpy(&(ring->slots[slot]), &pkt[i], sizeof(struct lgw_pkt_rx_s));
+            nb_stored += 1;
+        }
+    }
+
+    xSemaphoreGive(ring->mx_ring);
+
+    return nb_stored;
+}
+
+int uplink_ring_push_desc(struct uplink_ring_s *ring, const struct lgw_pkt_rx_desc_s *desc, int nb_pkt) {
+    int i;
+    int slot;
+    int nb_stored = 0;
+    TickType_t now = xTaskGetTickCount();
+
+    if ((desc == NULL) || (nb_pkt <= 0)) {
+        return 0;
+    }
+
+    xSemaphoreTake(ring->mx_ring, portMAX_DELAY);
+
+    /* the payload is copied once, from the HAL RX buffer to its slot */
+    for (i = 0; i < nb_pkt; i++) {
+        slot = ring_alloc(ring, ring_class(desc[i].status, desc[i].modulation, desc[i].size, desc[i].payload), now);
+        if (slot >= 0) {
+            lgw_pkt_rx_from_desc(&(ring->slots[slot]), &desc[i]);
+            nb_stored += 1;
+        }
+    }
+
+    xSemaphoreGive(ring->mx_ring);
+
+    return nb_stored;
+}
+
+int uplink_ring_peek(struct uplink_ring_s *ring, struct lgw_pkt_rx_s **pkt, int max_pkt) {
+    int k, k_next;
+    bool backlog;
+    uint8_t slot;
+
+    if (pkt == NULL) {
+        return 0;
+    }
+
+    xSemaphoreTake(ring->mx_ring, portMAX_DELAY);
+
+    /* slots of a previous peek not released yet are returned again */
+    ring_untake(ring, 0);
+
+    backlog = (ring->stat.occupancy > ring->watermark);
+    while (ring->nb_taken < max_pkt) {
+        k_next = -1;
+        for (k = 0; k < UPLINK_CLASS_NB; k++) {
+            if (ring->fifo[k].nb == 0) {
+                continue;
+            }
+            if (backlog == true) {
+                k_next = k; /* highest class first */
+                break;
+            }
+            /* oldest packet first, whatever its class */
+            if ((k_next < 0) || ((int32_t)(ring->meta[ring->fifo[k].slot[ring->fifo[k].first]].seq - ring->meta[ring->fifo[k_next].slot[ring->fifo[k_next].first]].seq) < 0)) {
+                k_next = k;
+            }
+        }
+        if (k_next < 0) {
+            break;
+        }
+        slot = fifo_pop_front(&(ring->fifo[k_next]));
+        pkt[ring->nb_taken] = &(ring->slots[slot]);
+        ring->taken[ring->nb_taken++] = slot;
+    }
+
+    xSemaphoreGive(ring->mx_ring);
+
+    return ring->nb_taken;
+}
+
+void uplink_ring_release(struct uplink_ring_s *ring, int nb_pkt) {
+    int i;
+    uint8_t slot;
+    struct uplink_class_stat_s *cs;
+    uint32_t latency_ms;
+    TickType_t now = xTaskGetTickCount();
+
+    xSemaphoreTake(ring->mx_ring, portMAX_DELAY);
+
+    if (nb_pkt > ring->nb_taken) {
+        MSG("ERROR: cannot release %d packets from uplink ring, only %u peeked\n", nb_pkt, ring->nb_taken);
+        nb_pkt = ring->nb_taken;
+    }
+    for (i = 0; i < nb_pkt; i++) {
+        slot = ring->taken[i];
+        cs = &(ring->stat.cls[ring->meta[slot].cls]);
+        latency_ms = (now - ring->meta[slot].tick) * portTICK_PERIOD_MS;
+        cs->nb_pkt += 1;
+        cs->latency_sum_ms += latency_ms;
+        if (latency_ms > cs->latency_max_ms) {
+            cs->latency_max_ms = latency_ms;
+        }
+        ring->free[ring->nb_free++] = slot;
+    }
+    ring->stat.occupancy -= nb_pkt;
+    ring_untake(ring, nb_pkt);
+
+    xSemaphoreGive(ring->mx_ring);
+}
+
+void uplink_ring_get_stat(struct uplink_ring_s *ring, struct uplink_ring_stat_s *stat, bool reset) {
+    xSemaphoreTake(ring->mx_ring, portMAX_DELAY);
+
+    *stat = ring->stat;
+    if (reset == true) {
+        ring->stat.occupancy_max = ring->stat.occupancy;
+        ring->stat.nb_overflow = 0;
+        memset(ring->stat.cls, 0, sizeof(ring->stat.cls));
+    }
+
+    xSemaphoreGive(ring->mx_ring);
+}
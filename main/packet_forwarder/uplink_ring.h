@@ -0,0 +1,161 @@
+/*
+ / _____)             _              | |
+( (____  _____ ____ _| |_ _____  ____| |__
+ \____ \| ___ |    (_   _) ___ |/ ___)  _ \
+ _____) ) ____| | | || |_| ____( (___| | | |
+(______/|_____)_|_|_| \__)_____)\____)_| |_|
+  (C)2019 Semtech
+
+Description:
+    LoRa concentrator : bounded ring of received packets, between the
+    concentrator fetch stage and the network (PUSH_DATA) stage
+
+License: Revised BSD License, see LICENSE.TXT file include in the project
+*/
+
+
+#ifndef _LORA_PKTFWD_UPLINK_RING_H
+#define _LORA_PKTFWD_UPLINK_RING_H
+
+
+#include <stdint.h>     /* C99 types */
+#include <stdbool.h>    /* bool type */
+
+#include "loragw_hal.h"
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+
+
+#define UPLINK_RING_SIZE    64  /* Number of RX packet slots between fetch and network stages */
+#define UPLINK_RING_WATERMARK_DEFAULT   (UPLINK_RING_SIZE / 2)  /* backlog from which packets are taken by priority */
+
+/* priority classes, from the highest to the lowest */
+enum uplink_class_e {
+    UPLINK_CLASS_JOIN,              /* join-requests and rejoin-requests */
+    UPLINK_CLASS_CONFIRMED,         /* confirmed data up */
+    UPLINK_CLASS_UNCONFIRMED,       /* unconfirmed data up, and any other valid frame */
+    UPLINK_CLASS_CRC_ERROR,         /* CRC_BAD and NO_CRC */
+    UPLINK_CLASS_NB
+};
+
+struct uplink_class_stat_s {
+    uint32_t nb_pkt;                /* Number of packets handed over to the network stage */
+    uint32_t nb_drop;               /* Number of packets shed or evicted to make room for higher classes */
+    uint32_t latency_sum_ms;        /* Sum of the time spent in the ring by the packets handed over */
+    uint32_t latency_max_ms;        /* Longest time spent in the ring */
+};
+
+struct uplink_ring_stat_s {
+    uint16_t occupancy;             /* Number of slots currently filled */
+    uint16_t occupancy_max;         /* Highest number of slots filled since last reset */
+    uint32_t nb_overflow;           /* Number of packets dropped because the ring was full */
+    struct uplink_class_stat_s cls[UPLINK_CLASS_NB]; /* Per priority class statistics */
+};
+
+/* FIFO of slot indexes, one per priority class */
+struct uplink_class_fifo_s {
+    uint16_t first;                 /* Position of the oldest slot index */
+    uint16_t nb;                    /* Number of slot indexes stored */
+    uint8_t slot[UPLINK_RING_SIZE];
+};
+
+/* bookkeeping of a slot, while it is filled */
+struct uplink_slot_meta_s {
+    uint32_t seq;                   /* Arrival order */
+    TickType_t tick;                /* Arrival time, for latency statistics */
+    uint8_t cls;                    /* Priority class */
+};
+
+struct uplink_ring_s {
+    SemaphoreHandle_t mx_ring;      /* control access to the ring indexes and statistics */
+    uint16_t watermark;             /* Occupancy above which packets are taken by priority, and CRC errors shed */
+    uint32_t seq;                   /* Arrival order of the next packet */
+    uint16_t nb_free;
+    uint8_t free[UPLINK_RING_SIZE]; /* Stack of free slot indexes */
+    uint16_t nb_taken;
+    uint8_t taken[UPLINK_RING_SIZE]; /* Slots returned by the last peek, owned by the network stage */
+    struct uplink_class_fifo_s fifo[UPLINK_CLASS_NB];
+    struct uplink_ring_stat_s stat; /* Occupancy and overflow statistics */
+    struct uplink_slot_meta_s meta[UPLINK_RING_SIZE];
+    struct lgw_pkt_rx_s slots[UPLINK_RING_SIZE]; /* RX packets storage */
+};
+
+/* -------------------------------------------------------------------------- */
+/* --- PUBLIC FUNCTIONS PROTOTYPES ------------------------------------------ */
+
+/**
+@brief Initialize an uplink ring.
+
+@param ring[in] Uplink ring to be initialized. Memory should have been allocated already.
+@param watermark[in] Occupancy above which the ring is considered backlogged
+*/
+void uplink_ring_init(struct uplink_ring_s *ring, uint16_t watermark);
+
+/**
+@brief Get the priority class of a received packet.
+
+@param pkt[in] Received packet
+@return priority class
+*/
+enum uplink_class_e uplink_ring_class(const struct lgw_pkt_rx_s *pkt);
+
+/**
+@brief Copy freshly fetched packets into the ring (fetch stage).
+
+@param ring[in/out] Uplink ring in which the packets should be stored
+@param pkt[in] Array of packets returned by lgw_receive()
+@param nb_pkt[in] Number of packets in the array
+@return number of packets stored, the remaining ones are dropped
+
+Packets are never blocked on the network: if the ring is full, the oldest packet of a lower
+class is evicted, or the new packet is dropped, so that the concentrator RX buffer keeps being
+drained. Above the watermark, packets with a CRC error are dropped on arrival.
+*/
+int uplink_ring_push(struct uplink_ring_s *ring, const struct lgw_pkt_rx_s *pkt, int nb_pkt);
+
+/**
+@brief Same as uplink_ring_push(), with the descriptors returned by lgw_receive_desc().
+
+@param ring[in/out] Uplink ring in which the packets should be stored
+@param desc[in] Array of packet descriptors, their payload is copied directly from the HAL RX buffer
+@param nb_pkt[in] Number of descriptors in the array
+@return number of packets stored, the remaining ones are dropped
+*/
+int uplink_ring_push_desc(struct uplink_ring_s *ring, const struct lgw_pkt_rx_desc_s *desc, int nb_pkt);
+
+/**
+@brief Get pointers on the next packets to be forwarded, without removing them (network stage).
+
+@param ring[in] Uplink ring to be read
+@param pkt[out] Array of pointers, filled with the packets to be forwarded
+@param max_pkt[in] Maximum number of packets to be returned
+@return number of packets returned (0 if the ring is empty)
+
+Packets are returned in arrival order, or by priority class when the ring is above its
+watermark. The returned slots remain owned by the caller until uplink_ring_release() is called,
+the fetch stage does not write in them in the meantime.
+*/
+int uplink_ring_peek(struct uplink_ring_s *ring, struct lgw_pkt_rx_s **pkt, int max_pkt);
+
+/**
+@brief Give back slots previously obtained with uplink_ring_peek() (network stage).
+
+@param ring[in/out] Uplink ring
+@param nb_pkt[in] Number of packets consumed, from the start of the peeked array
+
+The packets peeked but not consumed are put back, to be returned first by the next peek.
+*/
+void uplink_ring_release(struct uplink_ring_s *ring, int nb_pkt);
+
+/**
+@brief Get the ring statistics.
+
+@param ring[in/out] Uplink ring
+@param stat[out] Copy of the statistics
+@param reset[in] Reset high watermark and counters after reading them
+*/
+void uplink_ring_get_stat(struct uplink_ring_s *ring, struct uplink_ring_stat_s *stat, bool reset);
+
+#endif
+/* --- EOF ------------------------------------------------------------------ */
@@ -0,0 +1,317 @@
+/*
+ / _____)             _              | |
+( (____  _____ ____ _| |_ _____  ____| |__
+ \____ \| ___ |    (_   _) ___ |/ ___)  _ \
+ _____) ) ____| | | || |_| ____( (___| | | |
+(______/|_____)_|_|_| \__)_____)\____)_| |_|
+  (C)2019 Semtech
+
+Description:
+    LoRa concentrator : store-and-forward spool of unacknowledged uplinks on
+    the SD card, written by a low priority task and replayed once the server
+    acknowledges PUSH_DATA again
+
+License: Revised BSD License, see LICENSE.TXT file include in the project
+*/
+
+
+#include <stdlib.h>     /* malloc, free, strtoul */
+#include <stdio.h>      /* printf, fopen, fread, fwrite */
+#include <string.h>     /* memset */
+#include <strings.h>    /* strcasecmp */
+#include <errno.h>
+#include <dirent.h>     /* opendir, readdir */
+#include <sys/stat.h>   /* mkdir, stat */
+#include <unistd.h>     /* unlink */
+#include <assert.h>
+
+#include "trace.h"
+#include "uplink_spool.h"
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+#include "freertos/queue.h"
+
+/* -------------------------------------------------------------------------- */
+/* --- PRIVATE TYPES -------------------------------------------------------- */
+
+/* record as stored in the queues, and on the SD card (length then data) */
+struct spool_rec_s {
+    char *data;
+    uint16_t len;
+};
+
+/* -------------------------------------------------------------------------- */
+/* --- PRIVATE VARIABLES ---------------------------------------------------- */
+
+static bool spool_ok = false;
+static uint32_t spool_max_bytes;
+
+static QueueHandle_t q_write;   /* records to be written, from the network stage */
+static QueueHandle_t q_replay;  /* oldest record, read in advance for the network stage */
+
+static SemaphoreHandle_t mx_spool_stat; /* control access to the statistics */
+static struct uplink_spool_stat_s spool_stat;
+
+/* segments are numbered, the reader consumes from rd_seg while the writer appends to wr_seg */
+static uint32_t rd_seg;
+static uint32_t wr_seg;
+static FILE *rd_file = NULL;
+static FILE *wr_file = NULL;
+static uint32_t wr_size; /* nb of bytes written in current segment */
+
+/* -------------------------------------------------------------------------- */
+/* --- PRIVATE FUNCTIONS DEFINITION ----------------------------------------- */
+
+static void spool_seg_path(char *path, size_t size, uint32_t seg) {
+    snprintf(path, size, "%s/%08lu.SPL", SPOOL_DIR, (unsigned long)seg);
+}
+
+static void spool_add_stat(uint32_t *counter, int32_t value) {
+    xSemaphoreTake(mx_spool_stat, portMAX_DELAY);
+    *counter += value;
+    xSemaphoreGive(mx_spool_stat);
+}
+
+/* delete the oldest segment, whether it has been fully replayed or not */
+static void spool_remove_seg(void) {
+    char path[32];
+    struct stat st;
+
+    if (rd_file != NULL) {
+        fclose(rd_file);
+        rd_file = NULL;
+    }
+    spool_seg_path(path, sizeof path, rd_seg);
+    if (stat(path, &st) == 0) {
+        unlink(path);
+        spool_add_stat(&spool_stat.disk_bytes, -(int32_t)st.st_size);
+    }
+    rd_seg += 1;
+}
+
+/* close current segment, next record will be written in a new one */
+static void spool_rotate(void) {
+    if (wr_file != NULL) {
+        fclose(wr_file);
+        wr_file = NULL;
+    }
+    if (wr_size > 0) {
+        wr_seg += 1;
+        wr_size = 0;
+    }
+}
+
+static void spool_append(const struct spool_rec_s *rec) {
+    char path[32];
+    uint32_t rec_size = sizeof rec->len + rec->len;
+
+    /* stay within the disk budget, the oldest segments are sacrificed first */
+    while (((spool_stat.disk_bytes + rec_size) > spool_max_bytes) && (rd_seg < wr_seg)) {
+        MSG("WARNING: [spool] disk budget reached, segment %lu discarded\n", (unsigned long)rd_seg);
+        spool_remove_seg();
+        spool_add_stat(&spool_stat.nb_seg_discarded, 1);
+    }
+    if ((spool_stat.disk_bytes + rec_size) > spool_max_bytes) {
+        spool_add_stat(&spool_stat.nb_dropped, 1);
+        return;
+    }
+
+    if ((wr_size + rec_size) > SPOOL_SEGMENT_SIZE) {
+        spool_rotate();
+    }
+    if (wr_file == NULL) {
+        spool_seg_path(path, sizeof path, wr_seg);
+        wr_file = fopen(path, "ab");
+        if (wr_file == NULL) {
+            MSG("ERROR: [spool] failed to open %s (%s)\n", path, strerror(errno));
+            spool_add_stat(&spool_stat.nb_dropped, 1);
+            return;
+        }
+    }
+
+    if ((fwrite(&rec->len, sizeof rec->len, 1, wr_file) != 1) || (fwrite(rec->data, 1, rec->len, wr_file) != rec->len) || (fflush(wr_file) != 0)) {
+        MSG("ERROR: [spool] failed to write segment %lu\n", (unsigned long)wr_seg);
+        spool_add_stat(&spool_stat.nb_dropped, 1);
+        /* the end of this segment is unreliable, continue in a new one */
+        fclose(wr_file);
+        wr_file = NULL;
+        wr_seg += 1;
+        wr_size = 0;
+        return;
+    }
+    wr_size += rec_size;
+
+    xSemaphoreTake(mx_spool_stat, portMAX_DELAY);
+    spool_stat.nb_spooled += 1;
+    spool_stat.disk_bytes += rec_size;
+    xSemaphoreGive(mx_spool_stat);
+}
+
+/* read the oldest record, return -1 if the spool is empty */
+static int spool_read(struct spool_rec_s *rec) {
+    char path[32];
+
+    while ((rd_seg < wr_seg) || ((rd_seg == wr_seg) && (wr_size > 0))) {
+        /* the segment being written must be closed before being read */
+        if (rd_seg == wr_seg) {
+            spool_rotate();
+        }
+        if (rd_file == NULL) {
+            spool_seg_path(path, sizeof path, rd_seg);
+            rd_file = fopen(path, "rb");
+            if (rd_file == NULL) {
+                rd_seg += 1; /* missing segment, skip it */
+                continue;
+            }
+        }
+
+        if ((fread(&rec->len, sizeof rec->len, 1, rd_file) == 1) && (rec->len > 0)) {
+            rec->data = malloc(rec->len);
+            if (rec->data == NULL) {
+                fseek(rd_file, -(long)sizeof rec->len, SEEK_CUR); /* try again later */
+                return -1;
+            }
+            if (fread(rec->data, 1, rec->len, rd_file) == rec->len) {
+                return 0;
+            }
+            free(rec->data);
+        }
+
+        /* end of segment, or record truncated by a power loss */
+        spool_remove_seg();
+    }
+
+    return -1;
+}
+
+/* -------------------------------------------------------------------------- */
+/* --- PUBLIC FUNCTIONS DEFINITION ----------------------------------------- */
+
+int uplink_spool_init(uint32_t max_bytes) {
+    DIR *dir;
+    struct dirent *entry;
+    struct stat st;
+    char path[32 + 256];
+    char *end;
+    uint32_t seg;
+    uint32_t seg_min = UINT32_MAX;
+    uint32_t seg_max = 0;
+    uint32_t nb_seg = 0;
+
+    if ((mkdir(SPOOL_DIR, 0755) != 0) && (errno != EEXIST)) {
+        MSG("WARNING: [spool] cannot create %s (%s), uplink spool disabled\n", SPOOL_DIR, strerror(errno));
+        return -1;
+    }
+    dir = opendir(SPOOL_DIR);
+    if (dir == NULL) {
+        MSG("WARNING: [spool] cannot open %s, uplink spool disabled\n", SPOOL_DIR);
+        return -1;
+    }
+
+    mx_spool_stat = xSemaphoreCreateMutex();
+    assert(mx_spool_stat);
+    memset(&spool_stat, 0, sizeof spool_stat);
+
+    /* segments left by a previous run are replayed first, new records go in a new segment */
+    while ((entry = readdir(dir)) != NULL) {
+        seg = strtoul(entry->d_name, &end, 10);
+        if ((end == entry->d_name) || (strcasecmp(end, ".SPL") != 0)) {
+            continue;
+        }
+        snprintf(path, sizeof path, "%s/%s", SPOOL_DIR, entry->d_name);
+        if (stat(path, &st) == 0) {
+            spool_stat.disk_bytes += st.st_size;
+        }
+        seg_min = (seg < seg_min) ? seg : seg_min;
+        seg_max = (seg > seg_max) ? seg : seg_max;
+        nb_seg += 1;
+    }
+    closedir(dir);
+
+    if (nb_seg > 0) {
+        rd_seg = seg_min;
+        wr_seg = seg_max + 1;
+        MSG("INFO: [spool] %lu segment(s) to be replayed (%lu bytes)\n", (unsigned long)nb_seg, (unsigned long)spool_stat.disk_bytes);
+    } else {
+        rd_seg = 0;
+        wr_seg = 0;
+    }
+    wr_size = 0;
+
+    q_write = xQueueCreate(SPOOL_QUEUE_DEPTH, sizeof(struct spool_rec_s));
+    q_replay = xQueueCreate(1, sizeof(struct spool_rec_s));
+    assert(q_write && q_replay);
+
+    spool_max_bytes = max_bytes;
+    spool_ok = true;
+
+    return 0;
+}
+
+void uplink_spool_task(void) {
+    struct spool_rec_s rec;
+
+    while (true) {
+        if (xQueueReceive(q_write, &rec, pdMS_TO_TICKS(SPOOL_POLL_MS)) == pdTRUE) {
+            spool_append(&rec);
+            free(rec.data);
+        }
+
+        /* keep the oldest record ready, so that replay never waits for the SD card */
+        if (uxQueueMessagesWaiting(q_replay) == 0) {
+            if (spool_read(&rec) == 0) {
+                xQueueSend(q_replay, &rec, 0);
+            }
+        }
+    }
+}
+
+bool uplink_spool_enabled(void) {
+    return spool_ok;
+}
+
+void uplink_spool_write(char *rec, uint16_t len) {
+    struct spool_rec_s r;
+
+    if (spool_ok == false) {
+        free(rec);
+        return;
+    }
+
+    r.data = rec;
+    r.len = len;
+    if (xQueueSend(q_write, &r, 0) != pdTRUE) {
+        free(rec);
+        spool_add_stat(&spool_stat.nb_dropped, 1);
+    }
+}
+
+char *uplink_spool_take(uint16_t *len) {
+    struct spool_rec_s rec;
+
+    if ((spool_ok == false) || (xQueueReceive(q_replay, &rec, 0) != pdTRUE)) {
+        return NULL;
+    }
+    spool_add_stat(&spool_stat.nb_replayed, 1);
+
+    *len = rec.len;
+    return rec.data;
+}
+
+void uplink_spool_get_stat(struct uplink_spool_stat_s *stat, bool reset) {
+    if (spool_ok == false) {
+        memset(stat, 0, sizeof *stat);
+        return;
+    }
+
+    xSemaphoreTake(mx_spool_stat, portMAX_DELAY);
+    *stat = spool_stat;
+    if (reset == true) {
+        spool_stat.nb_spooled = 0;
+        spool_stat.nb_replayed = 0;
+        spool_stat.nb_dropped = 0;
+        spool_stat.nb_seg_discarded = 0;
+    }
+    xSemaphoreGive(mx_spool_stat);
+}
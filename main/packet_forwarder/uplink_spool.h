@@ -0,0 +1,92 @@
+/*
+ / _____)             _              | |
+( (____  _____ ____ _| |_ _____  ____| |__
+ \____ \| ___ |    (_   _) ___ |/ ___)  _ \
+ _____) ) ____| | | || |_| ____( (___| | | |
+(______/|_____)_|_|_| \__)_____)\____)_| |_|
+  (C)2019 Semtech
+
+Description:
+    LoRa concentrator : store-and-forward spool of unacknowledged uplinks on
+    the SD card, written by a low priority task and replayed once the server
+    acknowledges PUSH_DATA again
+
+License: Revised BSD License, see LICENSE.TXT file include in the project
+*/
+
+
+#ifndef _LORA_PKTFWD_UPLINK_SPOOL_H
+#define _LORA_PKTFWD_UPLINK_SPOOL_H
+
+
+#include <stdint.h>     /* C99 types */
+#include <stdbool.h>    /* bool type */
+
+
+#define SPOOL_DIR               "/sdcard/spool"     /* directory of the segment files, on the SD card */
+#define SPOOL_SEGMENT_SIZE      (64 * 1024)         /* size from which a new segment file is started */
+#define SPOOL_QUEUE_DEPTH       16                  /* nb of records waiting to be written */
+#define SPOOL_POLL_MS           100                 /* time in ms between two checks of the replay record */
+#define SPOOL_DEFAULT_MAX_BYTES (4 * 1024 * 1024)   /* default disk budget */
+
+struct uplink_spool_stat_s {
+    uint32_t nb_spooled;            /* Number of records written on the SD card */
+    uint32_t nb_replayed;           /* Number of records given back for replay */
+    uint32_t nb_dropped;            /* Number of records lost before reaching the SD card */
+    uint32_t nb_seg_discarded;      /* Number of segments deleted to stay within the disk budget */
+    uint32_t disk_bytes;            /* Number of bytes currently stored on the SD card */
+};
+
+/* -------------------------------------------------------------------------- */
+/* --- PUBLIC FUNCTIONS PROTOTYPES ------------------------------------------ */
+
+/**
+@brief Open the spool directory and account for the segments left by a previous run.
+
+@param max_bytes[in] Disk budget, the oldest segments are deleted to stay below it
+@return 0 if the spool can be used, -1 otherwise (no SD card mounted, ...)
+*/
+int uplink_spool_init(uint32_t max_bytes);
+
+/**
+@brief Spool task: writes the records to the SD card and prepares the next record to be replayed.
+
+Should be spawned with a priority lower than the packet forwarder threads.
+*/
+void uplink_spool_task(void);
+
+/**
+@brief Check if the spool has been successfully initialized.
+
+@return true if records can be written
+*/
+bool uplink_spool_enabled(void);
+
+/**
+@brief Hand over a record to the spool task, without waiting for the SD card.
+
+@param rec[in] Comma separated rxpk objects, allocated with malloc(), ownership is transferred
+@param len[in] Size of the record
+
+The record is dropped (and freed) if the spool is disabled or the write queue is full.
+*/
+void uplink_spool_write(char *rec, uint16_t len);
+
+/**
+@brief Get the oldest spooled record, if any.
+
+@param len[out] Size of the record
+@return record allocated with malloc() to be freed by the caller, NULL if nothing to replay
+*/
+char *uplink_spool_take(uint16_t *len);
+
+/**
+@brief Get the spool statistics.
+
+@param stat[out] Copy of the statistics
+@param reset[in] Reset the counters after reading them (disk_bytes is kept)
+*/
+void uplink_spool_get_stat(struct uplink_spool_stat_s *stat, bool reset);
+
+#endif
+/* --- EOF ------------------------------------------------------------------ */